@@ -0,0 +1,106 @@
+#include "cpu_features.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
+
+#if defined(__aarch64__) && !defined(HWCAP_ASIMD)
+#define HWCAP_ASIMD (1 << 1)
+#endif
+#if defined(__aarch64__) && !defined(HWCAP_ASIMDDP)
+#define HWCAP_ASIMDDP (1 << 20)
+#endif
+
+static CpuFeatures detect_cpu_features() {
+    CpuFeatures f;
+#if defined(__aarch64__)
+    f.neon = true;
+#if defined(__linux__)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    f.neon = (hwcap & HWCAP_ASIMD) != 0;
+    f.dotprod = (hwcap & HWCAP_ASIMDDP) != 0;
+#endif
+#elif defined(__x86_64__)
+    // __builtin_cpu_supports also checks that the OS saves the extended register state
+    __builtin_cpu_init();
+    f.avx2 = __builtin_cpu_supports("avx2");
+    f.fma = __builtin_cpu_supports("fma");
+    f.avx512f = __builtin_cpu_supports("avx512f");
+    f.avx512bw = __builtin_cpu_supports("avx512bw");
+    f.avx512vl = __builtin_cpu_supports("avx512vl");
+    f.avx512vnni = __builtin_cpu_supports("avx512vnni");
+#endif
+    return f;
+}
+
+const CpuFeatures& cpu_features() {
+    static const CpuFeatures features = detect_cpu_features();
+    return features;
+}
+
+namespace {
+
+bool read_u64(const std::string& path, uint64_t* out) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return false;
+    unsigned long long v = 0;
+    const bool ok = fscanf(f, "%llu", &v) == 1;
+    fclose(f);
+    if (ok) *out = v;
+    return ok;
+}
+
+// Parses a sysfs CPU list such as "0-3,6"
+std::vector<int> read_cpu_list(const std::string& path) {
+    std::vector<int> cpus;
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return cpus;
+    int first = 0;
+    while (fscanf(f, "%d", &first) == 1) {
+        int last = first;
+        int c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%d", &last) != 1) break;
+            c = fgetc(f);
+        }
+        for (int i = first; i <= last; ++i) cpus.push_back(i);
+        if (c != ',') break;
+    }
+    fclose(f);
+    return cpus;
+}
+
+std::vector<CpuCore> detect_cpu_cores() {
+    std::vector<CpuCore> cores;
+#if defined(__linux__)
+    const std::string base = "/sys/devices/system/cpu/";
+    for (int id : read_cpu_list(base + "online")) {
+        const std::string dir = base + "cpu" + std::to_string(id) + "/";
+        CpuCore core;
+        core.id = id;
+        if (!read_u64(dir + "cpu_capacity", &core.capacity)) {
+            read_u64(dir + "cpufreq/cpuinfo_max_freq", &core.capacity);
+        }
+        cores.push_back(core);
+    }
+    std::stable_sort(cores.begin(), cores.end(),
+                     [](const CpuCore& a, const CpuCore& b) { return a.capacity > b.capacity; });
+    // Unknown capacities (0) leave every core marked fast
+    const uint64_t max_capacity = cores.empty() ? 0 : cores.front().capacity;
+    for (CpuCore& core : cores) {
+        core.fast = core.capacity * 2 >= max_capacity;
+    }
+#endif
+    return cores;
+}
+
+} // namespace
+
+const std::vector<CpuCore>& cpu_cores() {
+    static const std::vector<CpuCore> cores = detect_cpu_cores();
+    return cores;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// CPU capabilities relevant to the compute kernels, detected once per process
+struct CpuFeatures {
+    // arm64
+    bool neon = false;
+    bool dotprod = false;
+
+    // x86_64
+    bool avx2 = false;
+    bool fma = false; // every AVX2 + FMA part also implements F16C
+    bool avx512f = false;
+    bool avx512bw = false;
+    bool avx512vl = false;
+    bool avx512vnni = false;
+};
+
+const CpuFeatures& cpu_features();
+
+// One online logical CPU. On big.LITTLE parts the kernel reports each core's
+// relative throughput in cpu_capacity (1024 for the fastest); otherwise the
+// maximum frequency stands in for it.
+struct CpuCore {
+    int id = 0;
+    uint64_t capacity = 0;
+    bool fast = true; // within a factor of two of the fastest core
+};
+
+// Online CPUs, fastest first. Empty if the topology cannot be read.
+const std::vector<CpuCore>& cpu_cores();
@@ -0,0 +1,526 @@
+#include "gguf.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t GGUF_MAGIC = 0x46554747; // "GGUF" little-endian
+constexpr uint32_t GGUF_DEFAULT_ALIGNMENT = 32;
+constexpr uint64_t GGUF_MAX_STRING = 1ull << 30;
+
+struct TypeTraits {
+    const char* name;
+    int64_t block_size;
+    size_t type_size;
+};
+
+const TypeTraits kTypeTraits[GGML_TYPE_COUNT] = {
+    /* F32     */ {"F32", 1, 4},
+    /* F16     */ {"F16", 1, 2},
+    /* Q4_0    */ {"Q4_0", 32, 18},
+    /* Q4_1    */ {"Q4_1", 32, 20},
+    /* 4       */ {nullptr, 0, 0},
+    /* 5       */ {nullptr, 0, 0},
+    /* Q5_0    */ {"Q5_0", 32, 22},
+    /* Q5_1    */ {"Q5_1", 32, 24},
+    /* Q8_0    */ {"Q8_0", 32, 34},
+    /* Q8_1    */ {"Q8_1", 32, 36},
+    /* Q2_K    */ {"Q2_K", 256, 84},
+    /* Q3_K    */ {"Q3_K", 256, 110},
+    /* Q4_K    */ {"Q4_K", 256, 144},
+    /* Q5_K    */ {"Q5_K", 256, 176},
+    /* Q6_K    */ {"Q6_K", 256, 210},
+    /* Q8_K    */ {"Q8_K", 256, 292},
+    /* IQ2_XXS */ {"IQ2_XXS", 256, 66},
+    /* IQ2_XS  */ {"IQ2_XS", 256, 74},
+    /* IQ3_XXS */ {"IQ3_XXS", 256, 98},
+    /* IQ1_S   */ {"IQ1_S", 256, 50},
+    /* IQ4_NL  */ {"IQ4_NL", 32, 18},
+    /* IQ3_S   */ {"IQ3_S", 256, 110},
+    /* IQ2_S   */ {"IQ2_S", 256, 82},
+    /* IQ4_XS  */ {"IQ4_XS", 256, 136},
+    /* I8      */ {"I8", 1, 1},
+    /* I16     */ {"I16", 1, 2},
+    /* I32     */ {"I32", 1, 4},
+    /* I64     */ {"I64", 1, 8},
+    /* F64     */ {"F64", 1, 8},
+    /* IQ1_M   */ {"IQ1_M", 256, 56},
+    /* BF16    */ {"BF16", 1, 2},
+};
+
+size_t value_type_size(GGUFValueType type) {
+    switch (type) {
+        case GGUF_TYPE_UINT8:
+        case GGUF_TYPE_INT8:
+        case GGUF_TYPE_BOOL:
+            return 1;
+        case GGUF_TYPE_UINT16:
+        case GGUF_TYPE_INT16:
+            return 2;
+        case GGUF_TYPE_UINT32:
+        case GGUF_TYPE_INT32:
+        case GGUF_TYPE_FLOAT32:
+            return 4;
+        case GGUF_TYPE_UINT64:
+        case GGUF_TYPE_INT64:
+        case GGUF_TYPE_FLOAT64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+// Bounds-checked cursor over an in-memory buffer
+class MemoryCursor {
+public:
+    MemoryCursor(const uint8_t* d, size_t s) : data(d), size(s) {}
+
+    bool read(void* dst, size_t n) {
+        if (n > size - pos) return false;
+        memcpy(dst, data + pos, n);
+        pos += n;
+        return true;
+    }
+
+    bool skip(uint64_t n) {
+        if (n > size - pos) return false;
+        pos += n;
+        return true;
+    }
+
+    uint64_t tell() const { return pos; }
+    uint64_t total_size() const { return size; }
+
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t pos = 0;
+};
+
+// Buffered pread() cursor over a file descriptor. Skips inside large arrays
+// only move the position, so unused metadata is never read from disk.
+class FileCursor {
+public:
+    FileCursor(int f, uint64_t s) : fd(f), size(s), buffer(64 * 1024) {}
+
+    bool read(void* dst, size_t n) {
+        if (n > size - pos) return false;
+        auto* out = static_cast<uint8_t*>(dst);
+        while (n > 0) {
+            if (pos < buf_begin || pos >= buf_begin + buf_len) {
+                if (!fill()) return false;
+            }
+            size_t avail = static_cast<size_t>(buf_begin + buf_len - pos);
+            size_t take = std::min(avail, n);
+            memcpy(out, buffer.data() + (pos - buf_begin), take);
+            out += take;
+            pos += take;
+            n -= take;
+        }
+        return true;
+    }
+
+    bool skip(uint64_t n) {
+        if (n > size - pos) return false;
+        pos += n;
+        return true;
+    }
+
+    uint64_t tell() const { return pos; }
+    uint64_t total_size() const { return size; }
+
+private:
+    bool fill() {
+        ssize_t got = pread(fd, buffer.data(), buffer.size(), static_cast<off_t>(pos));
+        if (got <= 0) return false;
+        buf_begin = pos;
+        buf_len = static_cast<size_t>(got);
+        return true;
+    }
+
+    int fd;
+    uint64_t size;
+    uint64_t pos = 0;
+    std::vector<uint8_t> buffer;
+    uint64_t buf_begin = 0;
+    size_t buf_len = 0;
+};
+
+template <typename Cursor, typename T>
+bool read_pod(Cursor& cur, T& out) {
+    return cur.read(&out, sizeof(T));
+}
+
+template <typename Cursor>
+bool read_string(Cursor& cur, std::string& out) {
+    uint64_t len = 0;
+    if (!read_pod(cur, len) || len > GGUF_MAX_STRING) return false;
+    out.resize(len);
+    return len == 0 || cur.read(&out[0], len);
+}
+
+template <typename Cursor>
+bool skip_string(Cursor& cur) {
+    uint64_t len = 0;
+    return read_pod(cur, len) && len <= GGUF_MAX_STRING && cur.skip(len);
+}
+
+template <typename Cursor>
+bool read_scalar(Cursor& cur, GGUFValueType type, GGUFValue& v) {
+    switch (type) {
+        case GGUF_TYPE_UINT8: { uint8_t x; if (!read_pod(cur, x)) return false; v.u64 = x; v.i64 = x; v.f64 = x; return true; }
+        case GGUF_TYPE_INT8: { int8_t x; if (!read_pod(cur, x)) return false; v.i64 = x; v.u64 = static_cast<uint64_t>(x); v.f64 = x; return true; }
+        case GGUF_TYPE_UINT16: { uint16_t x; if (!read_pod(cur, x)) return false; v.u64 = x; v.i64 = x; v.f64 = x; return true; }
+        case GGUF_TYPE_INT16: { int16_t x; if (!read_pod(cur, x)) return false; v.i64 = x; v.u64 = static_cast<uint64_t>(x); v.f64 = x; return true; }
+        case GGUF_TYPE_UINT32: { uint32_t x; if (!read_pod(cur, x)) return false; v.u64 = x; v.i64 = x; v.f64 = x; return true; }
+        case GGUF_TYPE_INT32: { int32_t x; if (!read_pod(cur, x)) return false; v.i64 = x; v.u64 = static_cast<uint64_t>(x); v.f64 = x; return true; }
+        case GGUF_TYPE_FLOAT32: { float x; if (!read_pod(cur, x)) return false; v.f64 = x; v.i64 = static_cast<int64_t>(x); v.u64 = static_cast<uint64_t>(v.i64); return true; }
+        case GGUF_TYPE_BOOL: { uint8_t x; if (!read_pod(cur, x)) return false; v.u64 = x != 0; v.i64 = x != 0; v.f64 = x != 0; return true; }
+        case GGUF_TYPE_UINT64: { uint64_t x; if (!read_pod(cur, x)) return false; v.u64 = x; v.i64 = static_cast<int64_t>(x); v.f64 = static_cast<double>(x); return true; }
+        case GGUF_TYPE_INT64: { int64_t x; if (!read_pod(cur, x)) return false; v.i64 = x; v.u64 = static_cast<uint64_t>(x); v.f64 = static_cast<double>(x); return true; }
+        case GGUF_TYPE_FLOAT64: { double x; if (!read_pod(cur, x)) return false; v.f64 = x; v.i64 = static_cast<int64_t>(x); v.u64 = static_cast<uint64_t>(v.i64); return true; }
+        case GGUF_TYPE_STRING: return read_string(cur, v.str);
+        default: return false;
+    }
+}
+
+bool fail(std::string* error, const char* message) {
+    if (error) *error = message;
+    return false;
+}
+
+template <typename Cursor>
+bool parse_header(Cursor& cur, bool with_tensors, GGUFHeader& out, std::string* error) {
+    uint32_t magic = 0;
+    if (!read_pod(cur, magic) || magic != GGUF_MAGIC) return fail(error, "not a GGUF file");
+    if (!read_pod(cur, out.version) || out.version < 2 || out.version > 3) {
+        return fail(error, "unsupported GGUF version");
+    }
+
+    uint64_t n_tensors = 0;
+    uint64_t n_kv = 0;
+    if (!read_pod(cur, n_tensors) || !read_pod(cur, n_kv)) return fail(error, "truncated GGUF header");
+
+    out.file_size = cur.total_size();
+    out.kv.reserve(n_kv);
+    for (uint64_t i = 0; i < n_kv; ++i) {
+        std::string key;
+        GGUFValue value;
+        if (!read_string(cur, key) || !read_pod(cur, value.type)) return fail(error, "truncated metadata key");
+
+        if (value.type == GGUF_TYPE_ARRAY) {
+            if (!read_pod(cur, value.array_type) || !read_pod(cur, value.array_count)) {
+                return fail(error, "truncated metadata array");
+            }
+            value.array_offset = cur.tell();
+            if (value.array_type == GGUF_TYPE_STRING) {
+                for (uint64_t j = 0; j < value.array_count; ++j) {
+                    if (!skip_string(cur)) return fail(error, "truncated string array");
+                }
+            } else {
+                size_t elem = value_type_size(value.array_type);
+                if (elem == 0 || value.array_count > cur.total_size() / elem ||
+                    !cur.skip(value.array_count * elem)) {
+                    return fail(error, "invalid metadata array");
+                }
+            }
+        } else if (!read_scalar(cur, value.type, value)) {
+            return fail(error, "invalid metadata value");
+        }
+        out.kv[key] = std::move(value);
+    }
+
+    out.alignment = static_cast<uint32_t>(out.get_uint("general.alignment", GGUF_DEFAULT_ALIGNMENT));
+    if (out.alignment == 0 || (out.alignment & (out.alignment - 1)) != 0) {
+        return fail(error, "invalid general.alignment");
+    }
+    if (!with_tensors) return true;
+
+    // Every tensor info takes at least 24 bytes; reject counts the file cannot hold
+    if (n_tensors > cur.total_size() / 24) return fail(error, "invalid tensor count");
+    out.tensors.resize(n_tensors);
+    for (auto& t : out.tensors) {
+        if (!read_string(cur, t.name) || !read_pod(cur, t.n_dims) || t.n_dims > 4) {
+            return fail(error, "invalid tensor info");
+        }
+        for (uint32_t d = 0; d < t.n_dims; ++d) {
+            uint64_t ne = 0;
+            if (!read_pod(cur, ne) || ne > INT64_MAX) return fail(error, "invalid tensor shape");
+            t.ne[d] = static_cast<int64_t>(ne);
+        }
+        uint32_t type = 0;
+        if (!read_pod(cur, type) || !read_pod(cur, t.offset)) return fail(error, "truncated tensor info");
+        if (type >= GGML_TYPE_COUNT || ggml_block_size(static_cast<GGMLType>(type)) == 0) {
+            return fail(error, "unknown tensor type");
+        }
+        t.type = static_cast<GGMLType>(type);
+        if (t.ne[0] % ggml_block_size(t.type) != 0) return fail(error, "tensor row not block aligned");
+        // n_elements() and n_bytes() must not wrap, or a huge tensor would
+        // pass the bounds check against the data section
+        uint64_t n_elements = static_cast<uint64_t>(t.ne[0]);
+        uint64_t n_bytes = 0;
+        bool overflow = __builtin_mul_overflow(static_cast<uint64_t>(ggml_type_size(t.type)),
+                                               n_elements / ggml_block_size(t.type), &n_bytes);
+        for (uint32_t d = 1; d < 4; ++d) {
+            overflow |= __builtin_mul_overflow(n_elements, static_cast<uint64_t>(t.ne[d]), &n_elements);
+            overflow |= __builtin_mul_overflow(n_bytes, static_cast<uint64_t>(t.ne[d]), &n_bytes);
+        }
+        if (overflow || n_elements > INT64_MAX || n_bytes > SIZE_MAX) return fail(error, "tensor too large");
+    }
+
+    uint64_t pos = cur.tell();
+    out.data_offset = (pos + out.alignment - 1) / out.alignment * out.alignment;
+    return true;
+}
+
+} // namespace
+
+const char* ggml_type_name(GGMLType type) {
+    if (type >= GGML_TYPE_COUNT || !kTypeTraits[type].name) return "unknown";
+    return kTypeTraits[type].name;
+}
+
+int64_t ggml_block_size(GGMLType type) {
+    return type < GGML_TYPE_COUNT ? kTypeTraits[type].block_size : 0;
+}
+
+size_t ggml_type_size(GGMLType type) {
+    return type < GGML_TYPE_COUNT ? kTypeTraits[type].type_size : 0;
+}
+
+size_t ggml_row_size(GGMLType type, int64_t n_elements) {
+    int64_t block = ggml_block_size(type);
+    if (block == 0) return 0;
+    return ggml_type_size(type) * static_cast<size_t>(n_elements / block);
+}
+
+// GGUFHeader
+
+bool GGUFHeader::read(const std::string& path, bool with_tensors, GGUFHeader& out, std::string* error) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (error) *error = "cannot open " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        if (error) *error = "cannot stat " + path;
+        close(fd);
+        return false;
+    }
+
+    FileCursor cur(fd, static_cast<uint64_t>(st.st_size));
+    bool ok = parse_header(cur, with_tensors, out, error);
+    close(fd);
+    return ok;
+}
+
+bool GGUFHeader::parse(const uint8_t* data, size_t size, bool with_tensors, GGUFHeader& out, std::string* error) {
+    MemoryCursor cur(data, size);
+    return parse_header(cur, with_tensors, out, error);
+}
+
+const GGUFValue* GGUFHeader::find(const std::string& key) const {
+    auto it = kv.find(key);
+    return it == kv.end() ? nullptr : &it->second;
+}
+
+uint64_t GGUFHeader::get_uint(const std::string& key, uint64_t fallback) const {
+    const GGUFValue* v = find(key);
+    if (!v || v->type == GGUF_TYPE_STRING || v->type == GGUF_TYPE_ARRAY) return fallback;
+    return v->u64;
+}
+
+float GGUFHeader::get_float(const std::string& key, float fallback) const {
+    const GGUFValue* v = find(key);
+    if (!v || v->type == GGUF_TYPE_STRING || v->type == GGUF_TYPE_ARRAY) return fallback;
+    return static_cast<float>(v->f64);
+}
+
+std::string GGUFHeader::get_string(const std::string& key, const std::string& fallback) const {
+    const GGUFValue* v = find(key);
+    if (!v || v->type != GGUF_TYPE_STRING) return fallback;
+    return v->str;
+}
+
+uint64_t GGUFHeader::get_array_count(const std::string& key) const {
+    const GGUFValue* v = find(key);
+    if (!v || v->type != GGUF_TYPE_ARRAY) return 0;
+    return v->array_count;
+}
+
+uint64_t GGUFHeader::parameter_count() const {
+    uint64_t total = 0;
+    for (const auto& t : tensors) {
+        total += static_cast<uint64_t>(t.n_elements());
+    }
+    return total;
+}
+
+std::string GGUFHeader::file_type_name() const {
+    // llama_ftype values as written by the llama.cpp quantizer
+    switch (get_uint("general.file_type", UINT64_MAX)) {
+        case 0: return "F32";
+        case 1: return "F16";
+        case 2: return "Q4_0";
+        case 3: return "Q4_1";
+        case 7: return "Q8_0";
+        case 8: return "Q5_0";
+        case 9: return "Q5_1";
+        case 10: return "Q2_K";
+        case 11: return "Q3_K_S";
+        case 12: return "Q3_K_M";
+        case 13: return "Q3_K_L";
+        case 14: return "Q4_K_S";
+        case 15: return "Q4_K_M";
+        case 16: return "Q5_K_S";
+        case 17: return "Q5_K_M";
+        case 18: return "Q6_K";
+        case 32: return "BF16";
+        default: return "";
+    }
+}
+
+// MappedFile
+
+MappedFile::~MappedFile() {
+    if (addr) munmap(addr, length);
+}
+
+bool MappedFile::open(const std::string& path, std::string* error) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (error) *error = "cannot open " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        if (error) *error = "cannot stat " + path;
+        close(fd);
+        return false;
+    }
+    if (static_cast<uint64_t>(st.st_size) > SIZE_MAX) {
+        if (error) *error = "file too large for this address space";
+        close(fd);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps its own reference to the file
+    close(fd);
+    if (p == MAP_FAILED) {
+        if (error) *error = std::string("mmap failed: ") + strerror(errno);
+        return false;
+    }
+
+    addr = static_cast<uint8_t*>(p);
+    length = size;
+    return true;
+}
+
+size_t MappedFile::resident_bytes() const {
+    if (!addr) return 0;
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t n_pages = (length + page - 1) / page;
+    std::vector<unsigned char> vec(n_pages);
+    if (mincore(addr, length, vec.data()) != 0) return 0;
+
+    size_t resident = 0;
+    for (unsigned char v : vec) {
+        resident += v & 1;
+    }
+    return std::min(resident * page, length);
+}
+
+void MappedFile::advise(size_t offset, size_t len, int advice) const {
+    if (!addr || offset >= length) return;
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t begin = offset / page * page;
+    size_t end = std::min(length, offset + len);
+    madvise(addr + begin, end - begin, advice);
+}
+
+void MappedFile::touch(size_t offset, size_t len) const {
+    if (!addr || offset >= length) return;
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t end = std::min(length, offset + len);
+    volatile uint8_t sink = 0;
+    for (size_t i = offset / page * page; i < end; i += page) {
+        sink = sink + addr[i];
+    }
+}
+
+// GGUFFile
+
+std::unique_ptr<GGUFFile> GGUFFile::load(const std::string& path, std::string* error) {
+    std::unique_ptr<GGUFFile> file(new GGUFFile());
+    if (!file->map.open(path, error)) return nullptr;
+
+    // Only the header pages are touched here; tensor data stays on disk until used
+    if (!GGUFHeader::parse(file->map.data(), file->map.size(), true, file->hdr, error)) return nullptr;
+
+    const GGUFHeader& hdr = file->hdr;
+    if (hdr.data_offset > hdr.file_size) {
+        if (error) *error = "data section beyond end of file";
+        return nullptr;
+    }
+    const uint64_t data_size = hdr.file_size - hdr.data_offset;
+
+    file->tensor_index.reserve(hdr.tensors.size());
+    for (size_t i = 0; i < hdr.tensors.size(); ++i) {
+        const GGUFTensorInfo& t = hdr.tensors[i];
+        if (t.offset % hdr.alignment != 0 || t.offset > data_size || t.n_bytes() > data_size - t.offset) {
+            if (error) *error = "tensor " + t.name + " out of bounds";
+            return nullptr;
+        }
+        file->tensor_index.emplace(t.name, i);
+    }
+    return file;
+}
+
+const GGUFTensorInfo* GGUFFile::find_tensor(const std::string& name) const {
+    auto it = tensor_index.find(name);
+    return it == tensor_index.end() ? nullptr : &hdr.tensors[it->second];
+}
+
+std::vector<std::string_view> GGUFFile::get_string_array(const std::string& key) const {
+    std::vector<std::string_view> out;
+    const GGUFValue* v = hdr.find(key);
+    if (!v || v->type != GGUF_TYPE_ARRAY || v->array_type != GGUF_TYPE_STRING) return out;
+
+    // Bounds were validated when the header was parsed
+    out.reserve(v->array_count);
+    const uint8_t* p = map.data() + v->array_offset;
+    for (uint64_t i = 0; i < v->array_count; ++i) {
+        uint64_t len = 0;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        out.emplace_back(reinterpret_cast<const char*>(p), static_cast<size_t>(len));
+        p += len;
+    }
+    return out;
+}
+
+const uint8_t* GGUFFile::get_array_data(const std::string& key, GGUFValueType element_type, uint64_t* count) const {
+    const GGUFValue* v = hdr.find(key);
+    if (!v || v->type != GGUF_TYPE_ARRAY || v->array_type != element_type) return nullptr;
+    if (count) *count = v->array_count;
+    return map.data() + v->array_offset;
+}
+
+size_t GGUFFile::tensor_bytes() const {
+    size_t total = 0;
+    for (const auto& t : hdr.tensors) {
+        total += t.n_bytes();
+    }
+    return total;
+}
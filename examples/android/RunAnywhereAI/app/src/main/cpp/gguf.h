@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Tensor storage types as they appear in GGUF tensor infos (ggml numbering)
+enum GGMLType : uint32_t {
+    GGML_TYPE_F32 = 0,
+    GGML_TYPE_F16 = 1,
+    GGML_TYPE_Q4_0 = 2,
+    GGML_TYPE_Q4_1 = 3,
+    GGML_TYPE_Q5_0 = 6,
+    GGML_TYPE_Q5_1 = 7,
+    GGML_TYPE_Q8_0 = 8,
+    GGML_TYPE_Q8_1 = 9,
+    GGML_TYPE_Q2_K = 10,
+    GGML_TYPE_Q3_K = 11,
+    GGML_TYPE_Q4_K = 12,
+    GGML_TYPE_Q5_K = 13,
+    GGML_TYPE_Q6_K = 14,
+    GGML_TYPE_Q8_K = 15,
+    GGML_TYPE_IQ2_XXS = 16,
+    GGML_TYPE_IQ2_XS = 17,
+    GGML_TYPE_IQ3_XXS = 18,
+    GGML_TYPE_IQ1_S = 19,
+    GGML_TYPE_IQ4_NL = 20,
+    GGML_TYPE_IQ3_S = 21,
+    GGML_TYPE_IQ2_S = 22,
+    GGML_TYPE_IQ4_XS = 23,
+    GGML_TYPE_I8 = 24,
+    GGML_TYPE_I16 = 25,
+    GGML_TYPE_I32 = 26,
+    GGML_TYPE_I64 = 27,
+    GGML_TYPE_F64 = 28,
+    GGML_TYPE_IQ1_M = 29,
+    GGML_TYPE_BF16 = 30,
+    GGML_TYPE_COUNT
+};
+
+const char* ggml_type_name(GGMLType type);
+// Elements per quantization block (1 for plain types), 0 if the type is unknown
+int64_t ggml_block_size(GGMLType type);
+// Bytes per quantization block
+size_t ggml_type_size(GGMLType type);
+// Bytes needed to store n_elements of the given type (n_elements must be block aligned)
+size_t ggml_row_size(GGMLType type, int64_t n_elements);
+
+// Metadata value types used by the GGUF key/value section
+enum GGUFValueType : uint32_t {
+    GGUF_TYPE_UINT8 = 0,
+    GGUF_TYPE_INT8 = 1,
+    GGUF_TYPE_UINT16 = 2,
+    GGUF_TYPE_INT16 = 3,
+    GGUF_TYPE_UINT32 = 4,
+    GGUF_TYPE_INT32 = 5,
+    GGUF_TYPE_FLOAT32 = 6,
+    GGUF_TYPE_BOOL = 7,
+    GGUF_TYPE_STRING = 8,
+    GGUF_TYPE_ARRAY = 9,
+    GGUF_TYPE_UINT64 = 10,
+    GGUF_TYPE_INT64 = 11,
+    GGUF_TYPE_FLOAT64 = 12,
+};
+
+// A single metadata value. Scalars are decoded eagerly; arrays only record
+// where their elements live in the file so that large arrays (vocab, merges)
+// are never copied unless a caller asks for them.
+struct GGUFValue {
+    GGUFValueType type = GGUF_TYPE_UINT8;
+    uint64_t u64 = 0;
+    int64_t i64 = 0;
+    double f64 = 0.0;
+    std::string str;
+
+    GGUFValueType array_type = GGUF_TYPE_UINT8;
+    uint64_t array_count = 0;
+    uint64_t array_offset = 0; // absolute file offset of the first element
+};
+
+struct GGUFTensorInfo {
+    std::string name;
+    GGMLType type = GGML_TYPE_F32;
+    uint32_t n_dims = 0;
+    int64_t ne[4] = {1, 1, 1, 1};
+    uint64_t offset = 0; // relative to the start of the data section
+
+    int64_t n_elements() const { return ne[0] * ne[1] * ne[2] * ne[3]; }
+    size_t n_bytes() const { return ggml_row_size(type, ne[0]) * ne[1] * ne[2] * ne[3]; }
+};
+
+// Parsed GGUF header: key/value metadata plus (optionally) the tensor directory
+struct GGUFHeader {
+    uint32_t version = 0;
+    uint64_t file_size = 0;
+    uint32_t alignment = 32;
+    uint64_t data_offset = 0;
+    std::unordered_map<std::string, GGUFValue> kv;
+    std::vector<GGUFTensorInfo> tensors;
+
+    // Reads the header with buffered file reads only; tensor data is never mapped or read
+    static bool read(const std::string& path, bool with_tensors, GGUFHeader& out, std::string* error);
+    // Parses a header that is already in memory (e.g. a mapped file)
+    static bool parse(const uint8_t* data, size_t size, bool with_tensors, GGUFHeader& out, std::string* error);
+
+    const GGUFValue* find(const std::string& key) const;
+    uint64_t get_uint(const std::string& key, uint64_t fallback) const;
+    float get_float(const std::string& key, float fallback) const;
+    std::string get_string(const std::string& key, const std::string& fallback = "") const;
+    uint64_t get_array_count(const std::string& key) const;
+
+    std::string architecture() const { return get_string("general.architecture", "llama"); }
+    // Looks up "<architecture>.<suffix>", e.g. "llama.context_length"
+    uint64_t get_arch_uint(const std::string& suffix, uint64_t fallback) const {
+        return get_uint(architecture() + "." + suffix, fallback);
+    }
+    float get_arch_float(const std::string& suffix, float fallback) const {
+        return get_float(architecture() + "." + suffix, fallback);
+    }
+
+    // Total element count over all tensors (requires the tensor directory)
+    uint64_t parameter_count() const;
+    // Human-readable name for "general.file_type" (e.g. "Q4_K_M"), or "" if unknown
+    std::string file_type_name() const;
+};
+
+// Read-only shared mapping of a file. Pages are faulted in lazily by the kernel
+// on first touch, so mapping a multi-GB model costs no I/O up front.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path, std::string* error);
+
+    const uint8_t* data() const { return addr; }
+    size_t size() const { return length; }
+
+    // Bytes of the mapping currently resident in the page cache for this process
+    size_t resident_bytes() const;
+    // madvise() on a byte range; the range is widened to page boundaries
+    void advise(size_t offset, size_t len, int advice) const;
+    // Reads one byte per page of a range, faulting it in now rather than on first use
+    void touch(size_t offset, size_t len) const;
+
+private:
+    uint8_t* addr = nullptr;
+    size_t length = 0;
+};
+
+// A GGUF model opened for inference: the header is parsed in place from the
+// mapping and tensor data pointers point straight into it (no heap copy).
+class GGUFFile {
+public:
+    static std::unique_ptr<GGUFFile> load(const std::string& path, std::string* error);
+
+    const GGUFHeader& header() const { return hdr; }
+    const MappedFile& mapping() const { return map; }
+
+    const GGUFTensorInfo* find_tensor(const std::string& name) const;
+    const uint8_t* tensor_data(const GGUFTensorInfo& tensor) const {
+        return map.data() + hdr.data_offset + tensor.offset;
+    }
+
+    // Views into the mapping for a string array (e.g. "tokenizer.ggml.tokens")
+    std::vector<std::string_view> get_string_array(const std::string& key) const;
+    // Raw pointer to a fixed-size element array, or nullptr if the key is missing
+    // or has a different element type. Elements may be unaligned.
+    const uint8_t* get_array_data(const std::string& key, GGUFValueType element_type, uint64_t* count) const;
+
+    // Sum of tensor bytes in the data section
+    size_t tensor_bytes() const;
+
+private:
+    GGUFHeader hdr;
+    MappedFile map;
+    std::unordered_map<std::string, size_t> tensor_index;
+};
@@ -0,0 +1,835 @@
+#include "grammar.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+#include "llama_vocab.h"
+
+namespace {
+
+bool is_word_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-';
+}
+
+// Smallest code point each sequence length may encode, and the payload bits of
+// its lead byte
+const uint32_t kUtf8MinValue[5] = {0, 0, 0x80, 0x800, 0x10000};
+const uint8_t kUtf8LeadMask[5] = {0, 0, 0x1f, 0x0f, 0x07};
+
+// Sequence length by lead byte: 0 for continuation bytes and bytes that never
+// start a valid sequence (C0, C1 and F5..FF)
+int utf8_length(uint8_t b) {
+    if (b < 0x80) return 1;
+    if (b < 0xc2) return 0;
+    if (b < 0xe0) return 2;
+    if (b < 0xf0) return 3;
+    if (b < 0xf5) return 4;
+    return 0;
+}
+
+// Decodes one code point of grammar text at s, advancing it; invalid bytes
+// decode as themselves
+uint32_t decode_utf8(const char*& s) {
+    const uint8_t lead = static_cast<uint8_t>(*s);
+    const int length = utf8_length(lead);
+    if (length <= 1) {
+        s++;
+        return lead;
+    }
+    uint32_t cp = lead & kUtf8LeadMask[length];
+    for (int i = 1; i < length; ++i) {
+        const uint8_t b = static_cast<uint8_t>(s[i]);
+        if ((b & 0xc0) != 0x80) {
+            s++;
+            return lead;
+        }
+        cp = (cp << 6) | (b & 0x3f);
+    }
+    s += length;
+    return cp;
+}
+
+// Decodes `text` continuing from `partial`, appending complete code points.
+// Returns the state after the last byte; n_remaining is -1 if the bytes are
+// not UTF-8, including overlong forms and surrogates, which a model built from
+// byte tokens could otherwise use to spell characters a grammar excludes.
+PartialUtf8 decode_utf8(const std::string& text, PartialUtf8 partial, std::vector<uint32_t>& out) {
+    uint32_t value = partial.value;
+    int n_remaining = partial.n_remaining;
+    int length = partial.length;
+    for (unsigned char b : text) {
+        if (n_remaining > 0) {
+            if ((b & 0xc0) != 0x80) return {0, -1};
+            value = (value << 6) | (b & 0x3f);
+            if (--n_remaining == 0) {
+                if (value < kUtf8MinValue[length] || value > 0x10ffff || (value >= 0xd800 && value <= 0xdfff)) {
+                    return {0, -1};
+                }
+                out.push_back(value);
+            }
+            continue;
+        }
+        length = utf8_length(b);
+        if (length == 0) return {0, -1};
+        if (length == 1) {
+            out.push_back(b);
+            continue;
+        }
+        value = b & kUtf8LeadMask[length];
+        n_remaining = length - 1;
+    }
+    if (n_remaining > 0) return {value, n_remaining, length};
+    return {};
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+// Parser
+// ---------------------------------------------------------------------------
+
+// Recursive descent over the text. Parse functions return the position after
+// what they consumed, or nullptr after recording an error.
+class GrammarParser {
+public:
+    explicit GrammarParser(Grammar& grammar) : grammar(grammar) {}
+
+    bool parse(const std::string& text, std::string* error);
+
+private:
+    const char* fail(const char* pos, const std::string& message);
+    const char* parse_space(const char* pos, bool newline_ok);
+    const char* parse_name(const char* pos);
+    const char* parse_char(const char* pos, uint32_t* cp);
+    const char* parse_int(const char* pos, int* value);
+    const char* parse_alternatives(const char* pos, const std::string& rule_name, uint32_t rule_id, bool nested);
+    const char* parse_sequence(const char* pos, const std::string& rule_name, std::vector<GrammarElement>& out,
+                               bool nested);
+    // Rewrites the last item of `out` (from last_start) to repeat [min, max]
+    // times (max < 0 for unbounded) using generated helper rules
+    void repeat(std::vector<GrammarElement>& out, size_t last_start, const std::string& rule_name, int min, int max);
+
+    uint32_t symbol_id(const std::string& name);
+    uint32_t new_symbol(const std::string& base);
+    void add_rule(uint32_t id, const std::vector<GrammarElement>& elements);
+    bool check_left_recursion(std::string* error) const;
+
+    Grammar& grammar;
+    std::unordered_map<std::string, uint32_t> symbols;
+    std::vector<std::string> names;
+    std::vector<bool> defined;
+    const char* text_begin = nullptr;
+    std::string error_message;
+};
+
+const char* GrammarParser::fail(const char* pos, const std::string& message) {
+    if (error_message.empty()) {
+        error_message = message + " at offset " + std::to_string(pos - text_begin);
+    }
+    return nullptr;
+}
+
+const char* GrammarParser::parse_space(const char* pos, bool newline_ok) {
+    while (*pos == ' ' || *pos == '\t' || *pos == '#' || (newline_ok && (*pos == '\r' || *pos == '\n'))) {
+        if (*pos == '#') {
+            while (*pos && *pos != '\r' && *pos != '\n') pos++;
+        } else {
+            pos++;
+        }
+    }
+    return pos;
+}
+
+const char* GrammarParser::parse_name(const char* pos) {
+    const char* end = pos;
+    while (is_word_char(*end)) end++;
+    if (end == pos) return fail(pos, "expecting a rule name");
+    return end;
+}
+
+const char* GrammarParser::parse_int(const char* pos, int* value) {
+    const char* end = pos;
+    long v = 0;
+    while (*end >= '0' && *end <= '9') {
+        v = v * 10 + (*end - '0');
+        if (v > 100000) return fail(pos, "repetition count too large");
+        end++;
+    }
+    if (end == pos) return fail(pos, "expecting an integer");
+    *value = static_cast<int>(v);
+    return end;
+}
+
+const char* GrammarParser::parse_char(const char* pos, uint32_t* cp) {
+    if (*pos != '\\') {
+        *cp = decode_utf8(pos);
+        return pos;
+    }
+    int hex_digits = 0;
+    switch (pos[1]) {
+        case 'x': hex_digits = 2; break;
+        case 'u': hex_digits = 4; break;
+        case 'U': hex_digits = 8; break;
+        case 'n': *cp = '\n'; return pos + 2;
+        case 'r': *cp = '\r'; return pos + 2;
+        case 't': *cp = '\t'; return pos + 2;
+        case '\\':
+        case '"':
+        case '[':
+        case ']':
+        case '-':
+        case '^':
+        case '/':
+            *cp = static_cast<uint8_t>(pos[1]);
+            return pos + 2;
+        default:
+            return fail(pos, "unknown escape");
+    }
+    uint32_t value = 0;
+    pos += 2;
+    for (int i = 0; i < hex_digits; ++i, ++pos) {
+        const char c = *pos;
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return fail(pos, "expecting a hex digit");
+        }
+        value = value * 16 + digit;
+    }
+    *cp = value;
+    return pos;
+}
+
+uint32_t GrammarParser::symbol_id(const std::string& name) {
+    auto it = symbols.find(name);
+    if (it != symbols.end()) return it->second;
+    const uint32_t id = static_cast<uint32_t>(names.size());
+    symbols.emplace(name, id);
+    names.push_back(name);
+    defined.push_back(false);
+    return id;
+}
+
+uint32_t GrammarParser::new_symbol(const std::string& base) {
+    // Generated names contain '#', which rule names cannot, so they never clash
+    return symbol_id(base + "#" + std::to_string(names.size()));
+}
+
+void GrammarParser::add_rule(uint32_t id, const std::vector<GrammarElement>& elements) {
+    if (grammar.rule_elements.size() <= id) grammar.rule_elements.resize(id + 1);
+    grammar.rule_elements[id] = elements;
+    defined[id] = true;
+}
+
+void GrammarParser::repeat(std::vector<GrammarElement>& out, size_t last_start, const std::string& rule_name,
+                           int min, int max) {
+    const std::vector<GrammarElement> item(out.begin() + last_start, out.end());
+    out.resize(last_start);
+    for (int i = 0; i < min; ++i) {
+        out.insert(out.end(), item.begin(), item.end());
+    }
+
+    // x{0,n} nests n optionals: opt_n ::= x opt_{n-1} | (empty), opt_1 ::= x |;
+    // x{0,} is rec ::= x rec |
+    const int n_optional = max < 0 ? 1 : max - min;
+    uint32_t last_id = 0;
+    for (int i = 0; i < n_optional; ++i) {
+        std::vector<GrammarElement> rule = item;
+        const uint32_t id = new_symbol(rule_name);
+        if (max < 0) {
+            rule.push_back({GrammarElementType::RuleRef, id});
+        } else if (i > 0) {
+            rule.push_back({GrammarElementType::RuleRef, last_id});
+        }
+        rule.push_back({GrammarElementType::Alt, 0});
+        rule.push_back({GrammarElementType::End, 0});
+        add_rule(id, rule);
+        last_id = id;
+    }
+    if (n_optional > 0) out.push_back({GrammarElementType::RuleRef, last_id});
+}
+
+const char* GrammarParser::parse_sequence(const char* pos, const std::string& rule_name,
+                                          std::vector<GrammarElement>& out, bool nested) {
+    size_t last_start = out.size();
+    while (*pos) {
+        if (*pos == '"') {
+            last_start = out.size();
+            pos++;
+            while (*pos != '"') {
+                if (!*pos) return fail(pos, "unterminated string");
+                uint32_t cp;
+                pos = parse_char(pos, &cp);
+                if (!pos) return nullptr;
+                out.push_back({GrammarElementType::Char, cp});
+            }
+            pos = parse_space(pos + 1, nested);
+        } else if (*pos == '[') {
+            last_start = out.size();
+            pos++;
+            GrammarElementType type = GrammarElementType::Char;
+            if (*pos == '^') {
+                type = GrammarElementType::CharNot;
+                pos++;
+            }
+            while (*pos != ']') {
+                if (!*pos) return fail(pos, "unterminated character class");
+                uint32_t cp;
+                pos = parse_char(pos, &cp);
+                if (!pos) return nullptr;
+                out.push_back({out.size() > last_start ? GrammarElementType::CharAlt : type, cp});
+                if (pos[0] == '-' && pos[1] != ']') {
+                    if (!pos[1]) return fail(pos, "unterminated character class");
+                    uint32_t upper;
+                    pos = parse_char(pos + 1, &upper);
+                    if (!pos) return nullptr;
+                    out.push_back({GrammarElementType::CharRangeUpper, upper});
+                }
+            }
+            if (out.size() == last_start) {
+                // [] matches nothing; [^] anything
+                if (type == GrammarElementType::Char) return fail(pos, "empty character class");
+                out.push_back({GrammarElementType::CharAny, 0});
+            }
+            pos = parse_space(pos + 1, nested);
+        } else if (is_word_char(*pos)) {
+            last_start = out.size();
+            const char* end = parse_name(pos);
+            out.push_back({GrammarElementType::RuleRef, symbol_id(std::string(pos, end))});
+            pos = parse_space(end, nested);
+        } else if (*pos == '(') {
+            last_start = out.size();
+            const uint32_t sub_id = new_symbol(rule_name);
+            pos = parse_alternatives(parse_space(pos + 1, true), rule_name, sub_id, true);
+            if (!pos) return nullptr;
+            if (*pos != ')') return fail(pos, "expecting ')'");
+            out.push_back({GrammarElementType::RuleRef, sub_id});
+            pos = parse_space(pos + 1, nested);
+        } else if (*pos == '.') {
+            last_start = out.size();
+            out.push_back({GrammarElementType::CharAny, 0});
+            pos = parse_space(pos + 1, nested);
+        } else if (*pos == '*' || *pos == '+' || *pos == '?' || *pos == '{') {
+            if (last_start == out.size()) return fail(pos, "repetition without a preceding item");
+            int min = 0;
+            int max = -1;
+            if (*pos == '+') {
+                min = 1;
+            } else if (*pos == '?') {
+                max = 1;
+            } else if (*pos == '{') {
+                pos = parse_int(parse_space(pos + 1, nested), &min);
+                if (!pos) return nullptr;
+                pos = parse_space(pos, nested);
+                if (*pos == ',') {
+                    pos = parse_space(pos + 1, nested);
+                    if (*pos != '}') {
+                        pos = parse_int(pos, &max);
+                        if (!pos) return nullptr;
+                        pos = parse_space(pos, nested);
+                        if (max < min) return fail(pos, "repetition maximum below minimum");
+                    }
+                } else {
+                    max = min;
+                }
+                if (*pos != '}') return fail(pos, "expecting '}'");
+            }
+            repeat(out, last_start, rule_name, min, max);
+            pos = parse_space(pos + 1, nested);
+        } else {
+            break;
+        }
+    }
+    return pos;
+}
+
+const char* GrammarParser::parse_alternatives(const char* pos, const std::string& rule_name, uint32_t rule_id,
+                                              bool nested) {
+    std::vector<GrammarElement> rule;
+    pos = parse_sequence(pos, rule_name, rule, nested);
+    while (pos && *pos == '|') {
+        rule.push_back({GrammarElementType::Alt, 0});
+        pos = parse_sequence(parse_space(pos + 1, true), rule_name, rule, nested);
+    }
+    if (!pos) return nullptr;
+    rule.push_back({GrammarElementType::End, 0});
+    add_rule(rule_id, rule);
+    return pos;
+}
+
+bool GrammarParser::check_left_recursion(std::string* error) const {
+    const auto& rules = grammar.rule_elements;
+    const size_t n = rules.size();
+
+    // Rules that can match the empty string, to a fixed point
+    std::vector<bool> nullable(n, false);
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t r = 0; r < n; ++r) {
+            if (nullable[r]) continue;
+            for (const GrammarElement* alt : grammar.alt_starts[r]) {
+                const GrammarElement* e = alt;
+                while (e->type == GrammarElementType::RuleRef && nullable[e->value]) e++;
+                if (e->type == GrammarElementType::End || e->type == GrammarElementType::Alt) {
+                    nullable[r] = changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Rules each rule can reach without consuming a character
+    std::vector<std::vector<uint32_t>> leftmost(n);
+    for (size_t r = 0; r < n; ++r) {
+        for (const GrammarElement* e : grammar.alt_starts[r]) {
+            for (; e->type == GrammarElementType::RuleRef; ++e) {
+                leftmost[r].push_back(e->value);
+                if (!nullable[e->value]) break;
+            }
+        }
+    }
+
+    // Depth-first search for a cycle: 0 unvisited, 1 on the stack, 2 done
+    std::vector<uint8_t> state(n, 0);
+    std::vector<std::pair<uint32_t, size_t>> stack;
+    for (uint32_t start = 0; start < n; ++start) {
+        if (state[start]) continue;
+        stack.push_back({start, 0});
+        state[start] = 1;
+        while (!stack.empty()) {
+            auto& top = stack.back();
+            if (top.second == leftmost[top.first].size()) {
+                state[top.first] = 2;
+                stack.pop_back();
+                continue;
+            }
+            const uint32_t next = leftmost[top.first][top.second++];
+            if (state[next] == 1) {
+                if (error) *error = "left recursion in rule '" + names[next] + "'";
+                return false;
+            }
+            if (state[next] == 0) {
+                state[next] = 1;
+                stack.push_back({next, 0});
+            }
+        }
+    }
+    return true;
+}
+
+bool GrammarParser::parse(const std::string& text, std::string* error) {
+    text_begin = text.c_str();
+    const char* pos = parse_space(text_begin, true);
+    while (pos && *pos) {
+        const char* name_end = parse_name(pos);
+        if (!name_end) break;
+        const std::string name(pos, name_end);
+        const uint32_t id = symbol_id(name);
+        if (defined[id]) {
+            fail(pos, "rule '" + name + "' defined twice");
+            break;
+        }
+        pos = parse_space(name_end, false);
+        if (pos[0] != ':' || pos[1] != ':' || pos[2] != '=') {
+            fail(pos, "expecting '::='");
+            break;
+        }
+        pos = parse_alternatives(parse_space(pos + 3, true), name, id, false);
+        if (!pos) break;
+        if (*pos && *pos != '\r' && *pos != '\n') {
+            fail(pos, "expecting a newline or end of text");
+            break;
+        }
+        pos = parse_space(pos, true);
+    }
+    if (!error_message.empty()) {
+        if (error) *error = error_message;
+        return false;
+    }
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (!defined[i]) {
+            if (error) *error = "undefined rule '" + names[i] + "'";
+            return false;
+        }
+    }
+    auto root = symbols.find("root");
+    if (root == symbols.end()) {
+        if (error) *error = "grammar has no 'root' rule";
+        return false;
+    }
+    grammar.root_id = root->second;
+
+    grammar.alt_starts.resize(grammar.rule_elements.size());
+    for (size_t r = 0; r < grammar.rule_elements.size(); ++r) {
+        const std::vector<GrammarElement>& rule = grammar.rule_elements[r];
+        grammar.alt_starts[r].push_back(rule.data());
+        for (size_t i = 0; i + 1 < rule.size(); ++i) {
+            if (rule[i].type == GrammarElementType::Alt) grammar.alt_starts[r].push_back(&rule[i + 1]);
+        }
+    }
+    return check_left_recursion(error);
+}
+
+std::shared_ptr<const Grammar> Grammar::parse(const std::string& text, std::string* error) {
+    auto grammar = std::make_shared<Grammar>();
+    GrammarParser parser(*grammar);
+    if (!parser.parse(text, error)) return nullptr;
+    return grammar;
+}
+
+// ---------------------------------------------------------------------------
+// Token trie
+// ---------------------------------------------------------------------------
+
+TokenTrie::TokenTrie(const LlamaVocab& vocab) {
+    const int32_t n_vocab = static_cast<int32_t>(vocab.size());
+    pieces.resize(n_vocab);
+    std::vector<std::vector<uint32_t>> keys(n_vocab);
+    std::vector<int32_t> order;
+    order.reserve(n_vocab);
+    for (int32_t id = 0; id < n_vocab; ++id) {
+        pieces[id] = vocab.token_to_piece(id);
+        // Empty pieces (control tokens) can never be matched and stay out
+        if (pieces[id].empty()) continue;
+        std::vector<uint32_t>& key = keys[id];
+        const PartialUtf8 tail = decode_utf8(pieces[id], PartialUtf8{}, key);
+        if (tail.n_remaining < 0) continue;
+        if (tail.n_remaining > 0) {
+            key.push_back(kPartial | static_cast<uint32_t>(tail.length) << 28 |
+                          static_cast<uint32_t>(tail.n_remaining) << 24 | tail.value);
+        }
+        order.push_back(id);
+    }
+    // Sorted keys put every subtree in one contiguous range, shortest first
+    std::sort(order.begin(), order.end(), [&](int32_t a, int32_t b) { return keys[a] < keys[b]; });
+    trie_nodes.reserve(order.size() * 2);
+    build(keys, order, 0, order.size(), 0);
+}
+
+uint32_t TokenTrie::build(std::vector<std::vector<uint32_t>>& keys, std::vector<int32_t>& order, size_t begin,
+                          size_t end, size_t depth) {
+    const uint32_t index = static_cast<uint32_t>(trie_nodes.size());
+    trie_nodes.emplace_back();
+    max_depth = std::max(max_depth, depth);
+
+    Node node;
+    node.token_begin = static_cast<uint32_t>(tokens.size());
+    while (begin < end && keys[order[begin]].size() == depth) {
+        tokens.push_back(order[begin++]);
+    }
+    node.token_end = static_cast<uint32_t>(tokens.size());
+
+    // Reserve this node's edges before recursing so they stay contiguous
+    size_t n_children = 0;
+    for (size_t i = begin; i < end; ++n_children) {
+        const uint32_t key = keys[order[i]][depth];
+        while (i < end && keys[order[i]][depth] == key) i++;
+    }
+    node.edge_begin = static_cast<uint32_t>(trie_edges.size());
+    node.edge_end = static_cast<uint32_t>(trie_edges.size() + n_children);
+    trie_edges.resize(node.edge_end);
+
+    size_t edge = node.edge_begin;
+    for (size_t i = begin; i < end;) {
+        const uint32_t key = keys[order[i]][depth];
+        size_t j = i;
+        while (j < end && keys[order[j]][depth] == key) j++;
+        const uint32_t child = build(keys, order, i, j, depth + 1);
+        trie_edges[edge++] = {key, child};
+        i = j;
+    }
+    trie_nodes[index] = node;
+    return index;
+}
+
+// ---------------------------------------------------------------------------
+// Matcher
+// ---------------------------------------------------------------------------
+
+namespace {
+
+// Matcher tables are rebuilt from the current state beyond these sizes
+constexpr size_t kMaxFrames = 1 << 16;
+constexpr size_t kMaxStates = 1 << 12;
+// States whose allowed tokens are cached (16 KB each at a 128k vocabulary)
+constexpr size_t kMaxCachedMasks = 32;
+
+// Whether the character element at `pos` (with its CharAlt / CharRangeUpper
+// tail) matches cp
+bool match_char(const GrammarElement* pos, uint32_t cp) {
+    if (pos->type == GrammarElementType::CharAny) return true;
+    const bool positive = pos->type == GrammarElementType::Char;
+    do {
+        if (pos[1].type == GrammarElementType::CharRangeUpper) {
+            if (pos->value <= cp && cp <= pos[1].value) return positive;
+            pos += 2;
+        } else {
+            if (pos->value == cp) return positive;
+            pos += 1;
+        }
+    } while (pos->type == GrammarElementType::CharAlt);
+    return !positive;
+}
+
+// Whether some code point starting with the partial sequence could match
+bool match_partial(const GrammarElement* pos, PartialUtf8 partial) {
+    const bool positive = pos->type == GrammarElementType::Char;
+    // The completed code point lies in [low, high], and must not be overlong,
+    // past U+10FFFF or a surrogate
+    const int shift = 6 * partial.n_remaining;
+    const uint32_t low = std::max(partial.value << shift, kUtf8MinValue[partial.length]);
+    const uint32_t high = std::min((partial.value << shift) | ((1u << shift) - 1), 0x10ffffu);
+    if (low > high || (low >= 0xd800 && high <= 0xdfff)) return false;
+    if (pos->type == GrammarElementType::CharAny) return true;
+    do {
+        const uint32_t lo = pos->value;
+        const uint32_t hi = pos[1].type == GrammarElementType::CharRangeUpper ? pos[1].value : lo;
+        if (positive) {
+            if (lo <= high && low <= hi) return true;
+        } else if (lo <= low && high <= hi) {
+            return false; // the whole range is excluded
+        }
+        pos += pos[1].type == GrammarElementType::CharRangeUpper ? 2 : 1;
+    } while (pos->type == GrammarElementType::CharAlt);
+    return !positive;
+}
+
+// Element after a character element and its alternatives
+const GrammarElement* skip_char(const GrammarElement* pos) {
+    do {
+        pos++;
+    } while (pos->type == GrammarElementType::CharAlt || pos->type == GrammarElementType::CharRangeUpper);
+    return pos;
+}
+
+} // namespace
+
+GrammarMatcher::GrammarMatcher(std::shared_ptr<const Grammar> g, const TokenTrie& trie, const LlamaVocab& vocab)
+    : grammar(std::move(g)), trie(trie), vocab(vocab) {
+    Stacks start;
+    for (const GrammarElement* alt : grammar->alternatives(grammar->root())) {
+        expand(alt, nullptr, start);
+    }
+    current = intern(start);
+}
+
+const GrammarMatcher::Frame* GrammarMatcher::frame(const GrammarElement* pos, const Frame* parent) const {
+    return &*frames.insert({pos, parent}).first;
+}
+
+void GrammarMatcher::expand(const GrammarElement* pos, const Frame* parent, Stacks& out) const {
+    switch (pos->type) {
+        case GrammarElementType::End:
+        case GrammarElementType::Alt:
+            // This rule is done: continue in the rule that referenced it
+            if (parent) {
+                expand(parent->pos, parent->parent, out);
+            } else if (std::find(out.begin(), out.end(), nullptr) == out.end()) {
+                out.push_back(nullptr);
+            }
+            return;
+        case GrammarElementType::RuleRef: {
+            // A reference that ends its alternative continues straight in the
+            // parent, so repetition helpers (rec ::= x rec |) do not grow the
+            // stack with every repeat and their states recur
+            const GrammarElementType after = pos[1].type;
+            const Frame* next = after == GrammarElementType::End || after == GrammarElementType::Alt
+                                    ? parent
+                                    : frame(pos + 1, parent);
+            for (const GrammarElement* alt : grammar->alternatives(pos->value)) {
+                expand(alt, next, out);
+            }
+            return;
+        }
+        default:
+            break;
+    }
+    // Identical stacks are the same frame; ambiguous grammars would otherwise
+    // multiply them with every character
+    const Frame* top = frame(pos, parent);
+    if (std::find(out.begin(), out.end(), top) == out.end()) out.push_back(top);
+}
+
+int32_t GrammarMatcher::intern(Stacks& stacks) const {
+    std::sort(stacks.begin(), stacks.end());
+    auto it = state_index.find(stacks);
+    if (it != state_index.end()) return it->second;
+    const int32_t id = static_cast<int32_t>(states.size());
+    states.emplace_back();
+    states.back().stacks = stacks;
+    states.back().ascii_next.assign(128, kUnknown);
+    state_index.emplace(stacks, id);
+    return id;
+}
+
+int32_t GrammarMatcher::next_state(int32_t state, uint32_t cp) const {
+    int32_t* memo;
+    if (cp < 128) {
+        memo = &states[state].ascii_next[cp];
+    } else {
+        memo = &states[state].other_next.emplace(cp, kUnknown).first->second;
+    }
+    if (*memo != kUnknown) return *memo;
+
+    Stacks next;
+    for (const Frame* s : states[state].stacks) {
+        if (s && match_char(s->pos, cp)) expand(skip_char(s->pos), s->parent, next);
+    }
+    const int32_t result = next.empty() ? kRejected : intern(next);
+    // intern() may have grown `states`, so look the slot up again
+    if (cp < 128) {
+        states[state].ascii_next[cp] = result;
+    } else {
+        states[state].other_next[cp] = result;
+    }
+    return result;
+}
+
+bool GrammarMatcher::accepts_partial(int32_t state, PartialUtf8 p) const {
+    for (const Frame* s : states[state].stacks) {
+        if (s && match_partial(s->pos, p)) return true;
+    }
+    return false;
+}
+
+int32_t GrammarMatcher::advance(int32_t state, PartialUtf8& p, const std::string& text) const {
+    cps.clear();
+    const PartialUtf8 end = decode_utf8(text, p, cps);
+    if (end.n_remaining < 0) return kRejected;
+    for (uint32_t cp : cps) {
+        state = next_state(state, cp);
+        if (state == kRejected) return kRejected;
+    }
+    if (end.n_remaining > 0 && !accepts_partial(state, end)) return kRejected;
+    p = end;
+    return state;
+}
+
+bool GrammarMatcher::can_end() const {
+    const Stacks& stacks = states[current].stacks;
+    return partial.n_remaining == 0 && !stacks.empty() && stacks.front() == nullptr; // sorted: nullptr first
+}
+
+bool GrammarMatcher::finished() const {
+    const Stacks& stacks = states[current].stacks;
+    return partial.n_remaining == 0 && stacks.size() == 1 && stacks.front() == nullptr;
+}
+
+bool GrammarMatcher::allows(int32_t token) const {
+    if (vocab.is_eog(token)) return can_end();
+    if (token < 0 || static_cast<size_t>(token) >= trie.size() || trie.piece(token).empty()) return false;
+    PartialUtf8 p = partial;
+    return advance(current, p, trie.piece(token)) != kRejected;
+}
+
+bool GrammarMatcher::accept(int32_t token) {
+    if (vocab.is_eog(token)) return can_end();
+    if (token < 0 || static_cast<size_t>(token) >= trie.size() || trie.piece(token).empty()) return false;
+    PartialUtf8 p = partial;
+    const int32_t next = advance(current, p, trie.piece(token));
+    if (next == kRejected) return false;
+    current = next;
+    partial = p;
+    if (frames.size() > kMaxFrames || states.size() > kMaxStates) rebuild();
+    return true;
+}
+
+void GrammarMatcher::rebuild() {
+    const Stacks live = states[current].stacks;
+    std::unordered_set<Frame, FrameHash> old;
+    old.swap(frames);
+    states.clear();
+    state_index.clear();
+    cached_masks.clear();
+
+    // Re-creates each chain in the fresh table, parents first
+    std::vector<const Frame*> chain;
+    Stacks stacks;
+    for (const Frame* s : live) {
+        chain.clear();
+        for (const Frame* f = s; f; f = f->parent) chain.push_back(f);
+        const Frame* copy = nullptr;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) copy = frame((*it)->pos, copy);
+        stacks.push_back(copy);
+    }
+    current = intern(stacks);
+}
+
+void GrammarMatcher::mark_tokens(uint32_t node_index) const {
+    const TokenTrie::Node& node = trie.nodes()[node_index];
+    for (uint32_t i = node.token_begin; i < node.token_end; ++i) {
+        allowed[trie.node_tokens()[i]] = 1;
+    }
+}
+
+void GrammarMatcher::walk(uint32_t node_index, int32_t state) const {
+    const TokenTrie::Node& node = trie.nodes()[node_index];
+    for (uint32_t e = node.edge_begin; e < node.edge_end; ++e) {
+        const TokenTrie::Edge& edge = trie.edges()[e];
+        if (edge.key & TokenTrie::kPartial) {
+            // Final incomplete character: its tokens end at the child
+            PartialUtf8 p;
+            p.length = static_cast<int>((edge.key >> 28) & 0x7);
+            p.n_remaining = static_cast<int>((edge.key >> 24) & 0xf);
+            p.value = edge.key & 0xffffff;
+            if (accepts_partial(state, p)) mark_tokens(edge.node);
+            continue;
+        }
+        const int32_t next = next_state(state, edge.key);
+        if (next != kRejected) {
+            mark_tokens(edge.node);
+            walk(edge.node, next);
+        }
+    }
+}
+
+void GrammarMatcher::mask(float* logits, int32_t n_vocab) const {
+    const size_t n_words = (static_cast<size_t>(n_vocab) + 63) / 64;
+    if (partial.n_remaining == 0 && states[current].allowed_bits.size() == n_words) {
+        const uint64_t* bits = states[current].allowed_bits.data();
+        for (size_t w = 0; w < n_words; ++w) {
+            if (bits[w] == ~uint64_t(0)) continue;
+            const int32_t end = std::min<int32_t>(n_vocab, static_cast<int32_t>(w * 64 + 64));
+            for (int32_t id = static_cast<int32_t>(w * 64); id < end; ++id) {
+                if (!(bits[w] >> (id & 63) & 1)) logits[id] = -INFINITY;
+            }
+        }
+        return;
+    }
+
+    allowed.assign(n_vocab, 0);
+    if (partial.n_remaining == 0) {
+        walk(0, current);
+    } else {
+        // Mid-character: the trie's clean-start decoding does not apply
+        const int32_t n = std::min<int32_t>(n_vocab, static_cast<int32_t>(trie.size()));
+        for (int32_t id = 0; id < n; ++id) {
+            if (!vocab.is_eog(id)) allowed[id] = allows(id);
+        }
+    }
+    const bool end_ok = can_end();
+    for (int32_t id = 0; id < n_vocab; ++id) {
+        if (vocab.is_eog(id)) allowed[id] = end_ok;
+        if (!allowed[id]) logits[id] = -INFINITY;
+    }
+
+    if (partial.n_remaining == 0) {
+        if (cached_masks.size() == kMaxCachedMasks) {
+            std::vector<uint64_t>().swap(states[cached_masks.front()].allowed_bits);
+            cached_masks.pop_front();
+        }
+        std::vector<uint64_t>& bits = states[current].allowed_bits;
+        bits.assign(n_words, 0);
+        for (int32_t id = 0; id < n_vocab; ++id) {
+            bits[id >> 6] |= static_cast<uint64_t>(allowed[id]) << (id & 63);
+        }
+        cached_masks.push_back(current);
+    }
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "sampler.h"
+
+struct LlamaVocab;
+
+// GBNF grammars for constrained decoding. Syntax follows llama.cpp:
+//
+//   root   ::= object                 # the start symbol is always `root`
+//   object ::= "{" ws pair ("," ws pair)* "}"
+//   pair   ::= string ":" ws [0-9]+
+//
+// with string literals, character classes ([a-z], [^"\\]), `.`, grouping,
+// alternatives and the repetition operators *, +, ? and {m,n}. Rules may
+// reference rules defined later; left recursion is rejected.
+
+enum class GrammarElementType : uint32_t {
+    End,            // end of a rule
+    Alt,            // start of another alternative of the rule
+    RuleRef,        // value: rule id
+    Char,           // value: code point; may be followed by CharAlt / CharRangeUpper
+    CharNot,        // like Char, but matches any code point outside the set
+    CharRangeUpper, // value: inclusive upper bound of the preceding Char / CharAlt
+    CharAlt,        // value: another code point of the set
+    CharAny,        // any code point
+};
+
+struct GrammarElement {
+    GrammarElementType type;
+    uint32_t value;
+};
+
+// A parsed grammar. Immutable, so matchers of any number of sequences share one.
+class Grammar {
+public:
+    static std::shared_ptr<const Grammar> parse(const std::string& text, std::string* error);
+
+    // Each rule is its alternatives separated by Alt and terminated by End
+    const std::vector<std::vector<GrammarElement>>& rules() const { return rule_elements; }
+    // First element of every alternative of a rule
+    const std::vector<const GrammarElement*>& alternatives(uint32_t rule) const { return alt_starts[rule]; }
+    uint32_t root() const { return root_id; }
+
+private:
+    std::vector<std::vector<GrammarElement>> rule_elements;
+    std::vector<std::vector<const GrammarElement*>> alt_starts;
+    uint32_t root_id = 0;
+
+    friend class GrammarParser;
+};
+
+// Code point decoder state between tokens: the leading bits of a `length`-byte
+// sequence that is still missing n_remaining continuation bytes
+struct PartialUtf8 {
+    uint32_t value = 0;
+    int n_remaining = 0; // -1 after an invalid byte
+    int length = 0;
+};
+
+// Every token's text decoded to code points and laid out as a trie, so a
+// matcher tests a prefix shared by many tokens once. A trailing incomplete
+// UTF-8 sequence (e.g. a byte token) becomes a final partial-character edge.
+class TokenTrie {
+public:
+    explicit TokenTrie(const LlamaVocab& vocab);
+
+    struct Edge {
+        uint32_t key;  // code point, or kPartial | length << 28 | n_remaining << 24 | leading bits
+        uint32_t node;
+    };
+    struct Node {
+        uint32_t edge_begin = 0;
+        uint32_t edge_end = 0;
+        uint32_t token_begin = 0; // tokens whose text ends at this node
+        uint32_t token_end = 0;
+    };
+    static constexpr uint32_t kPartial = 0x80000000u;
+
+    const std::vector<Node>& nodes() const { return trie_nodes; }
+    const std::vector<Edge>& edges() const { return trie_edges; }
+    const std::vector<int32_t>& node_tokens() const { return tokens; }
+    // Raw text of a token, for matching it after a partial character
+    const std::string& piece(int32_t id) const { return pieces[id]; }
+    size_t size() const { return pieces.size(); }
+    // Length of the longest path from the root
+    size_t depth() const { return max_depth; }
+
+private:
+    uint32_t build(std::vector<std::vector<uint32_t>>& keys, std::vector<int32_t>& order, size_t begin,
+                   size_t end, size_t depth);
+
+    std::vector<Node> trie_nodes;
+    std::vector<Edge> trie_edges;
+    std::vector<int32_t> tokens;
+    std::vector<std::string> pieces;
+    size_t max_depth = 0;
+};
+
+// Where one sequence is in a grammar. The position is the set of parse stacks
+// that are still alive (the grammar may be ambiguous), each topped by the
+// character element it expects next.
+//
+// Stacks are hash-consed and every distinct stack set becomes a numbered
+// state whose transitions are memoized per code point. Masking walks the
+// token trie through these states, so once a state recurs (inside a string,
+// each character leads back to the same one) a trie edge costs a table
+// lookup instead of re-expanding rules. The allowed tokens of recent states
+// are cached too, as grammars keep returning to the same few states.
+class GrammarMatcher : public TokenFilter {
+public:
+    GrammarMatcher(std::shared_ptr<const Grammar> grammar, const TokenTrie& trie, const LlamaVocab& vocab);
+
+    // TokenFilter: end-of-generation tokens are allowed once the grammar may end
+    bool allows(int32_t token) const override;
+    void mask(float* logits, int32_t n_vocab) const override;
+
+    // Advances past `token`; false (and no change) if it is not allowed
+    bool accept(int32_t token);
+
+    // The text so far is a complete match
+    bool can_end() const;
+    // Complete, and nothing more could follow
+    bool finished() const;
+
+private:
+    // A parse stack as a linked list of frames. `pos` is the element to match
+    // next; the parent frame holds where to continue once this rule ends.
+    struct Frame {
+        const GrammarElement* pos;
+        const Frame* parent;
+
+        bool operator==(const Frame& other) const { return pos == other.pos && parent == other.parent; }
+    };
+    struct FrameHash {
+        size_t operator()(const Frame& f) const {
+            return std::hash<const void*>()(f.pos) * 31 + std::hash<const void*>()(f.parent);
+        }
+    };
+    using Stacks = std::vector<const Frame*>; // sorted; nullptr is the empty (accepting) stack
+
+    static constexpr int32_t kUnknown = -2;
+    static constexpr int32_t kRejected = -1;
+    struct State {
+        Stacks stacks;
+        std::vector<int32_t> ascii_next; // [128] next state per code point, or kUnknown / kRejected
+        std::unordered_map<uint32_t, int32_t> other_next;
+        std::vector<uint64_t> allowed_bits; // cached mask() result, one bit per token
+    };
+
+    // The unique frame for (pos, parent)
+    const Frame* frame(const GrammarElement* pos, const Frame* parent) const;
+    // Expands rule references at pos until every stack is topped by a character
+    void expand(const GrammarElement* pos, const Frame* parent, Stacks& out) const;
+    int32_t intern(Stacks& stacks) const;
+    // State after cp, or kRejected
+    int32_t next_state(int32_t state, uint32_t cp) const;
+    bool accepts_partial(int32_t state, PartialUtf8 partial) const;
+    // State after `text` decoded from `partial`, or kRejected
+    int32_t advance(int32_t state, PartialUtf8& partial, const std::string& text) const;
+    // Marks every token below `node` that `state` accepts
+    void walk(uint32_t node, int32_t state) const;
+    void mark_tokens(uint32_t node) const;
+    // Drops every frame and state but the current ones once the tables grow
+    // past their caps (deeply nested or long-running grammars)
+    void rebuild();
+
+    std::shared_ptr<const Grammar> grammar;
+    const TokenTrie& trie;
+    const LlamaVocab& vocab;
+    int32_t current = 0;
+    PartialUtf8 partial;
+
+    // Set elements keep their addresses, so a frame's pointer is its identity
+    mutable std::unordered_set<Frame, FrameHash> frames;
+    mutable std::vector<State> states;
+    mutable std::map<Stacks, int32_t> state_index;
+    mutable std::vector<uint32_t> cps; // decode scratch
+    mutable std::vector<uint8_t> allowed;
+    mutable std::deque<int32_t> cached_masks; // states holding allowed_bits, oldest first
+};
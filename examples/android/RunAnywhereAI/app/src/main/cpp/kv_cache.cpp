@@ -0,0 +1,176 @@
+#include "kv_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+bool kv_cache_type_supported(GGMLType type, uint32_t head_dim) {
+    switch (type) {
+        case GGML_TYPE_F32:
+        case GGML_TYPE_F16:
+            return true;
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_Q4_0:
+            return head_dim % ggml_block_size(type) == 0;
+        default:
+            return false;
+    }
+}
+
+KVCachePool::KVCachePool(uint32_t layers, uint32_t embd_kv, uint32_t blocks, GGMLType type)
+    : n_layer(layers), n_embd_kv(embd_kv), max_blocks(blocks), kv_type(type) {
+    row_size = ggml_row_size(kv_type, n_embd_kv);
+    layer_bytes = 2 * static_cast<size_t>(kBlockSize) * row_size;
+    block_size_bytes = layer_bytes * n_layer;
+    block_data.reserve(max_blocks);
+    refcount.reserve(max_blocks);
+    fill.reserve(max_blocks);
+}
+
+void KVCachePool::set_capacity(uint32_t blocks) {
+    max_blocks = blocks;
+    trim();
+}
+
+void KVCachePool::trim() {
+    while (!slabs.empty() && block_data.size() > max_blocks) {
+        const uint32_t n = slab_blocks.back();
+        const size_t first = block_data.size() - n;
+        for (size_t i = first; i < block_data.size(); ++i) {
+            if (refcount[i] > 0) return;
+        }
+        free_blocks.erase(std::remove_if(free_blocks.begin(), free_blocks.end(),
+                                         [&](int32_t b) { return static_cast<size_t>(b) >= first; }),
+                          free_blocks.end());
+        block_data.resize(first);
+        refcount.resize(first);
+        fill.resize(first);
+        slabs.pop_back();
+        slab_blocks.pop_back();
+    }
+}
+
+int32_t KVCachePool::allocate() {
+    const uint32_t n_in_use = static_cast<uint32_t>(block_data.size() - free_blocks.size());
+    if (n_in_use >= max_blocks) {
+        return -1;
+    }
+    if (free_blocks.empty()) {
+        const uint32_t n_alloc = static_cast<uint32_t>(block_data.size());
+        // Carve a new slab into blocks
+        const uint32_t n_new = std::min(kSlabBlocks, max_blocks - n_alloc);
+        slabs.emplace_back(new uint8_t[block_size_bytes * n_new]);
+        slab_blocks.push_back(n_new);
+        uint8_t* base = slabs.back().get();
+        for (uint32_t i = 0; i < n_new; ++i) {
+            block_data.push_back(base + i * block_size_bytes);
+            refcount.push_back(0);
+            fill.push_back(0);
+        }
+        // Hand out lower ids first
+        for (uint32_t i = n_new; i > 0; --i) {
+            free_blocks.push_back(static_cast<int32_t>(n_alloc + i - 1));
+        }
+    }
+
+    // Past a lowered capacity, reuse the lowest block so trailing slabs drain
+    auto pick = free_blocks.end() - 1;
+    if (block_data.size() > max_blocks) pick = std::min_element(free_blocks.begin(), free_blocks.end());
+    const int32_t block = *pick;
+    free_blocks.erase(pick);
+    refcount[block] = 1;
+    fill[block] = 0;
+    return block;
+}
+
+void KVCachePool::retain(int32_t block) {
+    refcount[block]++;
+}
+
+void KVCachePool::release(int32_t block) {
+    if (refcount[block] > 0 && --refcount[block] == 0) {
+        fill[block] = 0;
+        free_blocks.push_back(block);
+        if (block_data.size() > max_blocks) trim();
+    }
+}
+
+bool KVCachePool::reserve(KVSequence& seq, int32_t n_tokens) {
+    const size_t needed = (static_cast<size_t>(n_tokens) + kBlockSize - 1) / kBlockSize;
+    const size_t had = seq.blocks.size();
+    while (seq.blocks.size() < needed) {
+        const int32_t block = allocate();
+        if (block < 0) {
+            while (seq.blocks.size() > had) {
+                release(seq.blocks.back());
+                seq.blocks.pop_back();
+            }
+            return false;
+        }
+        seq.blocks.push_back(block);
+    }
+    seq.n_tokens = std::max(seq.n_tokens, n_tokens);
+    set_fill(seq);
+    return true;
+}
+
+void KVCachePool::truncate(KVSequence& seq, int32_t n_tokens) {
+    n_tokens = std::max(0, std::min(n_tokens, seq.n_tokens));
+    const size_t needed = (static_cast<size_t>(n_tokens) + kBlockSize - 1) / kBlockSize;
+    while (seq.blocks.size() > needed) {
+        release(seq.blocks.back());
+        seq.blocks.pop_back();
+    }
+    seq.n_tokens = n_tokens;
+    set_fill(seq);
+}
+
+void KVCachePool::erase(KVSequence& seq, size_t first, size_t n_blocks) {
+    if (first >= seq.blocks.size()) return;
+    n_blocks = std::min(n_blocks, seq.blocks.size() - first);
+    for (size_t i = first; i < first + n_blocks; ++i) {
+        release(seq.blocks[i]);
+    }
+    seq.blocks.erase(seq.blocks.begin() + first, seq.blocks.begin() + first + n_blocks);
+    seq.n_tokens = std::max<int32_t>(0, seq.n_tokens - static_cast<int32_t>(n_blocks * kBlockSize));
+    set_fill(seq);
+}
+
+bool KVCachePool::make_private(KVSequence& seq, size_t index) {
+    const int32_t shared = seq.blocks[index];
+    if (refcount[shared] <= 1) {
+        return true;
+    }
+    const int32_t copy = allocate();
+    if (copy < 0) {
+        return false;
+    }
+    memcpy(block_data[copy], block_data[shared], block_size_bytes);
+    fill[copy] = fill[shared];
+    release(shared);
+    seq.blocks[index] = copy;
+    return true;
+}
+
+void KVCachePool::set_fill(const KVSequence& seq) {
+    for (size_t i = 0; i < seq.blocks.size(); ++i) {
+        const int64_t remaining = seq.n_tokens - static_cast<int64_t>(i) * kBlockSize;
+        fill[seq.blocks[i]] = static_cast<uint16_t>(std::min<int64_t>(remaining, kBlockSize));
+    }
+}
+
+KVCacheStats KVCachePool::stats() const {
+    KVCacheStats s;
+    s.type = kv_type;
+    s.block_size = kBlockSize;
+    s.blocks_total = max_blocks;
+    s.blocks_allocated = static_cast<uint32_t>(block_data.size());
+    s.blocks_in_use = s.blocks_allocated - static_cast<uint32_t>(free_blocks.size());
+    for (size_t i = 0; i < refcount.size(); ++i) {
+        if (refcount[i] > 0) s.tokens += fill[i];
+    }
+    s.bytes_allocated = static_cast<uint64_t>(s.blocks_allocated) * block_bytes();
+    s.bytes_in_use = static_cast<uint64_t>(s.blocks_in_use) * block_bytes();
+    const uint64_t slots = static_cast<uint64_t>(s.blocks_in_use) * kBlockSize;
+    s.fragmentation = slots > 0 ? static_cast<float>(slots - s.tokens) / static_cast<float>(slots) : 0.0f;
+    return s;
+}
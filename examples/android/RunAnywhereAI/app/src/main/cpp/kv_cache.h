@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "gguf.h"
+
+// Occupancy of a KVCachePool, reported to Kotlin by nativeGetKVCacheStats
+struct KVCacheStats {
+    GGMLType type = GGML_TYPE_F32; // storage type of keys and values
+    uint32_t block_size = 0;       // positions per block
+    uint32_t blocks_total = 0;     // pool capacity
+    uint32_t blocks_allocated = 0; // blocks backed by memory
+    uint32_t blocks_in_use = 0;    // blocks referenced by at least one sequence
+    uint64_t tokens = 0;           // positions actually stored in used blocks
+    uint64_t bytes_allocated = 0;
+    uint64_t bytes_in_use = 0;
+    // Unused positions in used blocks, as a fraction of their capacity
+    float fragmentation = 0.0f;
+};
+
+// Block table of one sequence: position p lives at slot p % block_size of
+// blocks[p / block_size]
+struct KVSequence {
+    std::vector<int32_t> blocks;
+    int32_t n_tokens = 0;
+};
+
+// Pool of fixed-size KV blocks. A block holds keys and values for block_size
+// consecutive positions of every layer, so a sequence only needs one block per
+// block_size tokens regardless of model depth. Memory is carved out in slabs
+// as blocks are first needed, and freed blocks are recycled rather than
+// returned to the system, so the footprint follows the longest sequence seen
+// instead of the maximum context.
+//
+// Rows are stored as F32, F16, Q8_0 or Q4_0 (see kv_cache_type_supported).
+// Quantized rows keep ggml's 32-element blocks, so each head's slice of a row
+// can be fed straight to the matching vec_dot kernel.
+class KVCachePool {
+public:
+    static constexpr uint32_t kBlockSize = 16;
+    static constexpr uint32_t kSlabBlocks = 4;
+
+    KVCachePool(uint32_t n_layer, uint32_t n_embd_kv, uint32_t max_blocks, GGMLType type);
+    KVCachePool(const KVCachePool&) = delete;
+    KVCachePool& operator=(const KVCachePool&) = delete;
+
+    uint32_t block_size() const { return kBlockSize; }
+    uint32_t capacity() const { return max_blocks; }
+    // Raises or lowers the most blocks that may be in use at once. Lowering it
+    // frees trailing slabs that are wholly unused and past the new capacity;
+    // slabs still in use are freed as their blocks are released.
+    void set_capacity(uint32_t blocks);
+    GGMLType type() const { return kv_type; }
+    // Bytes of one position's keys (or values) for one layer
+    size_t row_bytes() const { return row_size; }
+    // Bytes of one block (all layers, keys and values)
+    size_t block_bytes() const { return block_size_bytes; }
+
+    // Returns a block with a reference count of one, or -1 if the pool is exhausted
+    int32_t allocate();
+    void retain(int32_t block);
+    void release(int32_t block);
+    uint32_t refs(int32_t block) const { return refcount[block]; }
+
+    // Whole block: per layer, block_size key rows followed by block_size value rows
+    uint8_t* data(int32_t block) { return block_data[block]; }
+    // [block_size] rows of row_bytes() for one layer within a block
+    uint8_t* k(int32_t block, uint32_t layer) { return block_data[block] + layer * layer_bytes; }
+    uint8_t* v(int32_t block, uint32_t layer) { return k(block, layer) + kBlockSize * row_size; }
+
+    // Grows the sequence's block table to hold n_tokens positions.
+    // Returns false (leaving the sequence unchanged) if the pool runs out.
+    bool reserve(KVSequence& seq, int32_t n_tokens);
+    // Drops positions >= n_tokens and releases blocks that become empty
+    void truncate(KVSequence& seq, int32_t n_tokens);
+    // Removes n_blocks whole blocks starting at table index `first`; later
+    // positions move down by n_blocks * block_size
+    void erase(KVSequence& seq, size_t first, size_t n_blocks);
+    // Gives the sequence its own copy of blocks[index] if other sequences or the
+    // prefix cache share it, so it can be modified in place. False if the pool is full.
+    bool make_private(KVSequence& seq, size_t index);
+
+    KVCacheStats stats() const;
+
+private:
+    void set_fill(const KVSequence& seq);
+    // Frees trailing slabs past max_blocks whose blocks are all unused
+    void trim();
+
+    uint32_t n_layer;
+    uint32_t n_embd_kv;
+    uint32_t max_blocks;
+    GGMLType kv_type;
+    size_t row_size;
+    size_t layer_bytes; // keys + values of one layer in a block
+    size_t block_size_bytes;
+
+    std::vector<std::unique_ptr<uint8_t[]>> slabs;
+    std::vector<uint32_t> slab_blocks; // blocks carved from each slab
+    std::vector<uint8_t*> block_data;
+    std::vector<int32_t> free_blocks;
+    std::vector<uint32_t> refcount;
+    // Positions written to each block by the sequence that owns it
+    std::vector<uint16_t> fill;
+};
+
+// Whether keys/values can be stored as `type` for a model with this head size.
+// Quantized types need every head to start on a 32-element block boundary.
+bool kv_cache_type_supported(GGMLType type, uint32_t head_dim);
@@ -0,0 +1,231 @@
+#include "llama_bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#include "llama_model.h"
+#include "llama_stream.h"
+#include "sampler.h"
+
+namespace {
+
+// File-backed pages mapped into this process, mostly the model's weights
+size_t rss_file_bytes() {
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f) return 0;
+    char line[256];
+    size_t kb = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "RssFile: %zu kB", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb * 1024;
+}
+
+} // namespace
+
+std::vector<KVCacheBenchResult> kv_cache_benchmark(const LlamaModel& model, const std::string& text,
+                                                   int32_t max_tokens, std::string* error) {
+    std::vector<KVCacheBenchResult> results;
+    std::vector<int32_t> tokens = model.vocab.tokenize(text, model.vocab.add_bos);
+    const size_t limit = std::min<size_t>(std::max(max_tokens, 2), model.context_size);
+    if (tokens.size() > limit) {
+        tokens.resize(limit);
+    }
+    if (tokens.size() < 2) {
+        if (error) *error = "benchmark text is too short";
+        return results;
+    }
+
+    const LlamaHParams& hp = model.hparams;
+    const uint32_t n_ctx = static_cast<uint32_t>(tokens.size());
+    const uint32_t n_blocks = (n_ctx + KVCachePool::kBlockSize - 1) / KVCachePool::kBlockSize;
+    const GGMLType types[] = {GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q4_0};
+
+    for (GGMLType type : types) {
+        if (!kv_cache_type_supported(type, hp.head_dim)) continue;
+
+        KVCachePool pool(hp.n_layer, hp.n_embd_kv(), n_blocks, type);
+        LlamaContext ctx(model, pool, nullptr, n_ctx);
+
+        // Negative log-likelihood of each next token given the ones before it
+        double nll = 0.0;
+        std::chrono::steady_clock::duration elapsed {};
+        for (size_t i = 0; i + 1 < tokens.size(); ++i) {
+            const auto start = std::chrono::steady_clock::now();
+            if (!ctx.decode(&tokens[i], 1, error)) {
+                return results;
+            }
+            elapsed += std::chrono::steady_clock::now() - start;
+
+            const std::vector<float>& logits = ctx.logits;
+            const float max = *std::max_element(logits.begin(), logits.end());
+            double sum = 0.0;
+            for (float l : logits) {
+                sum += std::exp(static_cast<double>(l - max));
+            }
+            nll -= static_cast<double>(logits[tokens[i + 1]] - max) - std::log(sum);
+        }
+
+        KVCacheBenchResult r;
+        r.type = type;
+        r.bytes_per_token = pool.block_bytes() / pool.block_size();
+        r.n_tokens = static_cast<int32_t>(tokens.size() - 1);
+        r.perplexity = std::exp(nll / r.n_tokens);
+        r.ms_per_token = std::chrono::duration<double, std::milli>(elapsed).count() / r.n_tokens;
+        results.push_back(r);
+    }
+    return results;
+}
+
+std::vector<ThreadBenchResult> thread_benchmark(LlamaModel& model, ThreadAffinity affinity, int32_t n_tokens,
+                                                std::string* error) {
+    std::vector<ThreadBenchResult> results;
+    n_tokens = std::min<int32_t>(std::max(n_tokens, 1), static_cast<int32_t>(model.context_size));
+
+    const LlamaHParams& hp = model.hparams;
+    const uint32_t n_ctx = static_cast<uint32_t>(n_tokens);
+    const uint32_t n_blocks = (n_ctx + KVCachePool::kBlockSize - 1) / KVCachePool::kBlockSize;
+    KVCachePool pool(hp.n_layer, hp.n_embd_kv(), n_blocks, model.kv_pool->type());
+
+    const int32_t saved_threads = model.threads->size();
+    const ThreadAffinity saved_affinity = model.threads->affinity();
+    const int32_t max_threads = ThreadPool::default_threads(affinity);
+    bool ok = true;
+    for (int32_t n = 1; ok && n <= max_threads; ++n) {
+        model.set_threads(n, affinity);
+        LlamaContext ctx(model, pool, nullptr, n_ctx);
+        // Token ids only need to be valid; the speed does not depend on them
+        const auto start = std::chrono::steady_clock::now();
+        for (int32_t i = 0; ok && i < n_tokens; ++i) {
+            const int32_t token = i % static_cast<int32_t>(hp.n_vocab);
+            ok = ctx.decode(&token, 1, error);
+        }
+        if (!ok) break;
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        ThreadBenchResult r;
+        r.threads = n;
+        r.tokens_per_second = seconds > 0.0 ? n_tokens / seconds : 0.0;
+        results.push_back(r);
+    }
+    model.set_threads(saved_threads, saved_affinity);
+    if (!ok) results.clear();
+    return results;
+}
+
+std::vector<MemoryBudgetBenchResult> memory_budget_benchmark(LlamaModel& model, const std::vector<size_t>& budgets,
+                                                             int32_t n_tokens, std::string* error) {
+    std::vector<MemoryBudgetBenchResult> results;
+    n_tokens = std::min<int32_t>(std::max(n_tokens, 1), static_cast<int32_t>(model.context_size));
+
+    const LlamaHParams& hp = model.hparams;
+    const uint32_t n_ctx = static_cast<uint32_t>(n_tokens);
+    const uint32_t n_blocks = (n_ctx + KVCachePool::kBlockSize - 1) / KVCachePool::kBlockSize;
+    KVCachePool pool(hp.n_layer, hp.n_embd_kv(), n_blocks, model.kv_pool->type());
+
+    const size_t saved_budget = model.streamer ? model.streamer->budget() : 0;
+    bool ok = true;
+    for (size_t budget : budgets) {
+        std::string budget_error;
+        if (!model.set_memory_budget(budget, &budget_error)) continue;
+        LlamaContext ctx(model, pool, nullptr, n_ctx);
+        size_t peak = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int32_t i = 0; ok && i < n_tokens; ++i) {
+            const int32_t token = i % static_cast<int32_t>(hp.n_vocab);
+            ok = ctx.decode(&token, 1, error);
+            peak = std::max(peak, rss_file_bytes());
+        }
+        if (!ok) break;
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        MemoryBudgetBenchResult r;
+        r.budget_bytes = budget;
+        r.pinned_layers = model.streamer ? model.streamer->pinned_layers() : hp.n_layer;
+        r.tokens_per_second = seconds > 0.0 ? n_tokens / seconds : 0.0;
+        r.peak_rss_file_bytes = peak;
+        results.push_back(r);
+    }
+    model.set_memory_budget(saved_budget, nullptr);
+    if (!ok) results.clear();
+    return results;
+}
+
+std::vector<SamplerBenchResult> sampler_benchmark(int32_t n_vocab, int32_t iterations) {
+    std::vector<SamplerBenchResult> results;
+    n_vocab = std::max(n_vocab, 2);
+    iterations = std::max(iterations, 1);
+
+    // Roughly the spread of real logits: a few standard deviations separate
+    // the likely tokens from the bulk
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> dist(0.0f, 3.0f);
+    std::vector<float> reference(n_vocab);
+    for (float& l : reference) l = dist(rng);
+    std::vector<int32_t> history(256);
+    for (int32_t& id : history) id = static_cast<int32_t>(rng() % n_vocab);
+
+    struct Config {
+        const char* name;
+        GenerationParams params;
+    };
+    std::vector<Config> configs(5);
+    configs[0].name = "greedy";
+    configs[0].params.temperature = 0.0f;
+    configs[1].name = "top_k=40 top_p=0.9 repeat=1.1";
+    configs[1].params.repeat_penalty = 1.1f;
+    configs[2].name = "top_p=0.95";
+    configs[2].params.top_k = 0;
+    configs[2].params.top_p = 0.95f;
+    configs[3].name = "min_p=0.05";
+    configs[3].params.top_k = 0;
+    configs[3].params.top_p = 1.0f;
+    configs[3].params.min_p = 0.05f;
+    configs[4].name = "temperature only";
+    configs[4].params.top_k = 0;
+    configs[4].params.top_p = 1.0f;
+
+    Sampler sampler;
+    std::vector<float> logits(n_vocab);
+    for (const Config& config : configs) {
+        std::chrono::steady_clock::duration elapsed {};
+        for (int32_t i = 0; i < iterations; ++i) {
+            // The chain clobbers its input; the copy is not timed
+            std::copy(reference.begin(), reference.end(), logits.begin());
+            const auto start = std::chrono::steady_clock::now();
+            sampler.apply(logits.data(), n_vocab, config.params, history.data(), history.size());
+            sampler.sample(rng);
+            elapsed += std::chrono::steady_clock::now() - start;
+        }
+
+        SamplerBenchResult r;
+        r.config = config.name;
+        r.n_vocab = n_vocab;
+        r.us_per_token = std::chrono::duration<double, std::micro>(elapsed).count() / iterations;
+        results.push_back(r);
+    }
+    return results;
+}
+
+TokenizerBenchResult tokenizer_benchmark(const LlamaVocab& vocab, const std::string& text, int32_t iterations) {
+    TokenizerBenchResult r;
+    r.n_bytes = text.size();
+    iterations = std::max(iterations, 1);
+
+    std::vector<int32_t> tokens;
+    const auto start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < iterations; ++i) {
+        tokens = vocab.tokenize(text, false);
+    }
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    r.n_tokens = static_cast<int32_t>(tokens.size());
+    r.ms_per_run = ms / iterations;
+    r.tokens_per_second = r.ms_per_run > 0.0 ? r.n_tokens * 1000.0 / r.ms_per_run : 0.0;
+    r.round_trip = vocab.detokenize(tokens.data(), tokens.size()) == text;
+    return r;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gguf.h"
+#include "thread_pool.h"
+
+struct LlamaModel;
+struct LlamaVocab;
+
+// Quality and speed of one KV cache storage type on a reference text
+struct KVCacheBenchResult {
+    GGMLType type = GGML_TYPE_F32;
+    size_t bytes_per_token = 0; // KV memory per position, all layers
+    int32_t n_tokens = 0;       // tokens scored
+    double perplexity = 0.0;
+    double ms_per_token = 0.0;  // single-token decode latency
+};
+
+// Scores `text` token by token with a throwaway context for every KV cache type
+// the model supports (F32, F16, Q8_0, Q4_0). The model's own context and
+// prefix cache are left untouched. At most max_tokens tokens are used.
+std::vector<KVCacheBenchResult> kv_cache_benchmark(const LlamaModel& model, const std::string& text,
+                                                   int32_t max_tokens, std::string* error);
+
+// Decode speed with a given number of compute threads
+struct ThreadBenchResult {
+    int32_t threads = 0;
+    double tokens_per_second = 0.0;
+};
+
+// Decodes n_tokens single tokens with a throwaway context for every thread
+// count from 1 to ThreadPool::default_threads(affinity). The model's compute
+// pool is swapped out meanwhile and restored afterwards, so the caller holds
+// model.state_mutex exclusively.
+std::vector<ThreadBenchResult> thread_benchmark(LlamaModel& model, ThreadAffinity affinity, int32_t n_tokens,
+                                                std::string* error);
+
+// Decode speed and memory under one weight memory budget
+struct MemoryBudgetBenchResult {
+    size_t budget_bytes = 0;     // 0: no limit
+    uint32_t pinned_layers = 0;  // layers kept resident; the rest are streamed
+    double tokens_per_second = 0.0;
+    size_t peak_rss_file_bytes = 0; // file-backed memory of the process (RssFile)
+};
+
+// Decodes n_tokens single tokens with a throwaway context under each budget
+// (see LlamaModel::set_memory_budget), giving the speed cost of running in
+// less memory. Budgets the model does not fit in are skipped. The model's own
+// budget is restored afterwards; the caller holds model.state_mutex exclusively.
+std::vector<MemoryBudgetBenchResult> memory_budget_benchmark(LlamaModel& model, const std::vector<size_t>& budgets,
+                                                             int32_t n_tokens, std::string* error);
+
+// Sampler chain cost for one configuration
+struct SamplerBenchResult {
+    std::string config;
+    int32_t n_vocab = 0;
+    double us_per_token = 0.0;
+};
+
+// Times Sampler::apply + sample on random logits of n_vocab entries (no model
+// needed) for greedy, the default top-k/top-p chain with a repetition penalty,
+// top-p and min-p without top-k, and plain temperature sampling.
+std::vector<SamplerBenchResult> sampler_benchmark(int32_t n_vocab, int32_t iterations);
+
+// Tokenizer throughput on one text
+struct TokenizerBenchResult {
+    size_t n_bytes = 0;
+    int32_t n_tokens = 0;
+    double ms_per_run = 0.0;
+    double tokens_per_second = 0.0;
+    bool round_trip = false; // detokenizing the tokens gives the text back
+};
+
+// Tokenizes `text` (no BOS) `iterations` times and reports the mean time per
+// run. Needs only the vocabulary, so it is safe while the model generates.
+TokenizerBenchResult tokenizer_benchmark(const LlamaVocab& vocab, const std::string& text, int32_t iterations);
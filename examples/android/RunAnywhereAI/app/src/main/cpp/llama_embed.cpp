@@ -0,0 +1,133 @@
+#include "llama_embed.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#include "llama_model.h"
+
+bool parse_embed_pooling(const std::string& name, EmbedPooling* pooling) {
+    if (name == "mean") {
+        *pooling = EmbedPooling::Mean;
+    } else if (name == "cls") {
+        *pooling = EmbedPooling::Cls;
+    } else if (name == "last") {
+        *pooling = EmbedPooling::Last;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+// A text whose tokens are still being evaluated
+struct EmbedSequence {
+    size_t index;                 // into texts / out
+    std::vector<int32_t> tokens;
+    size_t n_scheduled = 0;       // tokens given rows so far
+    std::unique_ptr<LlamaContext> ctx;
+    std::vector<float> pooled;    // [n_embd] running sum (Mean) or the chosen state
+};
+
+} // namespace
+
+bool embed_texts(const LlamaModel& model, const std::vector<std::string_view>& texts, EmbedPooling pooling,
+                 bool normalize, float* out, std::string* error) {
+    const LlamaHParams& hp = model.hparams;
+    const size_t n_embd = hp.n_embd;
+    const uint32_t n_ctx = static_cast<uint32_t>(model.context_size);
+    constexpr int32_t kBatchSize = LlamaContext::kBatchSize;
+
+    // Open sequences hold at most one window that spills over from the last
+    // batch, the texts of this batch, and a partial block each
+    const uint32_t block_size = KVCachePool::kBlockSize;
+    const uint32_t n_blocks = (n_ctx + 2 * kBatchSize + block_size - 1) / block_size + kBatchSize;
+    KVCachePool pool(hp.n_layer, hp.n_embd_kv(), n_blocks, model.kv_pool->type());
+    LlamaContext workspace(model, pool, nullptr, n_ctx);
+
+    std::vector<EmbedSequence> open;
+    std::vector<float> hidden(kBatchSize * n_embd);
+    LlamaBatchRow rows[kBatchSize];
+    size_t row_seq[kBatchSize];
+    size_t next_text = 0;
+
+    while (next_text < texts.size() || !open.empty()) {
+        // Pack tokens of as many texts as fit; only the newest open sequence
+        // can have tokens left to schedule
+        int32_t n_rows = 0;
+        while (n_rows < kBatchSize) {
+            if (open.empty() || open.back().n_scheduled == open.back().tokens.size()) {
+                if (next_text == texts.size()) break;
+                EmbedSequence seq;
+                seq.index = next_text++;
+                seq.tokens = model.vocab.tokenize(texts[seq.index], model.vocab.add_bos);
+                if (seq.tokens.size() > n_ctx) {
+                    seq.tokens.resize(n_ctx);
+                }
+                if (seq.tokens.empty()) {
+                    std::fill_n(out + seq.index * n_embd, n_embd, 0.0f);
+                    continue;
+                }
+                seq.ctx = std::make_unique<LlamaContext>(model, pool, nullptr, n_ctx);
+                seq.pooled.assign(n_embd, 0.0f);
+                open.push_back(std::move(seq));
+            }
+
+            EmbedSequence& seq = open.back();
+            const int32_t n = static_cast<int32_t>(
+                std::min<size_t>(kBatchSize - n_rows, seq.tokens.size() - seq.n_scheduled));
+            const int32_t* input = seq.tokens.data() + seq.n_scheduled;
+            if (!seq.ctx->prepare(input, n, error)) {
+                return false;
+            }
+            const size_t last = seq.tokens.size() - 1;
+            for (int32_t i = 0; i < n; ++i) {
+                const size_t pos = seq.n_scheduled + i;
+                const bool wanted = pooling == EmbedPooling::Mean || (pooling == EmbedPooling::Cls && pos == 0) ||
+                                    (pooling == EmbedPooling::Last && pos == last);
+                rows[n_rows] = {seq.ctx.get(), input[i], seq.ctx->n_past + i, nullptr,
+                                wanted ? &hidden[n_rows * n_embd] : nullptr};
+                row_seq[n_rows++] = open.size() - 1;
+            }
+            seq.n_scheduled += n;
+        }
+
+        if (n_rows == 0) break; // only empty texts were left
+        workspace.eval_rows(rows, n_rows);
+
+        for (int32_t t = 0; t < n_rows; ++t) {
+            if (!rows[t].embd) continue;
+            std::vector<float>& pooled = open[row_seq[t]].pooled;
+            for (size_t i = 0; i < n_embd; ++i) {
+                pooled[i] += rows[t].embd[i];
+            }
+        }
+
+        // Texts whose every token has been evaluated are done; their blocks go
+        // back to the pool for the next batch
+        size_t n_kept = 0;
+        for (size_t i = 0; i < open.size(); ++i) {
+            EmbedSequence& seq = open[i];
+            if (seq.ctx->n_past < static_cast<int32_t>(seq.tokens.size())) {
+                if (i != n_kept) open[n_kept] = std::move(seq);
+                n_kept++;
+                continue;
+            }
+            float scale = pooling == EmbedPooling::Mean ? 1.0f / seq.tokens.size() : 1.0f;
+            if (normalize) {
+                double norm = 0.0;
+                for (float v : seq.pooled) {
+                    norm += static_cast<double>(v) * v;
+                }
+                scale = norm > 0.0 ? static_cast<float>(1.0 / std::sqrt(norm)) : 0.0f;
+            }
+            float* dst = out + seq.index * n_embd;
+            for (size_t j = 0; j < n_embd; ++j) {
+                dst[j] = seq.pooled[j] * scale;
+            }
+        }
+        open.resize(n_kept);
+    }
+    return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct LlamaModel;
+
+// How the hidden states of a text's tokens become one vector
+enum class EmbedPooling : uint8_t {
+    Mean, // average over every token
+    Cls,  // first token (BOS when the vocabulary adds one)
+    Last, // last token, which has attended to the whole text
+};
+
+// Parses "mean", "cls" or "last"
+bool parse_embed_pooling(const std::string& name, EmbedPooling* pooling);
+
+// Embeds every text with one forward pass over all of them: their tokens are
+// packed back to back into batches of LlamaContext::kBatchSize rows, a text
+// spilling over into the next batch where needed. Nothing is sampled and no
+// output head is run. Each text attends only to itself through a throwaway
+// KV sequence that is dropped as soon as the text is done, so the model's
+// pool and prefix cache are untouched. Texts longer than the context window
+// keep their start.
+//
+// Writes texts.size() vectors of model.hparams.n_embd floats to `out`,
+// L2-normalized if `normalize`; a text with no tokens gives zeros. Runs on
+// the calling thread alongside any generation, sharing the compute threads;
+// the caller holds model.state_mutex shared.
+bool embed_texts(const LlamaModel& model, const std::vector<std::string_view>& texts, EmbedPooling pooling,
+                 bool normalize, float* out, std::string* error);
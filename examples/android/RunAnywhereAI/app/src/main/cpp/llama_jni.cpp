@@ -1,22 +1,209 @@
 #include <jni.h>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
 #include <android/log.h>
 
+#include "gguf.h"
+#include "llama_bench.h"
+#include "llama_embed.h"
+#include "llama_lora.h"
+#include "llama_model.h"
+#include "llama_scheduler.h"
+#include "llama_session.h"
+#include "llama_stream.h"
+#include "llama_warmup.h"
+#include "quants.h"
+
 #define TAG "LlamaCppJNI"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
 
-// Simplified llama.cpp model structure for demonstration
-// In a real implementation, this would use the actual llama.cpp library
-struct LlamaModel {
-    std::string model_path;
-    size_t vocab_size;
-    size_t context_size;
-    bool loaded;
+// Minimal JSON string escaping for metadata values returned to Kotlin
+static std::string json_escape(const std::string& in) {
+    std::string out;
+    out.reserve(in.size() + 2);
+    for (char c : in) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
+// KV cache storage types selectable from Kotlin, by ggml type name
+static bool parse_kv_type(const std::string& name, GGMLType* type) {
+    for (GGMLType t : {GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q4_0}) {
+        if (name == ggml_type_name(t)) {
+            *type = t;
+            return true;
+        }
+    }
+    return false;
+}
+
+static GenerationParams make_params(jint maxTokens, jfloat temperature, jfloat topP, jint topK, jfloat minP,
+                                    jfloat repeatPenalty, jfloat frequencyPenalty, jfloat presencePenalty,
+                                    jlong seed, jlong requestPtr) {
+    GenerationParams params;
+    params.max_tokens = maxTokens;
+    params.temperature = temperature;
+    params.top_p = topP;
+    params.top_k = topK;
+    params.min_p = minP;
+    params.repeat_penalty = repeatPenalty;
+    params.frequency_penalty = frequencyPenalty;
+    params.presence_penalty = presencePenalty;
+    params.seed = seed;
+    params.request = reinterpret_cast<GenerationRequest*>(requestPtr);
+    return params;
+}
 
-    LlamaModel(const std::string& path) : model_path(path), vocab_size(32000), context_size(2048), loaded(false) {}
+// Parses an optional GBNF grammar into params; false (logged) if it is invalid
+static bool set_grammar(JNIEnv* env, jstring grammar, GenerationParams& params) {
+    if (!grammar) return true;
+    const char *grammarStr = env->GetStringUTFChars(grammar, nullptr);
+    std::string text(grammarStr);
+    env->ReleaseStringUTFChars(grammar, grammarStr);
+
+    std::string error;
+    params.grammar = Grammar::parse(text, &error);
+    if (!params.grammar) {
+        LOGE("Invalid grammar: %s", error.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Concurrent calls are batched by the model's scheduler. Speculative decoding
+// needs the target and draft contexts to itself, so it runs exclusively on
+// both models' schedulers, holding the draft's state lock as well so its
+// context is not replaced meanwhile; grammar-constrained replies and
+// conversations (contextPtr != 0) never speculate and stay batched.
+static std::string generate_text(LlamaModel* model, jlong contextPtr, std::string_view prompt,
+                                 const GenerationParams& params, const TokenCallback& on_text) {
+    std::shared_lock<std::shared_mutex> state(model->state_mutex);
+    if (contextPtr) {
+        return reinterpret_cast<LlamaConversation*>(contextPtr)->generate(prompt, params, on_text);
+    }
+    if (!model->draft_model || params.grammar) {
+        return model->scheduler->generate(prompt, params, on_text);
+    }
+    LlamaModel* draft = model->draft_model;
+    std::shared_lock<std::shared_mutex> draft_state(draft->state_mutex);
+    std::string response;
+    model->scheduler->run_exclusive([&] {
+        draft->scheduler->run_exclusive([&] { response = model->context->generate(prompt, params, on_text); });
+    });
+    return response;
+}
+
+// Forwards generated text to LlamaCppService.TokenCallback.onToken(String): Boolean
+class TokenCallbackWrapper {
+    JNIEnv* env;
+    jobject callback;
+    jmethodID onTokenMethod;
+
+public:
+    TokenCallbackWrapper(JNIEnv* e, jobject cb) : env(e), callback(cb) {
+        jclass callbackClass = env->GetObjectClass(callback);
+        onTokenMethod = env->GetMethodID(callbackClass, "onToken", "(Ljava/lang/String;)Z");
+        env->DeleteLocalRef(callbackClass);
+    }
+
+    bool valid() const { return onTokenMethod != nullptr; }
+
+    // Returns false when Kotlin asks to stop or the callback threw
+    bool onToken(const std::string& text) {
+        jstring jText = env->NewStringUTF(text.c_str());
+        jboolean keepGoing = env->CallBooleanMethod(callback, onTokenMethod, jText);
+        env->DeleteLocalRef(jText);
+        return !env->ExceptionCheck() && keepGoing == JNI_TRUE;
+    }
+};
+
+// Forwards where new text landed to LlamaCppService.DirectTokenCallback.onText(Int, Int): Boolean
+class DirectTokenCallbackWrapper {
+    JNIEnv* env;
+    jobject callback;
+    jmethodID onTextMethod;
+
+public:
+    DirectTokenCallbackWrapper(JNIEnv* e, jobject cb) : env(e), callback(cb) {
+        jclass callbackClass = env->GetObjectClass(callback);
+        onTextMethod = env->GetMethodID(callbackClass, "onText", "(II)Z");
+        env->DeleteLocalRef(callbackClass);
+    }
+
+    bool valid() const { return onTextMethod != nullptr; }
+
+    // Returns false when Kotlin asks to stop or the callback threw
+    bool onText(size_t offset, size_t length) {
+        jboolean keepGoing = env->CallBooleanMethod(callback, onTextMethod, static_cast<jint>(offset),
+                                                    static_cast<jint>(length));
+        return !env->ExceptionCheck() && keepGoing == JNI_TRUE;
+    }
+};
+
+// Bytes [offset, offset + length) of a direct ByteBuffer, used in place. False
+// (logged) if the buffer is not direct or the range does not fit in it.
+static bool direct_region(JNIEnv* env, jobject buffer, jint offset, jint length, char** data) {
+    void* address = buffer ? env->GetDirectBufferAddress(buffer) : nullptr;
+    if (!address) {
+        LOGE("Expected a direct ByteBuffer");
+        return false;
+    }
+    const jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (offset < 0 || length < 0 || static_cast<jlong>(offset) + length > capacity) {
+        LOGE("Range %d+%d is outside a buffer of %lld bytes", offset, length, static_cast<long long>(capacity));
+        return false;
+    }
+    *data = static_cast<char*>(address) + offset;
+    return true;
+}
+
+// Appends generated text to a caller's buffer. Only whole UTF-8 characters
+// are written; once one does not fit, the writer is full and takes no more.
+struct DirectWriter {
+    char* data;
+    size_t capacity;
+    size_t size = 0;
+    bool full = false;
+
+    // False once the buffer is full
+    bool append(const std::string& text) {
+        if (full) return false;
+        size_t n = text.size();
+        if (n > capacity - size) {
+            n = capacity - size;
+            while (n > 0 && (static_cast<unsigned char>(text[n]) & 0xC0) == 0x80) --n;
+            full = true;
+        }
+        memcpy(data + size, text.data(), n);
+        size += n;
+        return !full;
+    }
 };
 
 extern "C" {
@@ -28,23 +215,131 @@ Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion
     const char *path = env->GetStringUTFChars(modelPath, nullptr);
     LOGI("Loading model from: %s", path);
 
-    // Create a new model instance
-    auto* model = new LlamaModel(path);
+    // Map the GGUF file and parse its tensor directory in place
+    auto model = std::make_unique<LlamaModel>(path);
+    env->ReleaseStringUTFChars(modelPath, path);
+
+    std::string error;
+    if (!model->load(&error)) {
+        LOGE("Failed to load model: %s", error.c_str());
+        return 0;
+    }
+
+    LOGI("Model loaded successfully (%s, %zu tensors, %zu bytes mapped, %s kernels), ptr: %p",
+         model->gguf->header().architecture().c_str(), model->gguf->header().tensors.size(),
+         model->gguf->mapping().size(), model->kernels->isa, model.get());
+    return reinterpret_cast<jlong>(model.release());
+}
+
+// Starts warming the model in the background: weights are read in execution
+// order on a low-priority thread, then one token is generated. Free the handle
+// (which cancels a warm-up in progress) before freeing the model or changing
+// its threads or KV cache.
+JNIEXPORT jlong JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeStartWarmup(
+    JNIEnv *env, jobject /* this */, jlong modelPtr) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return 0;
+    }
+    return reinterpret_cast<jlong>(new LlamaWarmup(*model));
+}
+
+// Warm-up phase and progress as JSON
+JNIEXPORT jstring JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeGetWarmupProgress(
+    JNIEnv *env, jobject /* this */, jlong warmupPtr) {
+
+    auto* warmup = reinterpret_cast<LlamaWarmup*>(warmupPtr);
+    if (!warmup) {
+        return nullptr;
+    }
+
+    const WarmupProgress p = warmup->progress();
+    std::ostringstream json;
+    json << "{\"phase\":\"" << warmup_phase_name(p.phase) << "\""
+         << ",\"bytesDone\":" << p.bytes_done
+         << ",\"bytesTotal\":" << p.bytes_total
+         << ",\"layersDone\":" << p.layers_done
+         << ",\"layerCount\":" << p.n_layers
+         << ",\"prefetchMs\":" << p.prefetch_ms
+         << ",\"primeMs\":" << p.prime_ms << "}";
+    return env->NewStringUTF(json.str().c_str());
+}
+
+JNIEXPORT void JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeFreeWarmup(
+    JNIEnv *env, jobject /* this */, jlong warmupPtr) {
+
+    delete reinterpret_cast<LlamaWarmup*>(warmupPtr);
+}
 
-    // In a real implementation, this would load the actual GGUF model
-    // For now, we'll simulate success
-    model->loaded = true;
+// Reads only the GGUF key/value header and tensor directory of a model file and
+// returns its metadata as JSON. No tensor data is mapped, so this is cheap enough
+// to call for every model in a picker.
+JNIEXPORT jstring JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeProbeModel(
+    JNIEnv *env, jobject /* this */, jstring modelPath) {
 
+    const char *path = env->GetStringUTFChars(modelPath, nullptr);
+    std::string pathStr(path);
     env->ReleaseStringUTFChars(modelPath, path);
 
-    LOGI("Model loaded successfully, ptr: %p", model);
-    return reinterpret_cast<jlong>(model);
+    GGUFHeader hdr;
+    std::string error;
+    if (!GGUFHeader::read(pathStr, true, hdr, &error)) {
+        LOGE("Failed to probe %s: %s", pathStr.c_str(), error.c_str());
+        return nullptr;
+    }
+
+    // Tensor count and element count per storage type
+    std::map<std::string, std::pair<uint64_t, uint64_t>> histogram;
+    for (const auto& t : hdr.tensors) {
+        auto& entry = histogram[ggml_type_name(t.type)];
+        entry.first++;
+        entry.second += static_cast<uint64_t>(t.n_elements());
+    }
+
+    uint64_t vocabSize = hdr.get_array_count("tokenizer.ggml.tokens");
+    if (vocabSize == 0) {
+        vocabSize = hdr.get_arch_uint("vocab_size", 0);
+    }
+
+    std::ostringstream json;
+    json << "{";
+    json << "\"architecture\":\"" << json_escape(hdr.architecture()) << "\",";
+    json << "\"name\":\"" << json_escape(hdr.get_string("general.name")) << "\",";
+    json << "\"version\":" << hdr.version << ",";
+    json << "\"fileSize\":" << hdr.file_size << ",";
+    json << "\"vocabSize\":" << vocabSize << ",";
+    json << "\"contextLength\":" << hdr.get_arch_uint("context_length", 0) << ",";
+    json << "\"embeddingLength\":" << hdr.get_arch_uint("embedding_length", 0) << ",";
+    json << "\"blockCount\":" << hdr.get_arch_uint("block_count", 0) << ",";
+    json << "\"parameterCount\":" << hdr.parameter_count() << ",";
+    json << "\"quantization\":\"" << hdr.file_type_name() << "\",";
+    json << "\"tensorTypes\":{";
+    bool first = true;
+    for (const auto& entry : histogram) {
+        if (!first) json << ",";
+        first = false;
+        json << "\"" << entry.first << "\":{\"tensors\":" << entry.second.first
+             << ",\"elements\":" << entry.second.second << "}";
+    }
+    json << "}}";
+
+    return env->NewStringUTF(json.str().c_str());
 }
 
+// Generates a reply to `prompt`. With a contextPtr from nativeCreateContext the
+// call continues that conversation; with 0 it stands alone.
 JNIEXPORT jstring JNICALL
 Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeGenerate(
-    JNIEnv *env, jobject /* this */, jlong modelPtr, jstring prompt,
-    jint maxTokens, jfloat temperature, jfloat topP, jint topK) {
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jlong contextPtr, jstring prompt,
+    jint maxTokens, jfloat temperature, jfloat topP, jint topK, jfloat minP,
+    jfloat repeatPenalty, jfloat frequencyPenalty, jfloat presencePenalty, jlong seed, jstring grammar,
+    jlong requestPtr) {
 
     auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
     if (!model || !model->loaded) {
@@ -52,27 +347,326 @@ Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion
         return env->NewStringUTF("Error: Model not loaded");
     }
 
+    GenerationParams params = make_params(maxTokens, temperature, topP, topK, minP, repeatPenalty,
+                                          frequencyPenalty, presencePenalty, seed, requestPtr);
+    if (!set_grammar(env, grammar, params)) {
+        return env->NewStringUTF("Error: Invalid grammar");
+    }
+
     const char *promptStr = env->GetStringUTFChars(prompt, nullptr);
-    LOGI("Generating with prompt: %s", promptStr);
+    std::string promptText(promptStr);
+    env->ReleaseStringUTFChars(prompt, promptStr);
 
-    // In a real implementation, this would:
-    // 1. Tokenize the prompt
-    // 2. Run inference with the model
-    // 3. Sample tokens based on temperature, topP, topK
-    // 4. Decode tokens back to text
+    std::string response = generate_text(model, contextPtr, promptText, params, nullptr);
+    return env->NewStringUTF(response.c_str());
+}
 
-    // For demonstration, return a placeholder response
-    std::string response = "Generated response from llama.cpp model. ";
-    response += "This is a placeholder implementation. ";
-    response += "In a real implementation, this would use the actual llama.cpp library ";
-    response += "to generate text based on the GGUF model loaded from: ";
-    response += model->model_path;
+// Same as nativeGenerate, but calls callback.onToken(text) as soon as each token
+// is sampled. Generation stops early when onToken returns false. Returns the
+// full generated text.
+JNIEXPORT jstring JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeGenerateStream(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jlong contextPtr, jstring prompt,
+    jint maxTokens, jfloat temperature, jfloat topP, jint topK, jfloat minP,
+    jfloat repeatPenalty, jfloat frequencyPenalty, jfloat presencePenalty, jlong seed, jstring grammar,
+    jlong requestPtr, jobject callback) {
 
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return nullptr;
+    }
+
+    GenerationParams params = make_params(maxTokens, temperature, topP, topK, minP, repeatPenalty,
+                                          frequencyPenalty, presencePenalty, seed, requestPtr);
+    if (!set_grammar(env, grammar, params)) {
+        return nullptr;
+    }
+
+    TokenCallbackWrapper wrapper(env, callback);
+    if (!wrapper.valid()) {
+        LOGE("Callback has no onToken(String): Boolean method");
+        return nullptr;
+    }
+
+    const char *promptStr = env->GetStringUTFChars(prompt, nullptr);
+    std::string promptText(promptStr);
     env->ReleaseStringUTFChars(prompt, promptStr);
 
+    std::string response = generate_text(
+        model, contextPtr, promptText, params,
+        [&wrapper](const std::string& text) { return wrapper.onToken(text); });
+
+    // Let a pending exception from the callback propagate to the caller
+    if (env->ExceptionCheck()) {
+        return nullptr;
+    }
     return env->NewStringUTF(response.c_str());
 }
 
+// nativeGenerate over direct ByteBuffers, for long prompts and replies: the
+// prompt is read in place from prompt[promptOffset, promptOffset + promptLength)
+// and the reply is written straight into output from outputOffset, both as
+// UTF-8. Generation stops once the outputLength bytes there are full. Returns
+// the number of bytes written, or -1 on error.
+JNIEXPORT jint JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeGenerateDirect(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jlong contextPtr, jobject prompt, jint promptOffset, jint promptLength,
+    jobject output, jint outputOffset, jint outputLength,
+    jint maxTokens, jfloat temperature, jfloat topP, jint topK, jfloat minP,
+    jfloat repeatPenalty, jfloat frequencyPenalty, jfloat presencePenalty, jlong seed, jstring grammar,
+    jlong requestPtr) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return -1;
+    }
+
+    char* promptData;
+    char* outputData;
+    if (!direct_region(env, prompt, promptOffset, promptLength, &promptData) ||
+        !direct_region(env, output, outputOffset, outputLength, &outputData)) {
+        return -1;
+    }
+
+    GenerationParams params = make_params(maxTokens, temperature, topP, topK, minP, repeatPenalty,
+                                          frequencyPenalty, presencePenalty, seed, requestPtr);
+    if (!set_grammar(env, grammar, params)) {
+        return -1;
+    }
+
+    DirectWriter writer{outputData, static_cast<size_t>(outputLength)};
+    generate_text(model, contextPtr, std::string_view(promptData, promptLength), params,
+                  [&writer](const std::string& text) { return writer.append(text); });
+    return static_cast<jint>(writer.size);
+}
+
+// Streaming nativeGenerateDirect: after each piece of text is written to
+// output, callback.onText(offset, length) says where it is. Generation stops
+// early when onText returns false.
+JNIEXPORT jint JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeGenerateStreamDirect(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jlong contextPtr, jobject prompt, jint promptOffset, jint promptLength,
+    jobject output, jint outputOffset, jint outputLength,
+    jint maxTokens, jfloat temperature, jfloat topP, jint topK, jfloat minP,
+    jfloat repeatPenalty, jfloat frequencyPenalty, jfloat presencePenalty, jlong seed, jstring grammar,
+    jlong requestPtr, jobject callback) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return -1;
+    }
+
+    char* promptData;
+    char* outputData;
+    if (!direct_region(env, prompt, promptOffset, promptLength, &promptData) ||
+        !direct_region(env, output, outputOffset, outputLength, &outputData)) {
+        return -1;
+    }
+
+    GenerationParams params = make_params(maxTokens, temperature, topP, topK, minP, repeatPenalty,
+                                          frequencyPenalty, presencePenalty, seed, requestPtr);
+    if (!set_grammar(env, grammar, params)) {
+        return -1;
+    }
+
+    DirectTokenCallbackWrapper wrapper(env, callback);
+    if (!wrapper.valid()) {
+        LOGE("Callback has no onText(Int, Int): Boolean method");
+        return -1;
+    }
+
+    DirectWriter writer{outputData, static_cast<size_t>(outputLength)};
+    generate_text(model, contextPtr, std::string_view(promptData, promptLength), params,
+                  [&](const std::string& text) {
+                      const size_t begin = writer.size;
+                      const bool room = writer.append(text);
+                      const bool keepGoing = writer.size == begin ||
+                                             wrapper.onText(outputOffset + begin, writer.size - begin);
+                      return room && keepGoing;
+                  });
+
+    // Let a pending exception from the callback propagate to the caller
+    if (env->ExceptionCheck()) {
+        return -1;
+    }
+    return static_cast<jint>(writer.size);
+}
+
+// Handle for one generation call: pass it as requestPtr, cancel it from any
+// thread, read how the call ended, then free it once the call has returned.
+// timeoutMs > 0 sets a wall-clock deadline counted from now.
+JNIEXPORT jlong JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeCreateRequest(
+    JNIEnv *env, jobject /* this */, jlong timeoutMs) {
+
+    auto* request = new GenerationRequest();
+    if (timeoutMs > 0) {
+        request->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    }
+    return reinterpret_cast<jlong>(request);
+}
+
+// Stops the request's generation within one forward pass; the call returns
+// the text generated so far
+JNIEXPORT void JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeCancelRequest(
+    JNIEnv *env, jobject /* this */, jlong requestPtr) {
+
+    auto* request = reinterpret_cast<GenerationRequest*>(requestPtr);
+    if (request) {
+        request->cancel();
+    }
+}
+
+// Token counts, timings (milliseconds), peak memory (bytes) and stop reason of
+// the request's finished generation, as JSON
+JNIEXPORT jstring JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeGetRequestStats(
+    JNIEnv *env, jobject /* this */, jlong requestPtr) {
+
+    auto* request = reinterpret_cast<GenerationRequest*>(requestPtr);
+    if (!request) {
+        return nullptr;
+    }
+
+    const GenerationStats& stats = request->stats;
+    std::ostringstream json;
+    json << "{";
+    json << "\"promptTokens\":" << stats.n_prompt_tokens << ",";
+    json << "\"cachedTokens\":" << stats.n_cached_tokens << ",";
+    json << "\"generatedTokens\":" << stats.n_generated << ",";
+    json << "\"queueMs\":" << stats.queue_ms << ",";
+    json << "\"prefillMs\":" << stats.prefill_ms << ",";
+    json << "\"ttftMs\":" << stats.ttft_ms << ",";
+    json << "\"decodeMs\":" << stats.decode_ms << ",";
+    json << "\"tokenP50Ms\":" << stats.token_p50_ms << ",";
+    json << "\"tokenP90Ms\":" << stats.token_p90_ms << ",";
+    json << "\"tokenP99Ms\":" << stats.token_p99_ms << ",";
+    json << "\"tokenMaxMs\":" << stats.token_max_ms << ",";
+    json << "\"peakScratchBytes\":" << stats.peak_scratch_bytes << ",";
+    json << "\"peakKvBytes\":" << stats.peak_kv_bytes << ",";
+    json << "\"stopReason\":\"" << stop_reason_name(stats.stop_reason) << "\"";
+    json << "}";
+
+    return env->NewStringUTF(json.str().c_str());
+}
+
+JNIEXPORT void JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeFreeRequest(
+    JNIEnv *env, jobject /* this */, jlong requestPtr) {
+
+    delete reinterpret_cast<GenerationRequest*>(requestPtr);
+}
+
+// A conversation of its own sharing the model's weights: pass it as contextPtr
+// to the generate calls. Each one keeps its KV cache between turns and has its
+// own sampler state; different contexts may generate in parallel. Free every
+// context before the model.
+JNIEXPORT jlong JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeCreateContext(
+    JNIEnv *env, jobject /* this */, jlong modelPtr) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return 0;
+    }
+    return reinterpret_cast<jlong>(new LlamaConversation(*model));
+}
+
+// Forgets the conversation so far, returning its KV blocks to the pool
+JNIEXPORT void JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeClearContext(
+    JNIEnv *env, jobject /* this */, jlong contextPtr) {
+
+    auto* conversation = reinterpret_cast<LlamaConversation*>(contextPtr);
+    if (conversation) {
+        conversation->clear();
+    }
+}
+
+// Tokens of the conversation currently held in its KV cache
+JNIEXPORT jint JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeGetContextTokens(
+    JNIEnv *env, jobject /* this */, jlong contextPtr) {
+
+    auto* conversation = reinterpret_cast<LlamaConversation*>(contextPtr);
+    return conversation ? conversation->n_past() : 0;
+}
+
+JNIEXPORT void JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeFreeContext(
+    JNIEnv *env, jobject /* this */, jlong contextPtr) {
+
+    delete reinterpret_cast<LlamaConversation*>(contextPtr);
+}
+
+// Maps a LoRA adapter GGUF for the model's contexts to attach. The base
+// weights are untouched, so this costs a header parse rather than a reload.
+// Returns 0 on failure.
+JNIEXPORT jlong JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeLoadAdapter(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jstring adapterPath) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return 0;
+    }
+
+    const char *pathStr = env->GetStringUTFChars(adapterPath, nullptr);
+    std::string path(pathStr);
+    env->ReleaseStringUTFChars(adapterPath, pathStr);
+
+    std::string error;
+    std::unique_ptr<LlamaLora> lora = LlamaLora::load(*model, path, &error);
+    if (!lora) {
+        LOGE("Failed to load adapter %s: %s", path.c_str(), error.c_str());
+        return 0;
+    }
+    LOGI("Loaded adapter %s: %zu weights, rank %u", path.c_str(), lora->weights.size(), lora->max_rank);
+    return reinterpret_cast<jlong>(new std::shared_ptr<const LlamaLora>(std::move(lora)));
+}
+
+// Contexts the adapter is attached to keep it mapped until they detach it
+JNIEXPORT void JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeFreeAdapter(
+    JNIEnv *env, jobject /* this */, jlong adapterPtr) {
+
+    delete reinterpret_cast<std::shared_ptr<const LlamaLora>*>(adapterPtr);
+}
+
+// Attaches adapterPtrs[i] with scales[i] to the context in place of its
+// current adapters; empty arrays detach them all. Clears the conversation.
+JNIEXPORT jboolean JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeSetContextAdapters(
+    JNIEnv *env, jobject /* this */, jlong contextPtr, jlongArray adapterPtrs, jfloatArray scales) {
+
+    auto* conversation = reinterpret_cast<LlamaConversation*>(contextPtr);
+    const jsize n = env->GetArrayLength(adapterPtrs);
+    if (!conversation || env->GetArrayLength(scales) != n) {
+        return JNI_FALSE;
+    }
+
+    std::vector<jlong> ptrs(n);
+    std::vector<jfloat> values(n);
+    env->GetLongArrayRegion(adapterPtrs, 0, n, ptrs.data());
+    env->GetFloatArrayRegion(scales, 0, n, values.data());
+    std::vector<LoraAttachment> adapters;
+    for (jsize i = 0; i < n; ++i) {
+        auto* lora = reinterpret_cast<std::shared_ptr<const LlamaLora>*>(ptrs[i]);
+        if (!lora) {
+            return JNI_FALSE;
+        }
+        adapters.push_back({*lora, values[i]});
+    }
+    conversation->set_adapters(std::move(adapters));
+    return JNI_TRUE;
+}
+
 JNIEXPORT void JNICALL
 Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeFreeModel(
     JNIEnv *env, jobject /* this */, jlong modelPtr) {
@@ -89,13 +683,24 @@ Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion
     JNIEnv *env, jobject /* this */, jlong modelPtr) {
 
     auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
-    if (!model) {
+    if (!model || !model->gguf) {
         return 0;
     }
 
-    // In a real implementation, this would return the actual model size
-    // For now, return a placeholder value
-    return 1024L * 1024L * 500L; // 500MB
+    // Mapped size of the model file; see nativeGetResidentModelSize for what is actually in RAM
+    return static_cast<jlong>(model->gguf->mapping().size());
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeGetResidentModelSize(
+    JNIEnv *env, jobject /* this */, jlong modelPtr) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->gguf) {
+        return 0;
+    }
+
+    return static_cast<jlong>(model->gguf->mapping().resident_bytes());
 }
 
 JNIEXPORT jlong JNICALL
@@ -122,6 +727,511 @@ Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion
     return static_cast<jlong>(model->context_size);
 }
 
+// Length of the vectors nativeEmbed writes
+JNIEXPORT jint JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeGetEmbeddingSize(
+    JNIEnv *env, jobject /* this */, jlong modelPtr) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        return 0;
+    }
+    return static_cast<jint>(model->hparams.n_embd);
+}
+
+// Embeds every text in one batched forward pass and writes texts.length
+// vectors of nativeGetEmbeddingSize floats (native byte order) to the direct
+// buffer `output` from byte outputOffset. pooling is "mean", "cls" or "last";
+// normalize scales each vector to unit length. Returns the vector length, or
+// -1 on error.
+JNIEXPORT jint JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeEmbed(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jobjectArray texts, jstring pooling, jboolean normalize,
+    jobject output, jint outputOffset) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return -1;
+    }
+
+    const char *poolingStr = env->GetStringUTFChars(pooling, nullptr);
+    std::string poolingName(poolingStr);
+    env->ReleaseStringUTFChars(pooling, poolingStr);
+    EmbedPooling mode;
+    if (!parse_embed_pooling(poolingName, &mode)) {
+        LOGE("Unknown pooling: %s", poolingName.c_str());
+        return -1;
+    }
+
+    const jsize n_texts = env->GetArrayLength(texts);
+    const size_t n_embd = model->hparams.n_embd;
+    char* data;
+    const jlong bytes = static_cast<jlong>(n_texts) * n_embd * sizeof(float);
+    if (bytes > INT32_MAX || !direct_region(env, output, outputOffset, static_cast<jint>(bytes), &data)) {
+        return -1;
+    }
+    if (reinterpret_cast<uintptr_t>(data) % alignof(float) != 0) {
+        LOGE("Output offset %d is not float aligned", outputOffset);
+        return -1;
+    }
+
+    std::vector<std::string> strings(n_texts);
+    for (jsize i = 0; i < n_texts; ++i) {
+        auto text = static_cast<jstring>(env->GetObjectArrayElement(texts, i));
+        const char *textStr = env->GetStringUTFChars(text, nullptr);
+        strings[i] = textStr;
+        env->ReleaseStringUTFChars(text, textStr);
+        env->DeleteLocalRef(text);
+    }
+    std::vector<std::string_view> views(strings.begin(), strings.end());
+
+    std::string error;
+    std::shared_lock<std::shared_mutex> state(model->state_mutex);
+    if (!embed_texts(*model, views, mode, normalize, reinterpret_cast<float*>(data), &error)) {
+        LOGE("Embedding failed: %s", error.c_str());
+        return -1;
+    }
+    return static_cast<jint>(n_embd);
+}
+
+// KV block pool occupancy as JSON, for memory diagnostics in the app
+JNIEXPORT jstring JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeGetKVCacheStats(
+    JNIEnv *env, jobject /* this */, jlong modelPtr) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        return nullptr;
+    }
+
+    std::shared_lock<std::shared_mutex> state(model->state_mutex);
+    const KVCacheStats stats = model->scheduler->kv_cache_stats();
+    std::ostringstream json;
+    json << "{";
+    json << "\"type\":\"" << ggml_type_name(stats.type) << "\",";
+    json << "\"blockSize\":" << stats.block_size << ",";
+    json << "\"blocksTotal\":" << stats.blocks_total << ",";
+    json << "\"blocksAllocated\":" << stats.blocks_allocated << ",";
+    json << "\"blocksInUse\":" << stats.blocks_in_use << ",";
+    json << "\"tokens\":" << stats.tokens << ",";
+    json << "\"bytesAllocated\":" << stats.bytes_allocated << ",";
+    json << "\"bytesInUse\":" << stats.bytes_in_use << ",";
+    json << "\"fragmentation\":" << stats.fragmentation;
+    json << "}";
+
+    return env->NewStringUTF(json.str().c_str());
+}
+
+// Prompt prefix cache hit/miss counters and size as JSON
+JNIEXPORT jstring JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeGetPrefixCacheStats(
+    JNIEnv *env, jobject /* this */, jlong modelPtr) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        return nullptr;
+    }
+
+    std::shared_lock<std::shared_mutex> state(model->state_mutex);
+    const PrefixCacheStats stats = model->scheduler->prefix_cache_stats();
+    std::ostringstream json;
+    json << "{";
+    json << "\"lookups\":" << stats.lookups << ",";
+    json << "\"hits\":" << stats.hits << ",";
+    json << "\"misses\":" << (stats.lookups - stats.hits) << ",";
+    json << "\"tokensLookedUp\":" << stats.tokens_looked_up << ",";
+    json << "\"tokensReused\":" << stats.tokens_reused << ",";
+    json << "\"evictions\":" << stats.evictions << ",";
+    json << "\"nodes\":" << stats.nodes << ",";
+    json << "\"bytes\":" << stats.bytes << ",";
+    json << "\"budgetBytes\":" << stats.budget_bytes;
+    json << "}";
+
+    return env->NewStringUTF(json.str().c_str());
+}
+
+JNIEXPORT void JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeSetPrefixCacheBudget(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jlong budgetBytes) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        return;
+    }
+
+    // A budget of 0 drops every cached prefix that is not in use
+    const uint64_t budget = budgetBytes > 0 ? static_cast<uint64_t>(budgetBytes) : 0;
+    std::shared_lock<std::shared_mutex> state(model->state_mutex);
+    model->scheduler->run_exclusive([&] { model->prefix_cache->set_budget(budget); });
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeGetSchedulerStats(
+    JNIEnv *env, jobject /* this */, jlong modelPtr) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        return nullptr;
+    }
+
+    std::shared_lock<std::shared_mutex> state(model->state_mutex);
+    const SchedulerStats stats = model->scheduler->stats();
+    std::ostringstream json;
+    json << "{";
+    json << "\"active\":" << stats.active << ",";
+    json << "\"queued\":" << stats.queued << ",";
+    json << "\"requests\":" << stats.requests << ",";
+    json << "\"steps\":" << stats.steps << ",";
+    json << "\"rows\":" << stats.rows << ",";
+    json << "\"tokensGenerated\":" << stats.tokens_generated;
+    json << "}";
+
+    return env->NewStringUTF(json.str().c_str());
+}
+
+// Saves the KV cache, token history and RNG state of the model's context: the
+// last finished reply, or the session restored since
+JNIEXPORT jboolean JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeSaveSession(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jstring sessionPath) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return JNI_FALSE;
+    }
+
+    const char *path = env->GetStringUTFChars(sessionPath, nullptr);
+    std::string pathStr(path);
+    env->ReleaseStringUTFChars(sessionPath, path);
+
+    std::string error;
+    bool saved = false;
+    size_t n_tokens = 0;
+    std::shared_lock<std::shared_mutex> state(model->state_mutex);
+    model->scheduler->run_exclusive([&] {
+        saved = session_save(*model->context, pathStr, &error);
+        n_tokens = model->context->tokens.size();
+    });
+    if (!saved) {
+        LOGE("Failed to save session: %s", error.c_str());
+        return JNI_FALSE;
+    }
+
+    LOGI("Saved session with %zu tokens to %s", n_tokens, pathStr.c_str());
+    return JNI_TRUE;
+}
+
+// Restores a session written by nativeSaveSession. The next generate call whose
+// prompt extends the saved conversation only prefills the new tokens.
+JNIEXPORT jboolean JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeLoadSession(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jstring sessionPath) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return JNI_FALSE;
+    }
+
+    const char *path = env->GetStringUTFChars(sessionPath, nullptr);
+    std::string pathStr(path);
+    env->ReleaseStringUTFChars(sessionPath, path);
+
+    std::string error;
+    bool restored = false;
+    size_t n_tokens = 0;
+    std::shared_lock<std::shared_mutex> state(model->state_mutex);
+    model->scheduler->run_exclusive([&] {
+        restored = session_load(*model->context, pathStr, &error);
+        n_tokens = model->context->tokens.size();
+    });
+    if (!restored) {
+        LOGE("Failed to load session %s: %s", pathStr.c_str(), error.c_str());
+        return JNI_FALSE;
+    }
+
+    LOGI("Restored session with %zu tokens from %s", n_tokens, pathStr.c_str());
+    return JNI_TRUE;
+}
+
+// Recreates the model's context with keys/values stored as `type` ("F32", "F16",
+// "Q8_0" or "Q4_0"). Drops the current conversation and cached prefixes.
+JNIEXPORT jboolean JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeSetKVCacheType(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jstring type) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return JNI_FALSE;
+    }
+
+    const char *typeStr = env->GetStringUTFChars(type, nullptr);
+    std::string typeName(typeStr);
+    env->ReleaseStringUTFChars(type, typeStr);
+
+    GGMLType kvType;
+    std::string error;
+    if (!parse_kv_type(typeName, &kvType)) {
+        LOGE("Unknown KV cache type: %s", typeName.c_str());
+        return JNI_FALSE;
+    }
+    // Waits for in-flight requests and holds back new ones until the new
+    // scheduler is in place
+    std::unique_lock<std::shared_mutex> state(model->state_mutex);
+    if (model->kv_pool->type() == kvType) {
+        return JNI_TRUE;
+    }
+    if (!model->create_context(kvType, &error)) {
+        LOGE("Failed to switch KV cache type: %s", error.c_str());
+        return JNI_FALSE;
+    }
+
+    LOGI("KV cache now stores %s (%zu bytes per token)", typeName.c_str(),
+         model->kv_pool->block_bytes() / model->kv_pool->block_size());
+    return JNI_TRUE;
+}
+
+// Perplexity and decode latency of `text` for every KV cache type, as a JSON array
+JNIEXPORT jstring JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeBenchmarkKVCache(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jstring text, jint maxTokens) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return nullptr;
+    }
+
+    const char *textStr = env->GetStringUTFChars(text, nullptr);
+    std::string input(textStr);
+    env->ReleaseStringUTFChars(text, textStr);
+
+    std::string error;
+    std::shared_lock<std::shared_mutex> state(model->state_mutex);
+    std::vector<KVCacheBenchResult> results = kv_cache_benchmark(*model, input, maxTokens, &error);
+    if (results.empty()) {
+        LOGE("KV cache benchmark failed: %s", error.c_str());
+        return nullptr;
+    }
+
+    std::ostringstream json;
+    json << "[";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const KVCacheBenchResult& r = results[i];
+        if (i > 0) json << ",";
+        json << "{";
+        json << "\"type\":\"" << ggml_type_name(r.type) << "\",";
+        json << "\"bytesPerToken\":" << r.bytes_per_token << ",";
+        json << "\"tokens\":" << r.n_tokens << ",";
+        json << "\"perplexity\":";
+        if (std::isfinite(r.perplexity)) json << r.perplexity; else json << "null";
+        json << ",";
+        json << "\"msPerToken\":" << r.ms_per_token;
+        json << "}";
+    }
+    json << "]";
+
+    return env->NewStringUTF(json.str().c_str());
+}
+
+// Sampler chain cost per token on random logits of vocabSize entries, as a JSON array
+JNIEXPORT jstring JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeBenchmarkSampler(
+    JNIEnv *env, jobject /* this */, jint vocabSize, jint iterations) {
+
+    std::vector<SamplerBenchResult> results = sampler_benchmark(vocabSize, iterations);
+
+    std::ostringstream json;
+    json << "[";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const SamplerBenchResult& r = results[i];
+        if (i > 0) json << ",";
+        json << "{";
+        json << "\"config\":\"" << r.config << "\",";
+        json << "\"vocabSize\":" << r.n_vocab << ",";
+        json << "\"usPerToken\":" << r.us_per_token;
+        json << "}";
+    }
+    json << "]";
+
+    return env->NewStringUTF(json.str().c_str());
+}
+
+// Uses draftPtr (0 to disable) to propose nDraft tokens per step for modelPtr
+JNIEXPORT jboolean JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeSetDraftModel(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jlong draftPtr, jint nDraft) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return JNI_FALSE;
+    }
+
+    auto* draft = reinterpret_cast<LlamaModel*>(draftPtr);
+    std::string error;
+    bool ok = false;
+    // Exclusive: generate_text reads draft_model under the shared lock
+    std::unique_lock<std::shared_mutex> state(model->state_mutex);
+    model->scheduler->run_exclusive([&] { ok = model->set_draft(draft, nDraft, &error); });
+    if (!ok) {
+        LOGE("Failed to set draft model: %s", error.c_str());
+        return JNI_FALSE;
+    }
+
+    if (draft) {
+        LOGI("Speculative decoding with %d draft tokens from %s", nDraft, draft->model_path.c_str());
+    }
+    return JNI_TRUE;
+}
+
+// Replaces the compute thread pool: nThreads (0 = one per allowed core) pinned
+// according to `affinity` ("NONE", "BIG_CORES" or "ALL_CORES")
+JNIEXPORT jboolean JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeSetThreads(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jint nThreads, jstring affinity) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return JNI_FALSE;
+    }
+
+    const char *affinityStr = env->GetStringUTFChars(affinity, nullptr);
+    std::string affinityName(affinityStr);
+    env->ReleaseStringUTFChars(affinity, affinityStr);
+
+    ThreadAffinity policy;
+    if (!parse_thread_affinity(affinityName, &policy) || nThreads < 0) {
+        LOGE("Invalid thread settings: %d threads, affinity %s", nThreads, affinityName.c_str());
+        return JNI_FALSE;
+    }
+
+    std::unique_lock<std::shared_mutex> state(model->state_mutex);
+    model->scheduler->run_exclusive([&] { model->set_threads(nThreads, policy); });
+    LOGI("Using %d compute threads (%s)", model->threads->size(), thread_affinity_name(policy));
+    return JNI_TRUE;
+}
+
+// Keeps the model's resident weights within budgetBytes by streaming layers
+// from the mapped file; 0 removes the limit. Fails if the budget is too small.
+JNIEXPORT jboolean JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeSetMemoryBudget(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jlong budgetBytes) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded || budgetBytes < 0) {
+        LOGE("Invalid model pointer or memory budget");
+        return JNI_FALSE;
+    }
+
+    std::string error;
+    bool ok = false;
+    std::unique_lock<std::shared_mutex> state(model->state_mutex);
+    model->scheduler->run_exclusive([&] { ok = model->set_memory_budget(static_cast<size_t>(budgetBytes), &error); });
+    if (!ok) {
+        LOGE("Failed to set memory budget: %s", error.c_str());
+        return JNI_FALSE;
+    }
+    if (model->streamer) {
+        LOGI("Memory budget %lld bytes: %u of %u layers resident", static_cast<long long>(budgetBytes),
+             model->streamer->pinned_layers(), model->hparams.n_layer);
+    }
+    return JNI_TRUE;
+}
+
+// Decode speed and peak file-backed memory under each budget, as a JSON array
+JNIEXPORT jstring JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeBenchmarkMemoryBudget(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jlongArray budgets, jint nTokens) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return nullptr;
+    }
+
+    const jsize n = env->GetArrayLength(budgets);
+    std::vector<jlong> values(n);
+    env->GetLongArrayRegion(budgets, 0, n, values.data());
+    std::vector<size_t> sizes;
+    for (jlong v : values) {
+        if (v >= 0) sizes.push_back(static_cast<size_t>(v));
+    }
+
+    std::string error;
+    std::vector<MemoryBudgetBenchResult> results;
+    std::unique_lock<std::shared_mutex> state(model->state_mutex);
+    model->scheduler->run_exclusive([&] { results = memory_budget_benchmark(*model, sizes, nTokens, &error); });
+    if (results.empty()) {
+        LOGE("Memory budget benchmark failed: %s", error.c_str());
+        return nullptr;
+    }
+
+    std::ostringstream json;
+    json << "[";
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (i > 0) json << ",";
+        json << "{";
+        json << "\"budgetBytes\":" << results[i].budget_bytes << ",";
+        json << "\"pinnedLayers\":" << results[i].pinned_layers << ",";
+        json << "\"tokensPerSecond\":" << results[i].tokens_per_second << ",";
+        json << "\"peakResidentBytes\":" << results[i].peak_rss_file_bytes;
+        json << "}";
+    }
+    json << "]";
+
+    return env->NewStringUTF(json.str().c_str());
+}
+
+// Decode speed for 1..N compute threads pinned per `affinity`, as a JSON array
+JNIEXPORT jstring JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeBenchmarkThreads(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jstring affinity, jint nTokens) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return nullptr;
+    }
+
+    const char *affinityStr = env->GetStringUTFChars(affinity, nullptr);
+    std::string affinityName(affinityStr);
+    env->ReleaseStringUTFChars(affinity, affinityStr);
+
+    ThreadAffinity policy;
+    if (!parse_thread_affinity(affinityName, &policy)) {
+        LOGE("Unknown thread affinity: %s", affinityName.c_str());
+        return nullptr;
+    }
+
+    std::string error;
+    std::vector<ThreadBenchResult> results;
+    std::unique_lock<std::shared_mutex> state(model->state_mutex);
+    model->scheduler->run_exclusive([&] { results = thread_benchmark(*model, policy, nTokens, &error); });
+    if (results.empty()) {
+        LOGE("Thread benchmark failed: %s", error.c_str());
+        return nullptr;
+    }
+
+    std::ostringstream json;
+    json << "[";
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (i > 0) json << ",";
+        json << "{";
+        json << "\"threads\":" << results[i].threads << ",";
+        json << "\"tokensPerSecond\":" << results[i].tokens_per_second;
+        json << "}";
+    }
+    json << "]";
+
+    return env->NewStringUTF(json.str().c_str());
+}
+
+// Tokenizes without BOS, as the text would appear inside a prompt
 JNIEXPORT jintArray JNICALL
 Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeTokenize(
     JNIEnv *env, jobject /* this */, jlong modelPtr, jstring text) {
@@ -132,26 +1242,29 @@ Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion
     }
 
     const char *textStr = env->GetStringUTFChars(text, nullptr);
+    std::vector<int32_t> tokens = model->vocab.tokenize(textStr, false);
+    env->ReleaseStringUTFChars(text, textStr);
 
-    // In a real implementation, this would use the model's tokenizer
-    // For now, create dummy tokens
-    std::vector<jint> tokens;
-    std::string input(textStr);
+    jintArray result = env->NewIntArray(static_cast<jsize>(tokens.size()));
+    env->SetIntArrayRegion(result, 0, static_cast<jsize>(tokens.size()), tokens.data());
+    return result;
+}
 
-    // Simple word-based tokenization for demonstration
-    size_t pos = 0;
-    while (pos < input.length()) {
-        // Generate pseudo-tokens
-        tokens.push_back(static_cast<jint>((input[pos] * 31 + pos) % model->vocab_size));
-        pos++;
-    }
+// nativeTokenize for UTF-8 already in a direct ByteBuffer, read in place
+JNIEXPORT jintArray JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeTokenizeDirect(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jobject text, jint offset, jint length) {
 
-    env->ReleaseStringUTFChars(text, textStr);
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    char* data;
+    if (!model || !model->loaded || !direct_region(env, text, offset, length, &data)) {
+        return nullptr;
+    }
 
-    // Convert to Java array
-    jintArray result = env->NewIntArray(tokens.size());
-    env->SetIntArrayRegion(result, 0, tokens.size(), tokens.data());
+    std::vector<int32_t> tokens = model->vocab.tokenize(std::string_view(data, length), false);
 
+    jintArray result = env->NewIntArray(static_cast<jsize>(tokens.size()));
+    env->SetIntArrayRegion(result, 0, static_cast<jsize>(tokens.size()), tokens.data());
     return result;
 }
 
@@ -168,11 +1281,122 @@ Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion
     std::vector<jint> tokenVec(length);
     env->GetIntArrayRegion(tokens, 0, length, tokenVec.data());
 
-    // In a real implementation, this would use the model's detokenizer
-    // For now, return a placeholder
-    std::string result = "Detokenized text from " + std::to_string(length) + " tokens";
-
+    std::string result = model->vocab.detokenize(tokenVec.data(), tokenVec.size());
     return env->NewStringUTF(result.c_str());
 }
 
+// Streaming detokenizer for modelPtr's vocabulary; free it before the model
+JNIEXPORT jlong JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeCreateDetokenizer(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jboolean stripLeadingSpace) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return 0;
+    }
+    return reinterpret_cast<jlong>(new Detokenizer(model->vocab, stripLeadingSpace == JNI_TRUE));
+}
+
+// UTF-8 bytes completed by `tokens`. Bytes rather than a String: the deltas
+// may hold supplementary characters, which NewStringUTF does not accept.
+JNIEXPORT jbyteArray JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeDetokenizerPush(
+    JNIEnv *env, jobject /* this */, jlong detokenizerPtr, jintArray tokens) {
+
+    auto* detokenizer = reinterpret_cast<Detokenizer*>(detokenizerPtr);
+    std::string text;
+    if (detokenizer) {
+        jsize length = env->GetArrayLength(tokens);
+        std::vector<jint> tokenVec(length);
+        env->GetIntArrayRegion(tokens, 0, length, tokenVec.data());
+        for (jint id : tokenVec) {
+            detokenizer->push(id, text);
+        }
+    }
+
+    jbyteArray result = env->NewByteArray(static_cast<jsize>(text.size()));
+    env->SetByteArrayRegion(result, 0, static_cast<jsize>(text.size()), reinterpret_cast<const jbyte*>(text.data()));
+    return result;
+}
+
+// Ends the stream; returns the UTF-8 bytes of anything held back
+JNIEXPORT jbyteArray JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeDetokenizerFlush(
+    JNIEnv *env, jobject /* this */, jlong detokenizerPtr) {
+
+    auto* detokenizer = reinterpret_cast<Detokenizer*>(detokenizerPtr);
+    std::string text;
+    if (detokenizer) {
+        detokenizer->flush(text);
+    }
+
+    jbyteArray result = env->NewByteArray(static_cast<jsize>(text.size()));
+    env->SetByteArrayRegion(result, 0, static_cast<jsize>(text.size()), reinterpret_cast<const jbyte*>(text.data()));
+    return result;
+}
+
+JNIEXPORT void JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeFreeDetokenizer(
+    JNIEnv *env, jobject /* this */, jlong detokenizerPtr) {
+
+    delete reinterpret_cast<Detokenizer*>(detokenizerPtr);
+}
+
+// Tokenizer speed on `text` averaged over `iterations` runs, as a JSON object
+JNIEXPORT jstring JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeBenchmarkTokenizer(
+    JNIEnv *env, jobject /* this */, jlong modelPtr, jstring text, jint iterations) {
+
+    auto* model = reinterpret_cast<LlamaModel*>(modelPtr);
+    if (!model || !model->loaded) {
+        LOGE("Invalid model pointer or model not loaded");
+        return nullptr;
+    }
+
+    const char *textStr = env->GetStringUTFChars(text, nullptr);
+    std::string input(textStr);
+    env->ReleaseStringUTFChars(text, textStr);
+
+    TokenizerBenchResult r = tokenizer_benchmark(model->vocab, input, iterations);
+
+    std::ostringstream json;
+    json << "{";
+    json << "\"bytes\":" << r.n_bytes << ",";
+    json << "\"tokens\":" << r.n_tokens << ",";
+    json << "\"msPerRun\":" << r.ms_per_run << ",";
+    json << "\"tokensPerSecond\":" << r.tokens_per_second << ",";
+    json << "\"roundTrip\":" << (r.round_trip ? "true" : "false");
+    json << "}";
+
+    return env->NewStringUTF(json.str().c_str());
+}
+
+// JNI marshaling microbenchmark, String side: the copies every String entry
+// point makes (modified UTF-8 out of the Java string, then back into a new one)
+JNIEXPORT jstring JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeEchoString(
+    JNIEnv *env, jobject /* this */, jstring text) {
+
+    const char *textStr = env->GetStringUTFChars(text, nullptr);
+    std::string copy(textStr);
+    env->ReleaseStringUTFChars(text, textStr);
+    return env->NewStringUTF(copy.c_str());
+}
+
+// JNI marshaling microbenchmark, direct ByteBuffer side: `length` bytes from
+// input to output, the only copy the direct entry points make
+JNIEXPORT jint JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_LlamaCppService_00024Companion_nativeEchoDirect(
+    JNIEnv *env, jobject /* this */, jobject input, jint length, jobject output) {
+
+    char* in;
+    char* out;
+    if (!direct_region(env, input, 0, length, &in) || !direct_region(env, output, 0, length, &out)) {
+        return -1;
+    }
+    memcpy(out, in, length);
+    return length;
+}
+
 } // extern "C"
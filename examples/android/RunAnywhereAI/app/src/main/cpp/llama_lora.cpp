@@ -0,0 +1,113 @@
+#include "llama_lora.h"
+
+#include <algorithm>
+
+namespace {
+
+const std::string kSuffixA = ".lora_a";
+const std::string kSuffixB = ".lora_b";
+
+bool ends_with(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Views a 2D adapter tensor as a matmul weight
+bool bind_lora_tensor(const LlamaModel& model, const GGUFFile& file, const GGUFTensorInfo& info, LlamaTensor& out,
+                      std::string* error) {
+    if (info.n_dims != 2) {
+        if (error) *error = "adapter tensor " + info.name + " is not 2D";
+        return false;
+    }
+    // Rows must hold whole quantization blocks for the matmul kernels
+    if (!model.kernels->supports(info.type) || info.ne[0] % ggml_block_size(info.type) != 0) {
+        if (error) *error = "unsupported tensor type " + std::string(ggml_type_name(info.type)) + " in " + info.name;
+        return false;
+    }
+    out.data = file.tensor_data(info);
+    out.type = info.type;
+    out.ne0 = info.ne[0];
+    out.ne1 = info.ne[1];
+    return true;
+}
+
+} // namespace
+
+std::unique_ptr<LlamaLora> LlamaLora::load(const LlamaModel& model, const std::string& path, std::string* error) {
+    auto lora = std::make_unique<LlamaLora>();
+    lora->gguf = GGUFFile::load(path, error);
+    if (!lora->gguf) {
+        return nullptr;
+    }
+    const GGUFFile& f = *lora->gguf;
+    const GGUFHeader& h = f.header();
+    const std::string type = h.get_string("general.type", "adapter");
+    if (type != "adapter" || h.get_string("adapter.type", "lora") != "lora") {
+        if (error) *error = "not a LoRA adapter";
+        return nullptr;
+    }
+    if (h.architecture() != model.gguf->header().architecture()) {
+        if (error) *error = "adapter is for architecture " + h.architecture();
+        return nullptr;
+    }
+    lora->alpha = h.get_float("adapter.lora.alpha", 0.0f);
+
+    // Base weights an adapter may target, by GGUF name
+    std::unordered_map<std::string, const LlamaTensor*> targets;
+    for (uint32_t i = 0; i < model.hparams.n_layer; ++i) {
+        const std::string p = "blk." + std::to_string(i) + ".";
+        const LlamaLayer& l = model.layers[i];
+        targets[p + "attn_q.weight"] = &l.wq;
+        targets[p + "attn_k.weight"] = &l.wk;
+        targets[p + "attn_v.weight"] = &l.wv;
+        targets[p + "attn_output.weight"] = &l.wo;
+        targets[p + "ffn_gate.weight"] = &l.ffn_gate;
+        targets[p + "ffn_up.weight"] = &l.ffn_up;
+        targets[p + "ffn_down.weight"] = &l.ffn_down;
+    }
+
+    size_t n_b = 0;
+    for (const GGUFTensorInfo& info : h.tensors) {
+        if (ends_with(info.name, kSuffixB)) {
+            n_b++; // bound with its A
+            continue;
+        }
+        if (!ends_with(info.name, kSuffixA)) {
+            if (error) *error = "unexpected adapter tensor " + info.name;
+            return nullptr;
+        }
+        const std::string base = info.name.substr(0, info.name.size() - kSuffixA.size());
+        auto target = targets.find(base);
+        if (target == targets.end()) {
+            if (error) *error = "adapter tensor " + info.name + " has no matching layer weight";
+            return nullptr;
+        }
+        const GGUFTensorInfo* info_b = f.find_tensor(base + kSuffixB);
+        if (!info_b) {
+            if (error) *error = "missing tensor " + base + kSuffixB;
+            return nullptr;
+        }
+
+        LoraWeight lw;
+        if (!bind_lora_tensor(model, f, info, lw.a, error) || !bind_lora_tensor(model, f, *info_b, lw.b, error)) {
+            return nullptr;
+        }
+        const LlamaTensor& w = *target->second;
+        if (lw.a.ne0 != w.ne0 || lw.b.ne1 != w.ne1 || lw.b.ne0 != lw.a.ne1) {
+            if (error) *error = "unexpected shape for " + base + " adapter";
+            return nullptr;
+        }
+        const uint32_t rank = static_cast<uint32_t>(lw.a.ne1);
+        lw.scale = lora->alpha != 0.0f ? lora->alpha / rank : 1.0f;
+        lora->max_rank = std::max(lora->max_rank, rank);
+        lora->weights[target->second] = lw;
+    }
+    if (n_b != lora->weights.size()) {
+        if (error) *error = "adapter has a " + kSuffixB + " tensor without its " + kSuffixA;
+        return nullptr;
+    }
+    if (lora->weights.empty()) {
+        if (error) *error = "adapter has no tensors";
+        return nullptr;
+    }
+    return lora;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "gguf.h"
+#include "llama_model.h"
+
+// Low-rank delta of one base weight W: y = W x + scale * B (A x)
+struct LoraWeight {
+    LlamaTensor a;      // [rank rows][n_in]
+    LlamaTensor b;      // [n_out rows][rank]
+    float scale = 1.0f; // alpha / rank, or 1 without alpha
+};
+
+// A LoRA adapter in its own GGUF file, as written by llama.cpp's
+// convert_lora_to_gguf.py: "<weight>.lora_a" / "<weight>.lora_b" pairs for some
+// of the base model's layer weights, and "adapter.lora.alpha". A and B are
+// viewed in place in the mapping like base weights, so loading one costs a
+// header parse and its resident size is what inference touches (a few MB at
+// typical ranks). Shared by every context it is attached to.
+struct LlamaLora {
+    std::unique_ptr<GGUFFile> gguf;
+    float alpha = 0.0f;
+    uint32_t max_rank = 0;
+    // Keyed by the base weight of `model`; valid only for that model
+    std::unordered_map<const LlamaTensor*, LoraWeight> weights;
+
+    // Maps `path` and binds its tensors to `model`'s layer weights. Fails if the
+    // architecture or any shape differs, or a tensor has no matching weight.
+    static std::unique_ptr<LlamaLora> load(const LlamaModel& model, const std::string& path, std::string* error);
+
+    const LoraWeight* find(const LlamaTensor& w) const {
+        auto it = weights.find(&w);
+        return it == weights.end() ? nullptr : &it->second;
+    }
+};
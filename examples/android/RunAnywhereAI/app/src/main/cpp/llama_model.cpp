@@ -0,0 +1,972 @@
+#include "llama_model.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "llama_lora.h"
+#include "llama_scheduler.h"
+#include "llama_stream.h"
+#include "ops.h"
+
+namespace {
+
+// KV memory is paged in as sequences grow, so the cap only bounds the pool
+constexpr uint32_t kMaxContextSize = 8192;
+// Half the memory of F32 with no measurable quality loss
+constexpr GGMLType kDefaultKVType = GGML_TYPE_F16;
+// Little cores finish their share of a matmul last and stall the others
+constexpr ThreadAffinity kDefaultAffinity = ThreadAffinity::BigCores;
+// Output rows per work-stealing chunk of a matmul
+constexpr int64_t kMatmulGrain = 16;
+// KV positions scored per step of attention's online softmax: the scores of a
+// tile stay in L1 and are consumed before the next tile is computed
+constexpr int64_t kAttnTile = 64;
+static_assert(kAttnTile % KVCachePool::kBlockSize == 0, "attention tiles must cover whole KV blocks");
+
+bool bind_tensor(const GGUFFile& file, const std::string& name, int64_t ne0, int64_t ne1,
+                 LlamaTensor& out, std::string* error) {
+    const GGUFTensorInfo* info = file.find_tensor(name);
+    if (!info) {
+        if (error) *error = "missing tensor " + name;
+        return false;
+    }
+    if (info->ne[0] != ne0 || info->ne[1] != ne1) {
+        if (error) *error = "unexpected shape for " + name;
+        return false;
+    }
+    out.data = file.tensor_data(*info);
+    out.type = info->type;
+    out.ne0 = info->ne[0];
+    out.ne1 = info->ne[1];
+    return true;
+}
+
+// Norm weights are tiny; keep them as dequantized floats
+bool load_norm(const GGUFFile& file, const std::string& name, int64_t n, std::vector<float>& out,
+               std::string* error) {
+    LlamaTensor t;
+    if (!bind_tensor(file, name, n, 1, t, error)) return false;
+    out.resize(n);
+    if (!dequantize_row(t.type, t.data, out.data(), n)) {
+        if (error) *error = "unsupported type for " + name;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+// GenerationRequest
+
+const char* stop_reason_name(StopReason reason) {
+    switch (reason) {
+        case StopReason::MaxTokens: return "max_tokens";
+        case StopReason::EndOfText: return "eos";
+        case StopReason::Grammar: return "grammar";
+        case StopReason::Callback: return "callback";
+        case StopReason::Cancelled: return "cancelled";
+        case StopReason::Deadline: return "deadline";
+        case StopReason::Error: return "error";
+    }
+    return "error";
+}
+
+bool GenerationRequest::should_stop(StopReason* reason) const {
+    if (cancelled.load(std::memory_order_relaxed)) {
+        *reason = StopReason::Cancelled;
+        return true;
+    }
+    if (deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline) {
+        *reason = StopReason::Deadline;
+        return true;
+    }
+    return false;
+}
+
+void GenerationTimer::tokens(int32_t n) {
+    const Clock::time_point now = Clock::now();
+    if (first_token == Clock::time_point()) {
+        first_token = now;
+        last_token = now;
+        n--;
+    }
+    if (n <= 0) return;
+    const float ms = std::chrono::duration<float, std::milli>(now - last_token).count() / n;
+    latencies_ms.insert(latencies_ms.end(), n, ms);
+    last_token = now;
+}
+
+void GenerationTimer::finish(GenerationStats& stats) {
+    using Ms = std::chrono::duration<double, std::milli>;
+    const Clock::time_point none;
+    stats.queue_ms = admit_time != none ? Ms(admit_time - start).count() : 0.0;
+    stats.prefill_ms = prefill_start != none && prefill_stop != none ? Ms(prefill_stop - prefill_start).count() : 0.0;
+    stats.ttft_ms = first_token != none ? Ms(first_token - start).count() : 0.0;
+    stats.decode_ms = first_token != none ? Ms(last_token - first_token).count() : 0.0;
+
+    // Nearest-rank percentiles
+    std::sort(latencies_ms.begin(), latencies_ms.end());
+    const auto percentile = [&](double p) {
+        if (latencies_ms.empty()) return 0.0f;
+        const size_t rank = static_cast<size_t>(std::ceil(p * latencies_ms.size()));
+        return latencies_ms[std::max<size_t>(rank, 1) - 1];
+    };
+    stats.token_p50_ms = percentile(0.50);
+    stats.token_p90_ms = percentile(0.90);
+    stats.token_p99_ms = percentile(0.99);
+    stats.token_max_ms = percentile(1.0);
+}
+
+// LlamaModel
+
+LlamaModel::LlamaModel(const std::string& path)
+    : model_path(path), vocab_size(32000), context_size(2048), loaded(false) {}
+
+LlamaModel::~LlamaModel() = default;
+
+bool LlamaModel::load(std::string* error) {
+    gguf = GGUFFile::load(model_path, error);
+    if (!gguf) {
+        return false;
+    }
+
+    kernels = &quant_kernels();
+    for (const auto& t : gguf->header().tensors) {
+        if (!kernels->supports(t.type)) {
+            if (error) *error = "unsupported tensor type " + std::string(ggml_type_name(t.type)) + " in " + t.name;
+            return false;
+        }
+    }
+
+    if (!vocab.load(*gguf, error) || !load_hparams(error) || !load_weights(error)) {
+        return false;
+    }
+
+    vocab_size = hparams.n_vocab;
+    set_threads(0, kDefaultAffinity);
+    if (!create_context(kDefaultKVType, error)) {
+        return false;
+    }
+    loaded = true;
+    return true;
+}
+
+bool LlamaModel::create_context(GGMLType kv_type, std::string* error) {
+    if (!kv_cache_type_supported(kv_type, hparams.head_dim)) {
+        if (error) *error = std::string("unsupported KV cache type ") + ggml_type_name(kv_type);
+        return false;
+    }
+    if (n_conversations > 0) {
+        if (error) *error = "contexts created on this model must be freed first";
+        return false;
+    }
+
+    // Tear down in dependency order: contexts and the prefix cache hold pool blocks
+    scheduler.reset();
+    context.reset();
+    prefix_cache.reset();
+    kv_pool.reset();
+
+    const uint32_t n_ctx = std::min(hparams.n_ctx_train, kMaxContextSize);
+    const uint32_t n_blocks = (n_ctx + KVCachePool::kBlockSize - 1) / KVCachePool::kBlockSize;
+    // One window for the sequences the scheduler runs and one for `context`,
+    // so keeping the last reply never cuts a new one short. Blocks are only
+    // allocated as sequences grow.
+    kv_pool = std::make_unique<KVCachePool>(hparams.n_layer, hparams.n_embd_kv(), 2 * n_blocks, kv_type);
+    // By default cached prefixes may hold up to half a window
+    prefix_cache = std::make_unique<PrefixCache>(*kv_pool, n_blocks / 2 * static_cast<uint64_t>(kv_pool->block_bytes()));
+    context = std::make_unique<LlamaContext>(*this, *kv_pool, prefix_cache.get(), n_ctx);
+    context_size = context->n_ctx;
+    scheduler = std::make_unique<LlamaScheduler>(*this);
+    return true;
+}
+
+void LlamaModel::set_threads(int32_t n_threads, ThreadAffinity affinity) {
+    threads.reset();
+    threads = std::make_unique<ThreadPool>(n_threads, affinity);
+}
+
+bool LlamaModel::set_memory_budget(size_t budget_bytes, std::string* error) {
+    if (budget_bytes == 0) {
+        streamer.reset();
+        return true;
+    }
+    std::unique_ptr<LayerStreamer> s = LayerStreamer::create(*this, budget_bytes, error);
+    if (!s) {
+        return false;
+    }
+    streamer = std::move(s);
+    return true;
+}
+
+const TokenTrie& LlamaModel::token_trie() const {
+    std::call_once(trie_once, [this] { trie = std::make_unique<TokenTrie>(vocab); });
+    return *trie;
+}
+
+bool LlamaModel::set_draft(LlamaModel* draft, int32_t n, std::string* error) {
+    if (draft) {
+        if (draft == this) {
+            if (error) *error = "a model cannot be its own draft";
+            return false;
+        }
+        if (!draft->loaded || !draft->context) {
+            if (error) *error = "draft model is not loaded";
+            return false;
+        }
+        // Draft tokens are verified by id, so both models must agree on every token
+        if (draft->vocab.tokens != vocab.tokens) {
+            if (error) *error = "draft model uses a different vocabulary";
+            return false;
+        }
+        if (n <= 0) {
+            if (error) *error = "number of draft tokens must be positive";
+            return false;
+        }
+    }
+    draft_model = draft;
+    n_draft = draft ? n : 0;
+    return true;
+}
+
+bool LlamaModel::load_hparams(std::string* error) {
+    const GGUFHeader& hdr = gguf->header();
+    const std::string arch = hdr.architecture();
+    if (arch != "llama") {
+        if (error) *error = "unsupported architecture " + arch;
+        return false;
+    }
+
+    LlamaHParams& hp = hparams;
+    hp.n_vocab = static_cast<uint32_t>(vocab.size());
+    hp.n_ctx_train = static_cast<uint32_t>(hdr.get_arch_uint("context_length", 2048));
+    hp.n_embd = static_cast<uint32_t>(hdr.get_arch_uint("embedding_length", 0));
+    hp.n_layer = static_cast<uint32_t>(hdr.get_arch_uint("block_count", 0));
+    hp.n_head = static_cast<uint32_t>(hdr.get_arch_uint("attention.head_count", 0));
+    hp.n_head_kv = static_cast<uint32_t>(hdr.get_arch_uint("attention.head_count_kv", hp.n_head));
+    hp.n_ff = static_cast<uint32_t>(hdr.get_arch_uint("feed_forward_length", 0));
+    if (hp.n_embd == 0 || hp.n_layer == 0 || hp.n_head == 0 || hp.n_head_kv == 0 || hp.n_ff == 0 ||
+        hp.n_embd % hp.n_head != 0 || hp.n_head % hp.n_head_kv != 0) {
+        if (error) *error = "invalid model hyperparameters";
+        return false;
+    }
+
+    hp.head_dim = hp.n_embd / hp.n_head;
+    hp.n_rot = static_cast<uint32_t>(hdr.get_arch_uint("rope.dimension_count", hp.head_dim));
+    hp.rms_eps = hdr.get_arch_float("attention.layer_norm_rms_epsilon", hp.rms_eps);
+    hp.rope_freq_base = hdr.get_arch_float("rope.freq_base", hp.rope_freq_base);
+    if (hdr.get_arch_float("rope.scaling.factor", 0.0f) > 0.0f &&
+        hdr.get_string(hdr.architecture() + ".rope.scaling.type", "linear") == "linear") {
+        hp.rope_freq_scale = 1.0f / hdr.get_arch_float("rope.scaling.factor", 1.0f);
+    }
+    if (hp.n_rot > hp.head_dim || hp.n_rot % 2 != 0) {
+        if (error) *error = "invalid rope dimension";
+        return false;
+    }
+    return true;
+}
+
+bool LlamaModel::load_weights(std::string* error) {
+    const GGUFFile& f = *gguf;
+    const LlamaHParams& hp = hparams;
+    const int64_t n_embd = hp.n_embd;
+    const int64_t n_embd_kv = hp.n_embd_kv();
+
+    if (!bind_tensor(f, "token_embd.weight", n_embd, hp.n_vocab, tok_embd, error)) return false;
+    if (!load_norm(f, "output_norm.weight", n_embd, output_norm, error)) return false;
+    // Models with tied embeddings have no separate output matrix
+    if (f.find_tensor("output.weight")) {
+        if (!bind_tensor(f, "output.weight", n_embd, hp.n_vocab, output, error)) return false;
+    } else {
+        output = tok_embd;
+    }
+
+    layers.resize(hp.n_layer);
+    for (uint32_t i = 0; i < hp.n_layer; ++i) {
+        const std::string p = "blk." + std::to_string(i) + ".";
+        LlamaLayer& l = layers[i];
+        if (!load_norm(f, p + "attn_norm.weight", n_embd, l.attn_norm, error) ||
+            !load_norm(f, p + "ffn_norm.weight", n_embd, l.ffn_norm, error) ||
+            !bind_tensor(f, p + "attn_q.weight", n_embd, n_embd, l.wq, error) ||
+            !bind_tensor(f, p + "attn_k.weight", n_embd, n_embd_kv, l.wk, error) ||
+            !bind_tensor(f, p + "attn_v.weight", n_embd, n_embd_kv, l.wv, error) ||
+            !bind_tensor(f, p + "attn_output.weight", n_embd, n_embd, l.wo, error) ||
+            !bind_tensor(f, p + "ffn_gate.weight", n_embd, hp.n_ff, l.ffn_gate, error) ||
+            !bind_tensor(f, p + "ffn_up.weight", n_embd, hp.n_ff, l.ffn_up, error) ||
+            !bind_tensor(f, p + "ffn_down.weight", hp.n_ff, n_embd, l.ffn_down, error)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// LlamaContext
+
+LlamaContext::LlamaContext(const LlamaModel& m, KVCachePool& pool, PrefixCache* cache, uint32_t ctx_size)
+    : model(m), kv_pool(pool), prefix_cache(cache), n_ctx(ctx_size), rng(std::random_device{}()) {
+    logits.resize(model.hparams.n_vocab);
+}
+
+LlamaContext::~LlamaContext() {
+    kv_pool.truncate(kv, 0);
+}
+
+void LlamaContext::reset() {
+    n_past = 0;
+    kv_shifted = false;
+    tokens.clear();
+    kv_pool.truncate(kv, 0);
+}
+
+void LlamaContext::take_sequence(LlamaContext& other) {
+    reset();
+    std::swap(kv, other.kv);
+    tokens.swap(other.tokens);
+    n_past = other.n_past;
+    kv_shifted = other.kv_shifted;
+    rng = other.rng;
+    other.reset();
+}
+
+void LlamaContext::set_adapters(std::vector<LoraAttachment> list) {
+    adapters = std::move(list);
+    reset();
+}
+
+bool LlamaContext::reserve_kv(int32_t n_tokens, std::string* error) {
+    if (kv_pool.reserve(kv, n_tokens)) {
+        return true;
+    }
+    // Make room by dropping cached prefixes nobody is using, then retry
+    const uint32_t needed = (n_tokens + kv_pool.block_size() - 1) / kv_pool.block_size() -
+                            static_cast<uint32_t>(kv.blocks.size());
+    if (prefix_cache && prefix_cache->evict(needed) >= needed && kv_pool.reserve(kv, n_tokens)) {
+        return true;
+    }
+    if (error) *error = "KV cache pool is exhausted";
+    return false;
+}
+
+bool LlamaContext::shift_context(std::string* error) {
+    const LlamaHParams& hp = model.hparams;
+    const int32_t bs = static_cast<int32_t>(kv_pool.block_size());
+    const int32_t n_keep = (kSinkTokens + bs - 1) / bs * bs;
+    // Discard whole blocks so the shift is an edit of the block table
+    const int32_t n_discard = (n_past - n_keep) / 2 / bs * bs;
+    if (n_discard <= 0) {
+        if (error) *error = "context window too small to shift";
+        return false;
+    }
+
+    // Shared blocks (e.g. held by the prefix cache) must keep their rotation,
+    // so every block that moves gets a private copy first. Copies leave the
+    // sequence's contents unchanged, so running out of blocks here leaves the
+    // context as it was.
+    for (size_t b = (n_keep + n_discard) / bs; b < kv.blocks.size(); ++b) {
+        if (!kv_pool.make_private(kv, b) && !(prefix_cache && prefix_cache->evict(1) == 1 && kv_pool.make_private(kv, b))) {
+            if (error) *error = "KV cache pool is exhausted";
+            return false;
+        }
+    }
+
+    kv_pool.erase(kv, n_keep / bs, n_discard / bs);
+    tokens.erase(tokens.begin() + n_keep, tokens.begin() + n_keep + n_discard);
+    n_past -= n_discard;
+    kv_shifted = true;
+
+    // RoPE rotations compose, so rotating by -n_discard moves each kept key
+    // from position p + n_discard to p
+    std::vector<float> cs(hp.n_rot);
+    op_rope_cache(cs.data(), hp.n_rot, -n_discard, hp.rope_freq_base, hp.rope_freq_scale);
+    const GGMLType kv_type = kv_pool.type();
+    const size_t row_bytes = kv_pool.row_bytes();
+    std::vector<float> row(hp.n_embd_kv());
+    for (size_t b = n_keep / bs; b < kv.blocks.size(); ++b) {
+        const int32_t n_slots = std::min<int32_t>(bs, n_past - static_cast<int32_t>(b) * bs);
+        for (uint32_t il = 0; il < hp.n_layer; ++il) {
+            uint8_t* k_rows = kv_pool.k(kv.blocks[b], il);
+            for (int32_t j = 0; j < n_slots; ++j) {
+                dequantize_row(kv_type, k_rows + j * row_bytes, row.data(), hp.n_embd_kv());
+                op_rope(row.data(), hp.n_head_kv, hp.head_dim, hp.n_rot, cs.data());
+                quantize_row(kv_type, row.data(), k_rows + j * row_bytes, hp.n_embd_kv());
+            }
+        }
+    }
+    return true;
+}
+
+void LlamaContext::matmul(const LlamaTensor& w, const float* in, int32_t n_tokens, float* out) {
+    const QuantKernels& kernels = *model.kernels;
+    act_scratch.resize(quant_activation_row_size(kernels, w.type, w.ne0) * n_tokens);
+    quant_prepare_activations(kernels, w.type, in, w.ne0, n_tokens, act_scratch.data());
+    const void* xq = act_scratch.data();
+    // Each chunk of output rows reads its own slice of the weights
+    model.threads->parallel_for(w.ne1, kMatmulGrain, [&](int64_t begin, int64_t end, int) {
+        quant_matmul_rows(kernels, w.type, w.data, w.ne0, w.ne1, xq, n_tokens, out, begin, end);
+    });
+}
+
+void LlamaContext::project(const LlamaTensor& w, const LlamaBatchRow* rows, int32_t n_rows, const float* in,
+                           float* out) {
+    matmul(w, in, n_rows, out);
+    for (int32_t t0 = 0, t1; t0 < n_rows; t0 = t1) {
+        const LlamaContext& owner = *rows[t0].ctx;
+        for (t1 = t0 + 1; t1 < n_rows && rows[t1].ctx == &owner; ++t1) {}
+        for (const LoraAttachment& attached : owner.adapters) {
+            const LoraWeight* lw = attached.lora->find(w);
+            if (!lw) continue;
+            // Two thin matmuls: [n][n_in] -> [n][rank] -> [n][n_out]
+            const int32_t n = t1 - t0;
+            lora_ax.resize(std::max(lora_ax.size(), static_cast<size_t>(n * lw->a.ne1)));
+            lora_out.resize(std::max(lora_out.size(), static_cast<size_t>(n * w.ne1)));
+            matmul(lw->a, in + t0 * w.ne0, n, lora_ax.data());
+            matmul(lw->b, lora_ax.data(), n, lora_out.data());
+            const float scale = attached.scale * lw->scale;
+            float* dst = out + t0 * w.ne1;
+            for (int64_t i = 0; i < n * w.ne1; ++i) {
+                dst[i] += scale * lora_out[i];
+            }
+        }
+    }
+}
+
+void LlamaContext::alloc_scratch() {
+    if (!x.empty()) return;
+    const LlamaHParams& hp = model.hparams;
+    const size_t n_embd = hp.n_embd;
+    const size_t n_embd_kv = hp.n_embd_kv();
+    const size_t batch = kBatchSize;
+
+    x.resize(batch * n_embd);
+    xb.resize(batch * n_embd);
+    q.resize(batch * n_embd);
+    k.resize(batch * n_embd_kv);
+    v.resize(batch * n_embd_kv);
+    att_out.resize(batch * n_embd);
+    hb.resize(batch * hp.n_ff);
+    hb2.resize(batch * hp.n_ff);
+    rope_cs.resize(hp.n_rot);
+}
+
+bool LlamaContext::prepare(const int32_t* input, int32_t n_tokens, std::string* error) {
+    if (n_past + n_tokens > static_cast<int32_t>(n_ctx)) {
+        if (error) *error = "context window is full";
+        return false;
+    }
+    for (int32_t i = 0; i < n_tokens; ++i) {
+        if (input[i] < 0 || static_cast<uint32_t>(input[i]) >= model.hparams.n_vocab) {
+            if (error) *error = "token id out of range";
+            return false;
+        }
+    }
+    if (!reserve_kv(n_past + n_tokens, error)) {
+        return false;
+    }
+    // After a truncate() the first block written may still be shared with the
+    // prefix cache, whose copy must keep the old positions
+    const size_t first = n_past / kv_pool.block_size();
+    if (!kv_pool.make_private(kv, first) && !(prefix_cache && prefix_cache->evict(1) == 1 && kv_pool.make_private(kv, first))) {
+        if (error) *error = "KV cache pool is exhausted";
+        return false;
+    }
+    return true;
+}
+
+bool LlamaContext::decode(const int32_t* input, int32_t n_tokens, std::string* error, bool all_logits) {
+    if (n_tokens <= 0) return true;
+    if (!prepare(input, n_tokens, error)) {
+        return false;
+    }
+
+    const size_t n_vocab = model.hparams.n_vocab;
+    if (all_logits) {
+        logits_all.resize(static_cast<size_t>(n_tokens) * n_vocab);
+    }
+    LlamaBatchRow rows[kBatchSize];
+    for (int32_t done = 0; done < n_tokens; done += kBatchSize) {
+        const int32_t n = std::min(kBatchSize, n_tokens - done);
+        for (int32_t t = 0; t < n; ++t) {
+            const int32_t i = done + t;
+            float* out = all_logits ? &logits_all[i * n_vocab] : i == n_tokens - 1 ? logits.data() : nullptr;
+            rows[t] = {this, input[i], n_past + t, out};
+        }
+        eval_rows(rows, n);
+    }
+    if (all_logits) {
+        std::copy_n(&logits_all[(n_tokens - 1) * n_vocab], n_vocab, logits.data());
+    }
+    return true;
+}
+
+void LlamaContext::truncate(int32_t n_tokens) {
+    n_past = std::max(0, std::min(n_tokens, n_past));
+    tokens.resize(n_past);
+    kv_pool.truncate(kv, n_past);
+}
+
+size_t LlamaContext::scratch_bytes() const {
+    size_t bytes = 0;
+    for (const std::vector<float>* buf : {&x, &xb, &q, &k, &v, &att_out, &hb, &hb2, &scores, &rope_cs, &out_logits,
+                                          &probs, &draft_probs, &sampler_logits, &logits, &logits_all, &lora_ax,
+                                          &lora_out}) {
+        bytes += buf->capacity() * sizeof(float);
+    }
+    return bytes + q_head.capacity() + act_scratch.capacity();
+}
+
+bool LlamaContext::prefill(const std::vector<int32_t>& input, std::string* error,
+                           GenerationRequest* request) {
+    reset();
+    // Start from the longest cached prefix and prefill only the remainder
+    if (shares_prefixes()) {
+        n_past = prefix_cache->match(input, kv);
+        tokens.assign(input.begin(), input.begin() + n_past);
+    }
+    if (request) {
+        request->stats.n_cached_tokens = n_past;
+    }
+    const int32_t n_input = static_cast<int32_t>(input.size());
+    if (!request) {
+        if (!decode(input.data() + n_past, n_input - n_past, error)) {
+            return false;
+        }
+    } else {
+        // One forward pass at a time, so a long prompt can be cancelled
+        StopReason reason;
+        while (n_past < n_input) {
+            if (request->should_stop(&reason)) {
+                // What was prefilled is kept for a retry of the same prompt
+                if (shares_prefixes()) prefix_cache->insert(tokens, kv);
+                return false;
+            }
+            if (!decode(input.data() + n_past, std::min(kBatchSize, n_input - n_past), error)) {
+                return false;
+            }
+        }
+    }
+    if (shares_prefixes()) {
+        prefix_cache->insert(tokens, kv);
+    }
+    return true;
+}
+
+void LlamaContext::eval_rows(const LlamaBatchRow* rows, int32_t n_rows) {
+    alloc_scratch();
+    const LlamaHParams& hp = model.hparams;
+    const int64_t n_embd = hp.n_embd;
+    const int64_t n_embd_kv = hp.n_embd_kv();
+    const int64_t head_dim = hp.head_dim;
+    const int64_t n_ff = hp.n_ff;
+    const int32_t n_group = static_cast<int32_t>(hp.n_head / hp.n_head_kv);
+    const int32_t block_size = static_cast<int32_t>(kv_pool.block_size());
+    const GGMLType kv_type = kv_pool.type();
+    const QuantTypeKernels& kq = model.kernels->types[kv_type];
+    const size_t row_bytes = kv_pool.row_bytes();
+    const float kq_scale = 1.0f / std::sqrt(static_cast<float>(head_dim));
+
+    for (int32_t t = 0; t < n_rows; ++t) {
+        dequantize_row(model.tok_embd.type, model.tok_embd.row(rows[t].token), &x[t * n_embd], n_embd);
+    }
+    // A work item is one row's query heads that share a KV head, so each K and
+    // V row is read once for all of them. When that leaves threads idle (a
+    // single decode row with few KV heads), items are single heads instead.
+    const int n_threads = model.threads->size();
+    const int32_t n_item_heads = static_cast<int64_t>(n_rows) * hp.n_head_kv >= n_threads ? n_group : 1;
+    const int64_t items_per_row = hp.n_head / n_item_heads;
+    // Attention scratch, one slice per compute thread, independent of n_kv
+    const size_t q_head_bytes = ggml_row_size(kq.vec_dot_type, head_dim);
+    const int64_t scores_stride = n_group * (kAttnTile + 2);
+    scores.resize(std::max(scores.size(), static_cast<size_t>(scores_stride * n_threads)));
+    q_head.resize(std::max(q_head.size(), q_head_bytes * n_group * n_threads));
+
+    LayerStreamer* const streamer = model.streamer.get();
+    for (uint32_t il = 0; il < hp.n_layer; ++il) {
+        const LlamaLayer& layer = model.layers[il];
+        if (streamer) streamer->begin_layer(il);
+
+        // Attention
+        for (int32_t t = 0; t < n_rows; ++t) {
+            op_rms_norm(&xb[t * n_embd], &x[t * n_embd], layer.attn_norm.data(), n_embd, hp.rms_eps);
+        }
+        project(layer.wq, rows, n_rows, xb.data(), q.data());
+        project(layer.wk, rows, n_rows, xb.data(), k.data());
+        project(layer.wv, rows, n_rows, xb.data(), v.data());
+
+        for (int32_t t = 0; t < n_rows; ++t) {
+            const int64_t pos = rows[t].pos;
+            op_rope_cache(rope_cs.data(), hp.n_rot, pos, hp.rope_freq_base, hp.rope_freq_scale);
+            op_rope(&q[t * n_embd], hp.n_head, head_dim, hp.n_rot, rope_cs.data());
+            op_rope(&k[t * n_embd_kv], hp.n_head_kv, head_dim, hp.n_rot, rope_cs.data());
+            const int32_t block = rows[t].ctx->kv.blocks[pos / block_size];
+            const int64_t slot = pos % block_size;
+            quantize_row(kv_type, &k[t * n_embd_kv], kv_pool.k(block, il) + slot * row_bytes, n_embd_kv);
+            quantize_row(kv_type, &v[t * n_embd_kv], kv_pool.v(block, il) + slot * row_bytes, n_embd_kv);
+        }
+
+        // Single pass over the KV positions a tile at a time with an online
+        // softmax: each tile's scores are exponentiated against the running
+        // max, the output and sum so far are rescaled when the max grows, and
+        // the tile's V rows are accumulated before the next tile is scored
+        model.threads->parallel_for(n_rows * items_per_row, 1, [&](int64_t begin, int64_t end, int thread) {
+            float* sc = &scores[thread * scores_stride]; // [head][kAttnTile]
+            float* run_max = sc + n_group * kAttnTile;   // [head]
+            float* run_sum = run_max + n_group;          // [head]
+            uint8_t* qh = &q_head[thread * q_head_bytes * n_group];
+            for (int64_t item = begin; item < end; ++item) {
+                const int64_t t = item / items_per_row;
+                const uint32_t h0 = static_cast<uint32_t>(item % items_per_row) * n_item_heads;
+                const KVSequence& seq = rows[t].ctx->kv;
+                const int64_t n_kv = rows[t].pos + 1; // causal: attend to positions <= own
+                const size_t head_off = ggml_row_size(kv_type, (h0 / n_group) * head_dim);
+                float* out = &att_out[t * n_embd + h0 * head_dim]; // the item's heads are adjacent
+                // Scores come straight from the stored K rows via the matching
+                // vec_dot kernel, so each query head is converted once
+                for (int32_t g = 0; g < n_item_heads; ++g) {
+                    quantize_row(kq.vec_dot_type, &q[t * n_embd + (h0 + g) * head_dim], qh + g * q_head_bytes,
+                                 head_dim);
+                    run_max[g] = -INFINITY;
+                    run_sum[g] = 0.0f;
+                }
+                std::fill_n(out, n_item_heads * head_dim, 0.0f);
+
+                for (int64_t p0 = 0; p0 < n_kv; p0 += kAttnTile) {
+                    const int64_t n = std::min(kAttnTile, n_kv - p0);
+                    // Walk the block table; each block holds block_size positions
+                    for (int64_t b0 = 0; b0 < n; b0 += block_size) {
+                        const uint8_t* kb = kv_pool.k(seq.blocks[(p0 + b0) / block_size], il) + head_off;
+                        const int64_t nb = std::min<int64_t>(block_size, n - b0);
+                        for (int64_t j = 0; j < nb; ++j) {
+                            for (int32_t g = 0; g < n_item_heads; ++g) {
+                                kq.vec_dot(head_dim, &sc[g * kAttnTile + b0 + j], kb + j * row_bytes,
+                                           qh + g * q_head_bytes);
+                            }
+                        }
+                    }
+                    for (int32_t g = 0; g < n_item_heads; ++g) {
+                        float* s = &sc[g * kAttnTile];
+                        const float tile_max = op_max(s, n) * kq_scale;
+                        if (tile_max > run_max[g]) {
+                            if (run_sum[g] > 0.0f) {
+                                const float c = std::exp(run_max[g] - tile_max);
+                                op_scale(out + g * head_dim, c, head_dim);
+                                run_sum[g] *= c;
+                            }
+                            run_max[g] = tile_max;
+                        }
+                        run_sum[g] += op_exp_sum(s, n, kq_scale, -run_max[g]);
+                    }
+                    for (int64_t b0 = 0; b0 < n; b0 += block_size) {
+                        const uint8_t* vb = kv_pool.v(seq.blocks[(p0 + b0) / block_size], il) + head_off;
+                        const int64_t nb = std::min<int64_t>(block_size, n - b0);
+                        for (int64_t j = 0; j < nb; ++j) {
+                            for (int32_t g = 0; g < n_item_heads; ++g) {
+                                axpy_row(kv_type, out + g * head_dim, sc[g * kAttnTile + b0 + j], vb + j * row_bytes,
+                                         head_dim);
+                            }
+                        }
+                    }
+                }
+                for (int32_t g = 0; g < n_item_heads; ++g) {
+                    op_scale(out + g * head_dim, 1.0f / run_sum[g], head_dim);
+                }
+            }
+        });
+        project(layer.wo, rows, n_rows, att_out.data(), xb.data());
+        op_add(x.data(), xb.data(), n_rows * n_embd);
+
+        // Feed-forward (SwiGLU)
+        for (int32_t t = 0; t < n_rows; ++t) {
+            op_rms_norm(&xb[t * n_embd], &x[t * n_embd], layer.ffn_norm.data(), n_embd, hp.rms_eps);
+        }
+        project(layer.ffn_gate, rows, n_rows, xb.data(), hb.data());
+        project(layer.ffn_up, rows, n_rows, xb.data(), hb2.data());
+        op_swiglu(hb.data(), hb.data(), hb2.data(), n_rows * n_ff);
+        project(layer.ffn_down, rows, n_rows, hb.data(), xb.data());
+        op_add(x.data(), xb.data(), n_rows * n_embd);
+        if (streamer) streamer->end_layer(il);
+    }
+
+    for (int32_t t = 0; t < n_rows; ++t) {
+        rows[t].ctx->tokens.push_back(rows[t].token);
+        rows[t].ctx->n_past = rows[t].pos + 1;
+    }
+
+    // Output head only for the rows that want logits
+    int32_t n_out = 0;
+    for (int32_t t = 0; t < n_rows; ++t) {
+        if (!rows[t].logits && !rows[t].embd) continue;
+        float* normed = &xb[n_out * n_embd];
+        op_rms_norm(normed, &x[t * n_embd], model.output_norm.data(), n_embd, hp.rms_eps);
+        if (rows[t].embd) std::copy_n(normed, n_embd, rows[t].embd);
+        if (rows[t].logits) n_out++;
+    }
+    if (n_out == 0) return;
+    const size_t n_vocab = hp.n_vocab;
+    out_logits.resize(std::max(out_logits.size(), n_out * n_vocab));
+    matmul(model.output, xb.data(), n_out, out_logits.data());
+    for (int32_t t = 0, j = 0; t < n_rows; ++t) {
+        if (rows[t].logits) {
+            std::copy_n(&out_logits[j++ * n_vocab], n_vocab, rows[t].logits);
+        }
+    }
+}
+
+void LlamaContext::compute_probs(const float* in, const GenerationParams& params, size_t n_history,
+                                 std::vector<float>& out) {
+    const int32_t n_vocab = static_cast<int32_t>(model.hparams.n_vocab);
+    sampler_logits.assign(in, in + n_vocab);
+    sampler.apply(sampler_logits.data(), n_vocab, params, tokens.data(), n_history);
+    if (sampler.dense()) {
+        const float inv_total = 1.0f / sampler.total();
+        out.resize(n_vocab);
+        for (int32_t i = 0; i < n_vocab; ++i) {
+            out[i] = sampler_logits[i] * inv_total;
+        }
+        return;
+    }
+    out.assign(n_vocab, 0.0f);
+    for (const TokenProb& c : sampler.candidates()) {
+        out[c.id] = c.p;
+    }
+}
+
+int32_t LlamaContext::sample_from(const std::vector<float>& p) {
+    const int32_t n = static_cast<int32_t>(p.size());
+    float r = std::uniform_real_distribution<float>(0.0f, 1.0f)(rng);
+    for (int32_t i = 0; i < n; ++i) {
+        if (r < p[i]) return i;
+        r -= p[i];
+    }
+    // Rounding left r above the total; take the last token with any mass
+    for (int32_t i = n - 1; i > 0; --i) {
+        if (p[i] > 0.0f) return i;
+    }
+    return 0;
+}
+
+int32_t LlamaContext::sample(const GenerationParams& params, const TokenFilter* filter) {
+    sampler.apply(logits.data(), static_cast<int32_t>(logits.size()), params, tokens.data(), tokens.size(),
+                  filter);
+    return sampler.sample(rng);
+}
+
+bool LlamaContext::speculate(LlamaContext& draft, int32_t n_draft, const GenerationParams& params,
+                             std::vector<int32_t>& out, std::string* error) {
+    const size_t n_vocab = model.hparams.n_vocab;
+    const int32_t n0 = n_past;
+
+    // Draft n_draft tokens autoregressively, keeping each proposal distribution q_i
+    draft_probs.resize(static_cast<size_t>(n_draft) * n_vocab);
+    std::vector<int32_t> drafted;
+    for (int32_t i = 0; i < n_draft; ++i) {
+        draft.compute_probs(draft.logits.data(), params, draft.tokens.size(), probs);
+        std::copy(probs.begin(), probs.end(), &draft_probs[i * n_vocab]);
+        const int32_t id = sample_from(probs);
+        drafted.push_back(id);
+        if (!draft.decode(&id, 1, error)) {
+            draft.truncate(n0);
+            return false;
+        }
+        if (model.vocab.is_eog(id)) break;
+    }
+    const int32_t n_drafted_now = static_cast<int32_t>(drafted.size());
+
+    // Target distribution after the current last token, then one batched pass
+    // over the drafts for the distributions after each of them. Penalties see
+    // the same history the draft did at each position.
+    std::vector<float> p;
+    compute_probs(logits.data(), params, n0, p);
+    if (!decode(drafted.data(), n_drafted_now, error, true)) {
+        draft.truncate(n0);
+        return false;
+    }
+
+    // Accept d_i with probability min(1, p(d_i) / q(d_i)); on the first rejection
+    // resample from the residual max(0, p - q). This leaves the output
+    // distributed exactly as sampling from the target alone, and for greedy
+    // (one-hot p and q) accepts exactly the drafts the target would pick.
+    int32_t n_accepted = 0;
+    int32_t next = -1;
+    for (int32_t i = 0; i < n_drafted_now; ++i) {
+        const int32_t id = drafted[i];
+        const float* q = &draft_probs[i * n_vocab];
+        const float u = std::uniform_real_distribution<float>(0.0f, 1.0f)(rng);
+        if (u * q[id] < p[id]) {
+            n_accepted++;
+            compute_probs(&logits_all[i * n_vocab], params, n0 + i + 1, p);
+            continue;
+        }
+        // The residual goes to a separate buffer: when it has no mass (q covers
+        // p everywhere) p itself is still intact to sample from, since the
+        // logits it came from were overwritten by the batched pass above
+        probs.resize(n_vocab);
+        float sum = 0.0f;
+        for (size_t t = 0; t < n_vocab; ++t) {
+            probs[t] = std::max(0.0f, p[t] - q[t]);
+            sum += probs[t];
+        }
+        if (sum > 0.0f) {
+            for (float& pt : probs) pt /= sum;
+            p.swap(probs);
+        }
+        break;
+    }
+    // Either a residual sample or, when every draft passed, a bonus token from
+    // the target's distribution after the last draft
+    next = sample_from(p);
+
+    n_drafted += n_drafted_now;
+    n_draft_accepted += n_accepted;
+
+    out.assign(drafted.begin(), drafted.begin() + n_accepted);
+    out.push_back(next);
+    truncate(n0 + n_accepted);
+    draft.truncate(n0 + n_accepted);
+    return true;
+}
+
+std::vector<int32_t> LlamaContext::prompt_tokens(std::string_view prompt, const GenerationParams& params) const {
+    std::vector<int32_t> input = model.vocab.tokenize(prompt, model.vocab.add_bos);
+    // Keep the end of an over-long prompt and leave room for the reply
+    const size_t budget = n_ctx > static_cast<uint32_t>(params.max_tokens) + 1
+                              ? n_ctx - static_cast<uint32_t>(params.max_tokens)
+                              : n_ctx / 2;
+    if (input.size() > budget) {
+        input.erase(input.begin(), input.end() - static_cast<std::ptrdiff_t>(budget));
+    }
+    return input;
+}
+
+std::string LlamaContext::generate(std::string_view prompt, const GenerationParams& params,
+                                   const TokenCallback& on_text) {
+    GenerationTimer timer;
+    const std::vector<int32_t> input = prompt_tokens(prompt, params);
+    GenerationRequest* request = params.request;
+    if (request) {
+        request->stats = GenerationStats();
+        request->stats.n_prompt_tokens = static_cast<int32_t>(input.size());
+    }
+    if (params.seed >= 0) {
+        rng.seed(static_cast<std::mt19937::result_type>(params.seed));
+    }
+    std::string error;
+    StopReason stop = StopReason::MaxTokens;
+    size_t peak_kv_blocks = 0;
+    timer.prefill_begin();
+    const bool prefilled = prefill(input, &error, request);
+    timer.prefill_end();
+    if (!prefilled) {
+        // Stopped between prompt chunks, or failed
+        if (request) {
+            if (!request->should_stop(&request->stats.stop_reason)) {
+                request->stats.stop_reason = StopReason::Error;
+            }
+            timer.finish(request->stats);
+            request->stats.peak_scratch_bytes = scratch_bytes();
+            request->stats.peak_kv_bytes = kv.blocks.size() * kv_pool.block_bytes();
+        }
+        return "";
+    }
+    peak_kv_blocks = kv.blocks.size();
+
+    std::unique_ptr<GrammarMatcher> grammar;
+    if (params.grammar) {
+        grammar = std::make_unique<GrammarMatcher>(params.grammar, model.token_trie(), model.vocab);
+    }
+
+    // The draft mirrors this context's tokens; any failure just turns it off.
+    // Draft proposals are not grammar-checked, so a grammar turns it off too.
+    LlamaContext* draft = model.draft_model && !grammar ? model.draft_model->context.get() : nullptr;
+    if (draft && !draft->prefill(input, &error)) {
+        draft = nullptr;
+    }
+
+    std::string output;
+    std::string chunk;
+    Detokenizer detokenizer(model.vocab);
+    std::vector<int32_t> step;
+    int32_t n_generated = 0;
+    int32_t n_timed = 0;
+    bool done = false;
+    while (!done && n_generated < params.max_tokens) {
+        if (request && request->should_stop(&stop)) {
+            break;
+        }
+        // Never draft past max_tokens or either context's window
+        const int32_t n_spec = draft ? std::min({model.n_draft, params.max_tokens - n_generated - 1,
+                                                 static_cast<int32_t>(std::min(n_ctx, draft->n_ctx)) - n_past - 1})
+                                     : 0;
+        const bool speculated = n_spec > 0 && speculate(*draft, n_spec, params, step, &error);
+        if (n_spec > 0 && !speculated) {
+            draft = nullptr;
+        }
+        if (!speculated) {
+            step.assign(1, sample(params, grammar.get()));
+        }
+
+        for (int32_t id : step) {
+            // A rejected token, or none allowed (-1), means the vocabulary
+            // cannot continue the grammar
+            if (id < 0 || model.vocab.is_eog(id) || (grammar && !grammar->accept(id))) {
+                stop = id >= 0 && model.vocab.is_eog(id) ? StopReason::EndOfText : StopReason::Grammar;
+                done = true;
+                break;
+            }
+            n_generated++;
+
+            chunk.clear();
+            if (detokenizer.push(id, chunk) > 0) {
+                output += chunk;
+                if (on_text && !on_text(chunk)) {
+                    stop = StopReason::Callback;
+                    done = true;
+                    break;
+                }
+            }
+            if (grammar && grammar->finished()) {
+                stop = StopReason::Grammar;
+                done = true;
+                break;
+            }
+        }
+        if (n_generated > n_timed) {
+            timer.tokens(n_generated - n_timed);
+            n_timed = n_generated;
+        }
+        if (done) {
+            break;
+        }
+
+        // Only the last token of a step is not in the cache yet. A full window
+        // is shifted rather than ending the reply.
+        const int32_t id = step.back();
+        const bool shift = n_past >= static_cast<int32_t>(n_ctx);
+        if ((shift && !shift_context(&error)) || !decode(&id, 1, &error)) {
+            stop = StopReason::Error;
+            break;
+        }
+        if (draft && !(shift ? draft->prefill(tokens, &error) : draft->decode(&id, 1, &error))) {
+            draft = nullptr;
+        }
+        peak_kv_blocks = std::max(peak_kv_blocks, kv.blocks.size());
+    }
+
+    chunk.clear();
+    if (detokenizer.flush(chunk) > 0) {
+        output += chunk;
+        if (on_text) on_text(chunk);
+    }
+    // The reply is usually part of the next turn's prompt
+    if (shares_prefixes() && !kv_shifted) {
+        prefix_cache->insert(tokens, kv);
+    }
+    if (request) {
+        GenerationStats& stats = request->stats;
+        stats.n_generated = n_generated;
+        stats.stop_reason = stop;
+        timer.finish(stats);
+        stats.peak_scratch_bytes = scratch_bytes();
+        stats.peak_kv_bytes = peak_kv_blocks * kv_pool.block_bytes();
+    }
+    return output;
+}
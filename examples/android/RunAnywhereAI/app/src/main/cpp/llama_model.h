@@ -0,0 +1,432 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gguf.h"
+#include "grammar.h"
+#include "kv_cache.h"
+#include "llama_vocab.h"
+#include "prefix_cache.h"
+#include "quants.h"
+#include "sampler.h"
+#include "thread_pool.h"
+
+// Hyperparameters of a llama-architecture model, read from GGUF metadata
+struct LlamaHParams {
+    uint32_t n_vocab = 0;
+    uint32_t n_ctx_train = 0;
+    uint32_t n_embd = 0;
+    uint32_t n_layer = 0;
+    uint32_t n_head = 0;
+    uint32_t n_head_kv = 0;
+    uint32_t n_ff = 0;
+    uint32_t n_rot = 0;
+    uint32_t head_dim = 0;
+    float rms_eps = 1e-5f;
+    float rope_freq_base = 10000.0f;
+    float rope_freq_scale = 1.0f;
+
+    uint32_t n_embd_kv() const { return n_head_kv * head_dim; }
+};
+
+// A 2D weight tensor viewed in place inside the mapped GGUF file
+struct LlamaTensor {
+    const uint8_t* data = nullptr;
+    GGMLType type = GGML_TYPE_F32;
+    int64_t ne0 = 0; // row length (input features)
+    int64_t ne1 = 1; // number of rows (output features)
+
+    size_t row_size() const { return ggml_row_size(type, ne0); }
+    const uint8_t* row(int64_t i) const { return data + i * row_size(); }
+    size_t n_bytes() const { return row_size() * static_cast<size_t>(ne1); }
+};
+
+struct LlamaLayer {
+    std::vector<float> attn_norm;
+    std::vector<float> ffn_norm;
+    LlamaTensor wq;
+    LlamaTensor wk;
+    LlamaTensor wv;
+    LlamaTensor wo;
+    LlamaTensor ffn_gate;
+    LlamaTensor ffn_up;
+    LlamaTensor ffn_down;
+
+    // The matmul weights in the order a forward pass reads them
+    std::array<const LlamaTensor*, 7> matrices() const {
+        return {&wq, &wk, &wv, &wo, &ffn_gate, &ffn_up, &ffn_down};
+    }
+};
+
+// Why a generation ended
+enum class StopReason : uint8_t {
+    MaxTokens,  // max_tokens were generated
+    EndOfText,  // the model sampled an end-of-generation token
+    Grammar,    // the grammar is complete, or no token can continue it
+    Callback,   // on_text returned false
+    Cancelled,  // GenerationRequest::cancel()
+    Deadline,   // the request's deadline passed
+    Error,      // the prompt or reply did not fit, or decoding failed
+};
+
+const char* stop_reason_name(StopReason reason);
+
+// Timing and token accounting of one generation, measured natively
+struct GenerationStats {
+    int32_t n_prompt_tokens = 0;  // after truncation to the window
+    int32_t n_cached_tokens = 0;  // of those, reused from the prefix cache
+    int32_t n_generated = 0;
+    double queue_ms = 0.0;        // waiting for a scheduler slot
+    double prefill_ms = 0.0;      // evaluating the rest of the prompt
+    double ttft_ms = 0.0;         // call start to the first generated token
+    double decode_ms = 0.0;       // first to last generated token
+    // Latency of each generated token after the first
+    float token_p50_ms = 0.0f;
+    float token_p90_ms = 0.0f;
+    float token_p99_ms = 0.0f;
+    float token_max_ms = 0.0f;
+    size_t peak_scratch_bytes = 0; // forward-pass and sampling buffers
+    size_t peak_kv_bytes = 0;      // KV blocks the sequence held at most
+    StopReason stop_reason = StopReason::Error; // Error if it never ran
+};
+
+// Timestamps of one generation, turned into GenerationStats at the end. The
+// first call of admitted() / prefill_begin() / prefill_end() counts, so a
+// preempted and recomputed request still reports its original timeline.
+// Tokens of one step (several with speculative decoding) share its latency.
+class GenerationTimer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    GenerationTimer() : start(Clock::now()) {}
+
+    void admitted() { mark(admit_time); }
+    void prefill_begin() { mark(prefill_start); }
+    void prefill_end() { mark(prefill_stop); }
+    // n tokens were generated since the previous call
+    void tokens(int32_t n);
+    // Fills in the timing fields of `stats`
+    void finish(GenerationStats& stats);
+
+private:
+    static void mark(Clock::time_point& t) {
+        if (t == Clock::time_point()) t = Clock::now();
+    }
+
+    Clock::time_point start;
+    Clock::time_point admit_time;
+    Clock::time_point prefill_start;
+    Clock::time_point prefill_stop;
+    Clock::time_point first_token;
+    Clock::time_point last_token;
+    std::vector<float> latencies_ms;
+};
+
+// Handle on one generation, for stopping it from another thread and reading
+// how it went. cancel() and the deadline are checked between forward passes
+// (decode steps and prompt chunks), so the compute threads are released
+// within one step; generate() then returns the partial reply as usual.
+struct GenerationRequest {
+    std::atomic<bool> cancelled{false};
+    // Set before the request starts; max() for none
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+    // Written by generate() before it returns
+    GenerationStats stats;
+
+    void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+    // True, with the reason, once generation should stop
+    bool should_stop(StopReason* reason) const;
+};
+
+struct GenerationParams {
+    int32_t max_tokens = 128;
+    float temperature = 0.7f;
+    float top_p = 0.9f;              // 1 disables
+    int32_t top_k = 40;              // <= 0 disables
+    float min_p = 0.0f;              // relative to the most likely token; 0 disables
+    float repeat_penalty = 1.0f;     // recent tokens' logits: positive / penalty, negative * penalty
+    float frequency_penalty = 0.0f;  // subtracted per occurrence among recent tokens
+    float presence_penalty = 0.0f;   // subtracted once if among recent tokens
+    int32_t penalty_last_n = 64;     // recent tokens the penalties look at; -1 for the whole context
+    int64_t seed = -1;               // < 0 seeds from the system
+    // Optional: only text the grammar matches is generated, and generation
+    // ends once it can match nothing more. Disables speculative decoding.
+    std::shared_ptr<const Grammar> grammar;
+    // Optional: cancellation, deadline and outcome. Must outlive the call.
+    GenerationRequest* request = nullptr;
+};
+
+// Receives each newly generated piece of text (always complete UTF-8).
+// Returning false stops generation.
+using TokenCallback = std::function<bool(const std::string& text)>;
+
+struct LlamaContext;
+struct LlamaLora;
+class LayerStreamer;
+class LlamaScheduler;
+
+struct LlamaModel {
+    std::string model_path;
+    size_t vocab_size;
+    size_t context_size;
+    bool loaded;
+
+    // Memory-mapped GGUF file; tensor data pages in lazily on first access
+    std::unique_ptr<GGUFFile> gguf;
+    // Matmul kernels for this CPU, chosen once at load
+    const QuantKernels* kernels = nullptr;
+
+    LlamaHParams hparams;
+    LlamaVocab vocab;
+    LlamaTensor tok_embd;
+    LlamaTensor output;
+    std::vector<float> output_norm;
+    std::vector<LlamaLayer> layers;
+
+    // Compute threads for matmuls and attention, shared by all contexts
+    std::unique_ptr<ThreadPool> threads;
+    // Optional: keeps the resident weights within a memory budget
+    std::unique_ptr<LayerStreamer> streamer;
+
+    // KV blocks shared by the model's contexts; must outlive them
+    std::unique_ptr<KVCachePool> kv_pool;
+    // Prompt prefixes whose KV blocks are kept across generate() calls
+    std::unique_ptr<PrefixCache> prefix_cache;
+    // Single-conversation state: sessions, speculative decoding, benchmarks.
+    // Holds the last sequence the scheduler finished for a stateless request,
+    // or what a speculative generate or a restored session left, in a window
+    // of the pool of its own.
+    std::unique_ptr<LlamaContext> context;
+    // Batches concurrent nativeGenerate / nativeGenerateStream calls
+    std::unique_ptr<LlamaScheduler> scheduler;
+    // Live LlamaConversations; each has a window of blocks added to the pool
+    std::atomic<uint32_t> n_conversations{0};
+    // Held shared by every call that runs the model or reaches the scheduler
+    // (generate, embed, the KV cache benchmark, sessions, stats), and
+    // exclusively around create_context, set_threads and set_memory_budget,
+    // which replace what those calls use. Taking it exclusively waits for
+    // in-flight requests to finish and holds back new ones.
+    mutable std::shared_mutex state_mutex;
+
+    // Optional smaller model with the same vocabulary that proposes n_draft
+    // tokens per step for speculative decoding (not owned)
+    LlamaModel* draft_model = nullptr;
+    int32_t n_draft = 0;
+
+    explicit LlamaModel(const std::string& path);
+    ~LlamaModel();
+
+    bool load(std::string* error);
+
+    // (Re)creates the KV pool, prefix cache and context, storing keys and values
+    // as kv_type (F32, F16, Q8_0 or Q4_0). Any cached conversation state is dropped.
+    // Fails while LlamaConversations exist, as they hold blocks of the old pool.
+    // Once the model is in use, the caller holds state_mutex exclusively.
+    bool create_context(GGMLType kv_type, std::string* error);
+
+    // Replaces the compute thread pool; n_threads 0 picks the policy's default.
+    // Once the model is in use, the caller holds state_mutex exclusively.
+    void set_threads(int32_t n_threads, ThreadAffinity affinity);
+
+    // Limits the weights kept in memory to budget_bytes by streaming layers
+    // from the mapped file (see LayerStreamer); 0 removes the limit. Fails if
+    // the budget is too small for the model. The caller holds state_mutex
+    // exclusively.
+    bool set_memory_budget(size_t budget_bytes, std::string* error);
+
+    // Enables speculative decoding with `draft` (nullptr disables it). The draft
+    // must share this model's vocabulary and outlive its use here. It may still
+    // serve requests of its own, since speculation parks the draft's scheduler
+    // while it uses the draft's context, but must not itself speculate with
+    // this model. The caller holds state_mutex exclusively.
+    bool set_draft(LlamaModel* draft, int32_t n_draft, std::string* error);
+
+    // The vocabulary as a trie for grammar matching, built on first use
+    const TokenTrie& token_trie() const;
+
+private:
+    bool load_hparams(std::string* error);
+    bool load_weights(std::string* error);
+
+    mutable std::once_flag trie_once;
+    mutable std::unique_ptr<TokenTrie> trie;
+};
+
+// One token of a multi-sequence batch: `token` at position `pos` of ctx's cache.
+// Logits are written to `logits` if it is non-null, and the final normalized
+// hidden state ([n_embd]) to `embd` if that is.
+struct LlamaBatchRow {
+    LlamaContext* ctx;
+    int32_t token;
+    int32_t pos;
+    float* logits;
+    float* embd = nullptr;
+};
+
+// A LoRA adapter attached to a context, its deltas multiplied by `scale`
+struct LoraAttachment {
+    std::shared_ptr<const LlamaLora> lora;
+    float scale = 1.0f;
+};
+
+// Per-conversation inference state: KV block table, scratch buffers and RNG
+struct LlamaContext {
+    static constexpr int32_t kBatchSize = 32;
+    // Leading "attention sink" tokens that context shifting never discards
+    static constexpr int32_t kSinkTokens = 4;
+
+    const LlamaModel& model;
+    KVCachePool& kv_pool;
+    PrefixCache* prefix_cache; // optional
+    uint32_t n_ctx;
+    int32_t n_past = 0;
+
+    // Tokens whose keys/values are in the cache, indexed by position
+    std::vector<int32_t> tokens;
+    // Blocks of kv_pool holding this context's keys and values
+    KVSequence kv;
+    // Logits of the last decoded token
+    std::vector<float> logits;
+    // [n_tokens][n_vocab] logits of every token of the last decode(..., true)
+    std::vector<float> logits_all;
+
+    // Adapters whose low-rank deltas are added to this context's projections
+    std::vector<LoraAttachment> adapters;
+
+    // Speculative decoding counters since the context was created
+    uint64_t n_drafted = 0;
+    uint64_t n_draft_accepted = 0;
+
+    std::mt19937 rng;
+
+    LlamaContext(const LlamaModel& model, KVCachePool& kv_pool, PrefixCache* prefix_cache, uint32_t n_ctx);
+    ~LlamaContext();
+    LlamaContext(const LlamaContext&) = delete;
+    LlamaContext& operator=(const LlamaContext&) = delete;
+
+    // Forgets all positions and returns their blocks to the pool
+    void reset();
+    // Replaces this context's sequence (tokens, KV blocks, RNG) with `other`'s,
+    // which must use the same pool; `other` is left empty
+    void take_sequence(LlamaContext& other);
+
+    // Replaces the attached adapters. Cached positions were computed with the
+    // old ones, so the context is reset.
+    void set_adapters(std::vector<LoraAttachment> list);
+
+    // The prefix cache holds base-model keys and values, so a context with
+    // adapters neither reuses nor publishes prefixes (it may still evict)
+    bool shares_prefixes() const { return prefix_cache && adapters.empty(); }
+
+    // Makes sure KV blocks exist for positions [0, n_tokens), evicting unused
+    // cached prefixes if the pool is full
+    bool reserve_kv(int32_t n_tokens, std::string* error);
+
+    // Frees room in a full window: keeps the sink tokens (rounded up to a whole
+    // block) and the most recent half of the rest, drops the blocks in between
+    // and re-rotates the kept keys to their new positions. Kept keys and values
+    // are not recomputed.
+    bool shift_context(std::string* error);
+
+    // Runs tokens through the model at positions n_past.. and appends them to
+    // the cache. Logits for the last token are left in `logits`; with all_logits
+    // every token's logits are also stored in `logits_all`.
+    bool decode(const int32_t* input, int32_t n_tokens, std::string* error, bool all_logits = false);
+
+    // Checks `input` and makes its positions writable: KV blocks are reserved and
+    // a shared first block is copied. Called by decode() and before eval_rows().
+    bool prepare(const int32_t* input, int32_t n_tokens, std::string* error);
+
+    // Runs up to kBatchSize rows through the model using this context's scratch
+    // buffers. Rows may belong to different contexts over the same KV pool; each
+    // context must have been prepare()d, and its rows must continue its cache in
+    // order. Weights are read once for all rows, which is what makes batching
+    // several sequences cheaper than decoding them one after another.
+    void eval_rows(const LlamaBatchRow* rows, int32_t n_rows);
+
+    // Drops every position >= n_tokens (e.g. rejected draft tokens)
+    void truncate(int32_t n_tokens);
+
+    // Memory held by the scratch, logits and sampling buffers; they only grow
+    size_t scratch_bytes() const;
+
+    // Resets the context and brings it to `input`, reusing cached prefixes.
+    // With a request, stops between chunks once it should (false, no error)
+    // and records how many tokens came from the prefix cache.
+    bool prefill(const std::vector<int32_t>& input, std::string* error, GenerationRequest* request = nullptr);
+
+    // Tokenizes and prefills the prompt, then samples up to max_tokens tokens.
+    // Any prompt prefix found in the prefix cache is reused instead of prefilled.
+    // `on_text` (optional) is invoked as soon as each token is sampled. Stats
+    // are written to params.request, if given.
+    std::string generate(std::string_view prompt, const GenerationParams& params,
+                         const TokenCallback& on_text);
+
+private:
+    friend class LlamaScheduler;
+    friend bool session_save(const LlamaContext& ctx, const std::string& path, std::string* error);
+    friend bool session_load(LlamaContext& ctx, const std::string& path, std::string* error);
+
+    // Tokenized prompt, keeping its end if it leaves no room for the reply
+    std::vector<int32_t> prompt_tokens(std::string_view prompt, const GenerationParams& params) const;
+
+    // Sizes the scratch buffers on first use, so contexts that only hold a
+    // sequence for the scheduler do not pay for them
+    void alloc_scratch();
+    void matmul(const LlamaTensor& w, const float* x, int32_t n_tokens, float* y);
+    // matmul() plus, for each run of rows of one context, that context's
+    // adapter deltas scale * B (A x) for `w`
+    void project(const LlamaTensor& w, const LlamaBatchRow* rows, int32_t n_rows, const float* x, float* y);
+
+    // Full-vocabulary next-token distribution for `logits` after the first
+    // n_history tokens (one-hot on the argmax when temperature <= 0)
+    void compute_probs(const float* logits, const GenerationParams& params, size_t n_history,
+                       std::vector<float>& probs);
+    int32_t sample_from(const std::vector<float>& probs);
+    // Samples the next token from `logits`, which the sampler chain clobbers;
+    // -1 if the filter allows no token
+    int32_t sample(const GenerationParams& params, const TokenFilter* filter = nullptr);
+
+    // One speculative step against `draft`, which must hold the same tokens.
+    // Sets `out` to the accepted draft tokens (already in both caches) followed
+    // by one token sampled from the target that is not decoded yet.
+    bool speculate(LlamaContext& draft, int32_t n_draft, const GenerationParams& params,
+                   std::vector<int32_t>& out, std::string* error);
+
+    // Set once positions were shifted; the cache then no longer matches a plain
+    // prefill of `tokens`, so it must not be published to the prefix cache
+    bool kv_shifted = false;
+
+    // Scratch buffers sized for kBatchSize tokens
+    std::vector<float> x;
+    std::vector<float> xb;
+    std::vector<float> q;
+    std::vector<float> k;
+    std::vector<float> v;
+    std::vector<float> att_out;
+    std::vector<float> hb;
+    std::vector<float> hb2;
+    std::vector<float> scores;   // [thread] one attention tile's scores, then running max and sum, per head
+    std::vector<float> rope_cs;
+    std::vector<uint8_t> q_head; // [thread] the query heads of a work item in the K cache's vec_dot_type
+    std::vector<uint8_t> act_scratch;
+    std::vector<float> lora_ax;  // A x of one adapter for a run of rows
+    std::vector<float> lora_out; // B (A x) of the same
+    std::vector<float> out_logits; // logits of the rows that asked for them
+    std::vector<float> probs;
+    std::vector<float> draft_probs; // [n_draft][n_vocab] draft distributions
+    std::vector<float> sampler_logits; // compute_probs' copy of the row it samples
+    Sampler sampler;
+};
@@ -0,0 +1,507 @@
+#include "llama_scheduler.h"
+
+#include <algorithm>
+
+struct LlamaScheduler::Request {
+    Request(LlamaModel& m, LlamaContext* conversation)
+        : owned(conversation ? nullptr
+                             : std::make_unique<LlamaContext>(m, *m.kv_pool, m.prefix_cache.get(),
+                                                              static_cast<uint32_t>(m.context_size))),
+          ctx(conversation ? *conversation : *owned), keep(conversation != nullptr), detokenizer(m.vocab) {}
+
+    // Scheduler thread only
+    std::unique_ptr<LlamaContext> owned;
+    LlamaContext& ctx;
+    bool keep;                 // ctx is a conversation's; its sequence outlives the request
+    std::vector<int32_t> prompt;
+    GenerationParams params;
+    std::unique_ptr<GrammarMatcher> grammar; // position in params.grammar, if any
+    bool started = false;      // prefix cache consulted
+    size_t n_prompt_done = 0;  // prompt tokens in the cache
+    int32_t next = -1;         // sampled token waiting to be decoded
+    int32_t n_generated = 0;
+    Detokenizer detokenizer;   // holds back incomplete UTF-8
+    std::string chunk;         // text of the latest token
+    bool in_batch = false;     // has rows in the current step
+    bool preempted = false;    // gave its blocks up this step; goes back to the queue
+    bool finished = false;
+    StopReason stop = StopReason::MaxTokens;
+    GenerationTimer timer;
+    int32_t n_cached = -1;     // prompt tokens found in the prefix cache when first started
+    size_t peak_kv_blocks = 0;
+    size_t peak_scratch_bytes = 0;
+
+    // Shared with the calling thread, guarded by the scheduler mutex
+    std::string text;          // complete UTF-8 not yet handed to the caller
+    bool done = false;
+    bool cancelled = false;
+    std::condition_variable cv;
+};
+
+struct LlamaScheduler::Job {
+    bool granted = false;
+    bool done = false;
+    std::condition_variable cv;
+};
+
+LlamaScheduler::LlamaScheduler(LlamaModel& m)
+    : model(m), workspace(m, *m.kv_pool, nullptr, static_cast<uint32_t>(m.context_size)) {
+    publish_cache_stats();
+    worker = std::thread(&LlamaScheduler::run, this);
+}
+
+LlamaScheduler::~LlamaScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+
+    // Wake everyone still waiting; their sequences give their blocks back here,
+    // while the pool still exists
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& req : active) {
+        req->ctx.reset();
+        req->stop = StopReason::Error;
+        req->done = true;
+        req->cv.notify_all();
+    }
+    for (auto& req : queue) {
+        req->stop = StopReason::Error;
+        req->done = true;
+        req->cv.notify_all();
+    }
+    for (auto& job : jobs) {
+        job->cv.notify_all();
+    }
+}
+
+std::string LlamaScheduler::generate(std::string_view prompt, const GenerationParams& params,
+                                     const TokenCallback& on_text) {
+    return generate(std::make_shared<Request>(model, nullptr), prompt, params, on_text);
+}
+
+std::string LlamaScheduler::generate(LlamaContext& ctx, std::string_view prompt, const GenerationParams& params,
+                                     const TokenCallback& on_text) {
+    return generate(std::make_shared<Request>(model, &ctx), prompt, params, on_text);
+}
+
+std::string LlamaScheduler::generate(std::shared_ptr<Request> req, std::string_view prompt,
+                                     const GenerationParams& params, const TokenCallback& on_text) {
+    req->prompt = req->ctx.prompt_tokens(prompt, params);
+    req->params = params;
+    if (params.grammar) {
+        req->grammar = std::make_unique<GrammarMatcher>(params.grammar, model.token_trie(), model.vocab);
+    }
+    if (params.seed >= 0) {
+        req->ctx.rng.seed(static_cast<std::mt19937::result_type>(params.seed));
+    }
+
+    GenerationRequest* request = params.request;
+    if (request) {
+        request->stats = GenerationStats();
+        request->stats.n_prompt_tokens = static_cast<int32_t>(req->prompt.size());
+        request->stats.stop_reason = params.max_tokens <= 0 ? StopReason::MaxTokens : StopReason::Error;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (stopping || req->prompt.empty() || params.max_tokens <= 0) {
+        return "";
+    }
+    queue.push_back(req);
+    counters.queued = static_cast<uint32_t>(queue.size());
+    wake.notify_all();
+
+    std::string output;
+    for (;;) {
+        req->cv.wait(lock, [&] { return req->done || !req->text.empty(); });
+        std::string chunk;
+        chunk.swap(req->text);
+        if (!chunk.empty()) {
+            output += chunk;
+            if (on_text && !req->cancelled) {
+                lock.unlock();
+                const bool keep_going = on_text(chunk);
+                lock.lock();
+                // The sequence leaves the batch at the next step
+                if (!keep_going) req->cancelled = true;
+            }
+        }
+        if (req->done && req->text.empty()) break;
+    }
+    if (request) {
+        GenerationStats& stats = request->stats;
+        stats.n_cached_tokens = std::max(0, req->n_cached);
+        stats.n_generated = req->n_generated;
+        stats.stop_reason = req->stop;
+        req->timer.finish(stats);
+        stats.peak_scratch_bytes = req->peak_scratch_bytes;
+        stats.peak_kv_bytes = req->peak_kv_blocks * model.kv_pool->block_bytes();
+    }
+    return output;
+}
+
+void LlamaScheduler::run_exclusive(const std::function<void()>& job) {
+    auto token = std::make_shared<Job>();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stopping) return;
+        jobs.push_back(token);
+        wake.notify_all();
+        token->cv.wait(lock, [&] { return token->granted || stopping; });
+        if (!token->granted) return;
+    }
+    // The scheduler thread is parked, so `job` may touch the pool freely, and it
+    // runs on this thread so JNI callbacks inside it stay valid
+    job();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        token->done = true;
+    }
+    token->cv.notify_all();
+}
+
+SchedulerStats LlamaScheduler::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+KVCacheStats LlamaScheduler::kv_cache_stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return kv_stats;
+}
+
+PrefixCacheStats LlamaScheduler::prefix_cache_stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return prefix_stats;
+}
+
+void LlamaScheduler::publish_cache_stats() {
+    kv_stats = model.kv_pool->stats();
+    if (model.prefix_cache) prefix_stats = model.prefix_cache->stats();
+}
+
+void LlamaScheduler::run() {
+    for (;;) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || !queue.empty() || !jobs.empty() || !active.empty(); });
+            if (stopping) break;
+
+            if (!jobs.empty()) {
+                // Let running sequences drain, but admit nobody new
+                if (active.empty()) {
+                    job = jobs.front();
+                    jobs.pop_front();
+                }
+            } else if (!pool_full || active.empty()) {
+                // After a preemption nobody joins until a sequence finishes
+                while (active.size() < kMaxActive && !queue.empty()) {
+                    queue.front()->timer.admitted();
+                    active.push_back(queue.front());
+                    queue.pop_front();
+                }
+            }
+            counters.active = static_cast<uint32_t>(active.size());
+            counters.queued = static_cast<uint32_t>(queue.size());
+
+            if (job) {
+                job->granted = true;
+                job->cv.notify_all();
+                job->cv.wait(lock, [&] { return job->done; });
+                publish_cache_stats();
+                continue;
+            }
+        }
+        step();
+        std::lock_guard<std::mutex> lock(mutex);
+        publish_cache_stats();
+    }
+}
+
+bool LlamaScheduler::step() {
+    const int32_t n_ctx = static_cast<int32_t>(workspace.n_ctx);
+    LlamaBatchRow rows[LlamaContext::kBatchSize];
+    int32_t n_rows = 0;
+    std::vector<Request*> sampled;
+    std::string error;
+
+    // Stopped requests leave before this step's forward pass, queued ones too
+    std::vector<std::shared_ptr<Request>> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& req : active) {
+            if (req->cancelled) {
+                req->stop = StopReason::Callback;
+                req->finished = true;
+            } else if (req->params.request && req->params.request->should_stop(&req->stop)) {
+                req->finished = true;
+            }
+        }
+        for (auto it = queue.begin(); it != queue.end();) {
+            GenerationRequest* request = (*it)->params.request;
+            if (request && request->should_stop(&(*it)->stop)) {
+                dropped.push_back(*it);
+                it = queue.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (auto& req : dropped) {
+        finish(*req);
+    }
+
+    // Generating sequences first (one token each) so replies keep streaming
+    // while new prompts are being prefilled
+    for (auto& req : active) {
+        if (req->finished || req->preempted || req->next < 0) continue;
+        if (n_rows == LlamaContext::kBatchSize) break;
+        LlamaContext& ctx = req->ctx;
+        if (ctx.n_past >= n_ctx && !ctx.shift_context(&error)) {
+            req->stop = StopReason::Error;
+            req->finished = true;
+            continue;
+        }
+        if (!make_room(*req, &req->next, 1)) continue;
+        rows[n_rows++] = {&ctx, req->next, ctx.n_past, ctx.logits.data()};
+        req->in_batch = true;
+        sampled.push_back(req.get());
+    }
+
+    // Prompt chunks fill the rest of the batch
+    for (auto& req : active) {
+        if (req->finished || req->preempted || req->next >= 0) continue;
+        if (n_rows == LlamaContext::kBatchSize) break;
+        LlamaContext& ctx = req->ctx;
+        if (!req->started) {
+            req->started = true;
+            if (req->keep && !ctx.kv_shifted) {
+                // Keep what the conversation shares with the prompt, leaving at
+                // least the last prompt token to produce logits
+                size_t n_keep = 0;
+                const size_t n_max = std::min(ctx.tokens.size(), req->prompt.size() - 1);
+                while (n_keep < n_max && ctx.tokens[n_keep] == req->prompt[n_keep]) n_keep++;
+                ctx.truncate(static_cast<int32_t>(n_keep));
+                req->n_prompt_done = n_keep;
+            } else {
+                ctx.reset();
+            }
+            // Otherwise start from the longest cached prefix and prefill only the remainder
+            if (ctx.n_past == 0 && ctx.shares_prefixes()) {
+                ctx.n_past = ctx.prefix_cache->match(req->prompt, ctx.kv);
+                ctx.tokens.assign(req->prompt.begin(), req->prompt.begin() + ctx.n_past);
+                req->n_prompt_done = ctx.n_past;
+            }
+            if (req->n_cached < 0) req->n_cached = ctx.n_past;
+            req->timer.prefill_begin();
+        }
+        const int32_t n = std::min<int32_t>(LlamaContext::kBatchSize - n_rows,
+                                            static_cast<int32_t>(req->prompt.size() - req->n_prompt_done));
+        const int32_t* input = req->prompt.data() + req->n_prompt_done;
+        if (!make_room(*req, input, n)) continue;
+        req->n_prompt_done += n;
+        const bool last = req->n_prompt_done == req->prompt.size();
+        for (int32_t i = 0; i < n; ++i) {
+            rows[n_rows++] = {&ctx, input[i], ctx.n_past + i, last && i == n - 1 ? ctx.logits.data() : nullptr};
+        }
+        req->in_batch = true;
+        if (last) sampled.push_back(req.get());
+    }
+
+    if (n_rows > 0) {
+        workspace.eval_rows(rows, n_rows);
+    }
+
+    uint64_t n_new = 0;
+    for (Request* req : sampled) {
+        LlamaContext& ctx = req->ctx;
+        if (req->next < 0) {
+            req->timer.prefill_end();
+            if (ctx.shares_prefixes()) ctx.prefix_cache->insert(ctx.tokens, ctx.kv); // prompt just completed
+        }
+        const int32_t id = ctx.sample(req->params, req->grammar.get());
+        req->next = -1;
+        // -1: the grammar allows no token
+        if (id < 0 || model.vocab.is_eog(id) || (req->grammar && !req->grammar->accept(id))) {
+            req->stop = id >= 0 && model.vocab.is_eog(id) ? StopReason::EndOfText : StopReason::Grammar;
+            req->finished = true;
+            continue;
+        }
+        req->n_generated++;
+        req->timer.tokens(1);
+        n_new++;
+
+        req->chunk.clear();
+        if (req->detokenizer.push(id, req->chunk) > 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            req->text += req->chunk;
+            req->cv.notify_all();
+        }
+
+        if (req->n_generated >= req->params.max_tokens) {
+            req->finished = true;
+        } else if (req->grammar && req->grammar->finished()) {
+            req->stop = StopReason::Grammar;
+            req->finished = true;
+        } else {
+            req->next = id;
+        }
+    }
+
+    for (auto& req : active) {
+        if (req->in_batch) {
+            req->peak_kv_blocks = std::max(req->peak_kv_blocks, req->ctx.kv.blocks.size());
+        }
+        req->in_batch = false;
+        if (req->finished) {
+            finish(*req);
+            pool_full = false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    // Preempted sequences resume first, in their original order
+    std::vector<std::shared_ptr<Request>> running;
+    for (auto it = active.rbegin(); it != active.rend(); ++it) {
+        if ((*it)->finished) continue;
+        if ((*it)->preempted) {
+            (*it)->preempted = false;
+            queue.push_front(*it);
+        } else {
+            running.insert(running.begin(), *it);
+        }
+    }
+    active.swap(running);
+    counters.queued = static_cast<uint32_t>(queue.size());
+    counters.active = static_cast<uint32_t>(active.size());
+    counters.steps += n_rows > 0;
+    counters.rows += n_rows;
+    counters.tokens_generated += n_new;
+    return n_rows > 0;
+}
+
+bool LlamaScheduler::make_room(Request& req, const int32_t* input, int32_t n_tokens) {
+    std::string error;
+    while (!req.ctx.prepare(input, n_tokens, &error)) {
+        // Out of KV blocks: recompute-preempt the newest sequence that has no
+        // rows in this step (possibly `req` itself) and try again
+        Request* victim = nullptr;
+        bool others_running = false;
+        for (auto it = active.rbegin(); it != active.rend(); ++it) {
+            Request* r = it->get();
+            if (r->finished || r->preempted) continue;
+            if (r != &req && r->in_batch) others_running = true;
+            if (!victim && !r->in_batch && (r == &req || r->ctx.n_past > 0)) victim = r;
+        }
+        if (victim == &req && !others_running) {
+            req.stop = StopReason::Error;
+            req.finished = true; // alone and still too big; end the reply here
+            return false;
+        }
+        preempt(*victim);
+        if (victim == &req) return false;
+    }
+    return true;
+}
+
+void LlamaScheduler::preempt(Request& req) {
+    // Once generating, everything decoded so far plus the sampled token becomes
+    // the prompt of a later prefill, so the reply continues where it stopped
+    if (req.next >= 0) {
+        req.prompt = req.ctx.tokens;
+        req.prompt.push_back(req.next);
+        req.next = -1;
+    }
+    req.started = false;
+    req.n_prompt_done = 0;
+    req.preempted = true;
+    req.ctx.reset();
+    pool_full = true;
+}
+
+void LlamaScheduler::finish(Request& req) {
+    LlamaContext& ctx = req.ctx;
+    // The batch workspace is shared, but it is what this request needed to run
+    req.peak_scratch_bytes = workspace.scratch_bytes() + ctx.scratch_bytes();
+    // The reply is usually part of the next turn's prompt
+    if (ctx.shares_prefixes() && !ctx.kv_shifted && req.n_prompt_done == req.prompt.size()) {
+        ctx.prefix_cache->insert(ctx.tokens, ctx.kv);
+    }
+    // Blocks go back to the pool on this thread; the caller may drop the
+    // request at any time after `done`. A conversation keeps its sequence,
+    // and the model's context takes over the latest stateless one, so a
+    // session saved after a reply holds that turn.
+    if (!req.keep) {
+        if (ctx.n_past > 0) {
+            model.context->take_sequence(ctx);
+        } else {
+            ctx.reset();
+        }
+    }
+
+    req.chunk.clear();
+    req.detokenizer.flush(req.chunk);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    req.text += req.chunk;
+    req.done = true;
+    counters.requests++;
+    req.cv.notify_all();
+}
+
+// LlamaConversation
+
+// Blocks one context window needs
+static uint32_t window_blocks(const LlamaModel& model) {
+    const uint32_t block_size = model.kv_pool->block_size();
+    return (static_cast<uint32_t>(model.context_size) + block_size - 1) / block_size;
+}
+
+LlamaConversation::LlamaConversation(LlamaModel& m) : model(m) {
+    // The scheduler must not be replaced under us
+    std::shared_lock<std::shared_mutex> state(model.state_mutex);
+    // The pool is only touched on the scheduler thread or while it is parked
+    model.scheduler->run_exclusive([&] {
+        KVCachePool& pool = *model.kv_pool;
+        pool.set_capacity(pool.capacity() + window_blocks(model));
+        ctx = std::make_unique<LlamaContext>(model, pool, model.prefix_cache.get(),
+                                             static_cast<uint32_t>(model.context_size));
+        model.n_conversations++;
+    });
+}
+
+LlamaConversation::~LlamaConversation() {
+    // Once n_conversations drops, create_context may run; not before we are
+    // done. Taken before `mutex`, in the order generate calls take them.
+    std::shared_lock<std::shared_mutex> state(model.state_mutex);
+    std::lock_guard<std::mutex> lock(mutex);
+    model.scheduler->run_exclusive([&] {
+        ctx.reset();
+        KVCachePool& pool = *model.kv_pool;
+        pool.set_capacity(pool.capacity() - window_blocks(model));
+        model.n_conversations--;
+    });
+}
+
+std::string LlamaConversation::generate(std::string_view prompt, const GenerationParams& params,
+                                        const TokenCallback& on_text) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return model.scheduler->generate(*ctx, prompt, params, on_text);
+}
+
+void LlamaConversation::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    model.scheduler->run_exclusive([&] { ctx->reset(); });
+}
+
+void LlamaConversation::set_adapters(std::vector<LoraAttachment> adapters) {
+    std::lock_guard<std::mutex> lock(mutex);
+    model.scheduler->run_exclusive([&] { ctx->set_adapters(std::move(adapters)); });
+}
+
+int32_t LlamaConversation::n_past() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return ctx->n_past;
+}
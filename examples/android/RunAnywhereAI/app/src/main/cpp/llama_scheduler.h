@@ -0,0 +1,134 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "llama_model.h"
+
+// Counters reported to Kotlin by nativeGetSchedulerStats
+struct SchedulerStats {
+    uint32_t active = 0;          // sequences currently decoding
+    uint32_t queued = 0;          // requests waiting for a slot
+    uint64_t requests = 0;        // requests completed
+    uint64_t steps = 0;           // batched forward passes
+    uint64_t rows = 0;            // tokens evaluated across all steps
+    uint64_t tokens_generated = 0;
+};
+
+// Continuous batching for one model. generate() may be called from any number
+// of threads; a single scheduler thread owns every sequence and, each step,
+// packs one token per generating sequence plus prompt chunks of newly admitted
+// ones into a single eval_rows() call. Requests join and leave between steps,
+// so a long reply never blocks a short one and the weights are streamed from
+// memory once per step instead of once per request. When the KV pool runs out,
+// the newest sequence is preempted and later recomputed from its tokens.
+//
+// Callbacks run on the calling thread (a JNI env cannot cross threads): the
+// scheduler hands finished text chunks back through the request and the
+// caller invokes on_text while it waits.
+class LlamaScheduler {
+public:
+    // Sequences decoded together; later requests wait in the queue
+    static constexpr size_t kMaxActive = 8;
+
+    explicit LlamaScheduler(LlamaModel& model);
+    ~LlamaScheduler();
+    LlamaScheduler(const LlamaScheduler&) = delete;
+    LlamaScheduler& operator=(const LlamaScheduler&) = delete;
+
+    // Same contract as LlamaContext::generate; blocks until the reply is done
+    std::string generate(std::string_view prompt, const GenerationParams& params, const TokenCallback& on_text);
+    // Continues `ctx`, a context over the model's pool that nothing else uses
+    // meanwhile: cached tokens the prompt starts with are reused and the
+    // sequence is kept afterwards, so the next turn only prefills what is new
+    std::string generate(LlamaContext& ctx, std::string_view prompt, const GenerationParams& params,
+                         const TokenCallback& on_text);
+
+    // Runs `job` on the scheduler thread once no sequence is active, for work
+    // that uses model.context or the shared pool directly (sessions, speculative
+    // decoding). New requests wait until it returns.
+    void run_exclusive(const std::function<void()>& job);
+
+    SchedulerStats stats() const;
+    // The model's KV pool and prefix cache as of the last step or exclusive
+    // job. Neither has a lock of its own, so other threads read these
+    // snapshots instead.
+    KVCacheStats kv_cache_stats() const;
+    PrefixCacheStats prefix_cache_stats() const;
+
+private:
+    struct Request;
+    struct Job;
+
+    std::string generate(std::shared_ptr<Request> req, std::string_view prompt, const GenerationParams& params,
+                         const TokenCallback& on_text);
+    void run();
+    // Admits queued requests and runs one batched step; false if idle
+    bool step();
+    // prepare()s req's next input, preempting other sequences if the pool is
+    // full. False if req cannot run this step (preempted or finished).
+    bool make_room(Request& req, const int32_t* input, int32_t n_tokens);
+    // Frees req's blocks and requeues it to be recomputed from its tokens
+    void preempt(Request& req);
+    void finish(Request& req);
+    // Snapshots the pool and prefix cache, with the mutex held or before the
+    // scheduler thread starts
+    void publish_cache_stats();
+
+    LlamaModel& model;
+    // Scratch buffers for the batched forward pass
+    LlamaContext workspace;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::shared_ptr<Request>> queue;
+    std::deque<std::shared_ptr<Job>> jobs;
+    std::vector<std::shared_ptr<Request>> active; // scheduler thread only
+    bool pool_full = false; // a sequence was preempted since the last one finished
+    SchedulerStats counters;
+    // Refreshed by the scheduler thread while the pool is idle
+    KVCacheStats kv_stats;
+    PrefixCacheStats prefix_stats;
+    bool stopping = false;
+    std::thread worker;
+};
+
+// A conversation of its own over a shared model (nativeCreateContext): a KV
+// sequence kept between turns, plus its own sampler and RNG. The weights,
+// compute threads and KV pool are the model's, and the pool gains a window of
+// blocks per conversation, so an extra one costs only the KV it fills. Calls
+// on one conversation are serialized; different conversations generate in
+// parallel, batched by the scheduler. Must be destroyed before its model.
+class LlamaConversation {
+public:
+    explicit LlamaConversation(LlamaModel& model);
+    ~LlamaConversation();
+    LlamaConversation(const LlamaConversation&) = delete;
+    LlamaConversation& operator=(const LlamaConversation&) = delete;
+
+    // Same contract as LlamaContext::generate
+    std::string generate(std::string_view prompt, const GenerationParams& params, const TokenCallback& on_text);
+
+    // Forgets the conversation, returning its blocks to the pool
+    void clear();
+
+    // Attaches `adapters` in place of the current ones (empty detaches all).
+    // Also clears the conversation, whose cache was computed without them.
+    void set_adapters(std::vector<LoraAttachment> adapters);
+
+    // Positions currently in the conversation's KV cache
+    int32_t n_past();
+
+private:
+    LlamaModel& model;
+    std::mutex mutex;
+    std::unique_ptr<LlamaContext> ctx;
+};
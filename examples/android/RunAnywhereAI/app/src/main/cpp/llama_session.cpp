@@ -0,0 +1,184 @@
+#include "llama_session.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include "llama_model.h"
+
+namespace {
+
+constexpr uint32_t kSessionMagic = 0x5345534C; // "LSES"
+constexpr uint32_t kSessionVersion = 2;
+constexpr uint64_t kSessionAlignment = 4096;
+
+// SessionHeader::flags
+constexpr uint32_t kSessionShifted = 1; // the cache was shifted; positions no longer match a fresh prefill
+
+struct SessionHeader {
+    uint32_t magic;
+    uint32_t version;
+    // Shape of the model the cache was computed with
+    uint32_t n_layer;
+    uint32_t n_embd_kv;
+    uint32_t n_vocab;
+    uint32_t block_size;
+    uint64_t model_size;
+    uint32_t n_tokens;
+    uint32_t n_blocks;
+    uint32_t rng_bytes;
+    uint32_t kv_type; // GGMLType of the stored rows
+    uint64_t kv_offset;
+    uint32_t flags;
+    uint32_t reserved;
+};
+static_assert(sizeof(SessionHeader) == 64, "unexpected SessionHeader padding");
+
+SessionHeader make_header(const LlamaContext& ctx) {
+    const LlamaModel& model = ctx.model;
+    SessionHeader hdr {};
+    hdr.magic = kSessionMagic;
+    hdr.version = kSessionVersion;
+    hdr.n_layer = model.hparams.n_layer;
+    hdr.n_embd_kv = model.hparams.n_embd_kv();
+    hdr.n_vocab = model.hparams.n_vocab;
+    hdr.block_size = ctx.kv_pool.block_size();
+    hdr.kv_type = ctx.kv_pool.type();
+    hdr.model_size = model.gguf->mapping().size();
+    return hdr;
+}
+
+} // namespace
+
+bool session_save(const LlamaContext& ctx, const std::string& path, std::string* error) {
+    SessionHeader hdr = make_header(ctx);
+    const std::vector<int32_t>& tokens = ctx.tokens;
+
+    std::ostringstream rng_state;
+    rng_state << ctx.rng;
+    const std::string rng = rng_state.str();
+
+    hdr.n_tokens = static_cast<uint32_t>(tokens.size());
+    hdr.n_blocks = static_cast<uint32_t>((tokens.size() + hdr.block_size - 1) / hdr.block_size);
+    hdr.rng_bytes = static_cast<uint32_t>(rng.size());
+    hdr.flags = ctx.kv_shifted ? kSessionShifted : 0;
+    const uint64_t meta_end = sizeof(hdr) + tokens.size() * sizeof(int32_t) + rng.size();
+    hdr.kv_offset = (meta_end + kSessionAlignment - 1) / kSessionAlignment * kSessionAlignment;
+
+    const std::string tmp_path = path + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if (!f) {
+        if (error) *error = "cannot create " + tmp_path + ": " + strerror(errno);
+        return false;
+    }
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    ok = ok && fwrite(tokens.data(), sizeof(int32_t), tokens.size(), f) == tokens.size();
+    ok = ok && fwrite(rng.data(), 1, rng.size(), f) == rng.size();
+    const std::vector<char> padding(hdr.kv_offset - meta_end, 0);
+    ok = ok && fwrite(padding.data(), 1, padding.size(), f) == padding.size();
+    const size_t block_bytes = ctx.kv_pool.block_bytes();
+    for (uint32_t i = 0; ok && i < hdr.n_blocks; ++i) {
+        ok = fwrite(ctx.kv_pool.data(ctx.kv.blocks[i]), block_bytes, 1, f) == 1;
+    }
+    // On disk before the rename makes it visible, so a crash cannot leave a
+    // complete-looking file with missing blocks
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        if (error) *error = "failed to write " + path + ": " + strerror(errno);
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool session_load(LlamaContext& ctx, const std::string& path, std::string* error) {
+    MappedFile file;
+    if (!file.open(path, error)) {
+        return false;
+    }
+
+    SessionHeader hdr;
+    if (file.size() < sizeof(hdr)) {
+        if (error) *error = "session file is truncated";
+        return false;
+    }
+    memcpy(&hdr, file.data(), sizeof(hdr));
+
+    const SessionHeader expected = make_header(ctx);
+    if (hdr.magic != kSessionMagic) {
+        if (error) *error = "not a session file";
+        return false;
+    }
+    if (hdr.version != kSessionVersion) {
+        if (error) *error = "unsupported session version " + std::to_string(hdr.version);
+        return false;
+    }
+    if (hdr.n_layer != expected.n_layer || hdr.n_embd_kv != expected.n_embd_kv || hdr.n_vocab != expected.n_vocab ||
+        hdr.block_size != expected.block_size || hdr.model_size != expected.model_size) {
+        if (error) *error = "session was saved with a different model";
+        return false;
+    }
+    if (hdr.kv_type != expected.kv_type) {
+        if (error) *error = std::string("session KV cache is ") + ggml_type_name(static_cast<GGMLType>(hdr.kv_type)) +
+                            ", context uses " + ggml_type_name(static_cast<GGMLType>(expected.kv_type));
+        return false;
+    }
+    if (hdr.n_tokens > ctx.n_ctx) {
+        if (error) *error = "session does not fit in the context window";
+        return false;
+    }
+
+    const size_t block_bytes = ctx.kv_pool.block_bytes();
+    const uint64_t meta_end = sizeof(hdr) + static_cast<uint64_t>(hdr.n_tokens) * sizeof(int32_t) + hdr.rng_bytes;
+    if (hdr.n_blocks != (hdr.n_tokens + hdr.block_size - 1) / hdr.block_size || hdr.kv_offset < meta_end ||
+        hdr.kv_offset > file.size() || static_cast<uint64_t>(hdr.n_blocks) * block_bytes > file.size() - hdr.kv_offset) {
+        if (error) *error = "session file is truncated";
+        return false;
+    }
+
+    const uint8_t* p = file.data() + sizeof(hdr);
+    std::vector<int32_t> tokens(hdr.n_tokens);
+    memcpy(tokens.data(), p, tokens.size() * sizeof(int32_t));
+    p += tokens.size() * sizeof(int32_t);
+    for (int32_t id : tokens) {
+        if (id < 0 || static_cast<uint32_t>(id) >= hdr.n_vocab) {
+            if (error) *error = "session contains an invalid token";
+            return false;
+        }
+    }
+
+    std::istringstream rng_state(std::string(reinterpret_cast<const char*>(p), hdr.rng_bytes));
+    std::mt19937 rng;
+    if (!(rng_state >> rng)) {
+        if (error) *error = "session has a corrupt RNG state";
+        return false;
+    }
+
+    ctx.reset();
+    if (!ctx.reserve_kv(static_cast<int32_t>(hdr.n_tokens), error)) {
+        return false;
+    }
+
+    // One sequential pass over the block data
+    file.advise(hdr.kv_offset, static_cast<size_t>(hdr.n_blocks) * block_bytes, MADV_SEQUENTIAL);
+    const uint8_t* blocks = file.data() + hdr.kv_offset;
+    for (uint32_t i = 0; i < hdr.n_blocks; ++i) {
+        memcpy(ctx.kv_pool.data(ctx.kv.blocks[i]), blocks + i * block_bytes, block_bytes);
+    }
+
+    ctx.tokens = std::move(tokens);
+    ctx.n_past = static_cast<int32_t>(hdr.n_tokens);
+    ctx.rng = rng;
+    ctx.kv_shifted = (hdr.flags & kSessionShifted) != 0;
+    if (ctx.shares_prefixes() && !ctx.kv_shifted) {
+        ctx.prefix_cache->insert(ctx.tokens, ctx.kv);
+    }
+    return true;
+}
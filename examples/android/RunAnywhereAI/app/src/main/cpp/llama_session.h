@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+
+struct LlamaContext;
+
+// Session files let a conversation resume without re-prefilling its history.
+// Layout (little endian, version 2):
+//   SessionHeader
+//   int32  tokens[n_tokens]        positions held in the KV cache
+//   char   rng[rng_bytes]          sampler RNG state (std::mt19937 text form)
+//   ...    zero padding up to kv_offset (page aligned)
+//   uint8  blocks[n_blocks][block] raw KV blocks in sequence order (rows in kv_type)
+// Restoring maps the file and copies the blocks straight into the KV pool, so
+// resume time is bounded by reading the file rather than by prefill compute.
+
+// Writes the context's KV cache, token history and RNG state to `path`
+// (through a temporary file, so an interrupted save keeps the old session).
+bool session_save(const LlamaContext& ctx, const std::string& path, std::string* error);
+
+// Replaces the context's state with the session stored at `path`. Restored
+// blocks are also added to the prefix cache so the next generate() call whose
+// prompt starts with the saved conversation picks them up, unless the saved
+// cache had been shifted and no longer matches a prefill of its tokens.
+bool session_load(LlamaContext& ctx, const std::string& path, std::string* error);
@@ -0,0 +1,114 @@
+#include "llama_stream.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include "llama_model.h"
+
+namespace {
+
+size_t layer_bytes(const LlamaLayer& layer) {
+    size_t bytes = 0;
+    for (const LlamaTensor* t : layer.matrices()) {
+        bytes += t->n_bytes();
+    }
+    return bytes;
+}
+
+} // namespace
+
+std::unique_ptr<LayerStreamer> LayerStreamer::create(const LlamaModel& model, size_t budget_bytes,
+                                                     std::string* error) {
+    // The embeddings are read a few rows at a time, but over a conversation
+    // most of them are, so they count in full
+    size_t fixed = model.output.n_bytes();
+    if (model.tok_embd.data != model.output.data) fixed += model.tok_embd.n_bytes();
+    size_t total = fixed;
+    size_t max_layer = 0;
+    for (const LlamaLayer& l : model.layers) {
+        total += layer_bytes(l);
+        max_layer = std::max(max_layer, layer_bytes(l));
+    }
+
+    const uint32_t n_layer = model.hparams.n_layer;
+    uint32_t n_pinned = n_layer;
+    if (total > budget_bytes) {
+        const size_t slots = budget_bytes > fixed ? (budget_bytes - fixed) / std::max<size_t>(max_layer, 1) : 0;
+        if (slots < 2) {
+            if (error) *error = "memory budget too small: at least " + std::to_string(fixed + 2 * max_layer) +
+                                " bytes are needed";
+            return nullptr;
+        }
+        // Fewer than all layers fit, so at least three are streamed
+        n_pinned = static_cast<uint32_t>(slots - 2);
+    }
+    return std::unique_ptr<LayerStreamer>(new LayerStreamer(model, budget_bytes, n_pinned));
+}
+
+LayerStreamer::LayerStreamer(const LlamaModel& m, size_t budget, uint32_t pinned)
+    : model(m), budget_bytes(budget), n_pinned(pinned) {
+    if (n_pinned == model.hparams.n_layer) return;
+    // Bring resident weights within the budget right away
+    for (uint32_t il = n_pinned; il < model.hparams.n_layer; ++il) {
+        advise_layer(il, MADV_DONTNEED);
+    }
+    prefetcher = std::thread([this] { prefetch_loop(); });
+}
+
+LayerStreamer::~LayerStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_one();
+    if (prefetcher.joinable()) prefetcher.join();
+}
+
+void LayerStreamer::advise_layer(uint32_t il, int advice) const {
+    const MappedFile& map = model.gguf->mapping();
+    for (const LlamaTensor* t : model.layers[il].matrices()) {
+        map.advise(static_cast<size_t>(t->data - map.data()), t->n_bytes(), advice);
+    }
+}
+
+void LayerStreamer::begin_layer(uint32_t il) {
+    const uint32_t n_layer = model.hparams.n_layer;
+    if (n_pinned == n_layer) return;
+    // The next streamed layer, wrapping around to the next token's pass
+    const int64_t next = il + 1 < n_layer ? std::max(il + 1, n_pinned) : n_pinned;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (next == requested) return;
+        requested = next;
+        pending = next;
+    }
+    cv.notify_one();
+}
+
+void LayerStreamer::end_layer(uint32_t il) {
+    if (streamed(il)) {
+        advise_layer(il, MADV_DONTNEED);
+    }
+}
+
+void LayerStreamer::prefetch_loop() {
+    const MappedFile& map = model.gguf->mapping();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait(lock, [this] { return stopping || pending >= 0; });
+        if (stopping) return;
+        const uint32_t il = static_cast<uint32_t>(pending);
+        pending = -1;
+        lock.unlock();
+
+        // Start read-ahead of the whole layer, then fault it in tensor by
+        // tensor in the order the layer reads them
+        advise_layer(il, MADV_WILLNEED);
+        for (const LlamaTensor* t : model.layers[il].matrices()) {
+            map.touch(static_cast<size_t>(t->data - map.data()), t->n_bytes());
+            bytes_prefetched += t->n_bytes();
+        }
+        lock.lock();
+    }
+}
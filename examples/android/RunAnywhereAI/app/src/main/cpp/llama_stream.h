@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct LlamaModel;
+
+// Runs a model whose weights do not fit in RAM by keeping only part of them
+// mapped in. Within the budget, the output head, the token embeddings and as
+// many layers as fit besides two slots stay resident for good ("pinned"); the
+// other layers are streamed through the two slots. While layer i computes, a
+// prefetch thread reads the next streamed layer from the mapped file, and once
+// layer i is done its pages are dropped with MADV_DONTNEED. Every token thus
+// reads each streamed layer from storage (or the page cache) once: speed falls
+// with the budget, but the weights the process holds stay within it.
+class LayerStreamer {
+public:
+    // Fails if the budget cannot hold the output head and two layers. With a
+    // budget that holds every weight, nothing is streamed.
+    static std::unique_ptr<LayerStreamer> create(const LlamaModel& model, size_t budget_bytes, std::string* error);
+    ~LayerStreamer();
+    LayerStreamer(const LayerStreamer&) = delete;
+    LayerStreamer& operator=(const LayerStreamer&) = delete;
+
+    // Called by LlamaContext::eval_rows around each layer, from any thread
+    void begin_layer(uint32_t il);
+    void end_layer(uint32_t il);
+
+    bool streamed(uint32_t il) const { return il >= n_pinned; }
+    uint32_t pinned_layers() const { return n_pinned; }
+    size_t budget() const { return budget_bytes; }
+    // Bytes read ahead by the prefetch thread so far
+    uint64_t prefetched_bytes() const { return bytes_prefetched; }
+
+private:
+    LayerStreamer(const LlamaModel& model, size_t budget_bytes, uint32_t n_pinned);
+    void advise_layer(uint32_t il, int advice) const;
+    void prefetch_loop();
+
+    const LlamaModel& model;
+    const size_t budget_bytes;
+    const uint32_t n_pinned; // layers [0, n_pinned) are never dropped
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    int64_t requested = -1; // last layer asked for, so each is prefetched once per pass
+    int64_t pending = -1;   // layer the prefetch thread should read next
+    bool stopping = false;
+    std::atomic<uint64_t> bytes_prefetched{0};
+    std::thread prefetcher;
+};
@@ -0,0 +1,865 @@
+#include "llama_vocab.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include "gguf.h"
+
+namespace {
+
+// SentencePiece word-boundary marker U+2581 ("▁")
+const char kSpmSpace[] = "\xE2\x96\x81";
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// Parses "<0xAB>" byte tokens; returns -1 for anything else
+int parse_byte_token(const std::string& text) {
+    if (text.size() != 6 || text[0] != '<' || text[1] != '0' || text[2] != 'x' || text[5] != '>') return -1;
+    int hi = hex_value(text[3]);
+    int lo = hex_value(text[4]);
+    return hi < 0 || lo < 0 ? -1 : hi * 16 + lo;
+}
+
+uint64_t pair_key(int32_t left, int32_t right) {
+    return static_cast<uint64_t>(static_cast<uint32_t>(left)) << 32 | static_cast<uint32_t>(right);
+}
+
+constexpr uint32_t kInvalidCodePoint = 0xFFFFFFFFu;
+
+// Code point at text[pos] and its length in bytes. A malformed sequence
+// decodes as kInvalidCodePoint covering one byte.
+uint32_t decode_utf8(std::string_view text, size_t pos, size_t* len) {
+    const auto* s = reinterpret_cast<const unsigned char*>(text.data()) + pos;
+    const size_t avail = text.size() - pos;
+    *len = 1;
+    if (s[0] < 0x80) return s[0];
+
+    size_t n;
+    uint32_t cp;
+    if ((s[0] & 0xE0) == 0xC0) {
+        n = 2;
+        cp = s[0] & 0x1F;
+    } else if ((s[0] & 0xF0) == 0xE0) {
+        n = 3;
+        cp = s[0] & 0x0F;
+    } else if ((s[0] & 0xF8) == 0xF0) {
+        n = 4;
+        cp = s[0] & 0x07;
+    } else {
+        return kInvalidCodePoint;
+    }
+    if (n > avail) return kInvalidCodePoint;
+    for (size_t i = 1; i < n; ++i) {
+        if ((s[i] & 0xC0) != 0x80) return kInvalidCodePoint;
+        cp = cp << 6 | (s[i] & 0x3F);
+    }
+    *len = n;
+    return cp;
+}
+
+void append_utf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | cp >> 6);
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | cp >> 12);
+        out += static_cast<char>(0x80 | (cp >> 6 & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | cp >> 18);
+        out += static_cast<char>(0x80 | (cp >> 12 & 0x3F));
+        out += static_cast<char>(0x80 | (cp >> 6 & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// Byte-level BPE spells every byte with a printable character: visible
+// Latin-1 bytes stand for themselves, the rest for U+0100 onwards
+struct ByteLevel {
+    uint32_t byte_to_cp[256];
+    int16_t cp_to_byte[324];
+
+    ByteLevel() {
+        std::fill(std::begin(cp_to_byte), std::end(cp_to_byte), -1);
+        uint32_t extra = 256;
+        for (uint32_t b = 0; b < 256; ++b) {
+            const bool visible = (b >= '!' && b <= '~') || (b >= 0xA1 && b <= 0xAC) || b >= 0xAE;
+            byte_to_cp[b] = visible ? b : extra++;
+            cp_to_byte[byte_to_cp[b]] = static_cast<int16_t>(b);
+        }
+    }
+};
+
+const ByteLevel& byte_level() {
+    static const ByteLevel table;
+    return table;
+}
+
+// Unicode classes the pre-tokenizer regexes use (\p{L}, \p{N}, \s)
+enum CharClass : uint8_t { kOther, kLetter, kNumber, kSpace };
+
+struct ClassRange {
+    uint32_t first;
+    uint32_t last;
+    CharClass cls;
+};
+
+// Non-letter ranges above ASCII, sorted. Everything else counts as a letter,
+// which holds for the scripts models are trained on; marks, punctuation,
+// symbols and emoji of the common blocks are listed.
+const ClassRange kClassRanges[] = {
+    {0x80, 0x84, kOther},     {0x85, 0x85, kSpace},     {0x86, 0x9F, kOther},     {0xA0, 0xA0, kSpace},
+    {0xA1, 0xA9, kOther},     {0xAB, 0xB1, kOther},     {0xB2, 0xB3, kNumber},    {0xB4, 0xB4, kOther},
+    {0xB6, 0xB8, kOther},     {0xB9, 0xB9, kNumber},    {0xBB, 0xBB, kOther},     {0xBC, 0xBE, kNumber},
+    {0xBF, 0xBF, kOther},     {0xD7, 0xD7, kOther},     {0xF7, 0xF7, kOther},     {0x2C2, 0x2C5, kOther},
+    {0x2D2, 0x2DF, kOther},   {0x2E5, 0x2EB, kOther},   {0x300, 0x36F, kOther},   {0x37E, 0x37E, kOther},
+    {0x387, 0x387, kOther},   {0x483, 0x489, kOther},   {0x55A, 0x55F, kOther},   {0x589, 0x58A, kOther},
+    {0x591, 0x5C7, kOther},   {0x5F3, 0x5F4, kOther},   {0x600, 0x61F, kOther},   {0x64B, 0x65F, kOther},
+    {0x660, 0x669, kNumber},  {0x66A, 0x66D, kOther},   {0x670, 0x670, kOther},   {0x6D4, 0x6D4, kOther},
+    {0x6D6, 0x6ED, kOther},   {0x6F0, 0x6F9, kNumber},  {0x900, 0x903, kOther},   {0x93A, 0x93C, kOther},
+    {0x93E, 0x94F, kOther},   {0x951, 0x957, kOther},   {0x962, 0x965, kOther},   {0x966, 0x96F, kNumber},
+    {0x970, 0x970, kOther},   {0xE31, 0xE31, kOther},   {0xE34, 0xE3A, kOther},   {0xE3F, 0xE3F, kOther},
+    {0xE47, 0xE4F, kOther},   {0xE50, 0xE59, kNumber},  {0xE5A, 0xE5B, kOther},   {0x1680, 0x1680, kSpace},
+    {0x2000, 0x200A, kSpace}, {0x200B, 0x2027, kOther}, {0x2028, 0x2029, kSpace}, {0x202A, 0x202E, kOther},
+    {0x202F, 0x202F, kSpace}, {0x2030, 0x205E, kOther}, {0x205F, 0x205F, kSpace}, {0x2060, 0x206F, kOther},
+    {0x2070, 0x2070, kNumber}, {0x2074, 0x2079, kNumber}, {0x207A, 0x207E, kOther}, {0x2080, 0x2089, kNumber},
+    {0x208A, 0x208E, kOther}, {0x20A0, 0x214F, kOther}, {0x2150, 0x2189, kNumber}, {0x218A, 0x245F, kOther},
+    {0x2460, 0x249B, kNumber}, {0x249C, 0x24E9, kOther}, {0x24EA, 0x24FF, kNumber}, {0x2500, 0x2BFF, kOther},
+    {0x2E00, 0x2E7F, kOther}, {0x3000, 0x3000, kSpace}, {0x3001, 0x3004, kOther}, {0x3007, 0x3007, kNumber},
+    {0x3008, 0x3020, kOther}, {0x3021, 0x3029, kNumber}, {0x302A, 0x3030, kOther}, {0x3036, 0x3037, kOther},
+    {0x303D, 0x303F, kOther}, {0x3099, 0x309C, kOther}, {0x30A0, 0x30A0, kOther}, {0x30FB, 0x30FB, kOther},
+    {0xD800, 0xF8FF, kOther}, {0xFD3E, 0xFD3F, kOther}, {0xFE00, 0xFE19, kOther}, {0xFE20, 0xFE6F, kOther},
+    {0xFEFF, 0xFEFF, kOther}, {0xFF01, 0xFF0F, kOther}, {0xFF10, 0xFF19, kNumber}, {0xFF1A, 0xFF20, kOther},
+    {0xFF3B, 0xFF40, kOther}, {0xFF5B, 0xFF65, kOther}, {0xFFE0, 0xFFFF, kOther}, {0x1F000, 0x1FAFF, kOther},
+    {0xE0000, 0x10FFFF, kOther},
+};
+
+CharClass char_class(uint32_t cp) {
+    if (cp < 0x80) {
+        if ((cp | 0x20) >= 'a' && (cp | 0x20) <= 'z') return kLetter;
+        if (cp >= '0' && cp <= '9') return kNumber;
+        if (cp == ' ' || (cp >= '\t' && cp <= '\r')) return kSpace;
+        return kOther;
+    }
+    if (cp > 0x10FFFF) return kOther;
+    const ClassRange* end = std::end(kClassRanges);
+    const ClassRange* it = std::upper_bound(std::begin(kClassRanges), end, cp,
+                                            [](uint32_t c, const ClassRange& r) { return c < r.first; });
+    if (it != std::begin(kClassRanges) && cp <= (it - 1)->last) return (it - 1)->cls;
+    return kLetter;
+}
+
+enum class PreTokenizer { Gpt2, Llama3, Qwen2 };
+
+// Splits text into the words byte-level BPE merges within, appending the byte
+// offset where each word ends. Hand-written equivalents of the regexes
+//   GPT-2:  's|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
+//   Llama 3: (?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}{1,3}|
+//            ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+(?!\S)|\s+
+// Qwen2 is Llama 3 with single digits.
+void split_text(std::string_view text, PreTokenizer pre, std::vector<size_t>& ends) {
+    std::vector<uint32_t> cps;
+    std::vector<uint8_t> cls;
+    std::vector<size_t> offsets;
+    cps.reserve(text.size());
+    cls.reserve(text.size());
+    offsets.reserve(text.size() + 1);
+    for (size_t pos = 0; pos < text.size();) {
+        size_t len;
+        const uint32_t cp = decode_utf8(text, pos, &len);
+        cps.push_back(cp);
+        cls.push_back(char_class(cp));
+        offsets.push_back(pos);
+        pos += len;
+    }
+    offsets.push_back(text.size());
+
+    const size_t n = cps.size();
+    auto run = [&](size_t i, uint8_t c) {
+        while (i < n && cls[i] == c) ++i;
+        return i;
+    };
+    auto newline = [&](size_t i) { return i < n && (cps[i] == '\r' || cps[i] == '\n'); };
+    auto lower = [&](size_t i) -> uint32_t {
+        if (i >= n) return 0;
+        return pre != PreTokenizer::Gpt2 && cps[i] >= 'A' && cps[i] <= 'Z' ? cps[i] + 32 : cps[i];
+    };
+    // Length of the contraction at i, or 0
+    auto contraction = [&](size_t i) -> size_t {
+        if (cps[i] != '\'') return 0;
+        const uint32_t a = lower(i + 1);
+        const uint32_t b = lower(i + 2);
+        if (a == 's' || a == 't' || a == 'm' || a == 'd') return 2;
+        if ((a == 'r' && b == 'e') || (a == 'v' && b == 'e') || (a == 'l' && b == 'l')) return 3;
+        return 0;
+    };
+    // \s+(?!\S)|\s+ : a run of spaces leaves its last one to the word after it
+    auto spaces = [&](size_t i) {
+        const size_t j = run(i, kSpace);
+        return j < n && j - i > 1 ? j - 1 : j;
+    };
+
+    for (size_t i = 0; i < n;) {
+        size_t j;
+        if (size_t len = contraction(i)) {
+            j = i + len;
+        } else if (pre == PreTokenizer::Gpt2) {
+            // ` ?` before letters, digits or other characters
+            const size_t s = cps[i] == ' ' && i + 1 < n && cls[i + 1] != kSpace ? i + 1 : i;
+            j = cls[s] == kSpace ? spaces(i) : run(s, cls[s]);
+        } else if (cls[i] == kLetter) {
+            j = run(i, kLetter);
+        } else if (cls[i] != kNumber && !newline(i) && i + 1 < n && cls[i + 1] == kLetter) {
+            j = run(i + 1, kLetter);
+        } else if (cls[i] == kNumber) {
+            j = std::min(run(i, kNumber), i + (pre == PreTokenizer::Llama3 ? 3 : 1));
+        } else {
+            const size_t s = cps[i] == ' ' && i + 1 < n && cls[i + 1] == kOther ? i + 1 : i;
+            if (cls[s] == kOther) {
+                j = run(s, kOther);
+                while (newline(j)) ++j;
+            } else {
+                // \s*[\r\n]+ ends after the run's last line break
+                const size_t e = run(i, kSpace);
+                j = i;
+                for (size_t k = i; k < e; ++k) {
+                    if (newline(k)) j = k + 1;
+                }
+                if (j == i) j = spaces(i);
+            }
+        }
+        ends.push_back(offsets[j]);
+        i = j;
+    }
+}
+
+// SentencePiece input: spaces become "▁", plus the implicit leading one
+std::string spm_normalize(std::string_view text, bool add_space_prefix) {
+    std::string out;
+    out.reserve(text.size() * 2 + 3);
+    if (add_space_prefix) out += kSpmSpace;
+    for (char c : text) {
+        if (c == ' ') {
+            out += kSpmSpace;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+} // namespace
+
+bool LlamaVocab::load(const GGUFFile& file, std::string* error) {
+    const GGUFHeader& hdr = file.header();
+    model_type = hdr.get_string("tokenizer.ggml.model", "llama");
+    pre_type = hdr.get_string("tokenizer.ggml.pre", "default");
+
+    std::vector<std::string_view> views = file.get_string_array("tokenizer.ggml.tokens");
+    if (views.empty()) {
+        if (error) *error = "model has no tokenizer.ggml.tokens";
+        return false;
+    }
+
+    const size_t n = views.size();
+    tokens.reserve(n);
+    token_to_id.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        tokens.emplace_back(views[i]);
+        token_to_id.emplace(tokens.back(), static_cast<int32_t>(i));
+        max_token_len = std::max(max_token_len, views[i].size());
+    }
+
+    scores.assign(n, 0.0f);
+    uint64_t count = 0;
+    if (const uint8_t* p = file.get_array_data("tokenizer.ggml.scores", GGUF_TYPE_FLOAT32, &count)) {
+        memcpy(scores.data(), p, std::min<uint64_t>(count, n) * sizeof(float));
+    }
+
+    token_types.assign(n, TOKEN_NORMAL);
+    if (const uint8_t* p = file.get_array_data("tokenizer.ggml.token_type", GGUF_TYPE_INT32, &count)) {
+        memcpy(token_types.data(), p, std::min<uint64_t>(count, n) * sizeof(int32_t));
+    }
+
+    bos_id = static_cast<int32_t>(hdr.get_uint("tokenizer.ggml.bos_token_id", bos_id));
+    eos_id = static_cast<int32_t>(hdr.get_uint("tokenizer.ggml.eos_token_id", eos_id));
+    unk_id = static_cast<int32_t>(hdr.get_uint("tokenizer.ggml.unknown_token_id", unk_id));
+    add_bos = hdr.get_uint("tokenizer.ggml.add_bos_token", model_type == "llama" ? 1 : 0) != 0;
+    add_space_prefix = hdr.get_uint("tokenizer.ggml.add_space_prefix", 1) != 0;
+
+    std::fill(std::begin(byte_tokens), std::end(byte_tokens), -1);
+    for (size_t i = 0; i < n; ++i) {
+        int b = parse_byte_token(tokens[i]);
+        if (b >= 0) byte_tokens[b] = static_cast<int32_t>(i);
+    }
+
+    std::fill(std::begin(byte_symbols), std::end(byte_symbols), -1);
+    split_words = model_type != "gpt2";
+    for (size_t i = 0; i < n && split_words; ++i) {
+        if (token_types[i] != TOKEN_NORMAL && token_types[i] != TOKEN_USER_DEFINED) continue;
+        size_t pos = 0;
+        while (tokens[i].compare(pos, 3, kSpmSpace) == 0) pos += 3;
+        split_words = tokens[i].find(kSpmSpace, pos) == std::string::npos;
+    }
+    if (model_type == "t5") {
+        build_trie();
+    } else {
+        load_merges(file);
+    }
+    return true;
+}
+
+void LlamaVocab::load_merges(const GGUFFile& file) {
+    std::string left, right;
+
+    if (model_type == "gpt2") {
+        const ByteLevel& bytes = byte_level();
+        for (int b = 0; b < 256; ++b) {
+            left.clear();
+            append_utf8(left, bytes.byte_to_cp[b]);
+            auto it = token_to_id.find(left);
+            if (it != token_to_id.end()) byte_symbols[b] = it->second;
+        }
+
+        // "left right" per line, highest priority first
+        std::vector<std::string_view> rules = file.get_string_array("tokenizer.ggml.merges");
+        for (size_t rank = 0; rank < rules.size(); ++rank) {
+            const std::string_view rule = rules[rank];
+            const size_t space = rule.find(' ', 1);
+            if (space == std::string_view::npos) continue;
+            left.assign(rule.substr(0, space));
+            right.assign(rule.substr(space + 1));
+            auto l = token_to_id.find(left);
+            auto r = token_to_id.find(right);
+            auto merged = token_to_id.find(left + right);
+            if (l == token_to_id.end() || r == token_to_id.end() || merged == token_to_id.end()) continue;
+            merges.insert(pair_key(l->second, r->second), Merge {static_cast<float>(rank), merged->second});
+        }
+        return;
+    }
+
+    // SentencePiece BPE keeps no merge list: any two symbols whose texts join
+    // into a token merge, best score first
+    for (size_t id = 0; id < tokens.size(); ++id) {
+        if (token_types[id] != TOKEN_NORMAL && token_types[id] != TOKEN_USER_DEFINED) continue;
+        size_t len;
+        const uint32_t cp = decode_utf8(tokens[id], 0, &len);
+        if (len == tokens[id].size() && cp != kInvalidCodePoint) char_tokens.emplace(cp, static_cast<int32_t>(id));
+    }
+    auto symbol = [&](const std::string& text) -> int32_t {
+        size_t len;
+        const uint32_t cp = decode_utf8(text, 0, &len);
+        if (len == text.size() && cp != kInvalidCodePoint) {
+            auto it = char_tokens.find(cp);
+            return it != char_tokens.end() ? it->second : static_cast<int32_t>(tokens.size() + cp);
+        }
+        auto it = token_to_id.find(text);
+        return it != token_to_id.end() ? it->second : -1;
+    };
+    for (size_t id = 0; id < tokens.size(); ++id) {
+        if (token_types[id] != TOKEN_NORMAL && token_types[id] != TOKEN_USER_DEFINED) continue;
+        const std::string& text = tokens[id];
+        size_t len;
+        decode_utf8(text, 0, &len);
+        for (size_t split = len; split < text.size(); split += len) {
+            decode_utf8(text, split, &len);
+            left.assign(text, 0, split);
+            right.assign(text, split, std::string::npos);
+            const int32_t l = symbol(left);
+            const int32_t r = symbol(right);
+            if (l >= 0 && r >= 0) merges.insert(pair_key(l, r), Merge {-scores[id], static_cast<int32_t>(id)});
+        }
+    }
+}
+
+void LlamaVocab::build_trie() {
+    std::vector<int32_t> order;
+    float min_score = 0.0f;
+    for (size_t id = 0; id < tokens.size(); ++id) {
+        if (token_types[id] != TOKEN_NORMAL && token_types[id] != TOKEN_USER_DEFINED) continue;
+        if (token_types[id] == TOKEN_NORMAL) min_score = std::min(min_score, scores[id]);
+        order.push_back(static_cast<int32_t>(id));
+    }
+    // Sorted by text, so each node's subtree is a contiguous range
+    std::stable_sort(order.begin(), order.end(), [&](int32_t a, int32_t b) { return tokens[a] < tokens[b]; });
+    trie_nodes.clear();
+    trie_edges.clear();
+    build_trie_node(order, 0, order.size(), 0);
+
+    // Characters no token covers cost more than any token, as in SentencePiece
+    unk_score = min_score - 10.0f;
+}
+
+uint32_t LlamaVocab::build_trie_node(const std::vector<int32_t>& order, size_t begin, size_t end, size_t depth) {
+    const uint32_t node = static_cast<uint32_t>(trie_nodes.size());
+    trie_nodes.push_back({0, 0, -1});
+    // Texts that end here sort first; the lowest id wins among duplicates
+    if (begin < end && tokens[order[begin]].size() == depth) trie_nodes[node].token = order[begin];
+    while (begin < end && tokens[order[begin]].size() == depth) ++begin;
+
+    std::vector<size_t> groups; // start of each run of equal bytes at `depth`
+    for (size_t i = begin; i < end; ++i) {
+        if (i == begin || tokens[order[i]][depth] != tokens[order[i - 1]][depth]) groups.push_back(i);
+    }
+    groups.push_back(end);
+
+    const uint32_t edge_begin = static_cast<uint32_t>(trie_edges.size());
+    trie_nodes[node].edge_begin = edge_begin;
+    trie_nodes[node].edge_end = edge_begin + static_cast<uint32_t>(groups.size() - 1);
+    trie_edges.resize(trie_nodes[node].edge_end);
+    for (size_t g = 0; g + 1 < groups.size(); ++g) {
+        const uint8_t byte = static_cast<uint8_t>(tokens[order[groups[g]]][depth]);
+        const uint32_t child = build_trie_node(order, groups[g], groups[g + 1], depth + 1);
+        trie_edges[edge_begin + g] = {byte, child};
+    }
+    return node;
+}
+
+void LlamaVocab::MergeTable::insert(uint64_t key, Merge merge) {
+    if ((count + 1) * 2 > slots.size()) {
+        // Grow to keep the load factor at most 1/2
+        std::vector<Slot> old;
+        old.swap(slots);
+        const size_t capacity = std::max<size_t>(64, old.size() * 2);
+        slots.assign(capacity, Slot {0, Merge {0.0f, -1}});
+        mask = capacity - 1;
+        shift = 64 - __builtin_ctzll(capacity);
+        count = 0;
+        for (const Slot& slot : old) {
+            if (slot.merge.id >= 0) insert(slot.key, slot.merge);
+        }
+    }
+    for (size_t i = slot_of(key);; i = (i + 1) & mask) {
+        Slot& slot = slots[i];
+        if (slot.merge.id < 0) {
+            slot = Slot {key, merge};
+            ++count;
+            return;
+        }
+        if (slot.key == key) return;
+    }
+}
+
+struct LlamaVocab::MergeScratch {
+    struct Candidate {
+        float priority;
+        int32_t left;
+        int32_t right;
+        int32_t left_id;
+        int32_t right_id;
+        int32_t merged_id;
+    };
+    std::vector<int32_t> prev;
+    std::vector<int32_t> next;
+    std::vector<Candidate> heap;
+    std::vector<int32_t> ids;
+    // Words already tokenized by this call -> (first, count) in the output
+    std::unordered_map<std::string_view, std::pair<size_t, size_t>> words;
+
+    // Appends the tokens of a word seen before; false if it is new
+    bool reuse(std::string_view word, std::vector<int32_t>& out) const {
+        auto it = words.find(word);
+        if (it == words.end()) return false;
+        // Indices, as appending may reallocate the tokens being copied
+        for (size_t i = it->second.first; i < it->second.first + it->second.second; ++i) {
+            out.push_back(out[i]);
+        }
+        return true;
+    }
+    void remember(std::string_view word, size_t first, const std::vector<int32_t>& out) {
+        words.emplace(word, std::make_pair(first, out.size() - first));
+    }
+};
+
+void LlamaVocab::apply_merges(std::vector<int32_t>& ids, MergeScratch& scratch) const {
+    const int32_t n = static_cast<int32_t>(ids.size());
+    if (n < 2 || merges.empty()) return;
+
+    // Symbols form a linked list; merging folds the right one into the left
+    std::vector<int32_t>& prev = scratch.prev;
+    std::vector<int32_t>& next = scratch.next;
+    prev.resize(n);
+    next.resize(n);
+    for (int32_t i = 0; i < n; ++i) {
+        prev[i] = i - 1;
+        next[i] = i + 1 < n ? i + 1 : -1;
+    }
+
+    // Best pair on top: lowest priority, then leftmost
+    using Candidate = MergeScratch::Candidate;
+    auto worse = [](const Candidate& a, const Candidate& b) {
+        return a.priority > b.priority || (a.priority == b.priority && a.left > b.left);
+    };
+    std::vector<Candidate>& heap = scratch.heap;
+    heap.clear();
+    auto push = [&](int32_t left) {
+        if (left < 0 || next[left] < 0) return;
+        const int32_t right = next[left];
+        const Merge* merge = merges.find(pair_key(ids[left], ids[right]));
+        if (!merge) return;
+        heap.push_back({merge->priority, left, right, ids[left], ids[right], merge->id});
+        std::push_heap(heap.begin(), heap.end(), worse);
+    };
+    for (int32_t i = 0; i + 1 < n; ++i) push(i);
+
+    constexpr int32_t kMerged = std::numeric_limits<int32_t>::min();
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), worse);
+        const Candidate c = heap.back();
+        heap.pop_back();
+        // Skip pairs that an earlier merge changed
+        if (ids[c.left] != c.left_id || next[c.left] != c.right || ids[c.right] != c.right_id) continue;
+
+        ids[c.left] = c.merged_id;
+        ids[c.right] = kMerged;
+        next[c.left] = next[c.right];
+        if (next[c.left] >= 0) prev[next[c.left]] = c.left;
+        push(prev[c.left]);
+        push(c.left);
+    }
+
+    int32_t count = 0;
+    for (int32_t i = 0; i >= 0; i = next[i]) ids[count++] = ids[i];
+    ids.resize(count);
+}
+
+std::vector<int32_t> LlamaVocab::tokenize(std::string_view text, bool with_bos) const {
+    std::vector<int32_t> out;
+    out.reserve(text.size() / 3 + 2);
+    if (with_bos) out.push_back(bos_id);
+    if (text.empty()) return out;
+
+    if (model_type == "gpt2") {
+        tokenize_bpe(text, out);
+        return out;
+    }
+
+    const std::string normalized = spm_normalize(text, add_space_prefix);
+    MergeScratch scratch;
+    for (size_t begin = 0, end; begin < normalized.size(); begin = end) {
+        end = normalized.size();
+        if (split_words) {
+            size_t pos = begin;
+            while (normalized.compare(pos, 3, kSpmSpace) == 0) pos += 3;
+            end = std::min(normalized.find(kSpmSpace, pos), normalized.size());
+        }
+        const std::string_view word(normalized.data() + begin, end - begin);
+        if (scratch.reuse(word, out)) continue;
+
+        const size_t first = out.size();
+        if (model_type == "t5") {
+            tokenize_ugm(word, out);
+        } else {
+            tokenize_spm(word, scratch, out);
+        }
+        scratch.remember(word, first, out);
+    }
+    return out;
+}
+
+void LlamaVocab::tokenize_spm(std::string_view word, MergeScratch& scratch, std::vector<int32_t>& out) const {
+    // One symbol per character; see char_tokens for characters without a
+    // token. A malformed byte is size() + 0x110000 + byte.
+    const int32_t n_vocab = static_cast<int32_t>(tokens.size());
+    std::vector<int32_t>& ids = scratch.ids;
+    ids.clear();
+    for (size_t pos = 0; pos < word.size();) {
+        size_t len;
+        const uint32_t cp = decode_utf8(word, pos, &len);
+        if (cp == kInvalidCodePoint) {
+            ids.push_back(n_vocab + 0x110000 + static_cast<unsigned char>(word[pos]));
+        } else {
+            auto it = char_tokens.find(cp);
+            ids.push_back(it != char_tokens.end() ? it->second : n_vocab + static_cast<int32_t>(cp));
+        }
+        pos += len;
+    }
+
+    apply_merges(ids, scratch);
+
+    // Characters that are still not a token fall back to byte tokens
+    std::string bytes;
+    for (int32_t id : ids) {
+        if (id < n_vocab) {
+            out.push_back(id);
+            continue;
+        }
+        bytes.clear();
+        if (id - n_vocab >= 0x110000) {
+            bytes += static_cast<char>(id - n_vocab - 0x110000);
+        } else {
+            append_utf8(bytes, static_cast<uint32_t>(id - n_vocab));
+        }
+        for (char c : bytes) {
+            const int32_t b = byte_tokens[static_cast<unsigned char>(c)];
+            out.push_back(b >= 0 ? b : unk_id);
+        }
+    }
+}
+
+void LlamaVocab::tokenize_ugm(std::string_view word, std::vector<int32_t>& out) const {
+    const size_t n = word.size();
+
+    // Viterbi over byte offsets: the best-scoring segmentation of each prefix
+    // and the token (-1: an unknown character) that ends it
+    std::vector<double> best(n + 1, -std::numeric_limits<double>::infinity());
+    std::vector<int32_t> best_token(n + 1, -1);
+    std::vector<size_t> best_start(n + 1, 0);
+    best[0] = 0.0;
+    for (size_t i = 0; i < n;) {
+        size_t len;
+        decode_utf8(word, i, &len);
+        bool covered = false;
+        uint32_t node = 0;
+        for (size_t j = i; j < n; ++j) {
+            const TrieNode& parent = trie_nodes[node];
+            const uint8_t byte = static_cast<uint8_t>(word[j]);
+            auto edge = std::lower_bound(trie_edges.begin() + parent.edge_begin, trie_edges.begin() + parent.edge_end,
+                                         byte, [](const TrieEdge& e, uint8_t b) { return e.byte < b; });
+            if (edge == trie_edges.begin() + parent.edge_end || edge->byte != byte) break;
+            node = edge->node;
+            const int32_t id = trie_nodes[node].token;
+            if (id < 0) continue;
+            covered |= j + 1 == i + len;
+            const double score = best[i] + (token_types[id] == TOKEN_USER_DEFINED ? 0.0f : scores[id]);
+            if (score > best[j + 1]) {
+                best[j + 1] = score;
+                best_token[j + 1] = id;
+                best_start[j + 1] = i;
+            }
+        }
+        if (!covered && best[i] + unk_score > best[i + len]) {
+            best[i + len] = best[i] + unk_score;
+            best_token[i + len] = -1;
+            best_start[i + len] = i;
+        }
+        i += len;
+    }
+
+    std::vector<std::pair<size_t, int32_t>> path; // (start, token)
+    for (size_t end = n; end > 0; end = best_start[end]) {
+        path.emplace_back(best_start[end], best_token[end]);
+    }
+    bool prev_unknown = false;
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        if (it->second >= 0) {
+            out.push_back(it->second);
+            prev_unknown = false;
+            continue;
+        }
+        // Unknown characters: byte tokens when the vocabulary has them, else
+        // one unknown token per run
+        size_t len;
+        decode_utf8(word, it->first, &len);
+        bool bytes = true;
+        for (size_t i = it->first; i < it->first + len; ++i) {
+            bytes &= byte_tokens[static_cast<unsigned char>(word[i])] >= 0;
+        }
+        if (bytes) {
+            for (size_t i = it->first; i < it->first + len; ++i) {
+                out.push_back(byte_tokens[static_cast<unsigned char>(word[i])]);
+            }
+        } else if (!prev_unknown) {
+            out.push_back(unk_id);
+        }
+        prev_unknown = !bytes;
+    }
+}
+
+void LlamaVocab::tokenize_bpe(std::string_view text, std::vector<int32_t>& out) const {
+    PreTokenizer pre = PreTokenizer::Gpt2;
+    if (pre_type == "llama-bpe" || pre_type == "llama3") {
+        pre = PreTokenizer::Llama3;
+    } else if (pre_type == "qwen2") {
+        pre = PreTokenizer::Qwen2;
+    }
+    std::vector<size_t> ends;
+    split_text(text, pre, ends);
+
+    // Llama 3 takes a word that is a token as it is, whatever the merges say
+    const bool ignore_merges = pre == PreTokenizer::Llama3;
+    const ByteLevel& bytes = byte_level();
+    MergeScratch scratch;
+    std::vector<int32_t>& ids = scratch.ids;
+    std::string encoded;
+    size_t begin = 0;
+    for (size_t end : ends) {
+        const std::string_view word(text.data() + begin, end - begin);
+        if (scratch.reuse(word, out)) {
+            begin = end;
+            continue;
+        }
+        const size_t first = out.size();
+
+        if (ignore_merges) {
+            encoded.clear();
+            for (size_t i = begin; i < end; ++i) {
+                append_utf8(encoded, bytes.byte_to_cp[static_cast<unsigned char>(text[i])]);
+            }
+            auto it = token_to_id.find(encoded);
+            if (it != token_to_id.end()) {
+                out.push_back(it->second);
+                scratch.remember(word, first, out);
+                begin = end;
+                continue;
+            }
+        }
+
+        ids.clear();
+        for (size_t i = begin; i < end; ++i) {
+            ids.push_back(byte_symbols[static_cast<unsigned char>(text[i])]);
+        }
+        apply_merges(ids, scratch);
+        for (int32_t id : ids) {
+            out.push_back(id >= 0 ? id : unk_id);
+        }
+        scratch.remember(word, first, out);
+        begin = end;
+    }
+}
+
+std::string LlamaVocab::token_to_piece(int32_t id) const {
+    std::string out;
+    append_piece(id, out);
+    return out;
+}
+
+void LlamaVocab::append_piece(int32_t id, std::string& out) const {
+    if (id < 0 || static_cast<size_t>(id) >= tokens.size()) return;
+
+    switch (token_types[id]) {
+        case TOKEN_CONTROL:
+        case TOKEN_UNUSED:
+            return;
+        case TOKEN_BYTE: {
+            int b = parse_byte_token(tokens[id]);
+            if (b >= 0) out += static_cast<char>(b);
+            return;
+        }
+        case TOKEN_USER_DEFINED:
+            out += tokens[id];
+            return;
+        default:
+            break;
+    }
+
+    const std::string& text = tokens[id];
+    if (model_type == "gpt2") {
+        // Each character stands for one byte
+        const ByteLevel& bytes = byte_level();
+        for (size_t i = 0; i < text.size();) {
+            size_t len;
+            const uint32_t cp = decode_utf8(text, i, &len);
+            if (cp < 324 && bytes.cp_to_byte[cp] >= 0) {
+                out += static_cast<char>(bytes.cp_to_byte[cp]);
+            } else {
+                out.append(text, i, len);
+            }
+            i += len;
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < text.size();) {
+        if (text.compare(i, 3, kSpmSpace) == 0) {
+            out += ' ';
+            i += 3;
+        } else {
+            out += text[i++];
+        }
+    }
+}
+
+std::string LlamaVocab::detokenize(const int32_t* ids, size_t n) const {
+    Detokenizer detokenizer(*this, true);
+    std::string out;
+    for (size_t i = 0; i < n; ++i) {
+        detokenizer.push(ids[i], out);
+    }
+    detokenizer.flush(out);
+    return out;
+}
+
+// Detokenizer
+
+namespace {
+
+const char kReplacementChar[] = "\xEF\xBF\xBD"; // U+FFFD
+
+// Valid range of the second byte after a lead byte, which rules out overlong
+// forms, surrogates and code points past U+10FFFF
+void second_byte_range(unsigned char lead, unsigned char* lo, unsigned char* hi) {
+    *lo = 0x80;
+    *hi = 0xBF;
+    if (lead == 0xE0) *lo = 0xA0;
+    if (lead == 0xED) *hi = 0x9F;
+    if (lead == 0xF0) *lo = 0x90;
+    if (lead == 0xF4) *hi = 0x8F;
+}
+
+} // namespace
+
+Detokenizer::Detokenizer(const LlamaVocab& v, bool strip_leading_space)
+    : vocab(v), strip_space(strip_leading_space && v.model_type != "gpt2" && v.add_space_prefix) {}
+
+size_t Detokenizer::push(int32_t token, std::string& out) {
+    const size_t held = pending.size();
+    vocab.append_piece(token, pending);
+    if (pending.size() == held) return 0;
+    if (at_start && strip_space && pending[0] == ' ') pending.erase(0, 1);
+    at_start = false;
+
+    const size_t start = out.size();
+    const auto* p = reinterpret_cast<const unsigned char*>(pending.data());
+    const size_t n = pending.size();
+    size_t i = 0;
+    while (i < n) {
+        if (p[i] < 0x80) {
+            size_t j = i + 1;
+            while (j < n && p[j] < 0x80) ++j;
+            out.append(pending, i, j - i);
+            i = j;
+            continue;
+        }
+
+        const unsigned char lead = p[i];
+        const size_t len = lead >= 0xC2 && lead <= 0xDF ? 2 : lead >= 0xE0 && lead <= 0xEF ? 3
+                         : lead >= 0xF0 && lead <= 0xF4 ? 4 : 0;
+        if (len == 0) {
+            out += kReplacementChar;
+            ++i;
+            continue;
+        }
+        unsigned char lo, hi;
+        second_byte_range(lead, &lo, &hi);
+        size_t k = 1;
+        while (k < len && i + k < n && p[i + k] >= (k == 1 ? lo : 0x80) && p[i + k] <= (k == 1 ? hi : 0xBF)) ++k;
+        if (k == len) {
+            out.append(pending, i, len);
+        } else if (i + k == n) {
+            break; // a valid start; the rest comes with later tokens
+        } else {
+            out += kReplacementChar; // the valid part of a broken sequence
+        }
+        i += k;
+    }
+    pending.erase(0, i);
+    return out.size() - start;
+}
+
+size_t Detokenizer::flush(std::string& out) {
+    const size_t start = out.size();
+    if (!pending.empty()) out += kReplacementChar;
+    pending.clear();
+    at_start = true;
+    return out.size() - start;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class GGUFFile;
+
+// Token vocabulary read from the GGUF "tokenizer.ggml.*" metadata
+struct LlamaVocab {
+    enum TokenType : int32_t {
+        TOKEN_UNDEFINED = 0,
+        TOKEN_NORMAL = 1,
+        TOKEN_UNKNOWN = 2,
+        TOKEN_CONTROL = 3,
+        TOKEN_USER_DEFINED = 4,
+        TOKEN_UNUSED = 5,
+        TOKEN_BYTE = 6,
+    };
+
+    std::string model_type; // "llama" (SentencePiece BPE), "t5" (SentencePiece unigram) or "gpt2" (byte-level BPE)
+    std::string pre_type;   // gpt2 pre-tokenizer: "llama-bpe", "qwen2", anything else is GPT-2's
+    std::vector<std::string> tokens;
+    std::vector<float> scores;
+    std::vector<int32_t> token_types;
+    std::unordered_map<std::string, int32_t> token_to_id;
+    size_t max_token_len = 0;
+
+    int32_t bos_id = 1;
+    int32_t eos_id = 2;
+    int32_t unk_id = 0;
+    bool add_bos = true;
+    bool add_space_prefix = true; // SentencePiece: the text starts with an implicit space
+
+    // byte value -> id of its "<0xXX>" token, or -1
+    int32_t byte_tokens[256];
+
+    // A merge of two adjacent tokens; pairs with lower priority merge first
+    struct Merge {
+        float priority; // gpt2: rank in tokenizer.ggml.merges; llama: -score of the result
+        int32_t id;
+    };
+    // Open-addressing table of merges keyed by (left id << 32 | right id).
+    // Lookups are the inner loop of tokenization.
+    class MergeTable {
+    public:
+        // Keeps the first merge inserted for a key
+        void insert(uint64_t key, Merge merge);
+        const Merge* find(uint64_t key) const {
+            if (slots.empty()) return nullptr;
+            for (size_t i = slot_of(key);; i = (i + 1) & mask) {
+                const Slot& slot = slots[i];
+                if (slot.merge.id < 0) return nullptr;
+                if (slot.key == key) return &slot.merge;
+            }
+        }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+
+    private:
+        struct Slot {
+            uint64_t key;
+            Merge merge; // id < 0: empty
+        };
+        size_t slot_of(uint64_t key) const { return (key * 0x9E3779B97F4A7C15ull) >> shift; }
+
+        std::vector<Slot> slots;
+        size_t mask = 0;
+        int shift = 64;
+        size_t count = 0;
+    };
+    // For gpt2 and llama models
+    MergeTable merges;
+    // llama: tokens that are a single code point. Characters that only occur
+    // inside longer tokens have no entry and are symbol size() + code point.
+    std::unordered_map<uint32_t, int32_t> char_tokens;
+    // SentencePiece: no token runs from another character into "▁", so words
+    // (cut before each "▁" that follows another character) tokenize alone
+    bool split_words = false;
+    // gpt2: token of each byte's stand-in character
+    int32_t byte_symbols[256];
+    // t5: byte trie over the vocabulary; node 0 is the root
+    struct TrieNode {
+        uint32_t edge_begin;
+        uint32_t edge_end;
+        int32_t token; // token whose text ends here, or -1
+    };
+    struct TrieEdge {
+        uint8_t byte; // edges of a node are sorted by byte
+        uint32_t node;
+    };
+    std::vector<TrieNode> trie_nodes;
+    std::vector<TrieEdge> trie_edges;
+    float unk_score = 0.0f;
+
+    bool load(const GGUFFile& file, std::string* error);
+
+    size_t size() const { return tokens.size(); }
+    bool is_eog(int32_t id) const { return id == eos_id; }
+
+    // Tokenizes like the model's reference tokenizer: SentencePiece BPE merges
+    // by score with byte fallback, unigram Viterbi, or byte-level BPE merges by
+    // rank after splitting the text into words. Merging pops the best adjacent
+    // pair from a heap, so a text of n characters takes O(n log n).
+    std::vector<int32_t> tokenize(std::string_view text, bool with_bos) const;
+    // Raw bytes for a single token (SentencePiece spaces, byte tokens and
+    // byte-level BPE decoded)
+    std::string token_to_piece(int32_t id) const;
+    // Same, appended to `out` without allocating
+    void append_piece(int32_t id, std::string& out) const;
+    // Concatenated pieces as valid UTF-8, without the space tokenize() adds in front
+    std::string detokenize(const int32_t* ids, size_t n) const;
+
+private:
+    struct MergeScratch;
+
+    void load_merges(const GGUFFile& file);
+    void build_trie();
+    uint32_t build_trie_node(const std::vector<int32_t>& order, size_t begin, size_t end, size_t depth);
+    void tokenize_spm(std::string_view word, MergeScratch& scratch, std::vector<int32_t>& out) const;
+    void tokenize_ugm(std::string_view word, std::vector<int32_t>& out) const;
+    void tokenize_bpe(std::string_view text, std::vector<int32_t>& out) const;
+    // Merges adjacent pairs of `ids` in place until no merge applies
+    void apply_merges(std::vector<int32_t>& ids, MergeScratch& scratch) const;
+};
+
+// Turns a stream of tokens into text one token at a time. The text it hands
+// out is always valid UTF-8: a piece that ends inside a multi-byte character
+// (byte tokens, byte-level BPE) is held back until later tokens complete it,
+// and invalid bytes become U+FFFD. A token costs its piece plus at most three
+// held-back bytes, so streaming never re-decodes earlier tokens.
+class Detokenizer {
+public:
+    // strip_leading_space: drop the space SentencePiece adds in front of the
+    // text, for decoding from the start of a tokenize() result
+    explicit Detokenizer(const LlamaVocab& vocab, bool strip_leading_space = false);
+
+    // Appends the text `token` completes to `out`; returns the bytes appended
+    size_t push(int32_t token, std::string& out);
+    // Ends the stream: appends U+FFFD for any held-back incomplete character
+    // and starts over
+    size_t flush(std::string& out);
+
+private:
+    const LlamaVocab& vocab;
+    bool strip_space;
+    bool at_start = true;
+    std::string pending; // held-back bytes, then the new piece
+};
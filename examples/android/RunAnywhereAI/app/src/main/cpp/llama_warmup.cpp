@@ -0,0 +1,145 @@
+#include "llama_warmup.h"
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "llama_scheduler.h"
+#include "llama_stream.h"
+
+namespace {
+
+// Nice value of the warm-up thread, below foreground inference
+constexpr int kWarmupNice = 10;
+// Bytes read between cancellation checks
+constexpr size_t kTouchChunk = 1 << 20;
+
+float elapsed_ms(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+} // namespace
+
+// One group per layer, then the output head with the token embeddings. Layers
+// a LayerStreamer brings in on demand are left out.
+std::vector<std::vector<LlamaWarmup::ByteRange>> LlamaWarmup::weight_stages(const LlamaModel& model) {
+    const uint8_t* base = model.gguf->mapping().data();
+    const auto range = [&](const LlamaTensor& t) {
+        return ByteRange{static_cast<size_t>(t.data - base), t.n_bytes()};
+    };
+    std::vector<std::vector<ByteRange>> stages;
+    for (uint32_t il = 0; il < model.layers.size(); ++il) {
+        if (model.streamer && model.streamer->streamed(il)) break;
+        std::vector<ByteRange>& stage = stages.emplace_back();
+        for (const LlamaTensor* t : model.layers[il].matrices()) {
+            stage.push_back(range(*t));
+        }
+    }
+    // Only the prompt's rows of the embeddings are read, unless they are tied
+    std::vector<ByteRange> head = {range(model.output)};
+    if (model.output.data != model.tok_embd.data) head.push_back(range(model.tok_embd));
+    stages.push_back(std::move(head));
+    return stages;
+}
+
+const char* warmup_phase_name(WarmupPhase phase) {
+    switch (phase) {
+        case WarmupPhase::Prefetching: return "prefetching";
+        case WarmupPhase::Priming: return "priming";
+        case WarmupPhase::Hot: return "hot";
+        case WarmupPhase::Cancelled: return "cancelled";
+        case WarmupPhase::Failed: return "failed";
+    }
+    return "failed";
+}
+
+LlamaWarmup::LlamaWarmup(LlamaModel& m) : model(m) {
+    {
+        std::shared_lock<std::shared_mutex> state(model.state_mutex);
+        stages = weight_stages(model);
+    }
+    for (const std::vector<ByteRange>& stage : stages) {
+        for (const ByteRange& r : stage) {
+            bytes_total += r.len;
+        }
+    }
+    n_layers = static_cast<uint32_t>(stages.size() - 1);
+    thread = std::thread([this] { run(); });
+}
+
+LlamaWarmup::~LlamaWarmup() {
+    cancelled = true;
+    prime_request.cancel();
+    thread.join();
+}
+
+WarmupProgress LlamaWarmup::progress() const {
+    WarmupProgress p;
+    p.phase = phase;
+    p.bytes_done = bytes_done;
+    p.bytes_total = bytes_total;
+    p.layers_done = layers_done;
+    p.n_layers = n_layers;
+    p.prefetch_ms = prefetch_ms;
+    p.prime_ms = prime_ms;
+    return p;
+}
+
+bool LlamaWarmup::touch(size_t offset, size_t len) {
+    const MappedFile& map = model.gguf->mapping();
+    const size_t end = std::min(map.size(), offset + len);
+    for (size_t chunk = offset; chunk < end; chunk += kTouchChunk) {
+        if (cancelled) return false;
+        const size_t n = std::min(end - chunk, kTouchChunk);
+        map.touch(chunk, n);
+        bytes_done += n;
+    }
+    return true;
+}
+
+void LlamaWarmup::run() {
+    // On Linux this lowers only the calling thread
+    setpriority(PRIO_PROCESS, 0, kWarmupNice);
+
+    const auto start = std::chrono::steady_clock::now();
+    const MappedFile& map = model.gguf->mapping();
+    for (const ByteRange& r : stages[0]) {
+        map.advise(r.offset, r.len, MADV_WILLNEED);
+    }
+    for (size_t s = 0; s < stages.size(); ++s) {
+        // Read-ahead of the next stage overlaps faulting in this one
+        if (s + 1 < stages.size()) {
+            for (const ByteRange& r : stages[s + 1]) {
+                map.advise(r.offset, r.len, MADV_WILLNEED);
+            }
+        }
+        for (const ByteRange& r : stages[s]) {
+            if (!touch(r.offset, r.len)) {
+                phase = WarmupPhase::Cancelled;
+                return;
+            }
+        }
+        if (s + 1 < stages.size()) layers_done++;
+        prefetch_ms = elapsed_ms(start);
+    }
+
+    phase = WarmupPhase::Priming;
+    const auto prime_start = std::chrono::steady_clock::now();
+    GenerationParams params;
+    params.max_tokens = 1;
+    params.temperature = 0.0f;
+    params.request = &prime_request;
+    {
+        std::shared_lock<std::shared_mutex> state(model.state_mutex);
+        model.scheduler->generate("Hello", params, nullptr);
+    }
+    prime_ms = elapsed_ms(prime_start);
+    switch (prime_request.stats.stop_reason) {
+        case StopReason::Cancelled: phase = WarmupPhase::Cancelled; break;
+        case StopReason::Error: phase = WarmupPhase::Failed; break;
+        default: phase = WarmupPhase::Hot; break;
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "llama_model.h"
+
+enum class WarmupPhase : uint8_t {
+    Prefetching, // reading weights into memory in execution order
+    Priming,     // generating one token through the scheduler
+    Hot,         // done: the next request runs at steady-state speed
+    Cancelled,
+    Failed,      // the priming generation failed
+};
+
+const char* warmup_phase_name(WarmupPhase phase);
+
+struct WarmupProgress {
+    WarmupPhase phase = WarmupPhase::Prefetching;
+    uint64_t bytes_done = 0;  // weight bytes faulted in so far
+    uint64_t bytes_total = 0;
+    uint32_t layers_done = 0;
+    uint32_t n_layers = 0;    // layers to prefetch; streamed layers are not
+    float prefetch_ms = 0.0f;
+    float prime_ms = 0.0f;
+};
+
+// Warms a freshly loaded model so its first request does not pay for page
+// faults across the whole mapped file. On a low-priority thread, the weights
+// are read in the order a forward pass uses them, layer by layer, with the
+// next layer's pages requested (MADV_WILLNEED) while the current one is read.
+// Then a one-token generation runs through the scheduler, which sizes the
+// workspace's scratch buffers and wakes the compute threads. Requests made
+// meanwhile are served as usual and merely find more of the model resident.
+//
+// Must be destroyed before the model, and before its thread pool or context
+// is replaced (set_threads, create_context).
+class LlamaWarmup {
+public:
+    explicit LlamaWarmup(LlamaModel& model);
+    // Cancels the warm-up if it is still running and waits for it
+    ~LlamaWarmup();
+    LlamaWarmup(const LlamaWarmup&) = delete;
+    LlamaWarmup& operator=(const LlamaWarmup&) = delete;
+
+    WarmupProgress progress() const;
+
+private:
+    struct ByteRange {
+        size_t offset;
+        size_t len;
+    };
+
+    // The model's weights grouped by when a forward pass first reads them
+    static std::vector<std::vector<ByteRange>> weight_stages(const LlamaModel& model);
+
+    void run();
+    // Reads one byte per page of [offset, offset + len) of the mapping
+    bool touch(size_t offset, size_t len);
+
+    LlamaModel& model;
+    // Computed once under the model's state lock, as it depends on the streamer
+    std::vector<std::vector<ByteRange>> stages;
+    GenerationRequest prime_request; // cancelled along with the warm-up
+    std::atomic<bool> cancelled{false};
+    std::atomic<WarmupPhase> phase{WarmupPhase::Prefetching};
+    std::atomic<uint64_t> bytes_done{0};
+    uint64_t bytes_total = 0;
+    uint32_t n_layers = 0;
+    std::atomic<uint32_t> layers_done{0};
+    std::atomic<float> prefetch_ms{0.0f};
+    std::atomic<float> prime_ms{0.0f};
+    std::thread thread;
+};
@@ -1,5 +1,9 @@
 #include <jni.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <android/log.h>
 #include <sstream>
@@ -9,6 +13,14 @@
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, TAG, __VA_ARGS__)
 
+// One streaming call: created before the call starts, so a cancel issued at
+// any point before or during it is seen
+struct MLCRequest {
+    // Set by nativeCancelRequest; checked between tokens of the stream
+    std::atomic<bool> cancelled{false};
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+};
+
 // Placeholder MLC-LLM engine structure
 // In a real implementation, this would integrate with TVM runtime and MLC-LLM
 struct MLCEngine {
@@ -26,7 +38,7 @@ struct MLCEngine {
         LOGI("MLC-LLM Engine created with model: %s, device: %s", path.c_str(), dev.c_str());
     }
 
-    std::string generate(const std::string& messages, float temperature, int max_tokens) {
+    std::string generate(std::string_view messages, float temperature, int max_tokens) {
         // Placeholder implementation
         std::stringstream response;
         response << "{\"id\":\"chatcmpl-placeholder\",";
@@ -48,7 +60,10 @@ struct MLCEngine {
         return response.str();
     }
 
+    // Stops between tokens once `request` is cancelled or past its deadline,
+    // ending the stream with finish_reason "cancelled" or "deadline"
     void streamGenerate(const std::string& messages, float temperature, int max_tokens,
+                       const MLCRequest& request,
                        std::function<void(const std::string&)> callback) {
         // Placeholder streaming implementation
         std::vector<std::string> tokens = {
@@ -57,6 +72,12 @@ struct MLCEngine {
         };
 
         for (const auto& token : tokens) {
+            const char* stop = request.cancelled ? "cancelled"
+                               : std::chrono::steady_clock::now() >= request.deadline ? "deadline" : nullptr;
+            if (stop) {
+                callback(std::string("{\"choices\":[{\"delta\":{},\"finish_reason\":\"") + stop + "\"}]}");
+                return;
+            }
             std::stringstream chunk;
             chunk << "{\"choices\":[{\"delta\":{\"content\":\"" << token << " \"}}]}";
             callback(chunk.str());
@@ -117,6 +138,55 @@ Java_com_runanywhere_runanywhereai_llm_frameworks_MLCLLMService_00024Companion_n
     }
 }
 
+// nativeChatCompletion over direct ByteBuffers: the messages JSON is read in
+// place from messages[0, messagesLength) and the response JSON is written as
+// UTF-8 to the start of output. Returns the buffer holding the response with
+// its limit at the response's end: output itself, or a new direct buffer when
+// the response is larger than output's capacity, so generation runs once
+// either way. Returns null on error.
+JNIEXPORT jobject JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_MLCLLMService_00024Companion_nativeChatCompletionDirect(
+    JNIEnv *env, jobject /* this */, jlong enginePtr, jobject messages, jint messagesLength,
+    jobject output, jfloat temperature, jint maxTokens) {
+
+    if (enginePtr == 0) {
+        LOGE("Invalid engine pointer");
+        return nullptr;
+    }
+
+    auto* msgs = static_cast<const char*>(env->GetDirectBufferAddress(messages));
+    auto* out = static_cast<char*>(env->GetDirectBufferAddress(output));
+    if (!msgs || !out || messagesLength < 0 || messagesLength > env->GetDirectBufferCapacity(messages)) {
+        LOGE("Expected direct ByteBuffers holding the messages and the response");
+        return nullptr;
+    }
+
+    auto* engine = reinterpret_cast<MLCEngine*>(enginePtr);
+    std::string response;
+    try {
+        response = engine->generate(std::string_view(msgs, messagesLength), temperature, maxTokens);
+    } catch (const std::exception& e) {
+        LOGE("Generation failed: %s", e.what());
+        return nullptr;
+    }
+
+    jobject target = output;
+    if (static_cast<jlong>(response.size()) > env->GetDirectBufferCapacity(output)) {
+        jclass byteBuffer = env->FindClass("java/nio/ByteBuffer");
+        jmethodID allocateDirect = env->GetStaticMethodID(byteBuffer, "allocateDirect", "(I)Ljava/nio/ByteBuffer;");
+        target = env->CallStaticObjectMethod(byteBuffer, allocateDirect, static_cast<jint>(response.size()));
+        if (env->ExceptionCheck() || !target) return nullptr; // OutOfMemoryError reaches the caller
+        out = static_cast<char*>(env->GetDirectBufferAddress(target));
+    }
+    memcpy(out, response.data(), response.size());
+
+    jclass buffer = env->FindClass("java/nio/Buffer");
+    env->CallObjectMethod(target, env->GetMethodID(buffer, "clear", "()Ljava/nio/Buffer;"));
+    env->CallObjectMethod(target, env->GetMethodID(buffer, "limit", "(I)Ljava/nio/Buffer;"),
+                          static_cast<jint>(response.size()));
+    return target;
+}
+
 // Callback interface for streaming
 class StreamCallbackWrapper {
     JNIEnv* env;
@@ -150,23 +220,38 @@ public:
     }
 };
 
+// Handle for one nativeStreamCompletion call: pass it as requestPtr, cancel it
+// from any thread, then free it once the call has returned. timeoutMs > 0 sets
+// a wall-clock deadline counted from now.
+JNIEXPORT jlong JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_MLCLLMService_00024Companion_nativeCreateRequest(
+    JNIEnv *env, jobject /* this */, jlong timeoutMs) {
+
+    auto* request = new MLCRequest();
+    if (timeoutMs > 0) {
+        request->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    }
+    return reinterpret_cast<jlong>(request);
+}
+
 JNIEXPORT void JNICALL
 Java_com_runanywhere_runanywhereai_llm_frameworks_MLCLLMService_00024Companion_nativeStreamCompletion(
     JNIEnv *env, jobject /* this */, jlong enginePtr, jstring messages,
-    jfloat temperature, jint maxTokens, jobject callback) {
+    jfloat temperature, jint maxTokens, jlong requestPtr, jobject callback) {
 
-    if (enginePtr == 0) {
-        LOGE("Invalid engine pointer");
+    if (enginePtr == 0 || requestPtr == 0) {
+        LOGE("Invalid engine or request pointer");
         return;
     }
 
     auto* engine = reinterpret_cast<MLCEngine*>(enginePtr);
+    const auto* request = reinterpret_cast<MLCRequest*>(requestPtr);
     const char* msgs = env->GetStringUTFChars(messages, nullptr);
 
     StreamCallbackWrapper wrapper(env, callback);
 
     try {
-        engine->streamGenerate(msgs, temperature, maxTokens,
+        engine->streamGenerate(msgs, temperature, maxTokens, *request,
             [&wrapper](const std::string& chunk) {
                 wrapper.onToken(chunk);
             });
@@ -179,6 +264,24 @@ Java_com_runanywhere_runanywhereai_llm_frameworks_MLCLLMService_00024Companion_n
     env->ReleaseStringUTFChars(messages, msgs);
 }
 
+// Ends the request's stream at its next token, or before its first if the
+// call has not started yet; safe to call from any thread
+JNIEXPORT void JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_MLCLLMService_00024Companion_nativeCancelRequest(
+    JNIEnv *env, jobject /* this */, jlong requestPtr) {
+
+    if (requestPtr != 0) {
+        reinterpret_cast<MLCRequest*>(requestPtr)->cancelled = true;
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_runanywhere_runanywhereai_llm_frameworks_MLCLLMService_00024Companion_nativeFreeRequest(
+    JNIEnv *env, jobject /* this */, jlong requestPtr) {
+
+    delete reinterpret_cast<MLCRequest*>(requestPtr);
+}
+
 JNIEXPORT void JNICALL
 Java_com_runanywhere_runanywhereai_llm_frameworks_MLCLLMService_00024Companion_nativeReleaseEngine(
     JNIEnv *env, jobject /* this */, jlong enginePtr) {
@@ -0,0 +1,238 @@
+#include "ops.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Cephes expf: exp(x) = 2^n * exp(r) with n = round(x / ln 2) and |r| <= ln(2) / 2,
+// exp(r) from a degree-6 polynomial; within 2 ulp of std::exp. Inputs are clamped
+// so 2^n stays a normal float, and anything below kExpMin (e.g. the -inf of a
+// masked logit) gives exactly 0.
+constexpr float kExpMin = -87.3f;
+constexpr float kExpMax = 88.3f;
+constexpr float kLog2e = 1.44269504088896341f;
+constexpr float kLn2Hi = 0.693359375f;
+constexpr float kLn2Lo = -2.12194440e-4f;
+constexpr float kExpP0 = 1.9875691500e-4f;
+constexpr float kExpP1 = 1.3981999507e-3f;
+constexpr float kExpP2 = 8.3334519073e-3f;
+constexpr float kExpP3 = 4.1665795894e-2f;
+constexpr float kExpP4 = 1.6666665459e-1f;
+constexpr float kExpP5 = 5.0000001201e-1f;
+
+#if defined(__aarch64__)
+inline float32x4_t exp_f32x4(float32x4_t x) {
+    const uint32x4_t in_range = vcgeq_f32(x, vdupq_n_f32(kExpMin));
+    x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(kExpMin)), vdupq_n_f32(kExpMax));
+    const int32x4_t n = vcvtnq_s32_f32(vmulq_n_f32(x, kLog2e));
+    const float32x4_t fn = vcvtq_f32_s32(n);
+    x = vfmsq_f32(x, fn, vdupq_n_f32(kLn2Hi));
+    x = vfmsq_f32(x, fn, vdupq_n_f32(kLn2Lo));
+    float32x4_t y = vdupq_n_f32(kExpP0);
+    y = vfmaq_f32(vdupq_n_f32(kExpP1), y, x);
+    y = vfmaq_f32(vdupq_n_f32(kExpP2), y, x);
+    y = vfmaq_f32(vdupq_n_f32(kExpP3), y, x);
+    y = vfmaq_f32(vdupq_n_f32(kExpP4), y, x);
+    y = vfmaq_f32(vdupq_n_f32(kExpP5), y, x);
+    y = vfmaq_f32(vaddq_f32(x, vdupq_n_f32(1.0f)), y, vmulq_f32(x, x));
+    const int32x4_t pow2n = vshlq_n_s32(vaddq_s32(n, vdupq_n_s32(127)), 23);
+    y = vmulq_f32(y, vreinterpretq_f32_s32(pow2n));
+    return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(y), in_range));
+}
+#elif defined(__SSE2__)
+inline __m128 exp_f32x4(__m128 x) {
+    const __m128 in_range = _mm_cmpge_ps(x, _mm_set1_ps(kExpMin));
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(kExpMin)), _mm_set1_ps(kExpMax));
+    const __m128i n = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(kLog2e))); // rounds to nearest
+    const __m128 fn = _mm_cvtepi32_ps(n);
+    x = _mm_sub_ps(x, _mm_mul_ps(fn, _mm_set1_ps(kLn2Hi)));
+    x = _mm_sub_ps(x, _mm_mul_ps(fn, _mm_set1_ps(kLn2Lo)));
+    __m128 y = _mm_set1_ps(kExpP0);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(kExpP1));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(kExpP2));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(kExpP3));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(kExpP4));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(kExpP5));
+    y = _mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(x, x)), _mm_add_ps(x, _mm_set1_ps(1.0f)));
+    const __m128i pow2n = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+    return _mm_and_ps(_mm_mul_ps(y, _mm_castsi128_ps(pow2n)), in_range);
+}
+#endif
+
+} // namespace
+
+void op_rms_norm(float* out, const float* x, const float* w, int64_t n, float eps) {
+    float sum = 0.0f;
+    for (int64_t i = 0; i < n; ++i) {
+        sum += x[i] * x[i];
+    }
+    const float scale = 1.0f / std::sqrt(sum / static_cast<float>(n) + eps);
+    for (int64_t i = 0; i < n; ++i) {
+        out[i] = x[i] * scale * w[i];
+    }
+}
+
+void op_rope_cache(float* cos_sin, int n_rot, int64_t pos, float freq_base, float freq_scale) {
+    const float p = static_cast<float>(pos) * freq_scale;
+    for (int i = 0; i < n_rot / 2; ++i) {
+        const float theta = p * std::pow(freq_base, -2.0f * static_cast<float>(i) / static_cast<float>(n_rot));
+        cos_sin[2 * i + 0] = std::cos(theta);
+        cos_sin[2 * i + 1] = std::sin(theta);
+    }
+}
+
+void op_rope(float* x, int n_heads, int head_dim, int n_rot, const float* cos_sin) {
+    for (int h = 0; h < n_heads; ++h) {
+        float* v = x + h * head_dim;
+        for (int i = 0; i < n_rot / 2; ++i) {
+            const float c = cos_sin[2 * i + 0];
+            const float s = cos_sin[2 * i + 1];
+            const float x0 = v[2 * i + 0];
+            const float x1 = v[2 * i + 1];
+            v[2 * i + 0] = x0 * c - x1 * s;
+            v[2 * i + 1] = x0 * s + x1 * c;
+        }
+    }
+}
+
+float op_softmax(float* x, int64_t n) {
+    float max = x[0];
+    for (int64_t i = 1; i < n; ++i) {
+        max = std::max(max, x[i]);
+    }
+    float sum = 0.0f;
+    for (int64_t i = 0; i < n; ++i) {
+        x[i] = std::exp(x[i] - max);
+        sum += x[i];
+    }
+    const float inv = 1.0f / sum;
+    for (int64_t i = 0; i < n; ++i) {
+        x[i] *= inv;
+    }
+    return max;
+}
+
+float op_max(const float* x, int64_t n) {
+    int64_t i = 0;
+    float max = -INFINITY;
+#if defined(__aarch64__)
+    if (n >= 16) {
+        float32x4_t m0 = vld1q_f32(x), m1 = m0, m2 = m0, m3 = m0;
+        for (; i + 16 <= n; i += 16) {
+            m0 = vmaxq_f32(m0, vld1q_f32(x + i));
+            m1 = vmaxq_f32(m1, vld1q_f32(x + i + 4));
+            m2 = vmaxq_f32(m2, vld1q_f32(x + i + 8));
+            m3 = vmaxq_f32(m3, vld1q_f32(x + i + 12));
+        }
+        max = vmaxvq_f32(vmaxq_f32(vmaxq_f32(m0, m1), vmaxq_f32(m2, m3)));
+    }
+#elif defined(__SSE2__)
+    if (n >= 16) {
+        __m128 m0 = _mm_loadu_ps(x), m1 = m0, m2 = m0, m3 = m0;
+        for (; i + 16 <= n; i += 16) {
+            m0 = _mm_max_ps(m0, _mm_loadu_ps(x + i));
+            m1 = _mm_max_ps(m1, _mm_loadu_ps(x + i + 4));
+            m2 = _mm_max_ps(m2, _mm_loadu_ps(x + i + 8));
+            m3 = _mm_max_ps(m3, _mm_loadu_ps(x + i + 12));
+        }
+        __m128 m = _mm_max_ps(_mm_max_ps(m0, m1), _mm_max_ps(m2, m3));
+        m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+        max = _mm_cvtss_f32(m);
+    }
+#endif
+    for (; i < n; ++i) {
+        max = std::max(max, x[i]);
+    }
+    return max;
+}
+
+int64_t op_argmax(const float* x, int64_t n) {
+    const float max = op_max(x, n);
+    int64_t i = 0;
+    // Skip whole vectors that do not hold the max
+#if defined(__aarch64__)
+    const float32x4_t m = vdupq_n_f32(max);
+    for (; i + 4 <= n; i += 4) {
+        if (vmaxvq_u32(vceqq_f32(vld1q_f32(x + i), m)) != 0) break;
+    }
+#elif defined(__SSE2__)
+    const __m128 m = _mm_set1_ps(max);
+    for (; i + 4 <= n; i += 4) {
+        if (_mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(x + i), m)) != 0) break;
+    }
+#endif
+    for (; i < n; ++i) {
+        if (x[i] == max) return i;
+    }
+    return 0;
+}
+
+float op_exp_sum(float* x, int64_t n, float scale, float bias) {
+    int64_t i = 0;
+    float sum = 0.0f;
+#if defined(__aarch64__)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t e = exp_f32x4(vfmaq_n_f32(vdupq_n_f32(bias), vld1q_f32(x + i), scale));
+        vst1q_f32(x + i, e);
+        acc = vaddq_f32(acc, e);
+    }
+    sum = vaddvq_f32(acc);
+#elif defined(__SSE2__)
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        const __m128 e = exp_f32x4(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + i), _mm_set1_ps(scale)), _mm_set1_ps(bias)));
+        _mm_storeu_ps(x + i, e);
+        acc = _mm_add_ps(acc, e);
+    }
+    acc = _mm_add_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum = _mm_cvtss_f32(acc);
+#endif
+    for (; i < n; ++i) {
+        x[i] = std::exp(x[i] * scale + bias);
+        sum += x[i];
+    }
+    return sum;
+}
+
+void op_swiglu(float* out, const float* gate, const float* up, int64_t n) {
+    for (int64_t i = 0; i < n; ++i) {
+        const float g = gate[i];
+        out[i] = g / (1.0f + std::exp(-g)) * up[i];
+    }
+}
+
+void op_add(float* y, const float* x, int64_t n) {
+    for (int64_t i = 0; i < n; ++i) {
+        y[i] += x[i];
+    }
+}
+
+void op_scale(float* x, float a, int64_t n) {
+    for (int64_t i = 0; i < n; ++i) {
+        x[i] *= a;
+    }
+}
+
+void op_axpy(float* y, float a, const float* x, int64_t n) {
+    for (int64_t i = 0; i < n; ++i) {
+        y[i] += a * x[i];
+    }
+}
+
+float op_dot(const float* a, const float* b, int64_t n) {
+    float sum = 0.0f;
+    for (int64_t i = 0; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+
+// Element-wise and normalization ops used by the transformer forward pass.
+// All operate on contiguous float rows.
+
+// out = x / rms(x) * w
+void op_rms_norm(float* out, const float* x, const float* w, int64_t n, float eps);
+
+// Rotary embedding on interleaved pairs (x[2i], x[2i+1]) of the first n_rot dims
+// of each head. cos_sin holds n_rot/2 (cos, sin) pairs for the token's position.
+void op_rope(float* x, int n_heads, int head_dim, int n_rot, const float* cos_sin);
+
+// Fills cos_sin (n_rot/2 pairs) for position pos
+void op_rope_cache(float* cos_sin, int n_rot, int64_t pos, float freq_base, float freq_scale);
+
+// In-place softmax over n values; returns the max used for stabilization
+float op_softmax(float* x, int64_t n);
+
+// Largest of n values
+float op_max(const float* x, int64_t n);
+
+// Index of the first occurrence of the largest of n values
+int64_t op_argmax(const float* x, int64_t n);
+
+// x = exp(x * scale + bias) in place; returns the sum. Vectorized with a
+// polynomial exp where the baseline ISA allows (NEON on arm64, SSE2 on x86-64).
+float op_exp_sum(float* x, int64_t n, float scale, float bias);
+
+// out = silu(gate) * up
+void op_swiglu(float* out, const float* gate, const float* up, int64_t n);
+
+// y += x
+void op_add(float* y, const float* x, int64_t n);
+
+// x *= a
+void op_scale(float* x, float a, int64_t n);
+
+// y += a * x
+void op_axpy(float* y, float a, const float* x, int64_t n);
+
+// Dot product of two float rows
+float op_dot(const float* a, const float* b, int64_t n);
@@ -0,0 +1,140 @@
+#include "prefix_cache.h"
+
+#include <algorithm>
+#include <functional>
+
+PrefixCache::PrefixCache(KVCachePool& kv_pool, uint64_t budget_bytes)
+    : pool(kv_pool), budget(budget_bytes) {}
+
+PrefixCache::~PrefixCache() {
+    clear();
+}
+
+int32_t PrefixCache::match(const std::vector<int32_t>& tokens, KVSequence& seq) {
+    const size_t bs = pool.block_size();
+    // Never cover the last token: its logits are needed to start sampling
+    const size_t max_blocks = tokens.empty() ? 0 : (tokens.size() - 1) / bs;
+
+    counters.lookups++;
+    counters.tokens_looked_up += tokens.size();
+    const uint64_t now = ++clock;
+
+    Node* node = &root;
+    std::vector<int32_t> key(bs);
+    for (size_t i = 0; i < max_blocks; ++i) {
+        key.assign(tokens.begin() + i * bs, tokens.begin() + (i + 1) * bs);
+        auto it = node->children.find(key);
+        if (it == node->children.end()) {
+            break;
+        }
+        node = it->second.get();
+        node->last_used = now;
+        pool.retain(node->block);
+        seq.blocks.push_back(node->block);
+    }
+
+    const int32_t n_matched = static_cast<int32_t>(seq.blocks.size() * bs);
+    seq.n_tokens = n_matched;
+    if (n_matched > 0) {
+        counters.hits++;
+        counters.tokens_reused += n_matched;
+    }
+    return n_matched;
+}
+
+void PrefixCache::insert(const std::vector<int32_t>& tokens, const KVSequence& seq) {
+    const size_t bs = pool.block_size();
+    const size_t n_full = std::min(tokens.size(), static_cast<size_t>(seq.n_tokens)) / bs;
+    const uint64_t now = ++clock;
+
+    Node* node = &root;
+    std::vector<int32_t> key;
+    for (size_t i = 0; i < n_full && i < seq.blocks.size(); ++i) {
+        key.assign(tokens.begin() + i * bs, tokens.begin() + (i + 1) * bs);
+        auto it = node->children.find(key);
+        if (it == node->children.end()) {
+            auto child = std::make_unique<Node>();
+            child->key = key;
+            child->block = seq.blocks[i];
+            child->parent = node;
+            pool.retain(child->block);
+            n_nodes++;
+            it = node->children.emplace(key, std::move(child)).first;
+        }
+        // An existing node may hold an identical copy computed by another
+        // sequence; keep it and leave the caller's block private
+        node = it->second.get();
+        node->last_used = now;
+    }
+    enforce_budget();
+}
+
+PrefixCache::Node* PrefixCache::find_lru_leaf() const {
+    Node* best = nullptr;
+    std::function<void(const Node&)> visit = [&](const Node& n) {
+        for (const auto& entry : n.children) {
+            Node* child = entry.second.get();
+            if (!child->children.empty()) {
+                visit(*child);
+            } else if (pool.refs(child->block) == 1 && (!best || child->last_used < best->last_used)) {
+                // Only the cache references this block, so dropping it frees memory
+                best = child;
+            }
+        }
+    };
+    visit(root);
+    return best;
+}
+
+void PrefixCache::remove_leaf(Node* node) {
+    pool.release(node->block);
+    n_nodes--;
+    counters.evictions++;
+    const std::vector<int32_t> key = node->key; // erase() destroys the node
+    node->parent->children.erase(key);
+}
+
+uint32_t PrefixCache::evict(uint32_t n_blocks) {
+    uint32_t freed = 0;
+    while (freed < n_blocks) {
+        Node* leaf = find_lru_leaf();
+        if (!leaf) break;
+        remove_leaf(leaf);
+        freed++;
+    }
+    return freed;
+}
+
+void PrefixCache::enforce_budget() {
+    const size_t block_bytes = pool.block_bytes();
+    while (static_cast<uint64_t>(n_nodes) * block_bytes > budget) {
+        Node* leaf = find_lru_leaf();
+        if (!leaf) break; // everything left is in use by a live sequence
+        remove_leaf(leaf);
+    }
+}
+
+void PrefixCache::set_budget(uint64_t bytes) {
+    budget = bytes;
+    enforce_budget();
+}
+
+void PrefixCache::clear() {
+    std::function<void(Node&)> drop = [&](Node& n) {
+        for (auto& entry : n.children) {
+            drop(*entry.second);
+            pool.release(entry.second->block);
+        }
+        n.children.clear();
+    };
+    drop(root);
+    n_nodes = 0;
+}
+
+PrefixCacheStats PrefixCache::stats() const {
+    PrefixCacheStats s = counters;
+    s.nodes = n_nodes;
+    s.bytes = static_cast<uint64_t>(n_nodes) * pool.block_bytes();
+    s.budget_bytes = budget;
+    return s;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "kv_cache.h"
+
+struct PrefixCacheStats {
+    uint64_t lookups = 0;
+    uint64_t hits = 0;             // lookups that reused at least one block
+    uint64_t tokens_looked_up = 0;
+    uint64_t tokens_reused = 0;    // prompt tokens that skipped prefill
+    uint64_t evictions = 0;        // blocks dropped to honour the budget or free the pool
+    uint32_t nodes = 0;
+    uint64_t bytes = 0;
+    uint64_t budget_bytes = 0;
+};
+
+// Radix tree of token sequences whose keys and values are still in the KV pool.
+// Edges are block_size-token runs, so every node owns exactly one full KV block
+// and a path from the root spells out the prefix that block was computed under.
+// The cache holds its own reference on each block; blocks that no live
+// sequence uses are evicted least-recently-used first when the tree exceeds its
+// byte budget or the pool needs room.
+class PrefixCache {
+public:
+    PrefixCache(KVCachePool& pool, uint64_t budget_bytes);
+    ~PrefixCache();
+    PrefixCache(const PrefixCache&) = delete;
+    PrefixCache& operator=(const PrefixCache&) = delete;
+
+    // Appends the blocks of the longest cached prefix of `tokens` to `seq` (which
+    // must be empty) and returns the number of positions they cover. At least one
+    // token is always left over so the caller has something to decode for logits.
+    int32_t match(const std::vector<int32_t>& tokens, KVSequence& seq);
+
+    // Records the full blocks of `seq`, whose positions hold `tokens`
+    void insert(const std::vector<int32_t>& tokens, const KVSequence& seq);
+
+    // Drops up to n_blocks unused blocks, oldest first; returns how many were freed
+    uint32_t evict(uint32_t n_blocks);
+
+    void set_budget(uint64_t bytes);
+    void clear();
+
+    PrefixCacheStats stats() const;
+
+private:
+    struct Node {
+        std::vector<int32_t> key; // tokens stored in `block`
+        int32_t block = -1;
+        Node* parent = nullptr;
+        uint64_t last_used = 0;
+        std::map<std::vector<int32_t>, std::unique_ptr<Node>> children;
+    };
+
+    Node* find_lru_leaf() const;
+    void remove_leaf(Node* node);
+    void enforce_budget();
+
+    KVCachePool& pool;
+    Node root;
+    uint64_t clock = 0;
+    uint32_t n_nodes = 0;
+    uint64_t budget;
+    PrefixCacheStats counters;
+};
@@ -0,0 +1,495 @@
+#include "quants.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "cpu_features.h"
+
+namespace {
+
+// Scalar reference kernels. Integer accumulation order matches the SIMD paths
+// so results only differ by float rounding.
+
+void vec_dot_f32_f32(int64_t n, float* s, const void* vx, const void* vy) {
+    const auto* x = static_cast<const float*>(vx);
+    const auto* y = static_cast<const float*>(vy);
+    float sum = 0.0f;
+    for (int64_t i = 0; i < n; ++i) {
+        sum += x[i] * y[i];
+    }
+    *s = sum;
+}
+
+void vec_dot_f16_f32(int64_t n, float* s, const void* vx, const void* vy) {
+    const auto* x = static_cast<const ggml_half*>(vx);
+    const auto* y = static_cast<const float*>(vy);
+    float sum = 0.0f;
+    for (int64_t i = 0; i < n; ++i) {
+        sum += fp16_to_fp32(x[i]) * y[i];
+    }
+    *s = sum;
+}
+
+void vec_dot_q4_0_q8_0(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK8_0;
+    const auto* x = static_cast<const block_q4_0*>(vx);
+    const auto* y = static_cast<const block_q8_0*>(vy);
+
+    float sumf = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        int sumi = 0;
+        for (int j = 0; j < QK4_0 / 2; ++j) {
+            const int v0 = (x[i].qs[j] & 0x0F) - 8;
+            const int v1 = (x[i].qs[j] >> 4) - 8;
+            sumi += v0 * y[i].qs[j] + v1 * y[i].qs[j + QK4_0 / 2];
+        }
+        sumf += sumi * fp16_to_fp32(x[i].d) * fp16_to_fp32(y[i].d);
+    }
+    *s = sumf;
+}
+
+void vec_dot_q8_0_q8_0(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK8_0;
+    const auto* x = static_cast<const block_q8_0*>(vx);
+    const auto* y = static_cast<const block_q8_0*>(vy);
+
+    float sumf = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        int sumi = 0;
+        for (int j = 0; j < QK8_0; ++j) {
+            sumi += x[i].qs[j] * y[i].qs[j];
+        }
+        sumf += sumi * fp16_to_fp32(x[i].d) * fp16_to_fp32(y[i].d);
+    }
+    *s = sumf;
+}
+
+void vec_dot_q4_K_q8_K(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK_K;
+    const auto* x = static_cast<const block_q4_K*>(vx);
+    const auto* y = static_cast<const block_q8_K*>(vy);
+
+    float sumf = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        const uint8_t* q4 = x[i].qs;
+        const int8_t* q8 = y[i].qs;
+        int sumi = 0;
+        int summs = 0;
+        for (int j = 0; j < QK_K / 64; ++j) {
+            uint8_t sc0, m0, sc1, m1;
+            get_scale_min_k4(2 * j + 0, x[i].scales, &sc0, &m0);
+            get_scale_min_k4(2 * j + 1, x[i].scales, &sc1, &m1);
+
+            int s0 = 0;
+            int s1 = 0;
+            for (int l = 0; l < 32; ++l) {
+                s0 += (q4[l] & 0xF) * q8[l];
+                s1 += (q4[l] >> 4) * q8[l + 32];
+            }
+            sumi += sc0 * s0 + sc1 * s1;
+            summs += m0 * (y[i].bsums[4 * j + 0] + y[i].bsums[4 * j + 1]) +
+                     m1 * (y[i].bsums[4 * j + 2] + y[i].bsums[4 * j + 3]);
+            q4 += 32;
+            q8 += 64;
+        }
+        sumf += y[i].d * (fp16_to_fp32(x[i].d) * sumi - fp16_to_fp32(x[i].dmin) * summs);
+    }
+    *s = sumf;
+}
+
+void vec_dot_q5_K_q8_K(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK_K;
+    const auto* x = static_cast<const block_q5_K*>(vx);
+    const auto* y = static_cast<const block_q8_K*>(vy);
+
+    float sumf = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        const uint8_t* ql = x[i].qs;
+        const uint8_t* qh = x[i].qh;
+        const int8_t* q8 = y[i].qs;
+        int sumi = 0;
+        int summs = 0;
+        for (int j = 0; j < QK_K / 64; ++j) {
+            uint8_t sc0, m0, sc1, m1;
+            get_scale_min_k4(2 * j + 0, x[i].scales, &sc0, &m0);
+            get_scale_min_k4(2 * j + 1, x[i].scales, &sc1, &m1);
+
+            const uint8_t u0 = 1 << (2 * j);
+            const uint8_t u1 = 2 << (2 * j);
+            int s0 = 0;
+            int s1 = 0;
+            for (int l = 0; l < 32; ++l) {
+                s0 += ((ql[l] & 0xF) + (qh[l] & u0 ? 16 : 0)) * q8[l];
+                s1 += ((ql[l] >> 4) + (qh[l] & u1 ? 16 : 0)) * q8[l + 32];
+            }
+            sumi += sc0 * s0 + sc1 * s1;
+            summs += m0 * (y[i].bsums[4 * j + 0] + y[i].bsums[4 * j + 1]) +
+                     m1 * (y[i].bsums[4 * j + 2] + y[i].bsums[4 * j + 3]);
+            ql += 32;
+            q8 += 64;
+        }
+        sumf += y[i].d * (fp16_to_fp32(x[i].d) * sumi - fp16_to_fp32(x[i].dmin) * summs);
+    }
+    *s = sumf;
+}
+
+void vec_dot_q6_K_q8_K(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK_K;
+    const auto* x = static_cast<const block_q6_K*>(vx);
+    const auto* y = static_cast<const block_q8_K*>(vy);
+
+    float sumf = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        const uint8_t* ql = x[i].ql;
+        const uint8_t* qh = x[i].qh;
+        const int8_t* sc = x[i].scales;
+        const int8_t* q8 = y[i].qs;
+        int sumi = 0;
+        for (int half = 0; half < QK_K / 128; ++half) {
+            int s[8] = {0};
+            for (int l = 0; l < 32; ++l) {
+                const int is = l / 16;
+                const int q1 = ((ql[l] & 0xF) | (((qh[l] >> 0) & 3) << 4)) - 32;
+                const int q2 = ((ql[l + 32] & 0xF) | (((qh[l] >> 2) & 3) << 4)) - 32;
+                const int q3 = ((ql[l] >> 4) | (((qh[l] >> 4) & 3) << 4)) - 32;
+                const int q4 = ((ql[l + 32] >> 4) | (((qh[l] >> 6) & 3) << 4)) - 32;
+                s[is + 0] += q1 * q8[l];
+                s[is + 2] += q2 * q8[l + 32];
+                s[is + 4] += q3 * q8[l + 64];
+                s[is + 6] += q4 * q8[l + 96];
+            }
+            for (int k = 0; k < 8; ++k) {
+                sumi += sc[k] * s[k];
+            }
+            ql += 64;
+            qh += 32;
+            sc += 8;
+            q8 += 128;
+        }
+        sumf += y[i].d * fp16_to_fp32(x[i].d) * sumi;
+    }
+    *s = sumf;
+}
+
+void dequantize_row_q4_0(const block_q4_0* x, float* y, int64_t k) {
+    for (int64_t i = 0; i < k / QK4_0; ++i) {
+        const float d = fp16_to_fp32(x[i].d);
+        for (int j = 0; j < QK4_0 / 2; ++j) {
+            y[i * QK4_0 + j] = ((x[i].qs[j] & 0x0F) - 8) * d;
+            y[i * QK4_0 + j + QK4_0 / 2] = ((x[i].qs[j] >> 4) - 8) * d;
+        }
+    }
+}
+
+void dequantize_row_q8_0(const block_q8_0* x, float* y, int64_t k) {
+    for (int64_t i = 0; i < k / QK8_0; ++i) {
+        const float d = fp16_to_fp32(x[i].d);
+        for (int j = 0; j < QK8_0; ++j) {
+            y[i * QK8_0 + j] = x[i].qs[j] * d;
+        }
+    }
+}
+
+void dequantize_row_q4_K(const block_q4_K* x, float* y, int64_t k) {
+    for (int64_t i = 0; i < k / QK_K; ++i) {
+        const float d = fp16_to_fp32(x[i].d);
+        const float min = fp16_to_fp32(x[i].dmin);
+        const uint8_t* q = x[i].qs;
+        for (int j = 0; j < QK_K / 64; ++j) {
+            uint8_t sc, m;
+            get_scale_min_k4(2 * j + 0, x[i].scales, &sc, &m);
+            const float d1 = d * sc, m1 = min * m;
+            get_scale_min_k4(2 * j + 1, x[i].scales, &sc, &m);
+            const float d2 = d * sc, m2 = min * m;
+            for (int l = 0; l < 32; ++l) *y++ = d1 * (q[l] & 0xF) - m1;
+            for (int l = 0; l < 32; ++l) *y++ = d2 * (q[l] >> 4) - m2;
+            q += 32;
+        }
+    }
+}
+
+void dequantize_row_q5_K(const block_q5_K* x, float* y, int64_t k) {
+    for (int64_t i = 0; i < k / QK_K; ++i) {
+        const float d = fp16_to_fp32(x[i].d);
+        const float min = fp16_to_fp32(x[i].dmin);
+        const uint8_t* ql = x[i].qs;
+        const uint8_t* qh = x[i].qh;
+        uint8_t u1 = 1, u2 = 2;
+        for (int j = 0; j < QK_K / 64; ++j) {
+            uint8_t sc, m;
+            get_scale_min_k4(2 * j + 0, x[i].scales, &sc, &m);
+            const float d1 = d * sc, m1 = min * m;
+            get_scale_min_k4(2 * j + 1, x[i].scales, &sc, &m);
+            const float d2 = d * sc, m2 = min * m;
+            for (int l = 0; l < 32; ++l) *y++ = d1 * ((ql[l] & 0xF) + (qh[l] & u1 ? 16 : 0)) - m1;
+            for (int l = 0; l < 32; ++l) *y++ = d2 * ((ql[l] >> 4) + (qh[l] & u2 ? 16 : 0)) - m2;
+            ql += 32;
+            u1 <<= 2;
+            u2 <<= 2;
+        }
+    }
+}
+
+void dequantize_row_q6_K(const block_q6_K* x, float* y, int64_t k) {
+    for (int64_t i = 0; i < k / QK_K; ++i) {
+        const float d = fp16_to_fp32(x[i].d);
+        const uint8_t* ql = x[i].ql;
+        const uint8_t* qh = x[i].qh;
+        const int8_t* sc = x[i].scales;
+        for (int n = 0; n < QK_K; n += 128) {
+            for (int l = 0; l < 32; ++l) {
+                const int is = l / 16;
+                const int q1 = ((ql[l] & 0xF) | (((qh[l] >> 0) & 3) << 4)) - 32;
+                const int q2 = ((ql[l + 32] & 0xF) | (((qh[l] >> 2) & 3) << 4)) - 32;
+                const int q3 = ((ql[l] >> 4) | (((qh[l] >> 4) & 3) << 4)) - 32;
+                const int q4 = ((ql[l + 32] >> 4) | (((qh[l] >> 6) & 3) << 4)) - 32;
+                y[l + 0] = d * sc[is + 0] * q1;
+                y[l + 32] = d * sc[is + 2] * q2;
+                y[l + 64] = d * sc[is + 4] * q3;
+                y[l + 96] = d * sc[is + 6] * q4;
+            }
+            y += 128;
+            ql += 64;
+            qh += 32;
+            sc += 8;
+        }
+    }
+}
+
+QuantKernels make_scalar_kernels() {
+    QuantKernels k;
+    k.isa = "scalar";
+    k.types[GGML_TYPE_F32] = {vec_dot_f32_f32, GGML_TYPE_F32};
+    k.types[GGML_TYPE_F16] = {vec_dot_f16_f32, GGML_TYPE_F32};
+    k.types[GGML_TYPE_Q4_0] = {vec_dot_q4_0_q8_0, GGML_TYPE_Q8_0};
+    k.types[GGML_TYPE_Q8_0] = {vec_dot_q8_0_q8_0, GGML_TYPE_Q8_0};
+    k.types[GGML_TYPE_Q4_K] = {vec_dot_q4_K_q8_K, GGML_TYPE_Q8_K};
+    k.types[GGML_TYPE_Q5_K] = {vec_dot_q5_K_q8_K, GGML_TYPE_Q8_K};
+    k.types[GGML_TYPE_Q6_K] = {vec_dot_q6_K_q8_K, GGML_TYPE_Q8_K};
+    return k;
+}
+
+QuantKernels select_kernels() {
+    QuantKernels k = make_scalar_kernels();
+    const CpuFeatures& cpu = cpu_features();
+#if defined(__x86_64__)
+    if (cpu.avx2 && cpu.fma) {
+        quant_register_avx2(k);
+    }
+    if (cpu.avx2 && cpu.fma && cpu.avx512f && cpu.avx512bw && cpu.avx512vl && cpu.avx512vnni) {
+        quant_register_avx512_vnni(k);
+    }
+#elif defined(__aarch64__)
+    if (cpu.neon) {
+        quant_register_neon(k);
+    }
+    if (cpu.neon && cpu.dotprod) {
+        quant_register_neon_dotprod(k);
+    }
+#else
+    (void) cpu;
+#endif
+    return k;
+}
+
+} // namespace
+
+const QuantKernels& quant_kernels() {
+    static const QuantKernels kernels = select_kernels();
+    return kernels;
+}
+
+const QuantKernels& quant_kernels_scalar() {
+    static const QuantKernels kernels = make_scalar_kernels();
+    return kernels;
+}
+
+void quantize_row_q4_0(const float* x, block_q4_0* y, int64_t k) {
+    for (int64_t i = 0; i < k / QK4_0; ++i) {
+        // Signed max so the largest magnitude maps exactly to -8
+        float amax = 0.0f;
+        float max = 0.0f;
+        for (int j = 0; j < QK4_0; ++j) {
+            const float v = x[i * QK4_0 + j];
+            if (std::fabs(v) > amax) {
+                amax = std::fabs(v);
+                max = v;
+            }
+        }
+        const float d = max / -8.0f;
+        const float id = d != 0.0f ? 1.0f / d : 0.0f;
+        y[i].d = fp32_to_fp16(d);
+        for (int j = 0; j < QK4_0 / 2; ++j) {
+            const int q0 = std::min(15, static_cast<int>(x[i * QK4_0 + j] * id + 8.5f));
+            const int q1 = std::min(15, static_cast<int>(x[i * QK4_0 + j + QK4_0 / 2] * id + 8.5f));
+            y[i].qs[j] = static_cast<uint8_t>(q0 | (q1 << 4));
+        }
+    }
+}
+
+void quantize_row_q8_0(const float* x, block_q8_0* y, int64_t k) {
+    for (int64_t i = 0; i < k / QK8_0; ++i) {
+        float amax = 0.0f;
+        for (int j = 0; j < QK8_0; ++j) {
+            amax = std::max(amax, std::fabs(x[i * QK8_0 + j]));
+        }
+        const float d = amax / 127.0f;
+        const float id = d != 0.0f ? 1.0f / d : 0.0f;
+        y[i].d = fp32_to_fp16(d);
+        for (int j = 0; j < QK8_0; ++j) {
+            y[i].qs[j] = static_cast<int8_t>(std::lround(x[i * QK8_0 + j] * id));
+        }
+    }
+}
+
+void quantize_row_q8_K(const float* x, block_q8_K* y, int64_t k) {
+    for (int64_t i = 0; i < k / QK_K; ++i) {
+        float amax = 0.0f;
+        for (int j = 0; j < QK_K; ++j) {
+            amax = std::max(amax, std::fabs(x[j]));
+        }
+        const float d = amax / 127.0f;
+        const float id = d != 0.0f ? 1.0f / d : 0.0f;
+        y[i].d = d;
+        for (int j = 0; j < QK_K; ++j) {
+            long v = std::lround(x[j] * id);
+            y[i].qs[j] = static_cast<int8_t>(std::min(127L, std::max(-127L, v)));
+        }
+        for (int j = 0; j < QK_K / 16; ++j) {
+            int sum = 0;
+            for (int l = 0; l < 16; ++l) {
+                sum += y[i].qs[j * 16 + l];
+            }
+            y[i].bsums[j] = static_cast<int16_t>(sum);
+        }
+        x += QK_K;
+    }
+}
+
+bool dequantize_row(GGMLType type, const void* x, float* y, int64_t k) {
+    switch (type) {
+        case GGML_TYPE_F32:
+            memcpy(y, x, static_cast<size_t>(k) * sizeof(float));
+            return true;
+        case GGML_TYPE_F16: {
+            const auto* h = static_cast<const ggml_half*>(x);
+            for (int64_t i = 0; i < k; ++i) {
+                y[i] = fp16_to_fp32(h[i]);
+            }
+            return true;
+        }
+        case GGML_TYPE_Q4_0: dequantize_row_q4_0(static_cast<const block_q4_0*>(x), y, k); return true;
+        case GGML_TYPE_Q8_0: dequantize_row_q8_0(static_cast<const block_q8_0*>(x), y, k); return true;
+        case GGML_TYPE_Q4_K: dequantize_row_q4_K(static_cast<const block_q4_K*>(x), y, k); return true;
+        case GGML_TYPE_Q5_K: dequantize_row_q5_K(static_cast<const block_q5_K*>(x), y, k); return true;
+        case GGML_TYPE_Q6_K: dequantize_row_q6_K(static_cast<const block_q6_K*>(x), y, k); return true;
+        default:
+            return false;
+    }
+}
+
+bool quantize_row(GGMLType type, const float* x, void* y, int64_t k) {
+    switch (type) {
+        case GGML_TYPE_F32:
+            memcpy(y, x, static_cast<size_t>(k) * sizeof(float));
+            return true;
+        case GGML_TYPE_F16: {
+            auto* h = static_cast<ggml_half*>(y);
+            for (int64_t i = 0; i < k; ++i) {
+                h[i] = fp32_to_fp16(x[i]);
+            }
+            return true;
+        }
+        case GGML_TYPE_Q4_0: quantize_row_q4_0(x, static_cast<block_q4_0*>(y), k); return true;
+        case GGML_TYPE_Q8_0: quantize_row_q8_0(x, static_cast<block_q8_0*>(y), k); return true;
+        case GGML_TYPE_Q8_K: quantize_row_q8_K(x, static_cast<block_q8_K*>(y), k); return true;
+        default:
+            return false;
+    }
+}
+
+bool axpy_row(GGMLType type, float* y, float a, const void* x, int64_t k) {
+    switch (type) {
+        case GGML_TYPE_F32: {
+            const auto* f = static_cast<const float*>(x);
+            for (int64_t i = 0; i < k; ++i) {
+                y[i] += a * f[i];
+            }
+            return true;
+        }
+        case GGML_TYPE_F16: {
+            const auto* h = static_cast<const ggml_half*>(x);
+            for (int64_t i = 0; i < k; ++i) {
+                y[i] += a * fp16_to_fp32(h[i]);
+            }
+            return true;
+        }
+        case GGML_TYPE_Q4_0: {
+            const auto* b = static_cast<const block_q4_0*>(x);
+            for (int64_t i = 0; i < k / QK4_0; ++i) {
+                const float ad = a * fp16_to_fp32(b[i].d);
+                float* yb = y + i * QK4_0;
+                for (int j = 0; j < QK4_0 / 2; ++j) {
+                    yb[j] += ad * ((b[i].qs[j] & 0x0F) - 8);
+                    yb[j + QK4_0 / 2] += ad * ((b[i].qs[j] >> 4) - 8);
+                }
+            }
+            return true;
+        }
+        case GGML_TYPE_Q8_0: {
+            const auto* b = static_cast<const block_q8_0*>(x);
+            for (int64_t i = 0; i < k / QK8_0; ++i) {
+                const float ad = a * fp16_to_fp32(b[i].d);
+                float* yb = y + i * QK8_0;
+                for (int j = 0; j < QK8_0; ++j) {
+                    yb[j] += ad * b[i].qs[j];
+                }
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+size_t quant_activation_row_size(const QuantKernels& kernels, GGMLType wtype, int64_t n_cols) {
+    return ggml_row_size(kernels.types[wtype].vec_dot_type, n_cols);
+}
+
+void quant_prepare_activations(const QuantKernels& kernels, GGMLType wtype, const float* x,
+                               int64_t n_cols, int64_t n_tokens, void* out) {
+    const GGMLType act_type = kernels.types[wtype].vec_dot_type;
+    const size_t row_size = ggml_row_size(act_type, n_cols);
+    auto* dst = static_cast<uint8_t*>(out);
+    for (int64_t t = 0; t < n_tokens; ++t) {
+        quantize_row(act_type, x + t * n_cols, dst + t * row_size, n_cols);
+    }
+}
+
+void quant_matmul_rows(const QuantKernels& kernels, GGMLType wtype, const void* w, int64_t n_cols,
+                       int64_t n_rows, const void* xq, int64_t n_tokens, float* y,
+                       int64_t row_begin, int64_t row_end) {
+    const QuantTypeKernels& tk = kernels.types[wtype];
+    assert(tk.vec_dot != nullptr);
+
+    const size_t w_row_size = ggml_row_size(wtype, n_cols);
+    const size_t x_row_size = ggml_row_size(tk.vec_dot_type, n_cols);
+    const auto* wb = static_cast<const uint8_t*>(w);
+    const auto* xb = static_cast<const uint8_t*>(xq);
+
+    // Each weight row is streamed from memory once and reused for every token
+    for (int64_t r = row_begin; r < row_end; ++r) {
+        const uint8_t* wr = wb + r * w_row_size;
+        for (int64_t t = 0; t < n_tokens; ++t) {
+            tk.vec_dot(n_cols, &y[t * n_rows + r], wr, xb + t * x_row_size);
+        }
+    }
+}
+
+void quant_matmul(const QuantKernels& kernels, GGMLType wtype, const void* w, int64_t n_cols,
+                  int64_t n_rows, const float* x, int64_t n_tokens, float* y,
+                  std::vector<uint8_t>& scratch) {
+    scratch.resize(quant_activation_row_size(kernels, wtype, n_cols) * n_tokens);
+    quant_prepare_activations(kernels, wtype, x, n_cols, n_tokens, scratch.data());
+    quant_matmul_rows(kernels, wtype, w, n_cols, n_rows, scratch.data(), n_tokens, y, 0, n_rows);
+}
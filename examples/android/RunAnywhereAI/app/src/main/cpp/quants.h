@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "gguf.h"
+
+// Quantized block layouts (bit-compatible with ggml) and the fused
+// dequantize + dot-product kernels used by every matmul in the model.
+//
+// Weights stay in their on-disk block format. Activations are quantized once
+// per matmul to the weight type's "vec_dot_type" (Q8_0 for the 32-element
+// formats, Q8_K for the 256-element k-quants) so the inner loops run on int8.
+
+#define QK4_0 32
+#define QK8_0 32
+#define QK_K 256
+#define K_SCALE_SIZE 12
+
+typedef uint16_t ggml_half;
+
+struct block_q4_0 {
+    ggml_half d;
+    uint8_t qs[QK4_0 / 2];
+};
+static_assert(sizeof(block_q4_0) == 18, "wrong q4_0 block size");
+
+struct block_q8_0 {
+    ggml_half d;
+    int8_t qs[QK8_0];
+};
+static_assert(sizeof(block_q8_0) == 34, "wrong q8_0 block size");
+
+struct block_q4_K {
+    ggml_half d;
+    ggml_half dmin;
+    uint8_t scales[K_SCALE_SIZE];
+    uint8_t qs[QK_K / 2];
+};
+static_assert(sizeof(block_q4_K) == 144, "wrong q4_K block size");
+
+struct block_q5_K {
+    ggml_half d;
+    ggml_half dmin;
+    uint8_t scales[K_SCALE_SIZE];
+    uint8_t qh[QK_K / 8];
+    uint8_t qs[QK_K / 2];
+};
+static_assert(sizeof(block_q5_K) == 176, "wrong q5_K block size");
+
+struct block_q6_K {
+    uint8_t ql[QK_K / 2];
+    uint8_t qh[QK_K / 4];
+    int8_t scales[QK_K / 16];
+    ggml_half d;
+};
+static_assert(sizeof(block_q6_K) == 210, "wrong q6_K block size");
+
+struct block_q8_K {
+    float d;
+    int8_t qs[QK_K];
+    int16_t bsums[QK_K / 16];
+};
+static_assert(sizeof(block_q8_K) == 292, "wrong q8_K block size");
+
+// FP16 conversion. These are static so that ISA-specific translation units
+// compiled with wider -m flags never share an out-of-line copy with the
+// baseline build.
+static inline float fp32_from_bits(uint32_t w) {
+    float f;
+    memcpy(&f, &w, sizeof(f));
+    return f;
+}
+
+static inline uint32_t fp32_to_bits(float f) {
+    uint32_t w;
+    memcpy(&w, &f, sizeof(w));
+    return w;
+}
+
+static inline float fp16_to_fp32(ggml_half h) {
+#if defined(__aarch64__)
+    __fp16 v;
+    memcpy(&v, &h, sizeof(v));
+    return static_cast<float>(v);
+#else
+    const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    const uint32_t exp = (h >> 10) & 0x1F;
+    const uint32_t mant = h & 0x3FF;
+    if (exp == 0) {
+        // Zero or subnormal: value is mant * 2^-24
+        float f = static_cast<float>(mant) * 0x1.0p-24f;
+        return sign ? -f : f;
+    }
+    if (exp == 31) {
+        return fp32_from_bits(sign | 0x7F800000u | (mant << 13));
+    }
+    return fp32_from_bits(sign | ((exp + 112) << 23) | (mant << 13));
+#endif
+}
+
+static inline ggml_half fp32_to_fp16(float f) {
+#if defined(__aarch64__)
+    __fp16 v = static_cast<__fp16>(f);
+    ggml_half h;
+    memcpy(&h, &v, sizeof(h));
+    return h;
+#else
+    // Round-to-nearest-even without relying on F16C
+    const float scale_to_inf = 0x1.0p+112f;
+    const float scale_to_zero = 0x1.0p-110f;
+    float base = (std::fabs(f) * scale_to_inf) * scale_to_zero;
+
+    const uint32_t w = fp32_to_bits(f);
+    const uint32_t shl1_w = w + w;
+    const uint32_t sign = w & 0x80000000u;
+    uint32_t bias = shl1_w & 0xFF000000u;
+    if (bias < 0x71000000u) {
+        bias = 0x71000000u;
+    }
+
+    base = fp32_from_bits((bias >> 1) + 0x07800000u) + base;
+    const uint32_t bits = fp32_to_bits(base);
+    const uint32_t exp_bits = (bits >> 13) & 0x00007C00u;
+    const uint32_t mantissa_bits = bits & 0x00000FFFu;
+    const uint32_t nonsign = exp_bits + mantissa_bits;
+    return static_cast<ggml_half>((sign >> 16) | (shl1_w > 0xFF000000u ? 0x7E00u : nonsign));
+#endif
+}
+
+// Unpacks the 6-bit scale and min for sub-block j of a q4_K/q5_K block
+static inline void get_scale_min_k4(int j, const uint8_t* q, uint8_t* d, uint8_t* m) {
+    if (j < 4) {
+        *d = q[j] & 63;
+        *m = q[j + 4] & 63;
+    } else {
+        *d = (q[j + 4] & 0xF) | ((q[j - 4] >> 6) << 4);
+        *m = (q[j + 4] >> 4) | ((q[j - 0] >> 6) << 4);
+    }
+}
+
+// s = dot(x, y) over n elements; x is a weight row, y an activation row in vec_dot_type
+typedef void (*vec_dot_fn)(int64_t n, float* s, const void* x, const void* y);
+
+struct QuantTypeKernels {
+    vec_dot_fn vec_dot = nullptr;
+    GGMLType vec_dot_type = GGML_TYPE_F32;
+};
+
+struct QuantKernels {
+    const char* isa = "scalar";
+    QuantTypeKernels types[GGML_TYPE_COUNT];
+
+    bool supports(GGMLType type) const { return type < GGML_TYPE_COUNT && types[type].vec_dot != nullptr; }
+};
+
+// Kernels for the running CPU. Selected once, on first use, from cpu_features().
+const QuantKernels& quant_kernels();
+// Portable reference kernels; the SIMD paths are validated against these
+const QuantKernels& quant_kernels_scalar();
+
+// ISA-specific kernel registration (implemented in quants_*.cpp)
+#if defined(__x86_64__)
+void quant_register_avx2(QuantKernels& kernels);
+void quant_register_avx512_vnni(QuantKernels& kernels);
+#endif
+#if defined(__aarch64__)
+void quant_register_neon(QuantKernels& kernels);
+void quant_register_neon_dotprod(QuantKernels& kernels);
+#endif
+
+// Row conversion helpers (k must be a multiple of the type's block size)
+bool dequantize_row(GGMLType type, const void* x, float* y, int64_t k);
+bool quantize_row(GGMLType type, const float* x, void* y, int64_t k);
+
+void quantize_row_q4_0(const float* x, block_q4_0* y, int64_t k);
+void quantize_row_q8_0(const float* x, block_q8_0* y, int64_t k);
+void quantize_row_q8_K(const float* x, block_q8_K* y, int64_t k);
+
+// y += a * x, reading x (k elements of F32, F16, Q4_0 or Q8_0) without a
+// temporary float copy. Used to accumulate attention over a quantized V cache.
+bool axpy_row(GGMLType type, float* y, float a, const void* x, int64_t k);
+
+// Bytes needed to hold one activation row of n_cols elements in wtype's vec_dot_type
+size_t quant_activation_row_size(const QuantKernels& kernels, GGMLType wtype, int64_t n_cols);
+
+// Quantizes n_tokens activation rows (each n_cols floats) into `out`
+void quant_prepare_activations(const QuantKernels& kernels, GGMLType wtype, const float* x,
+                               int64_t n_cols, int64_t n_tokens, void* out);
+
+// y[t * n_rows + r] = dot(w row r, activation row t) for r in [row_begin, row_end).
+// `xq` holds activations prepared by quant_prepare_activations.
+void quant_matmul_rows(const QuantKernels& kernels, GGMLType wtype, const void* w, int64_t n_cols,
+                       int64_t n_rows, const void* xq, int64_t n_tokens, float* y,
+                       int64_t row_begin, int64_t row_end);
+
+// Convenience wrapper: prepares activations into `scratch` and multiplies all rows
+void quant_matmul(const QuantKernels& kernels, GGMLType wtype, const void* w, int64_t n_cols,
+                  int64_t n_rows, const float* x, int64_t n_tokens, float* y,
+                  std::vector<uint8_t>& scratch);
@@ -0,0 +1,28 @@
+// arm64 kernels using SDOT (ARMv8.2 dot product extension). This file is
+// compiled with -march=armv8.2-a+dotprod and only selected at runtime when
+// the CPU reports HWCAP_ASIMDDP.
+
+#if defined(__aarch64__)
+
+#include <arm_neon.h>
+
+namespace {
+
+inline int32x4_t arm_dot(int32x4_t acc, int8x16_t a, int8x16_t b) {
+    return vdotq_s32(acc, a, b);
+}
+
+} // namespace
+
+#include "quants_arm_impl.h"
+
+void quant_register_neon_dotprod(QuantKernels& k) {
+    k.isa = "neon-dotprod";
+    k.types[GGML_TYPE_Q4_0].vec_dot = vec_dot_q4_0_q8_0_neon;
+    k.types[GGML_TYPE_Q8_0].vec_dot = vec_dot_q8_0_q8_0_neon;
+    k.types[GGML_TYPE_Q4_K].vec_dot = vec_dot_q4_K_q8_K_neon;
+    k.types[GGML_TYPE_Q5_K].vec_dot = vec_dot_q5_K_q8_K_neon;
+    k.types[GGML_TYPE_Q6_K].vec_dot = vec_dot_q6_K_q8_K_neon;
+}
+
+#endif // __aarch64__
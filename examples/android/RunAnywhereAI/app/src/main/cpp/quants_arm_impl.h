@@ -0,0 +1,189 @@
+// Shared arm64 kernel bodies. Included by quants_arm_neon.cpp and
+// quants_arm_dotprod.cpp, each of which first defines
+//
+//     int32x4_t arm_dot(int32x4_t acc, int8x16_t a, int8x16_t b)
+//
+// (plain NEON widening multiplies, or SDOT when the file is compiled with
+// +dotprod). Everything here has internal linkage so the two builds never
+// share code.
+
+#pragma once
+
+#include <arm_neon.h>
+
+#include "quants.h"
+
+namespace {
+
+inline int32_t arm_dot32(int8x16_t a0, int8x16_t a1, int8x16_t b0, int8x16_t b1) {
+    return vaddvq_s32(arm_dot(arm_dot(vdupq_n_s32(0), a0, b0), a1, b1));
+}
+
+inline int32_t arm_dot16(int8x16_t a, int8x16_t b) {
+    return vaddvq_s32(arm_dot(vdupq_n_s32(0), a, b));
+}
+
+void vec_dot_q4_0_q8_0_neon(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK8_0;
+    const auto* x = static_cast<const block_q4_0*>(vx);
+    const auto* y = static_cast<const block_q8_0*>(vy);
+    const uint8x16_t m4 = vdupq_n_u8(0x0F);
+    const int8x16_t s8 = vdupq_n_s8(8);
+
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (int64_t i = 0; i < nb; ++i) {
+        const uint8x16_t v = vld1q_u8(x[i].qs);
+        const int8x16_t lo = vsubq_s8(vreinterpretq_s8_u8(vandq_u8(v, m4)), s8);
+        const int8x16_t hi = vsubq_s8(vreinterpretq_s8_u8(vshrq_n_u8(v, 4)), s8);
+        const int32x4_t p = arm_dot(arm_dot(vdupq_n_s32(0), lo, vld1q_s8(y[i].qs)), hi, vld1q_s8(y[i].qs + 16));
+        acc = vmlaq_n_f32(acc, vcvtq_f32_s32(p), fp16_to_fp32(x[i].d) * fp16_to_fp32(y[i].d));
+    }
+    *s = vaddvq_f32(acc);
+}
+
+void vec_dot_q8_0_q8_0_neon(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK8_0;
+    const auto* x = static_cast<const block_q8_0*>(vx);
+    const auto* y = static_cast<const block_q8_0*>(vy);
+
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (int64_t i = 0; i < nb; ++i) {
+        const int32x4_t p = arm_dot(arm_dot(vdupq_n_s32(0), vld1q_s8(x[i].qs), vld1q_s8(y[i].qs)),
+                                    vld1q_s8(x[i].qs + 16), vld1q_s8(y[i].qs + 16));
+        acc = vmlaq_n_f32(acc, vcvtq_f32_s32(p), fp16_to_fp32(x[i].d) * fp16_to_fp32(y[i].d));
+    }
+    *s = vaddvq_f32(acc);
+}
+
+inline int k_quant_mins(const uint8_t* m, const int16_t* bsums) {
+    int summs = 0;
+    for (int j = 0; j < 8; ++j) {
+        summs += m[j] * (bsums[2 * j] + bsums[2 * j + 1]);
+    }
+    return summs;
+}
+
+void vec_dot_q4_K_q8_K_neon(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK_K;
+    const auto* x = static_cast<const block_q4_K*>(vx);
+    const auto* y = static_cast<const block_q8_K*>(vy);
+    const uint8x16_t m4 = vdupq_n_u8(0x0F);
+
+    float sumf = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        uint8_t sc[8], m[8];
+        for (int j = 0; j < 8; ++j) {
+            get_scale_min_k4(j, x[i].scales, &sc[j], &m[j]);
+        }
+
+        const uint8_t* q4 = x[i].qs;
+        const int8_t* q8 = y[i].qs;
+        int32_t sumi = 0;
+        for (int j = 0; j < QK_K / 64; ++j) {
+            const uint8x16_t b0 = vld1q_u8(q4);
+            const uint8x16_t b1 = vld1q_u8(q4 + 16);
+            const int8x16_t l0 = vreinterpretq_s8_u8(vandq_u8(b0, m4));
+            const int8x16_t l1 = vreinterpretq_s8_u8(vandq_u8(b1, m4));
+            const int8x16_t h0 = vreinterpretq_s8_u8(vshrq_n_u8(b0, 4));
+            const int8x16_t h1 = vreinterpretq_s8_u8(vshrq_n_u8(b1, 4));
+            sumi += sc[2 * j] * arm_dot32(l0, l1, vld1q_s8(q8), vld1q_s8(q8 + 16));
+            sumi += sc[2 * j + 1] * arm_dot32(h0, h1, vld1q_s8(q8 + 32), vld1q_s8(q8 + 48));
+            q4 += 32;
+            q8 += 64;
+        }
+        sumf += y[i].d * (fp16_to_fp32(x[i].d) * sumi - fp16_to_fp32(x[i].dmin) * k_quant_mins(m, y[i].bsums));
+    }
+    *s = sumf;
+}
+
+void vec_dot_q5_K_q8_K_neon(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK_K;
+    const auto* x = static_cast<const block_q5_K*>(vx);
+    const auto* y = static_cast<const block_q8_K*>(vy);
+    const uint8x16_t m4 = vdupq_n_u8(0x0F);
+    const uint8x16_t m1 = vdupq_n_u8(1);
+
+    float sumf = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        uint8_t sc[8], m[8];
+        for (int j = 0; j < 8; ++j) {
+            get_scale_min_k4(j, x[i].scales, &sc[j], &m[j]);
+        }
+
+        const uint8_t* q5 = x[i].qs;
+        const int8_t* q8 = y[i].qs;
+        uint8x16_t qh0 = vld1q_u8(x[i].qh);
+        uint8x16_t qh1 = vld1q_u8(x[i].qh + 16);
+        int32_t sumi = 0;
+        for (int j = 0; j < QK_K / 64; ++j) {
+            const uint8x16_t b0 = vld1q_u8(q5);
+            const uint8x16_t b1 = vld1q_u8(q5 + 16);
+            // Fifth bit for the low and high sub-block of this group
+            const uint8x16_t hl0 = vshlq_n_u8(vandq_u8(qh0, m1), 4);
+            const uint8x16_t hl1 = vshlq_n_u8(vandq_u8(qh1, m1), 4);
+            const uint8x16_t hh0 = vshlq_n_u8(vandq_u8(vshrq_n_u8(qh0, 1), m1), 4);
+            const uint8x16_t hh1 = vshlq_n_u8(vandq_u8(vshrq_n_u8(qh1, 1), m1), 4);
+            qh0 = vshrq_n_u8(qh0, 2);
+            qh1 = vshrq_n_u8(qh1, 2);
+
+            const int8x16_t l0 = vreinterpretq_s8_u8(vorrq_u8(vandq_u8(b0, m4), hl0));
+            const int8x16_t l1 = vreinterpretq_s8_u8(vorrq_u8(vandq_u8(b1, m4), hl1));
+            const int8x16_t h0 = vreinterpretq_s8_u8(vorrq_u8(vshrq_n_u8(b0, 4), hh0));
+            const int8x16_t h1 = vreinterpretq_s8_u8(vorrq_u8(vshrq_n_u8(b1, 4), hh1));
+            sumi += sc[2 * j] * arm_dot32(l0, l1, vld1q_s8(q8), vld1q_s8(q8 + 16));
+            sumi += sc[2 * j + 1] * arm_dot32(h0, h1, vld1q_s8(q8 + 32), vld1q_s8(q8 + 48));
+            q5 += 32;
+            q8 += 64;
+        }
+        sumf += y[i].d * (fp16_to_fp32(x[i].d) * sumi - fp16_to_fp32(x[i].dmin) * k_quant_mins(m, y[i].bsums));
+    }
+    *s = sumf;
+}
+
+void vec_dot_q6_K_q8_K_neon(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK_K;
+    const auto* x = static_cast<const block_q6_K*>(vx);
+    const auto* y = static_cast<const block_q8_K*>(vy);
+    const uint8x16_t m4 = vdupq_n_u8(0x0F);
+    const uint8x16_t m2 = vdupq_n_u8(3);
+    const int8x16_t off = vdupq_n_s8(32);
+
+    float sumf = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        const uint8_t* ql = x[i].ql;
+        const uint8_t* qh = x[i].qh;
+        const int8_t* sc = x[i].scales;
+        const int8_t* q8 = y[i].qs;
+        int32_t sumi = 0;
+        for (int half = 0; half < QK_K / 128; ++half) {
+            for (int k = 0; k < 2; ++k) {
+                // 16 consecutive positions l = 16k..16k+15 of each of the four groups
+                const uint8x16_t l0 = vld1q_u8(ql + 16 * k);
+                const uint8x16_t l1 = vld1q_u8(ql + 32 + 16 * k);
+                const uint8x16_t h = vld1q_u8(qh + 16 * k);
+
+                const int8x16_t q1 = vsubq_s8(vreinterpretq_s8_u8(
+                    vorrq_u8(vandq_u8(l0, m4), vshlq_n_u8(vandq_u8(h, m2), 4))), off);
+                const int8x16_t q2 = vsubq_s8(vreinterpretq_s8_u8(
+                    vorrq_u8(vandq_u8(l1, m4), vshlq_n_u8(vandq_u8(vshrq_n_u8(h, 2), m2), 4))), off);
+                const int8x16_t q3 = vsubq_s8(vreinterpretq_s8_u8(
+                    vorrq_u8(vshrq_n_u8(l0, 4), vshlq_n_u8(vandq_u8(vshrq_n_u8(h, 4), m2), 4))), off);
+                const int8x16_t q4 = vsubq_s8(vreinterpretq_s8_u8(
+                    vorrq_u8(vshrq_n_u8(l1, 4), vshlq_n_u8(vshrq_n_u8(h, 6), 4))), off);
+
+                sumi += sc[k + 0] * arm_dot16(q1, vld1q_s8(q8 + 16 * k));
+                sumi += sc[k + 2] * arm_dot16(q2, vld1q_s8(q8 + 32 + 16 * k));
+                sumi += sc[k + 4] * arm_dot16(q3, vld1q_s8(q8 + 64 + 16 * k));
+                sumi += sc[k + 6] * arm_dot16(q4, vld1q_s8(q8 + 96 + 16 * k));
+            }
+            ql += 64;
+            qh += 32;
+            sc += 8;
+            q8 += 128;
+        }
+        sumf += y[i].d * fp16_to_fp32(x[i].d) * sumi;
+    }
+    *s = sumf;
+}
+
+} // namespace
@@ -0,0 +1,72 @@
+// Baseline arm64 kernels: int8 products via widening multiplies (ARMv8.0)
+
+#if defined(__aarch64__)
+
+#include <arm_neon.h>
+
+namespace {
+
+inline int32x4_t arm_dot(int32x4_t acc, int8x16_t a, int8x16_t b) {
+    const int16x8_t p0 = vmull_s8(vget_low_s8(a), vget_low_s8(b));
+    const int16x8_t p1 = vmull_high_s8(a, b);
+    return vaddq_s32(acc, vaddq_s32(vpaddlq_s16(p0), vpaddlq_s16(p1)));
+}
+
+} // namespace
+
+#include "quants_arm_impl.h"
+
+namespace {
+
+// Float kernels do not use arm_dot, and SDOT adds nothing to them, so only
+// this build carries them
+
+void vec_dot_f32_f32_neon(int64_t n, float* s, const void* vx, const void* vy) {
+    const auto* x = static_cast<const float*>(vx);
+    const auto* y = static_cast<const float*>(vy);
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    int64_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(x + i), vld1q_f32(y + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(x + i + 4), vld1q_f32(y + i + 4));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += x[i] * y[i];
+    }
+    *s = sum;
+}
+
+void vec_dot_f16_f32_neon(int64_t n, float* s, const void* vx, const void* vy) {
+    const auto* x = static_cast<const ggml_half*>(vx);
+    const auto* y = static_cast<const float*>(vy);
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    int64_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const float16x8_t h = vreinterpretq_f16_u16(vld1q_u16(x + i));
+        acc0 = vfmaq_f32(acc0, vcvt_f32_f16(vget_low_f16(h)), vld1q_f32(y + i));
+        acc1 = vfmaq_f32(acc1, vcvt_high_f32_f16(h), vld1q_f32(y + i + 4));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += fp16_to_fp32(x[i]) * y[i];
+    }
+    *s = sum;
+}
+
+} // namespace
+
+void quant_register_neon(QuantKernels& k) {
+    k.isa = "neon";
+    k.types[GGML_TYPE_F32].vec_dot = vec_dot_f32_f32_neon;
+    k.types[GGML_TYPE_F16].vec_dot = vec_dot_f16_f32_neon;
+    k.types[GGML_TYPE_Q4_0].vec_dot = vec_dot_q4_0_q8_0_neon;
+    k.types[GGML_TYPE_Q8_0].vec_dot = vec_dot_q8_0_q8_0_neon;
+    k.types[GGML_TYPE_Q4_K].vec_dot = vec_dot_q4_K_q8_K_neon;
+    k.types[GGML_TYPE_Q5_K].vec_dot = vec_dot_q5_K_q8_K_neon;
+    k.types[GGML_TYPE_Q6_K].vec_dot = vec_dot_q6_K_q8_K_neon;
+}
+
+#endif // __aarch64__
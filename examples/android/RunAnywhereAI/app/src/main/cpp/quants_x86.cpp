@@ -0,0 +1,443 @@
+// AVX2 and AVX-512 VNNI kernels for x86_64 hosts (emulators, Chromebooks and
+// Linux development machines). Functions carry target attributes instead of
+// per-file -m flags so that nothing here leaks into the baseline build.
+
+#include "quants.h"
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+#define TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#define TARGET_VNNI __attribute__((target("avx2,fma,f16c,avx512f,avx512bw,avx512vl,avx512vnni")))
+
+namespace {
+
+// Shared helpers
+
+TARGET_AVX2 inline float hsum_float_8(__m256 x) {
+    __m128 res = _mm256_extractf128_ps(x, 1);
+    res = _mm_add_ps(res, _mm256_castps256_ps128(x));
+    res = _mm_add_ps(res, _mm_movehl_ps(res, res));
+    res = _mm_add_ss(res, _mm_movehdup_ps(res));
+    return _mm_cvtss_f32(res);
+}
+
+TARGET_AVX2 inline int hsum_i32_8(__m256i a) {
+    const __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(a), _mm256_extractf128_si256(a, 1));
+    const __m128i hi64 = _mm_unpackhi_epi64(sum128, sum128);
+    const __m128i sum64 = _mm_add_epi32(hi64, sum128);
+    const __m128i hi32 = _mm_shuffle_epi32(sum64, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_cvtsi128_si32(_mm_add_epi32(sum64, hi32));
+}
+
+TARGET_AVX2 inline __m256i combine_128(__m128i lo, __m128i hi) {
+    return _mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+// 16 packed bytes -> 32 nibbles: low nibbles in bytes 0..15, high nibbles in 16..31
+TARGET_AVX2 inline __m256i bytes_from_nibbles_32(const uint8_t* p) {
+    const __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m256i bytes = combine_128(tmp, _mm_srli_epi16(tmp, 4));
+    return _mm256_and_si256(bytes, _mm256_set1_epi8(0x0F));
+}
+
+TARGET_AVX2 inline __m256i loadu_256(const void* p) {
+    return _mm256_loadu_si256(static_cast<const __m256i*>(p));
+}
+
+// Sum of products of unsigned x signed bytes, in pairs, as 8 int32 lanes
+TARGET_AVX2 inline __m256i mul_sum_us8_pairs(__m256i ax, __m256i sy) {
+    const __m256i dot = _mm256_maddubs_epi16(ax, sy);
+    return _mm256_madd_epi16(dot, _mm256_set1_epi16(1));
+}
+
+TARGET_AVX2 inline __m256 mul_sum_i8_pairs_float(__m256i x, __m256i y) {
+    const __m256i ax = _mm256_sign_epi8(x, x);
+    const __m256i sy = _mm256_sign_epi8(y, x);
+    return _mm256_cvtepi32_ps(mul_sum_us8_pairs(ax, sy));
+}
+
+TARGET_VNNI inline __m256 mul_sum_i8_pairs_float_vnni(__m256i x, __m256i y) {
+    const __m256i ax = _mm256_sign_epi8(x, x);
+    const __m256i sy = _mm256_sign_epi8(y, x);
+    return _mm256_cvtepi32_ps(_mm256_dpbusd_epi32(_mm256_setzero_si256(), ax, sy));
+}
+
+// Unpacks the eight 6-bit scales and mins of a q4_K/q5_K block
+inline void unpack_scales_mins(const uint8_t* scales, uint8_t* sc, uint8_t* m) {
+    for (int j = 0; j < 8; ++j) {
+        get_scale_min_k4(j, scales, &sc[j], &m[j]);
+    }
+}
+
+inline int k_quant_mins(const uint8_t* m, const int16_t* bsums) {
+    int summs = 0;
+    for (int j = 0; j < 8; ++j) {
+        summs += m[j] * (bsums[2 * j] + bsums[2 * j + 1]);
+    }
+    return summs;
+}
+
+inline int q6_K_offset_correction(const int8_t* sc, const int16_t* bsums) {
+    int corr = 0;
+    for (int j = 0; j < QK_K / 16; ++j) {
+        corr += sc[j] * bsums[j];
+    }
+    return 32 * corr;
+}
+
+// AVX2
+
+TARGET_AVX2 void vec_dot_f32_f32_avx2(int64_t n, float* s, const void* vx, const void* vy) {
+    const auto* x = static_cast<const float*>(vx);
+    const auto* y = static_cast<const float*>(vy);
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int64_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), acc1);
+    }
+    float sum = hsum_float_8(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += x[i] * y[i];
+    }
+    *s = sum;
+}
+
+TARGET_AVX2 void vec_dot_f16_f32_avx2(int64_t n, float* s, const void* vx, const void* vy) {
+    const auto* x = static_cast<const ggml_half*>(vx);
+    const auto* y = static_cast<const float*>(vy);
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int64_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256 x0 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)));
+        const __m256 x1 = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i + 8)));
+        acc0 = _mm256_fmadd_ps(x0, _mm256_loadu_ps(y + i), acc0);
+        acc1 = _mm256_fmadd_ps(x1, _mm256_loadu_ps(y + i + 8), acc1);
+    }
+    float sum = hsum_float_8(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += fp16_to_fp32(x[i]) * y[i];
+    }
+    *s = sum;
+}
+
+TARGET_AVX2 void vec_dot_q4_0_q8_0_avx2(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK8_0;
+    const auto* x = static_cast<const block_q4_0*>(vx);
+    const auto* y = static_cast<const block_q8_0*>(vy);
+    const __m256i off = _mm256_set1_epi8(8);
+
+    __m256 acc = _mm256_setzero_ps();
+    for (int64_t i = 0; i < nb; ++i) {
+        const __m256 d = _mm256_set1_ps(fp16_to_fp32(x[i].d) * fp16_to_fp32(y[i].d));
+        const __m256i qx = _mm256_sub_epi8(bytes_from_nibbles_32(x[i].qs), off);
+        const __m256i qy = loadu_256(y[i].qs);
+        acc = _mm256_fmadd_ps(d, mul_sum_i8_pairs_float(qx, qy), acc);
+    }
+    *s = hsum_float_8(acc);
+}
+
+TARGET_AVX2 void vec_dot_q8_0_q8_0_avx2(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK8_0;
+    const auto* x = static_cast<const block_q8_0*>(vx);
+    const auto* y = static_cast<const block_q8_0*>(vy);
+
+    __m256 acc = _mm256_setzero_ps();
+    for (int64_t i = 0; i < nb; ++i) {
+        const __m256 d = _mm256_set1_ps(fp16_to_fp32(x[i].d) * fp16_to_fp32(y[i].d));
+        acc = _mm256_fmadd_ps(d, mul_sum_i8_pairs_float(loadu_256(x[i].qs), loadu_256(y[i].qs)), acc);
+    }
+    *s = hsum_float_8(acc);
+}
+
+TARGET_AVX2 void vec_dot_q4_K_q8_K_avx2(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK_K;
+    const auto* x = static_cast<const block_q4_K*>(vx);
+    const auto* y = static_cast<const block_q8_K*>(vy);
+    const __m256i m4 = _mm256_set1_epi8(0xF);
+
+    __m256 acc = _mm256_setzero_ps();
+    float acc_m = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        const float d = y[i].d * fp16_to_fp32(x[i].d);
+        const float dmin = y[i].d * fp16_to_fp32(x[i].dmin);
+        uint8_t sc[8], m[8];
+        unpack_scales_mins(x[i].scales, sc, m);
+        acc_m += dmin * k_quant_mins(m, y[i].bsums);
+
+        const uint8_t* q4 = x[i].qs;
+        const int8_t* q8 = y[i].qs;
+        __m256i sumi = _mm256_setzero_si256();
+        for (int j = 0; j < QK_K / 64; ++j) {
+            const __m256i q4bits = loadu_256(q4);
+            const __m256i q4l = _mm256_and_si256(q4bits, m4);
+            const __m256i q4h = _mm256_and_si256(_mm256_srli_epi16(q4bits, 4), m4);
+            const __m256i pl = _mm256_maddubs_epi16(q4l, loadu_256(q8));
+            const __m256i ph = _mm256_maddubs_epi16(q4h, loadu_256(q8 + 32));
+            sumi = _mm256_add_epi32(sumi, _mm256_madd_epi16(_mm256_set1_epi16(sc[2 * j]), pl));
+            sumi = _mm256_add_epi32(sumi, _mm256_madd_epi16(_mm256_set1_epi16(sc[2 * j + 1]), ph));
+            q4 += 32;
+            q8 += 64;
+        }
+        acc = _mm256_fmadd_ps(_mm256_set1_ps(d), _mm256_cvtepi32_ps(sumi), acc);
+    }
+    *s = hsum_float_8(acc) - acc_m;
+}
+
+TARGET_AVX2 void vec_dot_q5_K_q8_K_avx2(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK_K;
+    const auto* x = static_cast<const block_q5_K*>(vx);
+    const auto* y = static_cast<const block_q8_K*>(vy);
+    const __m256i m4 = _mm256_set1_epi8(0xF);
+    const __m256i m1 = _mm256_set1_epi8(1);
+
+    __m256 acc = _mm256_setzero_ps();
+    float acc_m = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        const float d = y[i].d * fp16_to_fp32(x[i].d);
+        const float dmin = y[i].d * fp16_to_fp32(x[i].dmin);
+        uint8_t sc[8], m[8];
+        unpack_scales_mins(x[i].scales, sc, m);
+        acc_m += dmin * k_quant_mins(m, y[i].bsums);
+
+        const uint8_t* q5 = x[i].qs;
+        const int8_t* q8 = y[i].qs;
+        __m256i hbits = loadu_256(x[i].qh);
+        __m256i sumi = _mm256_setzero_si256();
+        for (int j = 0; j < QK_K / 64; ++j) {
+            const __m256i q5bits = loadu_256(q5);
+            const __m256i hl = _mm256_slli_epi16(_mm256_and_si256(hbits, m1), 4);
+            const __m256i hh = _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(hbits, 1), m1), 4);
+            hbits = _mm256_srli_epi16(hbits, 2);
+
+            const __m256i q5l = _mm256_or_si256(_mm256_and_si256(q5bits, m4), hl);
+            const __m256i q5h = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(q5bits, 4), m4), hh);
+            const __m256i pl = _mm256_maddubs_epi16(q5l, loadu_256(q8));
+            const __m256i ph = _mm256_maddubs_epi16(q5h, loadu_256(q8 + 32));
+            sumi = _mm256_add_epi32(sumi, _mm256_madd_epi16(_mm256_set1_epi16(sc[2 * j]), pl));
+            sumi = _mm256_add_epi32(sumi, _mm256_madd_epi16(_mm256_set1_epi16(sc[2 * j + 1]), ph));
+            q5 += 32;
+            q8 += 64;
+        }
+        acc = _mm256_fmadd_ps(_mm256_set1_ps(d), _mm256_cvtepi32_ps(sumi), acc);
+    }
+    *s = hsum_float_8(acc) - acc_m;
+}
+
+// Rebuilds the four groups of 32 unsigned 6-bit values (0..63) of one q6_K half-block
+TARGET_AVX2 inline void unpack_q6_K_half(const uint8_t* ql, const uint8_t* qh, __m256i q[4]) {
+    const __m256i m4 = _mm256_set1_epi8(0xF);
+    const __m256i m2 = _mm256_set1_epi8(3);
+    const __m256i ql0 = loadu_256(ql);
+    const __m256i ql1 = loadu_256(ql + 32);
+    const __m256i h = loadu_256(qh);
+    q[0] = _mm256_or_si256(_mm256_and_si256(ql0, m4), _mm256_slli_epi16(_mm256_and_si256(h, m2), 4));
+    q[1] = _mm256_or_si256(_mm256_and_si256(ql1, m4),
+                           _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(h, 2), m2), 4));
+    q[2] = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql0, 4), m4),
+                           _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(h, 4), m2), 4));
+    q[3] = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql1, 4), m4),
+                           _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(h, 6), m2), 4));
+}
+
+TARGET_AVX2 void vec_dot_q6_K_q8_K_avx2(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK_K;
+    const auto* x = static_cast<const block_q6_K*>(vx);
+    const auto* y = static_cast<const block_q8_K*>(vy);
+
+    __m256 acc = _mm256_setzero_ps();
+    float acc_corr = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        const float d = y[i].d * fp16_to_fp32(x[i].d);
+        const int8_t* sc = x[i].scales;
+        acc_corr += d * q6_K_offset_correction(sc, y[i].bsums);
+
+        const uint8_t* ql = x[i].ql;
+        const uint8_t* qh = x[i].qh;
+        const int8_t* q8 = y[i].qs;
+        __m256i sumi = _mm256_setzero_si256();
+        for (int half = 0; half < QK_K / 128; ++half) {
+            __m256i q[4];
+            unpack_q6_K_half(ql, qh, q);
+            for (int g = 0; g < 4; ++g) {
+                // Each group of 32 spans two 16-element sub-blocks with their own scale
+                const __m256i scale = combine_128(_mm_set1_epi16(sc[2 * g]), _mm_set1_epi16(sc[2 * g + 1]));
+                const __m256i p = _mm256_maddubs_epi16(q[g], loadu_256(q8 + 32 * g));
+                sumi = _mm256_add_epi32(sumi, _mm256_madd_epi16(scale, p));
+            }
+            ql += 64;
+            qh += 32;
+            sc += 8;
+            q8 += 128;
+        }
+        acc = _mm256_fmadd_ps(_mm256_set1_ps(d), _mm256_cvtepi32_ps(sumi), acc);
+    }
+    *s = hsum_float_8(acc) - acc_corr;
+}
+
+// AVX-512 VNNI (256-bit forms from AVX512VL): vpdpbusd replaces the
+// maddubs + madd pair and cannot saturate.
+
+TARGET_VNNI void vec_dot_q4_0_q8_0_vnni(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK8_0;
+    const auto* x = static_cast<const block_q4_0*>(vx);
+    const auto* y = static_cast<const block_q8_0*>(vy);
+    const __m256i off = _mm256_set1_epi8(8);
+
+    __m256 acc = _mm256_setzero_ps();
+    for (int64_t i = 0; i < nb; ++i) {
+        const __m256 d = _mm256_set1_ps(fp16_to_fp32(x[i].d) * fp16_to_fp32(y[i].d));
+        const __m256i qx = _mm256_sub_epi8(bytes_from_nibbles_32(x[i].qs), off);
+        acc = _mm256_fmadd_ps(d, mul_sum_i8_pairs_float_vnni(qx, loadu_256(y[i].qs)), acc);
+    }
+    *s = hsum_float_8(acc);
+}
+
+TARGET_VNNI void vec_dot_q8_0_q8_0_vnni(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK8_0;
+    const auto* x = static_cast<const block_q8_0*>(vx);
+    const auto* y = static_cast<const block_q8_0*>(vy);
+
+    __m256 acc = _mm256_setzero_ps();
+    for (int64_t i = 0; i < nb; ++i) {
+        const __m256 d = _mm256_set1_ps(fp16_to_fp32(x[i].d) * fp16_to_fp32(y[i].d));
+        acc = _mm256_fmadd_ps(d, mul_sum_i8_pairs_float_vnni(loadu_256(x[i].qs), loadu_256(y[i].qs)), acc);
+    }
+    *s = hsum_float_8(acc);
+}
+
+TARGET_VNNI void vec_dot_q4_K_q8_K_vnni(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK_K;
+    const auto* x = static_cast<const block_q4_K*>(vx);
+    const auto* y = static_cast<const block_q8_K*>(vy);
+    const __m256i m4 = _mm256_set1_epi8(0xF);
+
+    __m256 acc = _mm256_setzero_ps();
+    float acc_m = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        const float d = y[i].d * fp16_to_fp32(x[i].d);
+        const float dmin = y[i].d * fp16_to_fp32(x[i].dmin);
+        uint8_t sc[8], m[8];
+        unpack_scales_mins(x[i].scales, sc, m);
+        acc_m += dmin * k_quant_mins(m, y[i].bsums);
+
+        const uint8_t* q4 = x[i].qs;
+        const int8_t* q8 = y[i].qs;
+        __m256i sumi = _mm256_setzero_si256();
+        for (int j = 0; j < QK_K / 64; ++j) {
+            const __m256i q4bits = loadu_256(q4);
+            const __m256i q4l = _mm256_and_si256(q4bits, m4);
+            const __m256i q4h = _mm256_and_si256(_mm256_srli_epi16(q4bits, 4), m4);
+            const __m256i pl = _mm256_dpbusd_epi32(_mm256_setzero_si256(), q4l, loadu_256(q8));
+            const __m256i ph = _mm256_dpbusd_epi32(_mm256_setzero_si256(), q4h, loadu_256(q8 + 32));
+            sumi = _mm256_add_epi32(sumi, _mm256_mullo_epi32(pl, _mm256_set1_epi32(sc[2 * j])));
+            sumi = _mm256_add_epi32(sumi, _mm256_mullo_epi32(ph, _mm256_set1_epi32(sc[2 * j + 1])));
+            q4 += 32;
+            q8 += 64;
+        }
+        acc = _mm256_fmadd_ps(_mm256_set1_ps(d), _mm256_cvtepi32_ps(sumi), acc);
+    }
+    *s = hsum_float_8(acc) - acc_m;
+}
+
+TARGET_VNNI void vec_dot_q5_K_q8_K_vnni(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK_K;
+    const auto* x = static_cast<const block_q5_K*>(vx);
+    const auto* y = static_cast<const block_q8_K*>(vy);
+    const __m256i m4 = _mm256_set1_epi8(0xF);
+    const __m256i m1 = _mm256_set1_epi8(1);
+
+    __m256 acc = _mm256_setzero_ps();
+    float acc_m = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        const float d = y[i].d * fp16_to_fp32(x[i].d);
+        const float dmin = y[i].d * fp16_to_fp32(x[i].dmin);
+        uint8_t sc[8], m[8];
+        unpack_scales_mins(x[i].scales, sc, m);
+        acc_m += dmin * k_quant_mins(m, y[i].bsums);
+
+        const uint8_t* q5 = x[i].qs;
+        const int8_t* q8 = y[i].qs;
+        __m256i hbits = loadu_256(x[i].qh);
+        __m256i sumi = _mm256_setzero_si256();
+        for (int j = 0; j < QK_K / 64; ++j) {
+            const __m256i q5bits = loadu_256(q5);
+            const __m256i hl = _mm256_slli_epi16(_mm256_and_si256(hbits, m1), 4);
+            const __m256i hh = _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(hbits, 1), m1), 4);
+            hbits = _mm256_srli_epi16(hbits, 2);
+
+            const __m256i q5l = _mm256_or_si256(_mm256_and_si256(q5bits, m4), hl);
+            const __m256i q5h = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(q5bits, 4), m4), hh);
+            const __m256i pl = _mm256_dpbusd_epi32(_mm256_setzero_si256(), q5l, loadu_256(q8));
+            const __m256i ph = _mm256_dpbusd_epi32(_mm256_setzero_si256(), q5h, loadu_256(q8 + 32));
+            sumi = _mm256_add_epi32(sumi, _mm256_mullo_epi32(pl, _mm256_set1_epi32(sc[2 * j])));
+            sumi = _mm256_add_epi32(sumi, _mm256_mullo_epi32(ph, _mm256_set1_epi32(sc[2 * j + 1])));
+            q5 += 32;
+            q8 += 64;
+        }
+        acc = _mm256_fmadd_ps(_mm256_set1_ps(d), _mm256_cvtepi32_ps(sumi), acc);
+    }
+    *s = hsum_float_8(acc) - acc_m;
+}
+
+TARGET_VNNI void vec_dot_q6_K_q8_K_vnni(int64_t n, float* s, const void* vx, const void* vy) {
+    const int64_t nb = n / QK_K;
+    const auto* x = static_cast<const block_q6_K*>(vx);
+    const auto* y = static_cast<const block_q8_K*>(vy);
+
+    __m256 acc = _mm256_setzero_ps();
+    float acc_corr = 0.0f;
+    for (int64_t i = 0; i < nb; ++i) {
+        const float d = y[i].d * fp16_to_fp32(x[i].d);
+        const int8_t* sc = x[i].scales;
+        acc_corr += d * q6_K_offset_correction(sc, y[i].bsums);
+
+        const uint8_t* ql = x[i].ql;
+        const uint8_t* qh = x[i].qh;
+        const int8_t* q8 = y[i].qs;
+        __m256i sumi = _mm256_setzero_si256();
+        for (int half = 0; half < QK_K / 128; ++half) {
+            __m256i q[4];
+            unpack_q6_K_half(ql, qh, q);
+            for (int g = 0; g < 4; ++g) {
+                const __m256i scale = combine_128(_mm_set1_epi32(sc[2 * g]), _mm_set1_epi32(sc[2 * g + 1]));
+                const __m256i p = _mm256_dpbusd_epi32(_mm256_setzero_si256(), q[g], loadu_256(q8 + 32 * g));
+                sumi = _mm256_add_epi32(sumi, _mm256_mullo_epi32(scale, p));
+            }
+            ql += 64;
+            qh += 32;
+            sc += 8;
+            q8 += 128;
+        }
+        acc = _mm256_fmadd_ps(_mm256_set1_ps(d), _mm256_cvtepi32_ps(sumi), acc);
+    }
+    *s = hsum_float_8(acc) - acc_corr;
+}
+
+} // namespace
+
+void quant_register_avx2(QuantKernels& k) {
+    k.isa = "avx2";
+    k.types[GGML_TYPE_F32].vec_dot = vec_dot_f32_f32_avx2;
+    k.types[GGML_TYPE_F16].vec_dot = vec_dot_f16_f32_avx2;
+    k.types[GGML_TYPE_Q4_0].vec_dot = vec_dot_q4_0_q8_0_avx2;
+    k.types[GGML_TYPE_Q8_0].vec_dot = vec_dot_q8_0_q8_0_avx2;
+    k.types[GGML_TYPE_Q4_K].vec_dot = vec_dot_q4_K_q8_K_avx2;
+    k.types[GGML_TYPE_Q5_K].vec_dot = vec_dot_q5_K_q8_K_avx2;
+    k.types[GGML_TYPE_Q6_K].vec_dot = vec_dot_q6_K_q8_K_avx2;
+}
+
+void quant_register_avx512_vnni(QuantKernels& k) {
+    k.isa = "avx512-vnni";
+    k.types[GGML_TYPE_Q4_0].vec_dot = vec_dot_q4_0_q8_0_vnni;
+    k.types[GGML_TYPE_Q8_0].vec_dot = vec_dot_q8_0_q8_0_vnni;
+    k.types[GGML_TYPE_Q4_K].vec_dot = vec_dot_q4_K_q8_K_vnni;
+    k.types[GGML_TYPE_Q5_K].vec_dot = vec_dot_q5_K_q8_K_vnni;
+    k.types[GGML_TYPE_Q6_K].vec_dot = vec_dot_q6_K_q8_K_vnni;
+}
+
+#endif // __x86_64__
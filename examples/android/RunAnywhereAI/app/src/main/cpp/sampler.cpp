@@ -0,0 +1,251 @@
+#include "sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "llama_model.h"
+#include "ops.h"
+
+namespace {
+
+// Float exponents of probabilities in (0, 1], and interleaved histograms of them
+constexpr int kExponents = 128;
+constexpr int kHistograms = 4;
+
+// Top-k with a filter tests this many times k tokens before masking instead
+constexpr int32_t kFilterWiden = 4;
+
+// Top-p sorts candidates once the quickselect has narrowed the cut to this many
+constexpr size_t kTopPSortSize = 64;
+
+inline bool more_likely(const TokenProb& a, const TokenProb& b) {
+    return a.p > b.p;
+}
+
+} // namespace
+
+void Sampler::apply_penalties(float* logits, int32_t n_vocab, const GenerationParams& params,
+                              const int32_t* history, size_t n_history) {
+    if (params.repeat_penalty == 1.0f && params.frequency_penalty == 0.0f && params.presence_penalty == 0.0f) {
+        return;
+    }
+    const size_t n = params.penalty_last_n < 0 ? n_history
+                                               : std::min(n_history, static_cast<size_t>(params.penalty_last_n));
+    recent.assign(history + n_history - n, history + n_history);
+    std::sort(recent.begin(), recent.end());
+
+    for (size_t i = 0; i < recent.size();) {
+        const int32_t id = recent[i];
+        size_t count = 1;
+        while (i + count < recent.size() && recent[i + count] == id) count++;
+        i += count;
+        if (id < 0 || id >= n_vocab) continue;
+
+        float& l = logits[id];
+        // Dividing a negative logit would make the token more likely
+        l = l > 0.0f ? l / params.repeat_penalty : l * params.repeat_penalty;
+        l -= static_cast<float>(count) * params.frequency_penalty + params.presence_penalty;
+    }
+}
+
+void Sampler::select_top_k(const float* logits, int32_t n_vocab, int32_t k) {
+    // Min-heap of the k largest logits seen so far; most logits fail the
+    // comparison against its root and cost nothing else
+    cands.clear();
+    for (int32_t i = 0; i < k; ++i) {
+        cands.push_back({i, logits[i]});
+    }
+    std::make_heap(cands.begin(), cands.end(), more_likely);
+    float floor = cands.front().p;
+    for (int32_t i = k; i < n_vocab; ++i) {
+        if (logits[i] <= floor) continue;
+        std::pop_heap(cands.begin(), cands.end(), more_likely);
+        cands.back() = {i, logits[i]};
+        std::push_heap(cands.begin(), cands.end(), more_likely);
+        floor = cands.front().p;
+    }
+}
+
+bool Sampler::select_top_k_allowed(const float* logits, int32_t n_vocab, int32_t k, const TokenFilter& filter) {
+    const int32_t n_test = static_cast<int32_t>(std::min<int64_t>(static_cast<int64_t>(k) * kFilterWiden, n_vocab));
+    select_top_k(logits, n_vocab, n_test);
+    std::sort(cands.begin(), cands.end(), more_likely);
+    size_t kept = 0;
+    for (size_t i = 0; i < cands.size() && kept < static_cast<size_t>(k); ++i) {
+        if (filter.allows(cands[i].id)) cands[kept++] = cands[i];
+    }
+    // Anything not tested is less likely than everything that was, so the
+    // first k allowed tokens are the top k of the masked row
+    cands.resize(kept);
+    return kept == static_cast<size_t>(k) || n_test == n_vocab;
+}
+
+void Sampler::apply(float* logits, int32_t n_vocab, const GenerationParams& params, const int32_t* history,
+                    size_t n_history, const TokenFilter* filter) {
+    apply_penalties(logits, n_vocab, params, history, n_history);
+
+    cands.clear();
+    row = nullptr;
+    if (params.temperature <= 0.0f) {
+        int32_t id = static_cast<int32_t>(op_argmax(logits, n_vocab));
+        if (filter && !filter->allows(id)) {
+            filter->mask(logits, n_vocab);
+            id = static_cast<int32_t>(op_argmax(logits, n_vocab));
+            if (logits[id] == -INFINITY) return; // nothing is allowed
+        }
+        cands.push_back({id, 1.0f});
+        return;
+    }
+
+    // Probabilities are relative to the most likely token, which gets 1, so
+    // min-p compares against min_p directly
+    const float inv_temp = 1.0f / params.temperature;
+    const float min_p = std::min(std::max(params.min_p, 0.0f), 1.0f);
+    const float top_p = std::min(params.top_p, 1.0f);
+    const int32_t k = params.top_k > 0 ? std::min(params.top_k, n_vocab) : n_vocab;
+    if (filter) {
+        if (k < n_vocab && select_top_k_allowed(logits, n_vocab, k, *filter)) {
+            if (cands.empty()) return; // every token was tested and none is allowed
+        } else {
+            filter->mask(logits, n_vocab);
+            cands.clear();
+        }
+    }
+    float basis; // mass top-p is a fraction of
+    if (k < n_vocab) {
+        if (cands.empty()) select_top_k(logits, n_vocab, k);
+        float max = cands.front().p;
+        for (const TokenProb& c : cands) max = std::max(max, c.p);
+        if (max == -INFINITY) {
+            cands.clear(); // the filter allows nothing
+            return;
+        }
+        for (TokenProb& c : cands) c.p = std::exp((c.p - max) * inv_temp);
+        if (min_p > 0.0f || filter) {
+            // A masked row may leave fewer than k tokens with any mass
+            cands.erase(std::remove_if(cands.begin(), cands.end(),
+                                       [&](const TokenProb& c) { return c.p < min_p || c.p <= 0.0f; }),
+                        cands.end());
+        }
+        basis = 0.0f;
+        for (const TokenProb& c : cands) basis += c.p;
+    } else {
+        const float max = op_max(logits, n_vocab);
+        if (max == -INFINITY) return; // the filter allows nothing
+        const float sum = op_exp_sum(logits, n_vocab, inv_temp, -max * inv_temp);
+        if (min_p <= 0.0f && top_p >= 1.0f) {
+            // Nothing to truncate: sample straight from the row
+            row = logits;
+            row_size = n_vocab;
+            row_total = sum;
+            return;
+        }
+        basis = gather(logits, n_vocab, min_p, top_p);
+    }
+
+    if (top_p < 1.0f) {
+        truncate_top_p(top_p * basis);
+    }
+    float total = 0.0f;
+    for (const TokenProb& c : cands) total += c.p;
+    const float inv_total = 1.0f / total;
+    for (TokenProb& c : cands) c.p *= inv_total;
+}
+
+float Sampler::gather(const float* probs, int32_t n_vocab, float min_p, float top_p) {
+    float basis = 0.0f; // mass of the min-p survivors
+    float threshold = min_p;
+    if (top_p < 1.0f) {
+        // Mass per binary exponent of p, in kHistograms interleaved copies so
+        // consecutive adds do not wait on each other. Top-p keeps the most
+        // likely tokens, so it never reaches below the exponent where the
+        // cumulative mass from the top first covers top_p.
+        float mass[kHistograms][kExponents] = {};
+        for (int32_t i = 0; i < n_vocab; ++i) {
+            const float p = probs[i];
+            if (p < min_p) continue;
+            uint32_t bits;
+            std::memcpy(&bits, &p, sizeof(bits));
+            mass[i % kHistograms][(bits >> 23) & (kExponents - 1)] += p;
+        }
+        float bucket[kExponents];
+        for (int e = 0; e < kExponents; ++e) {
+            bucket[e] = 0.0f;
+            for (int h = 0; h < kHistograms; ++h) bucket[e] += mass[h][e];
+            basis += bucket[e];
+        }
+        float cumulative = 0.0f;
+        int e = kExponents - 1;
+        for (; e > 0 && cumulative < top_p * basis; --e) {
+            cumulative += bucket[e];
+        }
+        // One exponent of slack for rounding between these sums and top-p's
+        const uint32_t floor_bits = static_cast<uint32_t>(std::max(e - 1, 0)) << 23;
+        float floor;
+        std::memcpy(&floor, &floor_bits, sizeof(floor));
+        threshold = std::max(threshold, floor);
+    }
+
+    cands.clear();
+    for (int32_t i = 0; i < n_vocab; ++i) {
+        const float p = probs[i];
+        if (p >= threshold && p > 0.0f) {
+            cands.push_back({i, p});
+            if (top_p >= 1.0f) basis += p;
+        }
+    }
+    return basis;
+}
+
+void Sampler::truncate_top_p(float mass) {
+    // Quickselect on mass: cands[0, lo) are kept and more likely than anything
+    // after them, holding `kept` < mass; the cut lies in [lo, hi)
+    size_t lo = 0;
+    size_t hi = cands.size();
+    float kept = 0.0f;
+    while (hi - lo > kTopPSortSize) {
+        const size_t mid = lo + (hi - lo) / 2;
+        std::nth_element(cands.begin() + lo, cands.begin() + mid, cands.begin() + hi, more_likely);
+        float left = 0.0f;
+        for (size_t i = lo; i < mid; ++i) left += cands[i].p;
+        if (kept + left >= mass) {
+            hi = mid;
+        } else {
+            kept += left;
+            lo = mid;
+        }
+    }
+    std::sort(cands.begin() + lo, cands.begin() + hi, more_likely);
+    for (size_t i = lo; i < hi; ++i) {
+        kept += cands[i].p;
+        if (kept >= mass) {
+            hi = i + 1;
+            break;
+        }
+    }
+    cands.resize(hi);
+}
+
+int32_t Sampler::sample(std::mt19937& rng) const {
+    if (!row && cands.size() <= 1) return cands.empty() ? -1 : cands.front().id;
+    const float u = std::uniform_real_distribution<float>(0.0f, 1.0f)(rng);
+    if (row) {
+        float r = u * row_total;
+        for (int32_t i = 0; i < row_size; ++i) {
+            if (r < row[i]) return i;
+            r -= row[i];
+        }
+        return static_cast<int32_t>(op_argmax(row, row_size)); // rounding left r above the total
+    }
+    float r = u;
+    for (const TokenProb& c : cands) {
+        if (r < c.p) return c.id;
+        r -= c.p;
+    }
+    // Rounding left r above the total; take the last candidate with any mass
+    for (auto it = cands.rbegin(); it != cands.rend(); ++it) {
+        if (it->p > 0.0f) return it->id;
+    }
+    return cands.back().id;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+struct GenerationParams;
+
+// A token that survived the sampler chain, with its probability
+struct TokenProb {
+    int32_t id;
+    float p;
+};
+
+// Restricts which tokens may come next, e.g. a grammar
+class TokenFilter {
+public:
+    virtual ~TokenFilter() = default;
+    virtual bool allows(int32_t token) const = 0;
+    // Sets the logit of every token that is not allowed to -inf
+    virtual void mask(float* logits, int32_t n_vocab) const = 0;
+};
+
+// Turns one row of logits into a next-token distribution: repetition,
+// frequency and presence penalties over the recent tokens, then temperature,
+// top-k, min-p and top-p. Nothing sorts the whole vocabulary: top-k keeps a
+// k-entry heap in a single pass, and without top-k, top-p only gathers the
+// tokens above a floor found from a histogram of the mass, then cuts them with
+// a quickselect. Temperature <= 0 picks the argmax.
+//
+// A TokenFilter applies before temperature. Masking costs a pass over the
+// filter's whole vocabulary, so greedy sampling first tests just the argmax,
+// and top-k tests the most likely tokens one by one, masking only if too few
+// of them are allowed.
+class Sampler {
+public:
+    // Runs the chain over `logits` in place. Afterwards either candidates()
+    // holds the surviving tokens with normalized probabilities, or, if dense(),
+    // every token survived and logits[i] / total() is token i's probability.
+    // If the filter allows no token at all, candidates() is empty.
+    // The row must outlive the next sample().
+    void apply(float* logits, int32_t n_vocab, const GenerationParams& params, const int32_t* history,
+               size_t n_history, const TokenFilter* filter = nullptr);
+
+    bool dense() const { return row != nullptr; }
+    const std::vector<TokenProb>& candidates() const { return cands; }
+    const float* dense_row() const { return row; }
+    float total() const { return row_total; }
+
+    // Draws a token from the result of the last apply(); -1 if nothing survived
+    int32_t sample(std::mt19937& rng) const;
+
+private:
+    void apply_penalties(float* logits, int32_t n_vocab, const GenerationParams& params, const int32_t* history,
+                         size_t n_history);
+    // Fills cands with the k largest logits, unordered
+    void select_top_k(const float* logits, int32_t n_vocab, int32_t k);
+    // The k most likely tokens the filter allows, found by testing the k *
+    // kFilterWiden most likely tokens; false if too few of those are allowed
+    bool select_top_k_allowed(const float* logits, int32_t n_vocab, int32_t k, const TokenFilter& filter);
+    // Gathers the min-p survivors among `probs` (relative to the top token's
+    // 1), skipping the tail that top-p is certain to cut. Returns the mass of
+    // all min-p survivors.
+    float gather(const float* probs, int32_t n_vocab, float min_p, float top_p);
+    // Keeps the smallest set of most likely candidates holding `mass`
+    void truncate_top_p(float mass);
+
+    std::vector<TokenProb> cands;
+    const float* row = nullptr;
+    int32_t row_size = 0;
+    float row_total = 0.0f;
+    std::vector<int32_t> recent; // penalty window, sorted
+};
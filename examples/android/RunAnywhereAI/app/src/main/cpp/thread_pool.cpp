@@ -0,0 +1,177 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include "cpu_features.h"
+
+namespace {
+
+// Polls of `epoch` before an idle worker goes to sleep (tens of microseconds)
+constexpr int kSpinIterations = 1 << 14;
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+
+void pin_to_cpu(int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    // pid 0 is the calling thread; failure (e.g. the core went offline) just leaves it unpinned
+    sched_setaffinity(0, sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+// Cores workers may be pinned to, fastest first
+std::vector<int> allowed_cpus(ThreadAffinity affinity) {
+    std::vector<int> cpus;
+    for (const CpuCore& core : cpu_cores()) {
+        if (affinity == ThreadAffinity::AllCores || core.fast) cpus.push_back(core.id);
+    }
+    return cpus;
+}
+
+} // namespace
+
+const char* thread_affinity_name(ThreadAffinity affinity) {
+    switch (affinity) {
+        case ThreadAffinity::None: return "NONE";
+        case ThreadAffinity::BigCores: return "BIG_CORES";
+        case ThreadAffinity::AllCores: return "ALL_CORES";
+    }
+    return "?";
+}
+
+bool parse_thread_affinity(const std::string& name, ThreadAffinity* out) {
+    for (ThreadAffinity a : {ThreadAffinity::None, ThreadAffinity::BigCores, ThreadAffinity::AllCores}) {
+        if (name == thread_affinity_name(a)) {
+            *out = a;
+            return true;
+        }
+    }
+    return false;
+}
+
+int ThreadPool::default_threads(ThreadAffinity affinity) {
+    const size_t n = affinity == ThreadAffinity::None ? cpu_cores().size() : allowed_cpus(affinity).size();
+    if (n > 0) return static_cast<int>(n);
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+ThreadPool::ThreadPool(int threads, ThreadAffinity affinity)
+    : n_threads(threads > 0 ? threads : default_threads(affinity)), policy(affinity) {
+    shares.reset(new Share[n_threads]);
+
+    const std::vector<int> cpus = affinity == ThreadAffinity::None ? std::vector<int>() : allowed_cpus(affinity);
+    // The caller is thread 0 and is never pinned (it belongs to the app); each
+    // worker gets its own core, skipping the fastest one, which the caller is
+    // most likely to be scheduled on
+    for (int i = 1; i < n_threads; ++i) {
+        const int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        workers.emplace_back(&ThreadPool::worker_main, this, i, cpu);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    sleep_cv.notify_all();
+    for (std::thread& t : workers) {
+        t.join();
+    }
+}
+
+void ThreadPool::worker_main(int index, int cpu) {
+    if (cpu >= 0) pin_to_cpu(cpu);
+
+    uint64_t seen = 0;
+    for (;;) {
+        // Spin first: the next parallel_for usually follows within microseconds
+        int spins = 0;
+        while (epoch.load(std::memory_order_acquire) == seen && !stopping.load(std::memory_order_relaxed)) {
+            if (++spins < kSpinIterations) {
+                cpu_relax();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            sleeping++;
+            // sleeping and epoch are both sequentially consistent, so either this
+            // sees the new epoch or parallel_for sees sleeping > 0 and notifies
+            sleep_cv.wait(lock, [&] { return epoch.load() != seen || stopping.load(); });
+            sleeping--;
+        }
+        if (stopping.load()) return;
+
+        seen = epoch.load(std::memory_order_acquire);
+        run_chunks(index);
+        pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void ThreadPool::run_chunks(int index) {
+    const int64_t n = job_n;
+    const int64_t grain = job_grain;
+    // Own share first, then steal from the others in turn
+    for (int k = 0; k < n_threads; ++k) {
+        Share& share = shares[(index + k) % n_threads];
+        for (;;) {
+            const int64_t chunk = share.next.fetch_add(1, std::memory_order_relaxed);
+            if (chunk >= share.end) break;
+            const int64_t begin = chunk * grain;
+            (*job)(begin, std::min(begin + grain, n), index);
+        }
+    }
+}
+
+void ThreadPool::parallel_for(int64_t n, int64_t grain, const std::function<void(int64_t, int64_t, int)>& fn) {
+    if (n <= 0) return;
+    grain = std::max<int64_t>(grain, 1);
+    const int64_t n_chunks = (n + grain - 1) / grain;
+
+    std::unique_lock<std::mutex> owner(busy, std::try_to_lock);
+    if (n_threads == 1 || n_chunks == 1 || !owner.owns_lock()) {
+        fn(0, n, 0);
+        return;
+    }
+
+    job = &fn;
+    job_n = n;
+    job_grain = grain;
+    for (int i = 0; i < n_threads; ++i) {
+        shares[i].next.store(n_chunks * i / n_threads, std::memory_order_relaxed);
+        shares[i].end = n_chunks * (i + 1) / n_threads;
+    }
+    pending.store(n_threads - 1, std::memory_order_relaxed);
+
+    // Publish the job; pairs with the workers' acquire of `epoch`
+    epoch.fetch_add(1);
+    if (sleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        sleep_cv.notify_all();
+    }
+
+    run_chunks(0);
+    // Stragglers only finish their last chunk; yield now and then in case they
+    // share this core
+    for (int spins = 1; pending.load(std::memory_order_acquire) > 0; ++spins) {
+        if (spins % 1024 == 0) {
+            std::this_thread::yield();
+        } else {
+            cpu_relax();
+        }
+    }
+    job = nullptr;
+}
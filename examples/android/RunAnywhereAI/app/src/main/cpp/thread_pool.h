@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Where compute threads may run
+enum class ThreadAffinity {
+    None,     // no pinning; the OS scheduler decides
+    BigCores, // one worker per fast core; little cores are left out
+    AllCores, // one worker per core, fastest first
+};
+
+const char* thread_affinity_name(ThreadAffinity affinity);
+bool parse_thread_affinity(const std::string& name, ThreadAffinity* out);
+
+// Persistent compute threads for the forward pass. parallel_for splits a range
+// into chunks and deals each thread (the caller included) an equal share; a
+// thread that runs out steals chunks from the others, so a worker that lands
+// on a slow core or gets preempted does not hold up the barrier at the end.
+// Idle workers spin briefly between calls, since a decode step issues several
+// parallel_for calls per layer, then sleep.
+class ThreadPool {
+public:
+    // n_threads counts the calling thread; 0 picks default_threads(affinity)
+    ThreadPool(int n_threads, ThreadAffinity affinity);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return n_threads; }
+    ThreadAffinity affinity() const { return policy; }
+
+    // Runs fn(begin, end, thread) over [0, n) in chunks of at most `grain`,
+    // where thread < size() identifies the executing thread (for per-thread
+    // scratch). Returns when every chunk is done. If another thread is already
+    // using the pool, the whole range runs on the caller instead.
+    void parallel_for(int64_t n, int64_t grain, const std::function<void(int64_t, int64_t, int)>& fn);
+
+    // Fast cores for BigCores, all known cores otherwise (at least 1)
+    static int default_threads(ThreadAffinity affinity);
+
+private:
+    // Chunks dealt to one thread: it takes from `next` until `end`, and so do thieves
+    struct alignas(64) Share {
+        std::atomic<int64_t> next {0};
+        int64_t end = 0;
+    };
+
+    void worker_main(int index, int cpu);
+    void run_chunks(int index);
+
+    int n_threads;
+    ThreadAffinity policy;
+    std::vector<std::thread> workers;
+    std::unique_ptr<Share[]> shares;
+
+    // Current job, published by bumping `epoch`
+    const std::function<void(int64_t, int64_t, int)>* job = nullptr;
+    int64_t job_n = 0;
+    int64_t job_grain = 1;
+    std::atomic<uint64_t> epoch {0};
+    std::atomic<int> pending {0}; // workers still running the current job
+
+    std::mutex busy;  // held by the thread that owns the current job
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+    std::atomic<int> sleeping {0};
+    std::atomic<bool> stopping {false};
+};
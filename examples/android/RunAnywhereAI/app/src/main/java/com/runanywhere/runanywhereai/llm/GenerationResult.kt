@@ -7,5 +7,42 @@ data class GenerationResult(
     val text: String,
     val tokensGenerated: Int,
     val timeMs: Long,
-    val tokensPerSecond: Float
+    val tokensPerSecond: Float,
+    /** Native timing and token accounting, when the framework reports it */
+    val stats: GenerationStats? = null
 )
+
+/**
+ * Per-request accounting measured inside the native engine, so it excludes JNI and
+ * coroutine overhead. Times are in milliseconds.
+ */
+data class GenerationStats(
+    /** Tokens the prompt was evaluated as */
+    val promptTokens: Int,
+    /** Prompt tokens reused from the prefix cache instead of being evaluated */
+    val cachedTokens: Int,
+    val generatedTokens: Int,
+    /** Waiting for a batch slot */
+    val queueMs: Double,
+    /** Evaluating the uncached part of the prompt */
+    val prefillMs: Double,
+    /** From the call to the first generated token */
+    val timeToFirstTokenMs: Double,
+    /** From the first to the last generated token */
+    val decodeMs: Double,
+    /** Latency percentiles of the tokens after the first */
+    val tokenP50Ms: Float,
+    val tokenP90Ms: Float,
+    val tokenP99Ms: Float,
+    val tokenMaxMs: Float,
+    /** Forward-pass and sampling buffers */
+    val peakScratchBytes: Long,
+    /** KV cache blocks held by the sequence */
+    val peakKvBytes: Long,
+    /** "max_tokens", "eos", "grammar", "callback", "cancelled", "deadline" or "error" */
+    val stopReason: String
+) {
+    /** Decode throughput, excluding prefill */
+    val decodeTokensPerSecond: Float
+        get() = if (generatedTokens > 1 && decodeMs > 0) ((generatedTokens - 1) * 1000.0 / decodeMs).toFloat() else 0f
+}
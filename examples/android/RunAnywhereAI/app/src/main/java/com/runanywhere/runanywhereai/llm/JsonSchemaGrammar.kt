@@ -0,0 +1,210 @@
+package com.runanywhere.runanywhereai.llm
+
+import org.json.JSONArray
+import org.json.JSONObject
+
+/**
+ * Compiles JSON schemas to GBNF grammars for [GenerationOptions.grammar], so a
+ * constrained model can only produce JSON that the schema accepts.
+ *
+ * Supports objects (properties in declaration order, required), arrays (items,
+ * minItems, maxItems), strings (minLength, maxLength), numbers, integers,
+ * booleans, null, enum, const, anyOf / oneOf and lists of types. Anything else
+ * ($ref, patterns, formats) accepts any JSON value. Whitespace is allowed
+ * between tokens but not after the top-level value, so generation ends as soon
+ * as that value closes.
+ */
+object JsonSchemaGrammar {
+
+    /** Grammar for any JSON object */
+    val JSON_OBJECT: String by lazy { Compiler().compile(JSONObject().put("type", "object")) }
+
+    /** Grammar for any JSON value */
+    val JSON_VALUE: String by lazy { Compiler().compile(JSONObject()) }
+
+    /**
+     * Returns a GBNF grammar for [schema], a JSON schema document.
+     * Throws [org.json.JSONException] if it is not valid JSON.
+     */
+    fun fromSchema(schema: String): String = Compiler().compile(JSONObject(schema))
+
+    private val PRIMITIVES = linkedMapOf(
+        "ws" to "| \" \" | \"\\n\" [ \\t]{0,20}",
+        "char" to "[^\"\\\\\\x7F\\x00-\\x1F] | \"\\\\\" ( [\"\\\\/bfnrt] | \"u\" [0-9a-fA-F]{4} )",
+        "string" to "\"\\\"\" char* \"\\\"\"",
+        "integer" to "\"-\"? ( \"0\" | [1-9] [0-9]{0,15} )",
+        "number" to "integer ( \".\" [0-9]+ )? ( [eE] [-+]? [0-9]+ )?",
+        "boolean" to "\"true\" | \"false\"",
+        "null" to "\"null\"",
+        "value" to "object | array | string | number | boolean | null",
+        "object" to "\"{\" ws ( string ws \":\" ws value ( ws \",\" ws string ws \":\" ws value )* ws )? \"}\"",
+        "array" to "\"[\" ws ( value ( ws \",\" ws value )* ws )? \"]\""
+    )
+
+    // Rules each primitive refers to
+    private val PRIMITIVE_DEPENDENCIES = mapOf(
+        "string" to listOf("char"),
+        "number" to listOf("integer"),
+        "value" to listOf("object", "array", "string", "number", "boolean", "null"),
+        "object" to listOf("ws", "string", "value"),
+        "array" to listOf("ws", "value")
+    )
+
+    private class Compiler {
+        private val rules = linkedMapOf<String, String>()
+
+        fun compile(schema: JSONObject): String {
+            val root = visit(schema, "root")
+            if (root != "root") rules["root"] = root
+            return buildString {
+                // root first, then schema rules, then primitives in a fixed order
+                append("root ::= ").append(rules.getValue("root")).append('\n')
+                for ((name, body) in rules) {
+                    if (name != "root" && name !in PRIMITIVES) append(name).append(" ::= ").append(body).append('\n')
+                }
+                for ((name, body) in PRIMITIVES) {
+                    if (name in rules) append(name).append(" ::= ").append(body).append('\n')
+                }
+            }
+        }
+
+        private fun primitive(name: String): String {
+            if (name !in rules) {
+                rules[name] = PRIMITIVES.getValue(name)
+                PRIMITIVE_DEPENDENCIES[name]?.forEach { primitive(it) }
+            }
+            return name
+        }
+
+        private fun newRule(name: String, body: String): String {
+            var unique = name
+            var n = 2
+            while (unique in rules || unique in PRIMITIVES) unique = "$name-${n++}"
+            rules[unique] = body
+            return unique
+        }
+
+        /** Returns a grammar expression matching [schema] */
+        private fun visit(schema: Any?, name: String): String {
+            if (schema !is JSONObject) return primitive("value") // true / {} / unsupported
+
+            if (schema.has("const")) return newRule(name, literal(schema.get("const")))
+            schema.optJSONArray("enum")?.let { values ->
+                return newRule(name, (0 until values.length()).joinToString(" | ") { literal(values.get(it)) })
+            }
+            val alternatives = schema.optJSONArray("anyOf") ?: schema.optJSONArray("oneOf")
+            if (alternatives != null) {
+                val refs = (0 until alternatives.length()).map { visit(alternatives.get(it), "$name-$it") }
+                return newRule(name, refs.joinToString(" | "))
+            }
+
+            return when (val type = schema.opt("type")) {
+                is JSONArray -> {
+                    val refs = (0 until type.length()).map { i ->
+                        val single = JSONObject(schema.toString()).put("type", type.getString(i))
+                        visit(single, "$name-${type.getString(i)}")
+                    }
+                    newRule(name, refs.joinToString(" | "))
+                }
+                "object" -> visitObject(schema, name)
+                "array" -> visitArray(schema, name)
+                "string" -> visitString(schema, name)
+                "integer" -> primitive("integer")
+                "number" -> primitive("number")
+                "boolean" -> primitive("boolean")
+                "null" -> primitive("null")
+                else -> primitive("value")
+            }
+        }
+
+        private fun visitObject(schema: JSONObject, name: String): String {
+            val properties = schema.optJSONObject("properties") ?: return primitive("object")
+            primitive("ws")
+            val required = schema.optJSONArray("required")
+                ?.let { array -> (0 until array.length()).map { array.getString(it) }.toSet() }
+                ?: emptySet()
+
+            val pairs = mutableListOf<Pair<String, Boolean>>()
+            for (key in properties.keys()) {
+                val value = visit(properties.get(key), "$name-${sanitize(key)}")
+                pairs += "${literal(key)} ws \":\" ws $value" to (key in required)
+            }
+            val mandatory = pairs.filter { it.second }.map { it.first }
+            val optional = pairs.filterNot { it.second }.map { it.first }
+
+            val body = when {
+                mandatory.isNotEmpty() -> {
+                    // Required keys first, each optional one may follow in order
+                    val members = mandatory.joinToString(" ws \",\" ws ") +
+                        optional.joinToString("") { " ( ws \",\" ws $it )?" }
+                    "\"{\" ws $members ws \"}\""
+                }
+                optional.isEmpty() -> "\"{\" ws \"}\""
+                else -> {
+                    // Whichever optional key comes first has no comma before it
+                    val chains = optional.indices.joinToString(" | ") { first ->
+                        optional[first] + optional.drop(first + 1).joinToString("") { " ( ws \",\" ws $it )?" }
+                    }
+                    "\"{\" ws ( ( $chains ) ws )? \"}\""
+                }
+            }
+            return newRule(name, body)
+        }
+
+        private fun visitArray(schema: JSONObject, name: String): String {
+            val items = schema.opt("items")
+            val item = if (items == null) primitive("value") else visit(items, "$name-item")
+            primitive("ws")
+            val min = schema.optInt("minItems", 0)
+            val max = if (schema.has("maxItems")) schema.getInt("maxItems") else -1
+
+            val rest = "( ws \",\" ws $item )"
+            val body = when {
+                max == 0 -> "\"[\" ws \"]\""
+                min == 0 -> "\"[\" ws ( $item $rest${repeat(0, max - 1)} ws )? \"]\""
+                else -> "\"[\" ws $item $rest${repeat(min - 1, max - 1)} ws \"]\""
+            }
+            return newRule(name, body)
+        }
+
+        private fun visitString(schema: JSONObject, name: String): String {
+            val min = schema.optInt("minLength", 0)
+            val max = if (schema.has("maxLength")) schema.getInt("maxLength") else -1
+            if (min == 0 && max < 0) return primitive("string")
+            primitive("char")
+            return newRule(name, "\"\\\"\" char${repeat(min, max)} \"\\\"\"")
+        }
+
+        /** Repetition suffix for [min]..[max] occurrences; max < 0 is unbounded */
+        private fun repeat(min: Int, max: Int): String = when {
+            max < 0 && min == 0 -> "*"
+            max < 0 -> "{$min,}"
+            min == max -> "{$min}"
+            else -> "{$min,$max}"
+        }
+
+        private fun sanitize(key: String): String =
+            key.replace(Regex("[^a-zA-Z0-9-]"), "-").ifEmpty { "key" }
+
+        /** GBNF literal matching [value] serialized as JSON */
+        private fun literal(value: Any?): String {
+            val json = when (value) {
+                null, JSONObject.NULL -> "null"
+                is String -> JSONObject.quote(value)
+                else -> value.toString()
+            }
+            val escaped = StringBuilder("\"")
+            for (c in json) {
+                when (c) {
+                    '"' -> escaped.append("\\\"")
+                    '\\' -> escaped.append("\\\\")
+                    '\n' -> escaped.append("\\n")
+                    '\r' -> escaped.append("\\r")
+                    '\t' -> escaped.append("\\t")
+                    else -> escaped.append(c)
+                }
+            }
+            return escaped.append('"').toString()
+        }
+    }
+}
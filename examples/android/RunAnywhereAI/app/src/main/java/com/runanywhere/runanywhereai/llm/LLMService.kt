@@ -79,7 +79,15 @@ data class GenerationOptions(
     val repetitionPenalty: Float = 1.1f,
     val stopSequences: List<String> = emptyList(),
     val presencePenalty: Float? = null,
-    val frequencyPenalty: Float? = null
+    val frequencyPenalty: Float? = null,
+    val minP: Float = 0f,
+    val seed: Long? = null,
+    /** GBNF grammar the output must match; takes precedence over [jsonSchema] */
+    val grammar: String? = null,
+    /** JSON schema the output must match, compiled with [JsonSchemaGrammar] */
+    val jsonSchema: String? = null,
+    /** Wall-clock limit; generation stops once it passes and the partial reply is returned */
+    val timeoutMs: Long? = null
 )
 
 /**
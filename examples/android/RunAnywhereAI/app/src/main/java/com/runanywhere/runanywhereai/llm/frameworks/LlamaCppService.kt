@@ -3,11 +3,29 @@ package com.runanywhere.runanywhereai.llm.frameworks
 import android.content.Context
 import android.util.Log
 import com.runanywhere.runanywhereai.llm.*
+import kotlinx.coroutines.CancellationException
+import kotlinx.coroutines.CoroutineStart
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.NonCancellable
+import kotlinx.coroutines.awaitCancellation
+import kotlinx.coroutines.cancelAndJoin
+import kotlinx.coroutines.channels.Channel
+import kotlinx.coroutines.coroutineScope
+import kotlinx.coroutines.delay
 import kotlinx.coroutines.flow.Flow
-import kotlinx.coroutines.flow.flow
+import kotlinx.coroutines.flow.buffer
+import kotlinx.coroutines.flow.channelFlow
+import kotlinx.coroutines.flow.flowOn
+import kotlinx.coroutines.isActive
+import kotlinx.coroutines.launch
 import kotlinx.coroutines.withContext
+import org.json.JSONArray
+import org.json.JSONObject
+import java.io.Closeable
 import java.io.File
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.nio.CharBuffer
 
 /**
  * llama.cpp service implementation for GGUF model inference
@@ -22,6 +40,7 @@ import java.io.File
 class LlamaCppService(private val context: Context) : LLMService {
     companion object {
         private const val TAG = "LlamaCppService"
+        private const val WARMUP_POLL_MS = 50L
         private var nativeLibraryLoaded = false
 
         init {
@@ -39,34 +58,262 @@ class LlamaCppService(private val context: Context) : LLMService {
         @JvmStatic
         external fun nativeLoadModel(modelPath: String): Long
 
+        @JvmStatic
+        external fun nativeStartWarmup(modelPtr: Long): Long
+
+        @JvmStatic
+        external fun nativeGetWarmupProgress(warmupPtr: Long): String?
+
+        @JvmStatic
+        external fun nativeFreeWarmup(warmupPtr: Long)
+
         @JvmStatic
         external fun nativeGenerate(
             modelPtr: Long,
+            contextPtr: Long,
             prompt: String,
             maxTokens: Int,
             temperature: Float,
             topP: Float,
-            topK: Int
+            topK: Int,
+            minP: Float,
+            repeatPenalty: Float,
+            frequencyPenalty: Float,
+            presencePenalty: Float,
+            seed: Long,
+            grammar: String?,
+            requestPtr: Long
         ): String
 
+        @JvmStatic
+        external fun nativeGenerateStream(
+            modelPtr: Long,
+            contextPtr: Long,
+            prompt: String,
+            maxTokens: Int,
+            temperature: Float,
+            topP: Float,
+            topK: Int,
+            minP: Float,
+            repeatPenalty: Float,
+            frequencyPenalty: Float,
+            presencePenalty: Float,
+            seed: Long,
+            grammar: String?,
+            requestPtr: Long,
+            callback: TokenCallback
+        ): String?
+
+        @JvmStatic
+        external fun nativeGenerateDirect(
+            modelPtr: Long,
+            contextPtr: Long,
+            prompt: ByteBuffer,
+            promptOffset: Int,
+            promptLength: Int,
+            output: ByteBuffer,
+            outputOffset: Int,
+            outputLength: Int,
+            maxTokens: Int,
+            temperature: Float,
+            topP: Float,
+            topK: Int,
+            minP: Float,
+            repeatPenalty: Float,
+            frequencyPenalty: Float,
+            presencePenalty: Float,
+            seed: Long,
+            grammar: String?,
+            requestPtr: Long
+        ): Int
+
+        @JvmStatic
+        external fun nativeGenerateStreamDirect(
+            modelPtr: Long,
+            contextPtr: Long,
+            prompt: ByteBuffer,
+            promptOffset: Int,
+            promptLength: Int,
+            output: ByteBuffer,
+            outputOffset: Int,
+            outputLength: Int,
+            maxTokens: Int,
+            temperature: Float,
+            topP: Float,
+            topK: Int,
+            minP: Float,
+            repeatPenalty: Float,
+            frequencyPenalty: Float,
+            presencePenalty: Float,
+            seed: Long,
+            grammar: String?,
+            requestPtr: Long,
+            callback: DirectTokenCallback
+        ): Int
+
+        @JvmStatic
+        external fun nativeCreateRequest(timeoutMs: Long): Long
+
+        @JvmStatic
+        external fun nativeCancelRequest(requestPtr: Long)
+
+        @JvmStatic
+        external fun nativeGetRequestStats(requestPtr: Long): String?
+
+        @JvmStatic
+        external fun nativeFreeRequest(requestPtr: Long)
+
+        @JvmStatic
+        external fun nativeCreateContext(modelPtr: Long): Long
+
+        @JvmStatic
+        external fun nativeClearContext(contextPtr: Long)
+
+        @JvmStatic
+        external fun nativeGetContextTokens(contextPtr: Long): Int
+
+        @JvmStatic
+        external fun nativeFreeContext(contextPtr: Long)
+
+        @JvmStatic
+        external fun nativeLoadAdapter(modelPtr: Long, adapterPath: String): Long
+
+        @JvmStatic
+        external fun nativeFreeAdapter(adapterPtr: Long)
+
+        @JvmStatic
+        external fun nativeSetContextAdapters(contextPtr: Long, adapterPtrs: LongArray, scales: FloatArray): Boolean
+
         @JvmStatic
         external fun nativeFreeModel(modelPtr: Long)
 
         @JvmStatic
         external fun nativeGetModelSize(modelPtr: Long): Long
 
+        @JvmStatic
+        external fun nativeGetResidentModelSize(modelPtr: Long): Long
+
         @JvmStatic
         external fun nativeGetVocabSize(modelPtr: Long): Long
 
         @JvmStatic
         external fun nativeGetContextSize(modelPtr: Long): Long
 
+        @JvmStatic
+        external fun nativeGetEmbeddingSize(modelPtr: Long): Int
+
+        @JvmStatic
+        external fun nativeEmbed(
+            modelPtr: Long,
+            texts: Array<String>,
+            pooling: String,
+            normalize: Boolean,
+            output: ByteBuffer,
+            outputOffset: Int
+        ): Int
+
+        @JvmStatic
+        external fun nativeGetKVCacheStats(modelPtr: Long): String?
+
+        @JvmStatic
+        external fun nativeGetPrefixCacheStats(modelPtr: Long): String?
+
+        @JvmStatic
+        external fun nativeSetPrefixCacheBudget(modelPtr: Long, budgetBytes: Long)
+
+        @JvmStatic
+        external fun nativeGetSchedulerStats(modelPtr: Long): String?
+
+        @JvmStatic
+        external fun nativeSaveSession(modelPtr: Long, sessionPath: String): Boolean
+
+        @JvmStatic
+        external fun nativeLoadSession(modelPtr: Long, sessionPath: String): Boolean
+
+        @JvmStatic
+        external fun nativeSetKVCacheType(modelPtr: Long, type: String): Boolean
+
+        @JvmStatic
+        external fun nativeBenchmarkKVCache(modelPtr: Long, text: String, maxTokens: Int): String?
+
+        @JvmStatic
+        external fun nativeBenchmarkSampler(vocabSize: Int, iterations: Int): String?
+
+        @JvmStatic
+        external fun nativeSetDraftModel(modelPtr: Long, draftPtr: Long, nDraft: Int): Boolean
+
+        @JvmStatic
+        external fun nativeSetThreads(modelPtr: Long, nThreads: Int, affinity: String): Boolean
+
+        @JvmStatic
+        external fun nativeBenchmarkThreads(modelPtr: Long, affinity: String, nTokens: Int): String?
+
+        @JvmStatic
+        external fun nativeSetMemoryBudget(modelPtr: Long, budgetBytes: Long): Boolean
+
+        @JvmStatic
+        external fun nativeBenchmarkMemoryBudget(modelPtr: Long, budgets: LongArray, nTokens: Int): String?
+
         @JvmStatic
         external fun nativeTokenize(modelPtr: Long, text: String): IntArray
 
+        @JvmStatic
+        external fun nativeTokenizeDirect(modelPtr: Long, text: ByteBuffer, offset: Int, length: Int): IntArray?
+
         @JvmStatic
         external fun nativeDetokenize(modelPtr: Long, tokens: IntArray): String
 
+        @JvmStatic
+        external fun nativeCreateDetokenizer(modelPtr: Long, stripLeadingSpace: Boolean): Long
+
+        @JvmStatic
+        external fun nativeDetokenizerPush(detokenizerPtr: Long, tokens: IntArray): ByteArray
+
+        @JvmStatic
+        external fun nativeDetokenizerFlush(detokenizerPtr: Long): ByteArray
+
+        @JvmStatic
+        external fun nativeFreeDetokenizer(detokenizerPtr: Long)
+
+        @JvmStatic
+        external fun nativeBenchmarkTokenizer(modelPtr: Long, text: String, iterations: Int): String?
+
+        @JvmStatic
+        external fun nativeEchoString(text: String): String
+
+        @JvmStatic
+        external fun nativeEchoDirect(input: ByteBuffer, length: Int, output: ByteBuffer): Int
+
+        @JvmStatic
+        external fun nativeProbeModel(modelPath: String): String?
+
+        /**
+         * Read GGUF metadata from the file header without loading the model.
+         * Returns null if the native library is missing or the file is not valid GGUF.
+         */
+        fun probeModel(modelPath: String): GGUFMetadata? {
+            if (!nativeLibraryLoaded) return null
+            val json = nativeProbeModel(modelPath) ?: return null
+            return try {
+                val obj = JSONObject(json)
+                val tensorTypes = obj.getJSONObject("tensorTypes")
+                GGUFMetadata(
+                    architecture = obj.getString("architecture"),
+                    name = obj.optString("name"),
+                    vocabSize = obj.getLong("vocabSize"),
+                    contextLength = obj.getLong("contextLength"),
+                    parameterCount = obj.getLong("parameterCount"),
+                    quantization = obj.optString("quantization"),
+                    tensorTypeCounts = tensorTypes.keys().asSequence().associateWith {
+                        tensorTypes.getJSONObject(it).getInt("tensors")
+                    }
+                )
+            } catch (e: Exception) {
+                Log.e(TAG, "Failed to parse GGUF metadata for $modelPath", e)
+                null
+            }
+        }
+
         // Supported GGUF models
         val SUPPORTED_MODELS = listOf(
             GGUFModel("llama-2-7b-chat.Q4_0.gguf", "Llama 2 7B Chat", 3_900_000_000L, "Q4_0"),
@@ -77,10 +324,58 @@ class LlamaCppService(private val context: Context) : LLMService {
         )
     }
 
+    /**
+     * Receives generated text from [nativeGenerateStream] on the generating thread.
+     * Return false to stop generation.
+     */
+    interface TokenCallback {
+        fun onToken(token: String): Boolean
+    }
+
+    /**
+     * Told by [generateStreamInto] where each piece of generated text was written: [length]
+     * bytes of UTF-8 at [offset] in the output buffer. Return false to stop generation.
+     */
+    interface DirectTokenCallback {
+        fun onText(offset: Int, length: Int): Boolean
+    }
+
     private var modelPtr: Long = 0
+    private var draftPtr: Long = 0
+    private var warmupPtr: Long = 0
+    private val openContexts = mutableSetOf<ConversationContext>()
+    private val openAdapters = mutableSetOf<LoraAdapter>()
     private var currentModel: GGUFModel? = null
     private var modelInfo: ModelInfo? = null
 
+    /**
+     * Storage format of the KV cache for contexts created by [initialize]
+     */
+    var kvCacheType: KVCacheType = KVCacheType.F16
+
+    /**
+     * Compute threads for models loaded by [initialize]; 0 means one per allowed core
+     */
+    var threadCount: Int = 0
+
+    /**
+     * Which cores the compute threads are pinned to
+     */
+    var threadAffinity: ThreadAffinity = ThreadAffinity.BIG_CORES
+
+    /**
+     * Most memory the weights of models loaded by [initialize] may occupy; 0 means no limit.
+     * Below the model's size, layers are streamed from storage every token (see
+     * [setMemoryBudget]), which is slower but lets models larger than free RAM run.
+     */
+    var memoryBudgetBytes: Long = 0
+
+    /**
+     * Warm up models loaded by [initialize] in the background, so the first request does not
+     * pay for reading the weights; see [getWarmupProgress]
+     */
+    var warmUpOnLoad: Boolean = true
+
     override val name: String = "llama.cpp"
 
     override val isInitialized: Boolean
@@ -101,8 +396,14 @@ class LlamaCppService(private val context: Context) : LLMService {
                 }
 
                 // Find model info
+                val metadata = probeModel(modelPath)
                 currentModel = SUPPORTED_MODELS.find { it.fileName == modelFile.name }
-                    ?: GGUFModel(modelFile.name, "Custom GGUF Model", modelFile.length(), "Unknown")
+                    ?: GGUFModel(
+                        modelFile.name,
+                        metadata?.name?.takeIf { it.isNotEmpty() } ?: "Custom GGUF Model",
+                        modelFile.length(),
+                        metadata?.quantization?.takeIf { it.isNotEmpty() } ?: "Unknown"
+                    )
 
                 // Load the model
                 modelPtr = nativeLoadModel(modelPath)
@@ -110,6 +411,18 @@ class LlamaCppService(private val context: Context) : LLMService {
                     throw RuntimeException("Failed to load GGUF model from $modelPath")
                 }
 
+                if (kvCacheType != KVCacheType.F16 && !nativeSetKVCacheType(modelPtr, kvCacheType.nativeName)) {
+                    Log.w(TAG, "KV cache type $kvCacheType not supported by this model, using F16")
+                }
+                if ((threadCount != 0 || threadAffinity != ThreadAffinity.BIG_CORES) &&
+                    !nativeSetThreads(modelPtr, threadCount, threadAffinity.nativeName)
+                ) {
+                    Log.w(TAG, "Invalid thread settings $threadCount/$threadAffinity, using defaults")
+                }
+                if (memoryBudgetBytes != 0L && !nativeSetMemoryBudget(modelPtr, memoryBudgetBytes)) {
+                    Log.w(TAG, "Memory budget $memoryBudgetBytes is too small for this model, not limiting")
+                }
+
                 // Get model details from native code
                 val vocabSize = nativeGetVocabSize(modelPtr)
                 val contextSize = nativeGetContextSize(modelPtr)
@@ -119,7 +432,7 @@ class LlamaCppService(private val context: Context) : LLMService {
                 modelInfo = ModelInfo(
                     name = currentModel!!.displayName,
                     sizeBytes = modelSize,
-                    parameters = estimateParameters(currentModel!!),
+                    parameters = metadata?.parameterCount ?: estimateParameters(currentModel!!),
                     quantization = currentModel!!.quantization,
                     format = "GGUF",
                     framework = LLMFramework.LLAMA_CPP
@@ -127,6 +440,10 @@ class LlamaCppService(private val context: Context) : LLMService {
 
                 Log.d(TAG, "GGUF model loaded successfully: ${currentModel!!.displayName}")
                 Log.d(TAG, "Vocab size: $vocabSize, Context size: $contextSize")
+                Log.d(TAG, "Mapped: $modelSize bytes, resident: ${nativeGetResidentModelSize(modelPtr)} bytes")
+
+                // Last, as changing threads or the KV cache stops a warm-up
+                if (warmUpOnLoad) warmupPtr = nativeStartWarmup(modelPtr)
             } catch (e: Exception) {
                 Log.e(TAG, "Failed to initialize llama.cpp model", e)
                 release()
@@ -135,7 +452,11 @@ class LlamaCppService(private val context: Context) : LLMService {
         }
     }
 
-    override suspend fun generate(prompt: String, options: GenerationOptions): GenerationResult {
+    override suspend fun generate(prompt: String, options: GenerationOptions): GenerationResult =
+        generate(0L, prompt, options)
+
+    /** [generate] continuing the conversation [contextPtr], or standalone for 0 */
+    private suspend fun generate(contextPtr: Long, prompt: String, options: GenerationOptions): GenerationResult {
         return withContext(Dispatchers.Default) {
             if (!nativeLibraryLoaded || modelPtr == 0L) {
                 return@withContext GenerationResult(
@@ -150,25 +471,40 @@ class LlamaCppService(private val context: Context) : LLMService {
                 val startTime = System.currentTimeMillis()
 
                 // Call native generation
-                val response = nativeGenerate(
-                    modelPtr,
-                    prompt,
-                    options.maxTokens,
-                    options.temperature,
-                    options.topP,
-                    options.topK
-                )
+                val (response, stats) = withRequest(options) { request ->
+                    nativeGenerate(
+                        modelPtr,
+                        contextPtr,
+                        prompt,
+                        options.maxTokens,
+                        options.temperature,
+                        options.topP,
+                        options.topK,
+                        options.minP,
+                        options.repetitionPenalty,
+                        options.frequencyPenalty ?: 0f,
+                        options.presencePenalty ?: 0f,
+                        options.seed ?: -1L,
+                        grammarFor(options),
+                        request
+                    )
+                }
 
                 val endTime = System.currentTimeMillis()
-                val tokens = tokenize(response)
-                val tokensPerSecond = tokens.size.toFloat() / ((endTime - startTime) / 1000f)
+                val tokensGenerated = stats?.generatedTokens ?: 0
+                // Native decode rate when there is one, so prefill and JNI time do not count
+                val tokensPerSecond = stats?.decodeTokensPerSecond?.takeIf { it > 0f }
+                    ?: (tokensGenerated.toFloat() / ((endTime - startTime) / 1000f))
 
                 GenerationResult(
                     text = response,
-                    tokensGenerated = tokens.size,
+                    tokensGenerated = tokensGenerated,
                     timeMs = endTime - startTime,
-                    tokensPerSecond = tokensPerSecond
+                    tokensPerSecond = tokensPerSecond,
+                    stats = stats
                 )
+            } catch (e: CancellationException) {
+                throw e
             } catch (e: Exception) {
                 Log.e(TAG, "Generation failed", e)
                 GenerationResult(
@@ -181,70 +517,184 @@ class LlamaCppService(private val context: Context) : LLMService {
         }
     }
 
-    override fun generateStream(prompt: String, options: GenerationOptions): Flow<GenerationResult> = flow {
+    override fun generateStream(prompt: String, options: GenerationOptions): Flow<GenerationResult> =
+        generateStream(0L, prompt, options)
+
+    /** [generateStream] continuing the conversation [contextPtr], or standalone for 0 */
+    private fun generateStream(
+        contextPtr: Long,
+        prompt: String,
+        options: GenerationOptions
+    ): Flow<GenerationResult> = channelFlow {
         if (!nativeLibraryLoaded || modelPtr == 0L) {
-            emit(GenerationResult(
+            send(GenerationResult(
                 text = "llama.cpp native library not available",
                 tokensGenerated = 0,
                 timeMs = 0,
                 tokensPerSecond = 0f
             ))
-            return@flow
+            return@channelFlow
         }
 
         try {
             val startTime = System.currentTimeMillis()
-            var accumulatedText = ""
             var tokenCount = 0
 
-            // For now, we'll generate the full response and emit it in chunks
-            // In a real implementation, this would stream tokens as they're generated
-            val fullResponse = generate(prompt, options)
+            // Each piece is sent as soon as the native side samples it; returning
+            // false once the collector is gone stops generation
+            val callback = object : TokenCallback {
+                override fun onToken(token: String): Boolean {
+                    tokenCount++
+                    val currentTime = System.currentTimeMillis()
+                    val tokensPerSecond = tokenCount.toFloat() / ((currentTime - startTime) / 1000f)
 
-            // If generation failed, emit the error result
-            if (fullResponse.text.isEmpty()) {
-                emit(fullResponse)
-                return@flow
+                    trySend(GenerationResult(
+                        text = token,
+                        tokensGenerated = tokenCount,
+                        timeMs = currentTime - startTime,
+                        tokensPerSecond = tokensPerSecond
+                    ))
+                    return isActive
+                }
             }
 
-            // Emit response word by word to simulate streaming
-            val words = fullResponse.text.split(" ")
-            words.forEach { word ->
-                val chunk = "$word "
-                accumulatedText += chunk
-                tokenCount++
-
-                val currentTime = System.currentTimeMillis()
-                val tokensPerSecond = tokenCount.toFloat() / ((currentTime - startTime) / 1000f)
-
-                emit(GenerationResult(
-                    text = chunk,
-                    tokensGenerated = tokenCount,
-                    timeMs = currentTime - startTime,
-                    tokensPerSecond = tokensPerSecond
+            val (_, stats) = withRequest(options) { request ->
+                nativeGenerateStream(
+                    modelPtr,
+                    contextPtr,
+                    prompt,
+                    options.maxTokens,
+                    options.temperature,
+                    options.topP,
+                    options.topK,
+                    options.minP,
+                    options.repetitionPenalty,
+                    options.frequencyPenalty ?: 0f,
+                    options.presencePenalty ?: 0f,
+                    options.seed ?: -1L,
+                    grammarFor(options),
+                    request,
+                    callback
+                )
+            }
+            // A final empty piece carries the native accounting of the whole reply
+            if (stats != null) {
+                send(GenerationResult(
+                    text = "",
+                    tokensGenerated = stats.generatedTokens,
+                    timeMs = System.currentTimeMillis() - startTime,
+                    tokensPerSecond = stats.decodeTokensPerSecond,
+                    stats = stats
                 ))
-
-                kotlinx.coroutines.delay(30) // Simulate generation delay
             }
+        } catch (e: CancellationException) {
+            throw e
         } catch (e: Exception) {
             Log.e(TAG, "Stream generation failed", e)
-            emit(GenerationResult(
+            send(GenerationResult(
                 text = "",
                 tokensGenerated = 0,
                 timeMs = 0,
                 tokensPerSecond = 0f
             ))
         }
+    }.buffer(Channel.UNLIMITED).flowOn(Dispatchers.Default)
+
+    /**
+     * [generate] without Java strings: the prompt is the UTF-8 from [prompt]'s position to
+     * its limit, and the reply is written as UTF-8 at [output]'s position, which is advanced
+     * past it. Both buffers must be direct; neither is copied. Generation stops early once
+     * [output] is full. Suits long prompts (e.g. RAG context) assembled as bytes.
+     * Returns the number of bytes written.
+     */
+    suspend fun generateInto(prompt: ByteBuffer, output: ByteBuffer, options: GenerationOptions): Int =
+        withContext(Dispatchers.Default) {
+            checkDirect(prompt, output)
+            val (written, _) = withRequest(options) { request ->
+                nativeGenerateDirect(
+                    modelPtr,
+                    0L,
+                    prompt,
+                    prompt.position(),
+                    prompt.remaining(),
+                    output,
+                    output.position(),
+                    output.remaining(),
+                    options.maxTokens,
+                    options.temperature,
+                    options.topP,
+                    options.topK,
+                    options.minP,
+                    options.repetitionPenalty,
+                    options.frequencyPenalty ?: 0f,
+                    options.presencePenalty ?: 0f,
+                    options.seed ?: -1L,
+                    grammarFor(options),
+                    request
+                )
+            }
+            if (written < 0) throw RuntimeException("Generation failed")
+            output.position(output.position() + written)
+            written
+        }
+
+    /**
+     * Streaming [generateInto]: [callback] is told where each piece of text lands in
+     * [output] as soon as it is sampled, on the generating thread.
+     */
+    suspend fun generateStreamInto(
+        prompt: ByteBuffer,
+        output: ByteBuffer,
+        options: GenerationOptions,
+        callback: DirectTokenCallback
+    ): Int = withContext(Dispatchers.Default) {
+        checkDirect(prompt, output)
+        val (written, _) = withRequest(options) { request ->
+            nativeGenerateStreamDirect(
+                modelPtr,
+                0L,
+                prompt,
+                prompt.position(),
+                prompt.remaining(),
+                output,
+                output.position(),
+                output.remaining(),
+                options.maxTokens,
+                options.temperature,
+                options.topP,
+                options.topK,
+                options.minP,
+                options.repetitionPenalty,
+                options.frequencyPenalty ?: 0f,
+                options.presencePenalty ?: 0f,
+                options.seed ?: -1L,
+                grammarFor(options),
+                request,
+                callback
+            )
+        }
+        if (written < 0) throw RuntimeException("Generation failed")
+        output.position(output.position() + written)
+        written
     }
 
     override fun getModelInfo(): ModelInfo? = modelInfo
 
     override suspend fun release() {
         withContext(Dispatchers.IO) {
+            stopWarmup()
+            // Contexts hold KV blocks of the model, so they go first
+            synchronized(openContexts) { openContexts.toList() }.forEach { it.close() }
+            synchronized(openAdapters) { openAdapters.toList() }.forEach { it.close() }
             if (nativeLibraryLoaded && modelPtr != 0L) {
                 nativeFreeModel(modelPtr)
                 modelPtr = 0
             }
+            // The target refers to the draft, so the draft goes second
+            if (nativeLibraryLoaded && draftPtr != 0L) {
+                nativeFreeModel(draftPtr)
+                draftPtr = 0
+            }
             currentModel = null
             modelInfo = null
             Log.d(TAG, "llama.cpp resources released")
@@ -252,7 +702,395 @@ class LlamaCppService(private val context: Context) : LLMService {
     }
 
     /**
-     * Tokenize text using the loaded model's tokenizer
+     * Progress of the background warm-up started by [initialize], or null if there is none
+     * (no model, [warmUpOnLoad] off, or it was stopped by a thread or KV cache change)
+     */
+    fun getWarmupProgress(): WarmupProgress? {
+        if (!nativeLibraryLoaded || warmupPtr == 0L) return null
+        val json = nativeGetWarmupProgress(warmupPtr) ?: return null
+        return try {
+            val obj = JSONObject(json)
+            WarmupProgress(
+                phase = WarmupPhase.values().first { it.nativeName == obj.getString("phase") },
+                bytesDone = obj.getLong("bytesDone"),
+                bytesTotal = obj.getLong("bytesTotal"),
+                layersDone = obj.getInt("layersDone"),
+                layerCount = obj.getInt("layerCount"),
+                prefetchMs = obj.getDouble("prefetchMs"),
+                primeMs = obj.getDouble("primeMs")
+            )
+        } catch (e: Exception) {
+            Log.e(TAG, "Failed to parse warm-up progress", e)
+            null
+        }
+    }
+
+    /**
+     * Suspend until the background warm-up has finished. Returns true if the model is hot,
+     * false if the warm-up failed, was stopped or never started.
+     */
+    suspend fun awaitWarmup(): Boolean {
+        while (true) {
+            val progress = getWarmupProgress() ?: return false
+            when (progress.phase) {
+                WarmupPhase.HOT -> return true
+                WarmupPhase.PREFETCHING, WarmupPhase.PRIMING -> delay(WARMUP_POLL_MS)
+                else -> return false
+            }
+        }
+    }
+
+    /** Cancels a warm-up in progress and waits for it to stop */
+    private fun stopWarmup() {
+        if (warmupPtr != 0L) {
+            nativeFreeWarmup(warmupPtr)
+            warmupPtr = 0
+        }
+    }
+
+    /**
+     * Occupancy of the native paged KV cache, or null if no model is loaded
+     */
+    fun getKVCacheStats(): KVCacheStats? {
+        if (!nativeLibraryLoaded || modelPtr == 0L) return null
+        val json = nativeGetKVCacheStats(modelPtr) ?: return null
+        return try {
+            val obj = JSONObject(json)
+            KVCacheStats(
+                type = obj.getString("type"),
+                blockSize = obj.getInt("blockSize"),
+                blocksTotal = obj.getInt("blocksTotal"),
+                blocksAllocated = obj.getInt("blocksAllocated"),
+                blocksInUse = obj.getInt("blocksInUse"),
+                tokens = obj.getLong("tokens"),
+                bytesAllocated = obj.getLong("bytesAllocated"),
+                bytesInUse = obj.getLong("bytesInUse"),
+                fragmentation = obj.getDouble("fragmentation").toFloat()
+            )
+        } catch (e: Exception) {
+            Log.e(TAG, "Failed to parse KV cache stats", e)
+            null
+        }
+    }
+
+    /**
+     * Hit/miss counters of the native prompt prefix cache, or null if no model is loaded
+     */
+    fun getPrefixCacheStats(): PrefixCacheStats? {
+        if (!nativeLibraryLoaded || modelPtr == 0L) return null
+        val json = nativeGetPrefixCacheStats(modelPtr) ?: return null
+        return try {
+            val obj = JSONObject(json)
+            PrefixCacheStats(
+                lookups = obj.getLong("lookups"),
+                hits = obj.getLong("hits"),
+                misses = obj.getLong("misses"),
+                tokensLookedUp = obj.getLong("tokensLookedUp"),
+                tokensReused = obj.getLong("tokensReused"),
+                evictions = obj.getLong("evictions"),
+                bytes = obj.getLong("bytes"),
+                budgetBytes = obj.getLong("budgetBytes")
+            )
+        } catch (e: Exception) {
+            Log.e(TAG, "Failed to parse prefix cache stats", e)
+            null
+        }
+    }
+
+    /**
+     * Counters of the native continuous-batching scheduler that serves concurrent
+     * [generate] / [generateStream] calls, or null if no model is loaded
+     */
+    fun getSchedulerStats(): SchedulerStats? {
+        if (!nativeLibraryLoaded || modelPtr == 0L) return null
+        val json = nativeGetSchedulerStats(modelPtr) ?: return null
+        return try {
+            val obj = JSONObject(json)
+            SchedulerStats(
+                active = obj.getInt("active"),
+                queued = obj.getInt("queued"),
+                requests = obj.getLong("requests"),
+                steps = obj.getLong("steps"),
+                rows = obj.getLong("rows"),
+                tokensGenerated = obj.getLong("tokensGenerated")
+            )
+        } catch (e: Exception) {
+            Log.e(TAG, "Failed to parse scheduler stats", e)
+            null
+        }
+    }
+
+    /**
+     * Limit the memory used to keep prompt prefixes between calls. 0 disables reuse.
+     */
+    fun setPrefixCacheBudget(budgetBytes: Long) {
+        if (!nativeLibraryLoaded || modelPtr == 0L) return
+        nativeSetPrefixCacheBudget(modelPtr, budgetBytes)
+    }
+
+    /**
+     * Save the conversation state (KV cache, tokens, RNG) of the last finished
+     * [generate] call, or of the session restored since, so it can be resumed
+     * with [loadSession] after the process is restarted. [ConversationContext]s
+     * are not included.
+     */
+    suspend fun saveSession(sessionPath: String): Boolean = withContext(Dispatchers.IO) {
+        if (!nativeLibraryLoaded || modelPtr == 0L) return@withContext false
+        nativeSaveSession(modelPtr, sessionPath)
+    }
+
+    /**
+     * Restore a session saved with the same model. The next generate call whose
+     * prompt continues that conversation skips re-prefilling the saved history.
+     */
+    suspend fun loadSession(sessionPath: String): Boolean = withContext(Dispatchers.IO) {
+        if (!nativeLibraryLoaded || modelPtr == 0L) return@withContext false
+        if (!File(sessionPath).exists()) return@withContext false
+        nativeLoadSession(modelPtr, sessionPath)
+    }
+
+    /**
+     * Switch the KV cache storage format. Drops the current conversation state, and fails
+     * while any [ConversationContext] is open.
+     */
+    suspend fun setKVCacheType(type: KVCacheType): Boolean = withContext(Dispatchers.Default) {
+        if (!nativeLibraryLoaded || modelPtr == 0L) return@withContext false
+        stopWarmup()
+        val ok = nativeSetKVCacheType(modelPtr, type.nativeName)
+        if (ok) kvCacheType = type
+        ok
+    }
+
+    /**
+     * Change the number of compute threads and the cores they run on. On big.LITTLE
+     * phones [ThreadAffinity.BIG_CORES] is usually fastest, since every matmul waits
+     * for its slowest thread; use [benchmarkThreads] to pick a count.
+     */
+    suspend fun setThreads(count: Int, affinity: ThreadAffinity = threadAffinity): Boolean =
+        withContext(Dispatchers.Default) {
+            if (!nativeLibraryLoaded || modelPtr == 0L) return@withContext false
+            stopWarmup()
+            val ok = nativeSetThreads(modelPtr, count, affinity.nativeName)
+            if (ok) {
+                threadCount = count
+                threadAffinity = affinity
+            }
+            ok
+        }
+
+    /**
+     * Measure decode speed for every thread count from 1 to the number of cores
+     * allowed by [affinity]. Generation is paused while it runs.
+     */
+    suspend fun benchmarkThreads(
+        affinity: ThreadAffinity = threadAffinity,
+        tokens: Int = 64
+    ): List<ThreadBenchmark> = withContext(Dispatchers.Default) {
+        if (!nativeLibraryLoaded || modelPtr == 0L) return@withContext emptyList()
+        stopWarmup()
+        val json = nativeBenchmarkThreads(modelPtr, affinity.nativeName, tokens)
+            ?: return@withContext emptyList()
+        try {
+            val array = JSONArray(json)
+            (0 until array.length()).map { i ->
+                val obj = array.getJSONObject(i)
+                ThreadBenchmark(
+                    threads = obj.getInt("threads"),
+                    tokensPerSecond = obj.getDouble("tokensPerSecond")
+                )
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Failed to parse thread benchmark", e)
+            emptyList()
+        }
+    }
+
+    /**
+     * Limit the memory the model's weights occupy to [bytes] (0 removes the limit). Layers
+     * that do not fit stay on storage and are read ahead one at a time while the layer
+     * before them computes, then dropped again. Returns false if [bytes] cannot hold the
+     * output head and two layers; use [benchmarkMemoryBudget] to see the speed cost.
+     */
+    suspend fun setMemoryBudget(bytes: Long): Boolean = withContext(Dispatchers.Default) {
+        if (!nativeLibraryLoaded || modelPtr == 0L) return@withContext false
+        stopWarmup()
+        val ok = nativeSetMemoryBudget(modelPtr, bytes)
+        if (ok) memoryBudgetBytes = bytes
+        ok
+    }
+
+    /**
+     * Measure decode speed and peak weight memory under each of [budgets] (0 for no limit).
+     * Budgets too small for the model are left out. Generation is paused while it runs.
+     */
+    suspend fun benchmarkMemoryBudget(
+        budgets: List<Long>,
+        tokens: Int = 32
+    ): List<MemoryBudgetBenchmark> = withContext(Dispatchers.Default) {
+        if (!nativeLibraryLoaded || modelPtr == 0L) return@withContext emptyList()
+        stopWarmup()
+        val json = nativeBenchmarkMemoryBudget(modelPtr, budgets.toLongArray(), tokens)
+            ?: return@withContext emptyList()
+        try {
+            val array = JSONArray(json)
+            (0 until array.length()).map { i ->
+                val obj = array.getJSONObject(i)
+                MemoryBudgetBenchmark(
+                    budgetBytes = obj.getLong("budgetBytes"),
+                    residentLayers = obj.getInt("pinnedLayers"),
+                    tokensPerSecond = obj.getDouble("tokensPerSecond"),
+                    peakResidentBytes = obj.getLong("peakResidentBytes")
+                )
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Failed to parse memory budget benchmark", e)
+            emptyList()
+        }
+    }
+
+    /**
+     * Use a smaller model with the same tokenizer (e.g. TinyLlama for Llama 2) to
+     * draft [draftTokens] tokens per step, which the loaded model verifies in one
+     * batched pass. Output is unchanged; only decode speed differs. Pass null to
+     * turn speculative decoding off and free the draft model.
+     */
+    suspend fun setDraftModel(draftPath: String?, draftTokens: Int = 4): Boolean = withContext(Dispatchers.IO) {
+        if (!nativeLibraryLoaded || modelPtr == 0L) return@withContext false
+
+        nativeSetDraftModel(modelPtr, 0, 0)
+        if (draftPtr != 0L) {
+            nativeFreeModel(draftPtr)
+            draftPtr = 0
+        }
+        if (draftPath == null) return@withContext true
+
+        val ptr = nativeLoadModel(draftPath)
+        if (ptr == 0L) {
+            Log.e(TAG, "Failed to load draft model: $draftPath")
+            return@withContext false
+        }
+        if (!nativeSetDraftModel(modelPtr, ptr, draftTokens)) {
+            nativeFreeModel(ptr)
+            return@withContext false
+        }
+        draftPtr = ptr
+        true
+    }
+
+    /**
+     * Measure perplexity of [text] and decode latency for every KV cache format.
+     * Runs on throwaway contexts; the loaded conversation is not affected.
+     */
+    suspend fun benchmarkKVCache(text: String, maxTokens: Int = 256): List<KVCacheBenchmark> =
+        withContext(Dispatchers.Default) {
+            if (!nativeLibraryLoaded || modelPtr == 0L) return@withContext emptyList()
+            val json = nativeBenchmarkKVCache(modelPtr, text, maxTokens) ?: return@withContext emptyList()
+            try {
+                val array = JSONArray(json)
+                (0 until array.length()).map { i ->
+                    val obj = array.getJSONObject(i)
+                    KVCacheBenchmark(
+                        type = obj.getString("type"),
+                        bytesPerToken = obj.getLong("bytesPerToken"),
+                        tokens = obj.getInt("tokens"),
+                        perplexity = obj.optDouble("perplexity"),
+                        msPerToken = obj.getDouble("msPerToken")
+                    )
+                }
+            } catch (e: Exception) {
+                Log.e(TAG, "Failed to parse KV cache benchmark", e)
+                emptyList()
+            }
+        }
+
+    /**
+     * Measure the native sampler chain on random logits. Compare [SamplerBenchmark.usPerToken]
+     * with the decode time per token; it should be a small fraction even for 128k vocabularies.
+     */
+    suspend fun benchmarkSampler(vocabSize: Int = 128256, iterations: Int = 200): List<SamplerBenchmark> =
+        withContext(Dispatchers.Default) {
+            if (!nativeLibraryLoaded) return@withContext emptyList()
+            val json = nativeBenchmarkSampler(vocabSize, iterations) ?: return@withContext emptyList()
+            try {
+                val array = JSONArray(json)
+                (0 until array.length()).map { i ->
+                    val obj = array.getJSONObject(i)
+                    SamplerBenchmark(
+                        config = obj.getString("config"),
+                        vocabSize = obj.getInt("vocabSize"),
+                        usPerToken = obj.getDouble("usPerToken")
+                    )
+                }
+            } catch (e: Exception) {
+                Log.e(TAG, "Failed to parse sampler benchmark", e)
+                emptyList()
+            }
+        }
+
+    /**
+     * Measure the model's tokenizer on [text]. A document of 32k tokens should take a few
+     * milliseconds per run; [TokenizerBenchmark.roundTrip] checks that detokenizing gives the text back.
+     */
+    suspend fun benchmarkTokenizer(text: String, iterations: Int = 10): TokenizerBenchmark? =
+        withContext(Dispatchers.Default) {
+            if (!nativeLibraryLoaded || modelPtr == 0L) return@withContext null
+            val json = nativeBenchmarkTokenizer(modelPtr, text, iterations) ?: return@withContext null
+            try {
+                val obj = JSONObject(json)
+                TokenizerBenchmark(
+                    bytes = obj.getLong("bytes"),
+                    tokens = obj.getInt("tokens"),
+                    msPerRun = obj.getDouble("msPerRun"),
+                    tokensPerSecond = obj.getDouble("tokensPerSecond"),
+                    roundTrip = obj.getBoolean("roundTrip")
+                )
+            } catch (e: Exception) {
+                Log.e(TAG, "Failed to parse tokenizer benchmark", e)
+                null
+            }
+        }
+
+    /**
+     * Measure one JNI round trip of [text] through a String entry point and through a direct
+     * ByteBuffer one. The "ByteBuffer" row includes encoding the String to UTF-8 and decoding
+     * the result; "ByteBuffer (bytes)" is the call alone, for text that already is UTF-8.
+     * Needs no model.
+     */
+    suspend fun benchmarkJni(text: String, iterations: Int = 1000): List<JniBenchmark> =
+        withContext(Dispatchers.Default) {
+            if (!nativeLibraryLoaded) return@withContext emptyList()
+            val encoder = Charsets.UTF_8.newEncoder()
+            val decoder = Charsets.UTF_8.newDecoder()
+            val capacity = (text.length * encoder.maxBytesPerChar()).toInt()
+            val input = ByteBuffer.allocateDirect(capacity)
+            val output = ByteBuffer.allocateDirect(capacity)
+            val length = text.toByteArray(Charsets.UTF_8).size
+
+            fun time(path: String, call: () -> Unit): JniBenchmark {
+                repeat(minOf(iterations, 100)) { call() } // warm up the JIT
+                val start = System.nanoTime()
+                repeat(iterations) { call() }
+                val us = (System.nanoTime() - start) / 1000.0 / maxOf(iterations, 1)
+                return JniBenchmark(path, length, us)
+            }
+
+            listOf(
+                time("String") { nativeEchoString(text) },
+                time("ByteBuffer") {
+                    input.clear()
+                    encoder.reset().encode(CharBuffer.wrap(text), input, true)
+                    encoder.flush(input)
+                    val n = nativeEchoDirect(input, input.position(), output)
+                    output.limit(n).position(0)
+                    decoder.reset().decode(output).toString()
+                    output.clear()
+                },
+                time("ByteBuffer (bytes)") { nativeEchoDirect(input, length, output) }
+            )
+        }
+
+    /**
+     * Tokenize text using the loaded model's tokenizer (no BOS token)
      */
     fun tokenize(text: String): IntArray {
         if (!nativeLibraryLoaded || modelPtr == 0L) {
@@ -261,6 +1099,59 @@ class LlamaCppService(private val context: Context) : LLMService {
         return nativeTokenize(modelPtr, text)
     }
 
+    /**
+     * Tokenize the UTF-8 from [text]'s position to its limit, read in place (no BOS token).
+     * [text] must be a direct buffer.
+     */
+    fun tokenize(text: ByteBuffer): IntArray {
+        checkDirect(text)
+        return nativeTokenizeDirect(modelPtr, text, text.position(), text.remaining())
+            ?: throw IllegalStateException("Tokenization failed")
+    }
+
+    /**
+     * Length of the vectors [embed] returns, or 0 if no model is loaded
+     */
+    val embeddingSize: Int
+        get() = if (nativeLibraryLoaded && modelPtr != 0L) nativeGetEmbeddingSize(modelPtr) else 0
+
+    /**
+     * Embed [texts] for retrieval, e.g. to index chat history. All of them go through the model
+     * in packed batches in one native call, with no sampling and no KV cache kept afterwards;
+     * each text's token states are combined by [pooling], and [normalize] scales the vectors to
+     * unit length so a dot product is their cosine similarity.
+     */
+    suspend fun embed(
+        texts: List<String>,
+        pooling: EmbeddingPooling = EmbeddingPooling.MEAN,
+        normalize: Boolean = true
+    ): List<FloatArray> = withContext(Dispatchers.Default) {
+        val size = embeddingSize
+        val output = ByteBuffer.allocateDirect(texts.size * size * 4).order(ByteOrder.nativeOrder())
+        embedInto(texts, output, pooling, normalize)
+        output.flip()
+        val floats = output.asFloatBuffer()
+        List(texts.size) { FloatArray(size).also { floats.get(it) } }
+    }
+
+    /**
+     * [embed] into a direct buffer in native byte order: the vectors are written back to back at
+     * [output]'s position, which must be a multiple of 4 and is advanced past them. Suits
+     * handing vectors to a native index without copying. Returns the vector length.
+     */
+    suspend fun embedInto(
+        texts: List<String>,
+        output: ByteBuffer,
+        pooling: EmbeddingPooling = EmbeddingPooling.MEAN,
+        normalize: Boolean = true
+    ): Int = withContext(Dispatchers.Default) {
+        checkDirect(output)
+        val size = nativeEmbed(modelPtr, texts.toTypedArray(), pooling.nativeName, normalize, output, output.position())
+        if (size < 0) throw RuntimeException("Embedding failed")
+        output.position(output.position() + texts.size * size * 4)
+        size
+    }
+
     /**
      * Detokenize tokens back to text
      */
@@ -272,7 +1163,222 @@ class LlamaCppService(private val context: Context) : LLMService {
     }
 
     /**
-     * Estimate parameter count based on model and quantization
+     * Create a [StreamingDetokenizer] for the loaded model. Set [stripLeadingSpace] when the
+     * tokens start a text (e.g. a [tokenize] result) rather than continue a prompt.
+     */
+    fun newDetokenizer(stripLeadingSpace: Boolean = false): StreamingDetokenizer {
+        if (!nativeLibraryLoaded || modelPtr == 0L) {
+            throw IllegalStateException("Native library not available or model not loaded")
+        }
+        return StreamingDetokenizer(modelPtr, nativeCreateDetokenizer(modelPtr, stripLeadingSpace))
+    }
+
+    /**
+     * Turns tokens into text as they arrive, so a UI can append each delta instead of
+     * re-decoding the whole token list. A character split across tokens is held back until
+     * it is complete. Close it before the model is unloaded.
+     */
+    inner class StreamingDetokenizer internal constructor(
+        private val owner: Long,
+        private var handle: Long
+    ) : Closeable {
+
+        /** Text the [tokens] complete */
+        fun push(vararg tokens: Int): String = String(nativeDetokenizerPush(checkedHandle(), tokens), Charsets.UTF_8)
+
+        /** Ends the stream, returning anything held back, and starts a new one */
+        fun flush(): String = String(nativeDetokenizerFlush(checkedHandle()), Charsets.UTF_8)
+
+        override fun close() {
+            if (handle != 0L) {
+                nativeFreeDetokenizer(handle)
+                handle = 0
+            }
+        }
+
+        private fun checkedHandle(): Long {
+            check(handle != 0L) { "Detokenizer is closed" }
+            check(modelPtr == owner) { "Model was unloaded" }
+            return handle
+        }
+    }
+
+    /**
+     * Create a [ConversationContext] over the loaded model's weights, e.g. to summarize in the
+     * background while a chat keeps its own history. Close it when done; [release] closes any
+     * that are still open.
+     */
+    fun createContext(): ConversationContext {
+        if (!nativeLibraryLoaded || modelPtr == 0L) {
+            throw IllegalStateException("Native library not available or model not loaded")
+        }
+        val handle = nativeCreateContext(modelPtr)
+        check(handle != 0L) { "Failed to create context" }
+        return ConversationContext(modelPtr, handle).also { synchronized(openContexts) { openContexts += it } }
+    }
+
+    /**
+     * A conversation of its own over the shared weights. Its KV cache is kept between calls,
+     * so a prompt that repeats the conversation so far only evaluates what was added, and its
+     * sampler state is separate. Contexts generate in parallel with each other and with
+     * [LlamaCppService.generate]; calls on one context run one after another. Each one costs
+     * only the KV cache memory it fills.
+     */
+    inner class ConversationContext internal constructor(
+        private val owner: Long,
+        private var handle: Long
+    ) : Closeable {
+
+        suspend fun generate(prompt: String, options: GenerationOptions = GenerationOptions()): GenerationResult =
+            this@LlamaCppService.generate(checkedHandle(), prompt, options)
+
+        fun generateStream(prompt: String, options: GenerationOptions = GenerationOptions()): Flow<GenerationResult> =
+            this@LlamaCppService.generateStream(checkedHandle(), prompt, options)
+
+        /** Tokens of the conversation held in the KV cache */
+        val cachedTokens: Int
+            get() = nativeGetContextTokens(checkedHandle())
+
+        /** Forgets the conversation and frees its KV cache */
+        fun clear() = nativeClearContext(checkedHandle())
+
+        /**
+         * Attaches [adapter] with [scale] in place of any adapters attached so far, or detaches
+         * them all if it is null. Clears the conversation, whose cache was computed without it.
+         */
+        fun setAdapter(adapter: LoraAdapter?, scale: Float = 1f) =
+            setAdapters(if (adapter == null) emptyMap() else mapOf(adapter to scale))
+
+        /** Like [setAdapter], for several adapters whose deltas add up, each with its scale */
+        fun setAdapters(adapters: Map<LoraAdapter, Float>) {
+            val handles = adapters.keys.map { it.checkedHandle(owner) }.toLongArray()
+            check(nativeSetContextAdapters(checkedHandle(), handles, adapters.values.toFloatArray())) {
+                "Failed to set adapters"
+            }
+        }
+
+        /** Waits for a generation in progress on this context, then frees it */
+        override fun close() {
+            synchronized(openContexts) {
+                if (handle != 0L) {
+                    nativeFreeContext(handle)
+                    handle = 0
+                    openContexts -= this
+                }
+            }
+        }
+
+        private fun checkedHandle(): Long {
+            check(handle != 0L) { "Context is closed" }
+            check(modelPtr == owner) { "Model was unloaded" }
+            return handle
+        }
+    }
+
+    /**
+     * Map a LoRA adapter GGUF (as written by llama.cpp's convert_lora_to_gguf.py) for the loaded
+     * model, to attach to [ConversationContext]s with [ConversationContext.setAdapter]. The base
+     * weights stay as they are, so switching fine-tunes costs milliseconds and the adapter's
+     * size rather than a model reload. Returns null if the file does not match the model.
+     */
+    suspend fun loadAdapter(adapterPath: String): LoraAdapter? = withContext(Dispatchers.IO) {
+        if (!nativeLibraryLoaded || modelPtr == 0L) return@withContext null
+        if (!File(adapterPath).exists()) return@withContext null
+        val handle = nativeLoadAdapter(modelPtr, adapterPath)
+        if (handle == 0L) return@withContext null
+        LoraAdapter(modelPtr, handle, adapterPath).also { synchronized(openAdapters) { openAdapters += it } }
+    }
+
+    /**
+     * A LoRA adapter loaded by [loadAdapter]. Closing it does not detach it: contexts it is
+     * attached to keep it until they are given other adapters or closed.
+     */
+    inner class LoraAdapter internal constructor(
+        private val owner: Long,
+        private var handle: Long,
+        val path: String
+    ) : Closeable {
+
+        override fun close() {
+            synchronized(openAdapters) {
+                if (handle != 0L) {
+                    nativeFreeAdapter(handle)
+                    handle = 0
+                    openAdapters -= this
+                }
+            }
+        }
+
+        internal fun checkedHandle(model: Long): Long {
+            check(handle != 0L) { "Adapter is closed" }
+            check(modelPtr == owner && model == owner) { "Adapter belongs to another model" }
+            return handle
+        }
+    }
+
+    /**
+     * Runs a native generation [call] with a request handle carrying [GenerationOptions.timeoutMs].
+     * The handle is cancelled as soon as the calling coroutine is, so the native side stops within
+     * one forward pass instead of running on to maxTokens. Returns the call's value and the
+     * generation's native stats.
+     */
+    private suspend fun <T> withRequest(
+        options: GenerationOptions,
+        call: (request: Long) -> T
+    ): Pair<T, GenerationStats?> = coroutineScope {
+        val request = nativeCreateRequest(options.timeoutMs ?: 0L)
+        val watcher = launch(start = CoroutineStart.UNDISPATCHED) {
+            try {
+                awaitCancellation()
+            } finally {
+                nativeCancelRequest(request)
+            }
+        }
+        try {
+            val value = call(request)
+            value to nativeGetRequestStats(request)?.let { json ->
+                val obj = JSONObject(json)
+                GenerationStats(
+                    promptTokens = obj.getInt("promptTokens"),
+                    cachedTokens = obj.getInt("cachedTokens"),
+                    generatedTokens = obj.getInt("generatedTokens"),
+                    queueMs = obj.getDouble("queueMs"),
+                    prefillMs = obj.getDouble("prefillMs"),
+                    timeToFirstTokenMs = obj.getDouble("ttftMs"),
+                    decodeMs = obj.getDouble("decodeMs"),
+                    tokenP50Ms = obj.getDouble("tokenP50Ms").toFloat(),
+                    tokenP90Ms = obj.getDouble("tokenP90Ms").toFloat(),
+                    tokenP99Ms = obj.getDouble("tokenP99Ms").toFloat(),
+                    tokenMaxMs = obj.getDouble("tokenMaxMs").toFloat(),
+                    peakScratchBytes = obj.getLong("peakScratchBytes"),
+                    peakKvBytes = obj.getLong("peakKvBytes"),
+                    stopReason = obj.getString("stopReason")
+                )
+            }
+        } finally {
+            // The watcher may be cancelling the handle right now
+            withContext(NonCancellable) { watcher.cancelAndJoin() }
+            nativeFreeRequest(request)
+        }
+    }
+
+    private fun checkDirect(vararg buffers: ByteBuffer) {
+        if (!nativeLibraryLoaded || modelPtr == 0L) {
+            throw IllegalStateException("Native library not available or model not loaded")
+        }
+        require(buffers.all { it.isDirect }) { "Buffers must be allocated with ByteBuffer.allocateDirect" }
+    }
+
+    /**
+     * GBNF grammar constraining a generation, if the options ask for one.
+     * The native side rejects the call if the grammar does not parse.
+     */
+    private fun grammarFor(options: GenerationOptions): String? =
+        options.grammar ?: options.jsonSchema?.let { JsonSchemaGrammar.fromSchema(it) }
+
+    /**
+     * Estimate parameter count based on model and quantization.
+     * Only used when the GGUF header could not be probed.
      */
     private fun estimateParameters(model: GGUFModel): Long {
         // Rough estimation based on file size and quantization
@@ -286,6 +1392,189 @@ class LlamaCppService(private val context: Context) : LLMService {
         }
     }
 
+    /**
+     * Metadata read from a GGUF header by [probeModel]
+     */
+    data class GGUFMetadata(
+        val architecture: String,
+        val name: String,
+        val vocabSize: Long,
+        val contextLength: Long,
+        val parameterCount: Long,
+        val quantization: String,
+        val tensorTypeCounts: Map<String, Int>
+    )
+
+    enum class WarmupPhase(val nativeName: String) {
+        /** Reading the weights into memory, layer by layer */
+        PREFETCHING("prefetching"),
+        /** Generating one token to set up buffers and compute threads */
+        PRIMING("priming"),
+        /** Done; requests run at full speed */
+        HOT("hot"),
+        CANCELLED("cancelled"),
+        FAILED("failed")
+    }
+
+    /**
+     * Background warm-up state reported by [getWarmupProgress]
+     */
+    data class WarmupProgress(
+        val phase: WarmupPhase,
+        val bytesDone: Long,
+        val bytesTotal: Long,
+        val layersDone: Int,
+        val layerCount: Int,
+        val prefetchMs: Double,
+        val primeMs: Double
+    ) {
+        /** Fraction of the weights read so far */
+        val fraction: Float
+            get() = if (bytesTotal > 0) bytesDone.toFloat() / bytesTotal else 0f
+    }
+
+    /**
+     * Paged KV cache occupancy reported by [getKVCacheStats].
+     * [fragmentation] is the fraction of unused positions in blocks that are in use.
+     */
+    data class KVCacheStats(
+        val type: String,
+        val blockSize: Int,
+        val blocksTotal: Int,
+        val blocksAllocated: Int,
+        val blocksInUse: Int,
+        val tokens: Long,
+        val bytesAllocated: Long,
+        val bytesInUse: Long,
+        val fragmentation: Float
+    )
+
+    /**
+     * How [embed] turns a text's token states into one vector
+     */
+    enum class EmbeddingPooling(val nativeName: String) {
+        /** Average over every token; the usual choice */
+        MEAN("mean"),
+        /** First token (BOS), as for encoder models trained with a CLS token */
+        CLS("cls"),
+        /** Last token, the only one that attends to the whole text in a decoder-only model */
+        LAST("last")
+    }
+
+    /**
+     * KV cache storage formats. Quantized formats need a head size divisible by 32.
+     */
+    enum class KVCacheType(val nativeName: String) {
+        F32("F32"),
+        F16("F16"),
+        Q8_0("Q8_0"),
+        Q4_0("Q4_0")
+    }
+
+    /**
+     * One row of [benchmarkKVCache]: memory, quality and speed for a KV cache format
+     */
+    data class KVCacheBenchmark(
+        val type: String,
+        val bytesPerToken: Long,
+        val tokens: Int,
+        val perplexity: Double,
+        val msPerToken: Double
+    )
+
+    /**
+     * One row of [benchmarkSampler]: cost of sampling one token under a sampler configuration
+     */
+    data class SamplerBenchmark(
+        val config: String,
+        val vocabSize: Int,
+        val usPerToken: Double
+    )
+
+    /**
+     * Result of [benchmarkTokenizer]
+     */
+    data class TokenizerBenchmark(
+        val bytes: Long,
+        val tokens: Int,
+        val msPerRun: Double,
+        val tokensPerSecond: Double,
+        val roundTrip: Boolean
+    )
+
+    /**
+     * One row of [benchmarkJni]: microseconds for one round trip of [bytes] of UTF-8
+     */
+    data class JniBenchmark(
+        val path: String,
+        val bytes: Int,
+        val usPerCall: Double
+    )
+
+    /**
+     * Core sets the compute threads may be pinned to
+     */
+    enum class ThreadAffinity(val nativeName: String) {
+        /** No pinning; the OS decides */
+        NONE("NONE"),
+        /** Fast cores only; little cores are left idle */
+        BIG_CORES("BIG_CORES"),
+        /** Every core, fastest first */
+        ALL_CORES("ALL_CORES")
+    }
+
+    /**
+     * One row of [benchmarkThreads]
+     */
+    data class ThreadBenchmark(
+        val threads: Int,
+        val tokensPerSecond: Double
+    )
+
+    /**
+     * One row of [benchmarkMemoryBudget]. [residentLayers] layers stay in memory, the rest
+     * are streamed; [peakResidentBytes] is the process's peak file-backed memory.
+     */
+    data class MemoryBudgetBenchmark(
+        val budgetBytes: Long,
+        val residentLayers: Int,
+        val tokensPerSecond: Double,
+        val peakResidentBytes: Long
+    )
+
+    /**
+     * Prompt prefix cache counters reported by [getPrefixCacheStats]
+     */
+    data class PrefixCacheStats(
+        val lookups: Long,
+        val hits: Long,
+        val misses: Long,
+        val tokensLookedUp: Long,
+        val tokensReused: Long,
+        val evictions: Long,
+        val bytes: Long,
+        val budgetBytes: Long
+    ) {
+        val hitRate: Float
+            get() = if (lookups > 0) hits.toFloat() / lookups else 0f
+    }
+
+    /**
+     * Continuous-batching scheduler counters reported by [getSchedulerStats]
+     */
+    data class SchedulerStats(
+        val active: Int,
+        val queued: Int,
+        val requests: Long,
+        val steps: Long,
+        val rows: Long,
+        val tokensGenerated: Long
+    ) {
+        /** Average tokens evaluated per forward pass; above 1 means requests shared steps */
+        val rowsPerStep: Float
+            get() = if (steps > 0) rows.toFloat() / steps else 0f
+    }
+
     /**
      * GGUF model information
      */
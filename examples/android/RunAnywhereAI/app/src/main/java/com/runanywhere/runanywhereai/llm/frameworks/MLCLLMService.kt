@@ -5,13 +5,19 @@ import android.os.Build
 import android.util.Log
 import com.runanywhere.runanywhereai.llm.*
 import com.runanywhere.runanywhereai.utils.HardwareDetector
+import kotlinx.coroutines.CoroutineStart
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.NonCancellable
+import kotlinx.coroutines.awaitCancellation
+import kotlinx.coroutines.cancelAndJoin
 import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.flow
+import kotlinx.coroutines.launch
 import kotlinx.coroutines.withContext
 import org.json.JSONArray
 import org.json.JSONObject
 import java.io.File
+import java.nio.ByteBuffer
 
 /**
  * MLC-LLM service implementation
@@ -44,15 +50,35 @@ class MLCLLMService(private val context: Context) : LLMService {
             maxTokens: Int
         ): String
 
+        @JvmStatic
+        external fun nativeChatCompletionDirect(
+            enginePtr: Long,
+            messages: ByteBuffer,
+            messagesLength: Int,
+            output: ByteBuffer,
+            temperature: Float,
+            maxTokens: Int
+        ): ByteBuffer?
+
+        @JvmStatic
+        external fun nativeCreateRequest(timeoutMs: Long): Long
+
         @JvmStatic
         external fun nativeStreamCompletion(
             enginePtr: Long,
             messages: String,
             temperature: Float,
             maxTokens: Int,
+            requestPtr: Long,
             callback: StreamCallback
         )
 
+        @JvmStatic
+        external fun nativeCancelRequest(requestPtr: Long)
+
+        @JvmStatic
+        external fun nativeFreeRequest(requestPtr: Long)
+
         @JvmStatic
         external fun nativeReleaseEngine(enginePtr: Long)
     }
@@ -170,12 +196,7 @@ class MLCLLMService(private val context: Context) : LLMService {
                 val messages = buildMessages(prompt)
 
                 // Call native generation
-                val response = nativeChatCompletion(
-                    enginePtr,
-                    messages.toString(),
-                    options.temperature,
-                    options.maxTokens
-                )
+                val response = chatCompletion(messages.toString(), options.temperature, options.maxTokens)
 
                 // Parse response
                 val jsonResponse = JSONObject(response)
@@ -294,13 +315,30 @@ class MLCLLMService(private val context: Context) : LLMService {
                     }
                 }
 
-                nativeStreamCompletion(
-                    enginePtr,
-                    messages.toString(),
-                    options.temperature,
-                    options.maxTokens,
-                    callback
-                )
+                // Cancelling the collector stops the native stream at its next token.
+                // The handle exists before the call, so a cancel that comes first is kept.
+                val request = nativeCreateRequest(options.timeoutMs ?: 0L)
+                val watcher = launch(start = CoroutineStart.UNDISPATCHED) {
+                    try {
+                        awaitCancellation()
+                    } finally {
+                        nativeCancelRequest(request)
+                    }
+                }
+                try {
+                    nativeStreamCompletion(
+                        enginePtr,
+                        messages.toString(),
+                        options.temperature,
+                        options.maxTokens,
+                        request,
+                        callback
+                    )
+                } finally {
+                    // The watcher may be cancelling the handle right now
+                    withContext(NonCancellable) { watcher.cancelAndJoin() }
+                    nativeFreeRequest(request)
+                }
             }
         } catch (e: Exception) {
             Log.e(TAG, "Error during streaming generation", e)
@@ -313,6 +351,22 @@ class MLCLLMService(private val context: Context) : LLMService {
         }
     }
 
+    /**
+     * Chat completion over direct buffers, so the messages and response cross JNI as plain
+     * UTF-8 (emoji included) instead of being converted to and from modified UTF-8.
+     */
+    private fun chatCompletion(messages: String, temperature: Float, maxTokens: Int): String {
+        val bytes = messages.toByteArray(Charsets.UTF_8)
+        val input = ByteBuffer.allocateDirect(bytes.size).put(bytes)
+        // Room for the reply plus the response JSON around it. Each call has its own buffer,
+        // and a longer response comes back in a buffer the native side allocates instead.
+        val output = ByteBuffer.allocateDirect(maxTokens * 16 + 1024)
+
+        val response = nativeChatCompletionDirect(enginePtr, input, bytes.size, output, temperature, maxTokens)
+            ?: throw RuntimeException("Chat completion failed")
+        return Charsets.UTF_8.decode(response).toString()
+    }
+
     private fun buildMessages(currentPrompt: String): JSONArray {
         val messages = JSONArray()
 
@@ -0,0 +1,167 @@
+// Parses valid and invalid GBNF grammars, matches token sequences from the
+// gpt2 vocabulary fixture against them, and runs a repetition far longer than
+// the matcher's frame and state limits.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gguf.h"
+#include "grammar.h"
+#include "llama_vocab.h"
+
+namespace {
+
+int check_parser() {
+    const struct {
+        const char* text;
+        bool valid;
+    } cases[] = {
+        {"root ::= \"yes\" | \"no\"", true},
+        {"root ::= [a-z]*", true},
+        {"root ::= item (\",\" item)*\nitem ::= [0-9]+ | \"-\" [0-9]+", true},
+        {"root ::= \"[\" [^\\]]{1,3} \"]\"", true},
+        {"root ::= later\nlater ::= \"x\" later | \"x\"", true},
+        {"root ::= \"open", false},
+        {"root ::= [a-z", false},
+        {"root ::= missing", false},
+        {"item ::= \"x\"", false},
+        {"root ::= root \"x\"", false},
+        {"root ::= \"a\"{3,1}", false},
+        {"root ::= * \"a\"", false},
+        {"root ::= \"a\"\nroot ::= \"b\"", false},
+    };
+
+    int failures = 0;
+    for (const auto& c : cases) {
+        std::string error;
+        const bool parsed = Grammar::parse(c.text, &error) != nullptr;
+        if (parsed != c.valid) {
+            printf("FAIL parse \"%s\": %s\n", c.text, parsed ? "accepted" : error.c_str());
+            failures++;
+        } else if (!parsed && error.empty()) {
+            printf("FAIL parse \"%s\": rejected without an error\n", c.text);
+            failures++;
+        }
+    }
+    printf("%s parser, %zu grammars\n", failures == 0 ? "ok  " : "FAIL", sizeof(cases) / sizeof(cases[0]));
+    return failures;
+}
+
+// Feeds the tokens of `text`; true if all are accepted and the match may end
+bool matches(GrammarMatcher& matcher, const LlamaVocab& vocab, const std::string& text) {
+    for (int32_t token : vocab.tokenize(text, false)) {
+        if (!matcher.allows(token) || !matcher.accept(token)) return false;
+    }
+    return matcher.can_end();
+}
+
+int check_matching(const LlamaVocab& vocab, const TokenTrie& trie) {
+    const struct {
+        const char* grammar;
+        const char* text;
+        bool match;
+    } cases[] = {
+        {"root ::= \"yes\" | \"no\"", "yes", true},
+        {"root ::= \"yes\" | \"no\"", "maybe", false},
+        {"root ::= \"yes\" | \"no\"", "ye", false},
+        {"root ::= [0-9]+ (\",\" [0-9]+)*", "3,14,1592", true},
+        {"root ::= [0-9]+ (\",\" [0-9]+)*", "3,,14", false},
+        {"root ::= \"{\" pair (\",\" pair)* \"}\"\npair ::= \"\\\"\" [a-z]+ \"\\\":\" [0-9]+",
+         "{\"tokens\":42,\"sec\":7}", true},
+        {"root ::= \"{\" pair (\",\" pair)* \"}\"\npair ::= \"\\\"\" [a-z]+ \"\\\":\" [0-9]+", "{\"tokens\":}", false},
+        {"root ::= \"Hello\" \" world\"?", "Hello world", true},
+        {"root ::= \"Hello\" \" world\"?", "Hello", true},
+        {"root ::= [a-c]{2,3}", "abca", false},
+    };
+
+    int failures = 0;
+    for (const auto& c : cases) {
+        std::string error;
+        std::shared_ptr<const Grammar> grammar = Grammar::parse(c.grammar, &error);
+        if (!grammar) {
+            printf("FAIL match \"%s\": %s\n", c.grammar, error.c_str());
+            failures++;
+            continue;
+        }
+        GrammarMatcher matcher(grammar, trie, vocab);
+        if (matches(matcher, vocab, c.text) != c.match) {
+            printf("FAIL match \"%s\" against \"%s\"\n", c.text, c.grammar);
+            failures++;
+        }
+    }
+    printf("%s matching, %zu cases\n", failures == 0 ? "ok  " : "FAIL", sizeof(cases) / sizeof(cases[0]));
+    return failures;
+}
+
+// A repetition longer than the frame and state limits must keep allowing the
+// same tokens without growing the matcher's stacks
+int check_long_repetition(const LlamaVocab& vocab, const TokenTrie& trie) {
+    constexpr int kRepeats = 100000;
+    std::string error;
+    std::shared_ptr<const Grammar> grammar = Grammar::parse("root ::= \"<\" [a-z]* \">\"", &error);
+    GrammarMatcher matcher(grammar, trie, vocab);
+
+    std::vector<int32_t> letters;
+    for (char c = 'a'; c <= 'z'; ++c) {
+        const std::vector<int32_t> ids = vocab.tokenize(std::string(1, c), false);
+        if (ids.size() == 1) letters.push_back(ids[0]);
+    }
+    const std::vector<int32_t> open = vocab.tokenize("<", false);
+    const std::vector<int32_t> close = vocab.tokenize(">", false);
+    if (letters.empty() || open.size() != 1 || close.size() != 1 || !matcher.accept(open[0])) {
+        printf("FAIL long repetition: cannot start\n");
+        return 1;
+    }
+
+    std::vector<float> logits(vocab.size());
+    for (int i = 0; i < kRepeats; ++i) {
+        if (!matcher.accept(letters[i % letters.size()])) {
+            printf("FAIL long repetition: letter %d rejected\n", i);
+            return 1;
+        }
+        if (i % 10000 == 0) {
+            std::fill(logits.begin(), logits.end(), 0.0f);
+            matcher.mask(logits.data(), static_cast<int32_t>(logits.size()));
+            if (std::isinf(logits[letters[0]]) || std::isinf(logits[close[0]])) {
+                printf("FAIL long repetition: mask after %d letters\n", i);
+                return 1;
+            }
+        }
+    }
+    if (matcher.can_end() || !matcher.accept(close[0]) || !matcher.finished()) {
+        printf("FAIL long repetition: does not end after \">\"\n");
+        return 1;
+    }
+    printf("ok   long repetition, %d letters\n", kRepeats);
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        printf("usage: %s <vocab fixture directory>\n", argv[0]);
+        return 1;
+    }
+    std::string error;
+    std::unique_ptr<GGUFFile> file = GGUFFile::load(std::string(argv[1]) + "/vocab-gpt2.gguf", &error);
+    LlamaVocab vocab;
+    if (!file || !vocab.load(*file, &error)) {
+        printf("FAIL vocab: %s\n", error.c_str());
+        return 1;
+    }
+    const TokenTrie trie(vocab);
+
+    int failures = check_parser();
+    failures += check_matching(vocab, trie);
+    failures += check_long_repetition(vocab, trie);
+    if (failures > 0) {
+        printf("%d grammar checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,195 @@
+// Checks every SIMD kernel set the host CPU supports against the portable
+// scalar kernels: the same rows must give the same dot products up to float
+// rounding. Sets the CPU lacks are reported as skipped.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cpu_features.h"
+#include "quants.h"
+
+namespace {
+
+struct KernelSet {
+    std::string name;
+    QuantKernels kernels;
+};
+
+std::vector<KernelSet> available_sets(std::vector<std::string>& skipped) {
+    std::vector<KernelSet> sets;
+    const CpuFeatures& cpu = cpu_features();
+    QuantKernels k = quant_kernels_scalar();
+#if defined(__x86_64__)
+    if (cpu.avx2 && cpu.fma) {
+        quant_register_avx2(k);
+        sets.push_back({"avx2", k});
+        if (cpu.avx512f && cpu.avx512bw && cpu.avx512vl && cpu.avx512vnni) {
+            quant_register_avx512_vnni(k);
+            sets.push_back({"avx512-vnni", k});
+        } else {
+            skipped.push_back("avx512-vnni");
+        }
+    } else {
+        skipped.push_back("avx2");
+        skipped.push_back("avx512-vnni");
+    }
+#elif defined(__aarch64__)
+    if (cpu.neon) {
+        quant_register_neon(k);
+        sets.push_back({"neon", k});
+        if (cpu.dotprod) {
+            quant_register_neon_dotprod(k);
+            sets.push_back({"neon-dotprod", k});
+        } else {
+            skipped.push_back("neon-dotprod");
+        }
+    } else {
+        skipped.push_back("neon");
+        skipped.push_back("neon-dotprod");
+    }
+#else
+    (void) cpu;
+    (void) k;
+#endif
+    // What quant_kernels() picked must be one of the above
+    sets.push_back({std::string("selected (") + quant_kernels().isa + ")", quant_kernels()});
+    return sets;
+}
+
+// Random blocks for the k-quants, which have no quantizer here. Scales stay
+// small so the sums are well within float range.
+void random_k_blocks(GGMLType type, std::vector<uint8_t>& out, int64_t n, std::mt19937& rng) {
+    out.resize(ggml_row_size(type, n));
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (uint8_t& b : out) {
+        b = static_cast<uint8_t>(byte(rng));
+    }
+    std::uniform_real_distribution<float> scale(0.001f, 0.05f);
+    for (int64_t i = 0; i < n / QK_K; ++i) {
+        switch (type) {
+            case GGML_TYPE_Q4_K: {
+                auto* b = reinterpret_cast<block_q4_K*>(out.data()) + i;
+                b->d = fp32_to_fp16(scale(rng));
+                b->dmin = fp32_to_fp16(scale(rng));
+                break;
+            }
+            case GGML_TYPE_Q5_K: {
+                auto* b = reinterpret_cast<block_q5_K*>(out.data()) + i;
+                b->d = fp32_to_fp16(scale(rng));
+                b->dmin = fp32_to_fp16(scale(rng));
+                break;
+            }
+            case GGML_TYPE_Q6_K: {
+                auto* b = reinterpret_cast<block_q6_K*>(out.data()) + i;
+                b->d = fp32_to_fp16(scale(rng));
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+// A weight row of `type` built from x (or random for the k-quants)
+std::vector<uint8_t> make_weights(GGMLType type, const std::vector<float>& x, std::mt19937& rng) {
+    std::vector<uint8_t> w;
+    const int64_t n = static_cast<int64_t>(x.size());
+    if (type == GGML_TYPE_Q4_K || type == GGML_TYPE_Q5_K || type == GGML_TYPE_Q6_K) {
+        random_k_blocks(type, w, n, rng);
+    } else {
+        w.resize(ggml_row_size(type, n));
+        quantize_row(type, x.data(), w.data(), n);
+    }
+    return w;
+}
+
+bool check_type(const KernelSet& set, GGMLType type, const std::vector<int64_t>& sizes, std::mt19937& rng) {
+    const QuantTypeKernels& ref = quant_kernels_scalar().types[type];
+    const QuantTypeKernels& simd = set.kernels.types[type];
+    if (simd.vec_dot_type != ref.vec_dot_type) {
+        printf("FAIL %s %s: vec_dot_type %s, scalar uses %s\n", set.name.c_str(), ggml_type_name(type),
+               ggml_type_name(simd.vec_dot_type), ggml_type_name(ref.vec_dot_type));
+        return false;
+    }
+    std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+    double worst = 0.0;
+    for (int64_t n : sizes) {
+        for (int trial = 0; trial < 8; ++trial) {
+            std::vector<float> a(n), b(n);
+            for (int64_t i = 0; i < n; ++i) {
+                a[i] = value(rng);
+                b[i] = value(rng) * (trial == 0 ? 100.0f : 1.0f);
+            }
+            const std::vector<uint8_t> w = make_weights(type, a, rng);
+            std::vector<uint8_t> act(ggml_row_size(ref.vec_dot_type, n));
+            quantize_row(ref.vec_dot_type, b.data(), act.data(), n);
+
+            float expected = 0.0f;
+            float actual = 0.0f;
+            ref.vec_dot(n, &expected, w.data(), act.data());
+            simd.vec_dot(n, &actual, w.data(), act.data());
+
+            // Rounding differences scale with the magnitude of the terms
+            std::vector<float> wf(n);
+            dequantize_row(type, w.data(), wf.data(), n);
+            double magnitude = 0.0;
+            for (int64_t i = 0; i < n; ++i) {
+                magnitude += std::fabs(static_cast<double>(wf[i]) * b[i]);
+            }
+            const double err = std::fabs(static_cast<double>(actual) - expected) / (magnitude + 1e-6);
+            worst = std::max(worst, err);
+            if (!std::isfinite(actual) || err > 1e-4) {
+                printf("FAIL %s %s n=%lld: %.6g, scalar %.6g\n", set.name.c_str(), ggml_type_name(type),
+                       static_cast<long long>(n), actual, expected);
+                return false;
+            }
+        }
+    }
+    printf("ok   %-24s %-5s max relative error %.2g\n", set.name.c_str(), ggml_type_name(type), worst);
+    return true;
+}
+
+} // namespace
+
+int main() {
+    std::vector<std::string> skipped;
+    const std::vector<KernelSet> sets = available_sets(skipped);
+    for (const std::string& name : skipped) {
+        printf("skip %s: not supported by this CPU\n", name.c_str());
+    }
+
+    // Sizes exercise the vector bodies and, for the float types, scalar tails
+    const std::vector<int64_t> float_sizes = {1, 7, 32, 37, 256, 4099};
+    const std::vector<int64_t> block_sizes = {32, 96, 4096};
+    const std::vector<int64_t> k_sizes = {256, 768, 4096};
+    const struct {
+        GGMLType type;
+        const std::vector<int64_t>& sizes;
+    } cases[] = {
+        {GGML_TYPE_F32, float_sizes},  {GGML_TYPE_F16, float_sizes},  {GGML_TYPE_Q4_0, block_sizes},
+        {GGML_TYPE_Q8_0, block_sizes}, {GGML_TYPE_Q4_K, k_sizes},     {GGML_TYPE_Q5_K, k_sizes},
+        {GGML_TYPE_Q6_K, k_sizes},
+    };
+
+    std::mt19937 rng(1234);
+    int failures = 0;
+    for (const KernelSet& set : sets) {
+        for (const auto& c : cases) {
+            if (!set.kernels.supports(c.type)) {
+                printf("FAIL %s %s: no kernel\n", set.name.c_str(), ggml_type_name(c.type));
+                failures++;
+                continue;
+            }
+            if (!check_type(set, c.type, c.sizes, rng)) failures++;
+        }
+    }
+    if (failures > 0) {
+        printf("%d kernel checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
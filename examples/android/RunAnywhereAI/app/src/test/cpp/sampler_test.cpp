@@ -0,0 +1,100 @@
+// Every sampler configuration draws only tokens a filter allows, and reports
+// -1 rather than a token when the filter allows none.
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "llama_model.h"
+#include "sampler.h"
+
+namespace {
+
+// Allows a fixed set of tokens, as a grammar at one position would
+class SetFilter : public TokenFilter {
+public:
+    explicit SetFilter(std::set<int32_t> ids) : allowed(std::move(ids)) {}
+    bool allows(int32_t token) const override { return allowed.count(token) > 0; }
+    void mask(float* logits, int32_t n_vocab) const override {
+        for (int32_t i = 0; i < n_vocab; ++i) {
+            if (!allows(i)) logits[i] = -INFINITY;
+        }
+    }
+
+    std::set<int32_t> allowed;
+};
+
+struct Config {
+    const char* name;
+    GenerationParams params;
+};
+
+std::vector<Config> configs() {
+    std::vector<Config> out;
+    const auto add = [&](const char* name, float temperature, int32_t top_k, float top_p, float min_p) {
+        Config c{name, {}};
+        c.params.temperature = temperature;
+        c.params.top_k = top_k;
+        c.params.top_p = top_p;
+        c.params.min_p = min_p;
+        out.push_back(c);
+    };
+    add("greedy", 0.0f, 40, 0.9f, 0.0f);
+    add("top-k + top-p", 0.8f, 40, 0.9f, 0.0f);
+    add("top-k + min-p", 0.8f, 40, 1.0f, 0.05f);
+    add("wide top-k", 0.8f, 300, 0.9f, 0.0f); // the filter sees every token
+    add("top-p", 0.8f, 0, 0.9f, 0.0f);
+    add("min-p", 0.8f, 0, 1.0f, 0.05f);
+    add("temperature only", 1.0f, 0, 1.0f, 0.0f);
+    return out;
+}
+
+} // namespace
+
+int main() {
+    constexpr int32_t kVocab = 1000;
+    std::mt19937 rng(7);
+    std::normal_distribution<float> logit(0.0f, 3.0f);
+    std::vector<float> base(kVocab);
+    for (float& l : base) {
+        l = logit(rng);
+    }
+
+    // None allowed, the least likely token only, and a few tokens outside
+    // everyone's top-k
+    const std::set<int32_t> none;
+    int32_t least = 0;
+    for (int32_t i = 1; i < kVocab; ++i) {
+        if (base[i] < base[least]) least = i;
+    }
+    const std::set<int32_t> worst = {least};
+    const std::set<int32_t> several = {3, 500, 999};
+
+    int failures = 0;
+    Sampler sampler;
+    for (const Config& config : configs()) {
+        for (const std::set<int32_t>* allowed : {&none, &worst, &several}) {
+            const SetFilter filter(*allowed);
+            bool ok = true;
+            for (int trial = 0; trial < 20 && ok; ++trial) {
+                std::vector<float> logits = base;
+                sampler.apply(logits.data(), kVocab, config.params, nullptr, 0, &filter);
+                const int32_t id = sampler.sample(rng);
+                ok = allowed->empty() ? id == -1 : filter.allows(id);
+                if (!ok) {
+                    printf("FAIL %s, %zu allowed: sampled %d\n", config.name, allowed->size(), id);
+                }
+            }
+            if (ok) printf("ok   %s, %zu allowed\n", config.name, allowed->size());
+            if (!ok) failures++;
+        }
+    }
+    if (failures > 0) {
+        printf("%d sampler checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
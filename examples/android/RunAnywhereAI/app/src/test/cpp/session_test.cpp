@@ -0,0 +1,105 @@
+// Sessions saved after an ordinary (scheduled) generate hold that turn, and a
+// restored session is what the next save writes.
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "llama_scheduler.h"
+#include "llama_session.h"
+#include "test_model.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) failures++;
+}
+
+// Saves the model's context as nativeSaveSession does
+bool save(LlamaModel& model, const std::string& path) {
+    std::string error;
+    bool saved = false;
+    model.scheduler->run_exclusive([&] { saved = session_save(*model.context, path, &error); });
+    if (!saved) printf("save failed: %s\n", error.c_str());
+    return saved;
+}
+
+// Tokens of the session at `path`, loaded into a context of their own
+std::vector<int32_t> session_tokens(LlamaModel& model, const std::string& path) {
+    std::vector<int32_t> tokens;
+    model.scheduler->run_exclusive([&] {
+        LlamaContext ctx(model, *model.kv_pool, nullptr, static_cast<uint32_t>(model.context_size));
+        std::string error;
+        if (session_load(ctx, path, &error)) {
+            tokens = ctx.tokens;
+        } else {
+            printf("load failed: %s\n", error.c_str());
+        }
+    });
+    return tokens;
+}
+
+bool starts_with(const std::vector<int32_t>& tokens, const std::vector<int32_t>& prefix) {
+    return tokens.size() >= prefix.size() && std::equal(prefix.begin(), prefix.end(), tokens.begin());
+}
+
+} // namespace
+
+int main() {
+    const std::string model_path = "session_test.gguf";
+    if (!write_test_model(model_path)) {
+        printf("FAIL cannot write %s\n", model_path.c_str());
+        return 1;
+    }
+    LlamaModel model(model_path);
+    std::string error;
+    if (!model.load(&error)) {
+        printf("FAIL load: %s\n", error.c_str());
+        return 1;
+    }
+
+    GenerationParams params;
+    params.max_tokens = 8;
+    params.temperature = 0.0f;
+    GenerationRequest request;
+    params.request = &request;
+
+    const std::string first = "hello the world";
+    const std::vector<int32_t> first_prompt = model.vocab.tokenize(first, model.vocab.add_bos);
+    model.scheduler->generate(first, params, nullptr);
+    check(save(model, "turn1.session"), "save after a scheduled generate");
+    const std::vector<int32_t> turn1 = session_tokens(model, "turn1.session");
+    check(starts_with(turn1, first_prompt), "session starts with the prompt");
+    check(turn1.size() + 1 >= first_prompt.size() + request.stats.n_generated, "session holds the reply");
+
+    // A later turn replaces it
+    const std::string second = "the world he";
+    const std::vector<int32_t> second_prompt = model.vocab.tokenize(second, model.vocab.add_bos);
+    model.scheduler->generate(second, params, nullptr);
+    check(save(model, "turn2.session"), "save after a second generate");
+    check(starts_with(session_tokens(model, "turn2.session"), second_prompt), "session holds the latest turn");
+
+    // A restored session is what the next save writes
+    bool restored = false;
+    model.scheduler->run_exclusive([&] { restored = session_load(*model.context, "turn1.session", &error); });
+    check(restored, "restore turn 1");
+    check(save(model, "restored.session") && session_tokens(model, "restored.session") == turn1,
+          "a restored session saves back unchanged");
+
+    // While the model's context holds a long sequence, a reply that needs a
+    // whole window still runs to max_tokens
+    params.max_tokens = 200;
+    model.scheduler->generate(std::string(300, 'x'), params, nullptr);
+    model.scheduler->generate(std::string(300, 'z'), params, nullptr);
+    check(request.stats.stop_reason != StopReason::Error, "a full-window reply is not cut short by the kept sequence");
+
+    if (failures > 0) {
+        printf("%d session checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
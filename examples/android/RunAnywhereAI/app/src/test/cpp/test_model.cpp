@@ -0,0 +1,187 @@
+#include "test_model.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "gguf.h"
+
+namespace {
+
+constexpr uint32_t kAlignment = 32;
+
+constexpr uint32_t kVocab = 300;
+constexpr uint32_t kEmbd = 64;
+constexpr uint32_t kLayers = 2;
+constexpr uint32_t kHeads = 4;
+constexpr uint32_t kHeadsKV = 2;
+constexpr uint32_t kFF = 128;
+constexpr uint32_t kContext = 512;
+
+// Little-endian GGUF v3 serialization into a byte buffer
+class Writer {
+public:
+    void u32(uint32_t v) { pod(v); }
+    void u64(uint64_t v) { pod(v); }
+    void f32(float v) { pod(v); }
+    void str(const std::string& s) {
+        u64(s.size());
+        bytes.insert(bytes.end(), s.begin(), s.end());
+    }
+    void pad(size_t alignment) { bytes.resize((bytes.size() + alignment - 1) / alignment * alignment, 0); }
+
+    std::vector<uint8_t> bytes;
+
+private:
+    template <typename T>
+    void pod(T v) {
+        const auto* p = reinterpret_cast<const uint8_t*>(&v);
+        bytes.insert(bytes.end(), p, p + sizeof(v));
+    }
+};
+
+struct Tensor {
+    std::string name;
+    std::vector<uint64_t> ne;
+    std::vector<float> data;
+};
+
+} // namespace
+
+bool write_test_model(const std::string& path, unsigned seed) {
+    std::mt19937 rng(seed);
+    const auto random = [&](size_t n, float scale) {
+        std::normal_distribution<float> dist(0.0f, scale);
+        std::vector<float> v(n);
+        for (float& x : v) {
+            x = dist(rng);
+        }
+        return v;
+    };
+
+    // Vocabulary: specials, byte fallback, merges, then filler up to kVocab
+    std::vector<std::string> tokens = {"<unk>", "<s>", "</s>"};
+    for (int b = 0; b < 256; ++b) {
+        char name[8];
+        snprintf(name, sizeof(name), "<0x%02X>", b);
+        tokens.push_back(name);
+    }
+    for (const char* piece : {"\xE2\x96\x81the", "\xE2\x96\x81" "a", "he", "\xE2\x96\x81t", "in", "er",
+                              "\xE2\x96\x81h", "\xE2\x96\x81he", "llo", "\xE2\x96\x81hello", "\xE2\x96\x81world",
+                              "wor", "ld"}) {
+        tokens.push_back(piece);
+    }
+    while (tokens.size() < kVocab) {
+        tokens.push_back("tok" + std::to_string(tokens.size()));
+    }
+    std::vector<float> scores(tokens.size(), 0.0f);
+    std::vector<int32_t> types(tokens.size(), 1);
+    types[0] = 2; // unknown
+    types[1] = types[2] = 3; // control
+    for (size_t i = 3; i < 259; ++i) {
+        types[i] = 6; // byte
+    }
+    for (size_t i = 259; i < tokens.size(); ++i) {
+        scores[i] = -static_cast<float>(i - 259);
+    }
+
+    const uint32_t head_dim = kEmbd / kHeads;
+    const uint32_t n_embd_kv = kHeadsKV * head_dim;
+    std::vector<Tensor> tensors;
+    tensors.push_back({"token_embd.weight", {kEmbd, kVocab}, random(kEmbd * kVocab, 0.5f)});
+    for (uint32_t il = 0; il < kLayers; ++il) {
+        const std::string p = "blk." + std::to_string(il) + ".";
+        tensors.push_back({p + "attn_norm.weight", {kEmbd}, std::vector<float>(kEmbd, 1.0f)});
+        tensors.push_back({p + "attn_q.weight", {kEmbd, kEmbd}, random(kEmbd * kEmbd, 0.1f)});
+        tensors.push_back({p + "attn_k.weight", {kEmbd, n_embd_kv}, random(kEmbd * n_embd_kv, 0.1f)});
+        tensors.push_back({p + "attn_v.weight", {kEmbd, n_embd_kv}, random(kEmbd * n_embd_kv, 0.1f)});
+        tensors.push_back({p + "attn_output.weight", {kEmbd, kEmbd}, random(kEmbd * kEmbd, 0.1f)});
+        tensors.push_back({p + "ffn_norm.weight", {kEmbd}, std::vector<float>(kEmbd, 1.0f)});
+        tensors.push_back({p + "ffn_gate.weight", {kEmbd, kFF}, random(kEmbd * kFF, 0.1f)});
+        tensors.push_back({p + "ffn_up.weight", {kEmbd, kFF}, random(kEmbd * kFF, 0.1f)});
+        tensors.push_back({p + "ffn_down.weight", {kFF, kEmbd}, random(kFF * kEmbd, 0.1f)});
+    }
+    tensors.push_back({"output_norm.weight", {kEmbd}, std::vector<float>(kEmbd, 1.0f)});
+    tensors.push_back({"output.weight", {kEmbd, kVocab}, random(kEmbd * kVocab, 0.5f)});
+
+    Writer w;
+    w.u32(0x46554747); // "GGUF"
+    w.u32(3);
+    w.u64(tensors.size());
+    w.u64(18); // metadata entries below
+    const auto kv_u32 = [&](const char* key, uint32_t v) {
+        w.str(key);
+        w.u32(GGUF_TYPE_UINT32);
+        w.u32(v);
+    };
+    const auto kv_f32 = [&](const char* key, float v) {
+        w.str(key);
+        w.u32(GGUF_TYPE_FLOAT32);
+        w.f32(v);
+    };
+    const auto kv_str = [&](const char* key, const std::string& v) {
+        w.str(key);
+        w.u32(GGUF_TYPE_STRING);
+        w.str(v);
+    };
+    kv_str("general.architecture", "llama");
+    kv_str("general.name", "test");
+    kv_u32("general.file_type", 0);
+    kv_u32("llama.context_length", kContext);
+    kv_u32("llama.embedding_length", kEmbd);
+    kv_u32("llama.block_count", kLayers);
+    kv_u32("llama.feed_forward_length", kFF);
+    kv_u32("llama.attention.head_count", kHeads);
+    kv_u32("llama.attention.head_count_kv", kHeadsKV);
+    kv_u32("llama.rope.dimension_count", head_dim);
+    kv_f32("llama.attention.layer_norm_rms_epsilon", 1e-5f);
+    kv_f32("llama.rope.freq_base", 10000.0f);
+    kv_str("tokenizer.ggml.model", "llama");
+    w.str("tokenizer.ggml.tokens");
+    w.u32(GGUF_TYPE_ARRAY);
+    w.u32(GGUF_TYPE_STRING);
+    w.u64(tokens.size());
+    for (const std::string& t : tokens) {
+        w.str(t);
+    }
+    w.str("tokenizer.ggml.scores");
+    w.u32(GGUF_TYPE_ARRAY);
+    w.u32(GGUF_TYPE_FLOAT32);
+    w.u64(scores.size());
+    for (float s : scores) {
+        w.f32(s);
+    }
+    w.str("tokenizer.ggml.token_type");
+    w.u32(GGUF_TYPE_ARRAY);
+    w.u32(GGUF_TYPE_INT32);
+    w.u64(types.size());
+    for (int32_t t : types) {
+        w.u32(static_cast<uint32_t>(t));
+    }
+    kv_u32("tokenizer.ggml.bos_token_id", 1);
+    kv_u32("tokenizer.ggml.eos_token_id", 2);
+
+    uint64_t offset = 0;
+    for (const Tensor& t : tensors) {
+        w.str(t.name);
+        w.u32(static_cast<uint32_t>(t.ne.size()));
+        for (uint64_t n : t.ne) {
+            w.u64(n);
+        }
+        w.u32(GGML_TYPE_F32);
+        w.u64(offset);
+        offset += (t.data.size() * sizeof(float) + kAlignment - 1) / kAlignment * kAlignment;
+    }
+    w.pad(kAlignment);
+    for (const Tensor& t : tensors) {
+        const auto* p = reinterpret_cast<const uint8_t*>(t.data.data());
+        w.bytes.insert(w.bytes.end(), p, p + t.data.size() * sizeof(float));
+        w.pad(kAlignment);
+    }
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    const bool ok = fwrite(w.bytes.data(), 1, w.bytes.size(), f) == w.bytes.size();
+    return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+
+// Writes a tiny llama model with random weights to `path`: 2 layers, 64 dims,
+// 4 query and 2 KV heads, a 512-token context and a SentencePiece vocabulary
+// of byte tokens plus a few merges. For tests that need a model to run, not
+// a good one. The same seed writes the same file.
+bool write_test_model(const std::string& path, unsigned seed = 1);
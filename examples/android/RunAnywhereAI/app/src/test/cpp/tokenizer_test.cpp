@@ -0,0 +1,116 @@
+// Tokenizes the inputs of each vocab/vocab-<name>.inp and compares the ids
+// with the reference tokenizer's in vocab-<name>.out (see
+// vocab/make_vocab_fixtures.py). Lossless vocabularies must also detokenize
+// back to the input.
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gguf.h"
+#include "llama_vocab.h"
+
+namespace {
+
+const char kSeparator[] = "\n__ggml_vocab_test__\n";
+
+bool read_file(const std::string& path, std::string& out) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) return false;
+    std::ostringstream s;
+    s << f.rdbuf();
+    out = s.str();
+    return true;
+}
+
+std::vector<std::string> split(const std::string& text, const std::string& separator) {
+    std::vector<std::string> parts;
+    size_t begin = 0;
+    for (size_t end; (end = text.find(separator, begin)) != std::string::npos; begin = end + separator.size()) {
+        parts.push_back(text.substr(begin, end - begin));
+    }
+    parts.push_back(text.substr(begin));
+    return parts;
+}
+
+std::string format_ids(const std::vector<int32_t>& ids) {
+    std::string out;
+    for (int32_t id : ids) {
+        if (!out.empty()) out += ' ';
+        out += std::to_string(id);
+    }
+    return out;
+}
+
+// Number of failed cases, or -1 if the fixture cannot be read
+int check_vocab(const std::string& dir, const std::string& name, bool lossless) {
+    const std::string base = dir + "/vocab-" + name;
+    std::string error;
+    std::unique_ptr<GGUFFile> file = GGUFFile::load(base + ".gguf", &error);
+    LlamaVocab vocab;
+    if (!file || !vocab.load(*file, &error)) {
+        printf("FAIL %s: %s\n", name.c_str(), error.c_str());
+        return -1;
+    }
+    std::string inp, out;
+    if (!read_file(base + ".inp", inp) || !read_file(base + ".out", out)) {
+        printf("FAIL %s: cannot read %s.inp / .out\n", name.c_str(), base.c_str());
+        return -1;
+    }
+    const std::vector<std::string> inputs = split(inp, kSeparator);
+    std::vector<std::string> expected = split(out, "\n");
+    expected.pop_back(); // after the last newline
+    if (inputs.size() != expected.size()) {
+        printf("FAIL %s: %zu inputs but %zu outputs\n", name.c_str(), inputs.size(), expected.size());
+        return -1;
+    }
+
+    int failures = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        const std::vector<int32_t> ids = vocab.tokenize(inputs[i], false);
+        const std::string actual = format_ids(ids);
+        if (actual != expected[i]) {
+            printf("FAIL %s input %zu \"%s\"\n  expected %s\n  got      %s\n", name.c_str(), i, inputs[i].c_str(),
+                   expected[i].c_str(), actual.c_str());
+            failures++;
+            continue;
+        }
+        if (lossless && vocab.detokenize(ids.data(), ids.size()) != inputs[i]) {
+            printf("FAIL %s input %zu \"%s\": does not detokenize back\n", name.c_str(), i, inputs[i].c_str());
+            failures++;
+        }
+    }
+    printf("%s %-10s %zu inputs\n", failures == 0 ? "ok  " : "FAIL", name.c_str(), inputs.size());
+    return failures;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        printf("usage: %s <vocab fixture directory>\n", argv[0]);
+        return 1;
+    }
+    const struct {
+        const char* name;
+        bool lossless; // byte-level or byte fallback: every input has exact tokens
+    } vocabs[] = {
+        {"gpt2", true},
+        {"llama-spm", true},
+        {"t5", false},
+    };
+
+    int failures = 0;
+    for (const auto& v : vocabs) {
+        const int n = check_vocab(argv[1], v.name, v.lossless);
+        failures += n < 0 ? 1 : n;
+    }
+    if (failures > 0) {
+        printf("%d tokenizer checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}